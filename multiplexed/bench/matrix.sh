@@ -0,0 +1,210 @@
+#!/usr/bin/env bash
+#
+# runs every server backend through the same load-tester scenarios over loopback and writes one csv row per run
+#
+# usage: matrix.sh [-b BIN_DIR] [-o REPORT] [-d SECONDS] [-q]
+#   -b  directory holding the server binaries and load-tester (default: the current directory)
+#   -o  report file (default: bench-report.csv)
+#   -d  seconds per run (default: 5)
+#   -q  quick matrix, one size and one rate per connection count
+#
+# the lists can be overridden from the environment:
+#   BENCH_BACKENDS     names from the backend table below
+#   BENCH_CONNECTIONS  active connections, ACTIVE+IDLE adds idle connections that never send
+#   BENCH_SIZES        payload bytes
+#   BENCH_RATES        requests per second
+#   BENCH_MAX_BANDWIDTH  combinations sending more bytes per second than this are skipped (default 1 GiB/s)
+#
+# cpu per request is the server's user + system time divided by the replies the load tester got back,
+# rss is the server's peak resident set (VmHWM)
+
+set -u
+
+BIN_DIR=.
+REPORT=bench-report.csv
+DURATION=5
+QUICK=0
+PORT=4981
+
+while getopts "b:o:d:q" opt
+do
+    case "$opt" in
+        b) BIN_DIR=$OPTARG ;;
+        o) REPORT=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        q) QUICK=1 ;;
+        *) sed -n '5,9p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+if [ "$QUICK" -eq 1 ]
+then
+    DEFAULT_SIZES="1024"
+    DEFAULT_RATES="5000"
+else
+    DEFAULT_SIZES="16 1024 65536 1048576"
+    DEFAULT_RATES="1000 10000 50000"
+fi
+
+BACKENDS=${BENCH_BACKENDS:-"select poll epoll-level epoll-edge"}
+CONNECTIONS=${BENCH_CONNECTIONS:-"10 1000 100+10000"}
+SIZES=${BENCH_SIZES:-$DEFAULT_SIZES}
+RATES=${BENCH_RATES:-$DEFAULT_RATES}
+MAX_BANDWIDTH=${BENCH_MAX_BANDWIDTH:-1073741824}
+CLK_TCK=$(getconf CLK_TCK)
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# the io_uring server only speaks the legacy protocol, whose replies the load tester cannot match to requests
+backend_command()
+{
+    case "$1" in
+        select)      echo "$BIN_DIR/select-server --frame length --log-level error" ;;
+        poll)        echo "$BIN_DIR/poll-server --frame length --log-level error" ;;
+        epoll-level) echo "$BIN_DIR/epoll-server --level-triggered --frame length --log-level error" ;;
+        epoll-edge)  echo "$BIN_DIR/epoll-server --edge-triggered --frame length --log-level error" ;;
+        *)           return 1 ;;
+    esac
+}
+
+# select() cannot watch descriptors at or above FD_SETSIZE
+backend_max_connections()
+{
+    case "$1" in
+        select) echo 1000 ;;
+        *)      echo 1000000 ;;
+    esac
+}
+
+wait_for_port()
+{
+    for _ in $(seq 50)
+    do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null
+        then
+            return 0
+        fi
+
+        sleep 0.1
+    done
+
+    return 1
+}
+
+cpu_ticks()
+{
+    # utime and stime, the command name in field 2 can hold spaces so count from the closing parenthesis
+    sed 's/.*) //' "/proc/$1/stat" | awk '{print $12 + $13}'
+}
+
+stop_server()
+{
+    kill -INT "$1" 2>/dev/null
+
+    for _ in $(seq 30)
+    do
+        if ! kill -0 "$1" 2>/dev/null
+        then
+            wait "$1" 2>/dev/null
+            return
+        fi
+
+        sleep 0.1
+    done
+
+    kill -KILL "$1" 2>/dev/null
+    wait "$1" 2>/dev/null
+}
+
+report_row()
+{
+    echo "$1,$2,$3,$4,$5,$6,$7,$8,$9" >> "$REPORT"
+}
+
+# idle connections and the servers' own descriptors need more than the usual 1024
+ulimit -n "$(ulimit -Hn)" 2>/dev/null
+
+echo "backend,active,idle,payload_bytes,rate,sent,completed,errors,throughput,mean_us,p50_us,p90_us,p99_us,p999_us,max_us,cpu_us_per_request,peak_rss_kb,status" > "$REPORT"
+
+for backend in $BACKENDS
+do
+    if ! command=$(backend_command "$backend")
+    then
+        echo "unknown backend $backend" >&2
+        continue
+    fi
+
+    for connection_spec in $CONNECTIONS
+    do
+        active=${connection_spec%%+*}
+        idle=0
+
+        if [ "$connection_spec" != "$active" ]
+        then
+            idle=${connection_spec#*+}
+        fi
+
+        for size in $SIZES
+        do
+            for rate in $RATES
+            do
+                skipped=",,,,,,,,,"
+                label="$backend $active+$idle connections, $size bytes, $rate/s"
+
+                if [ $((active + idle)) -gt "$(backend_max_connections "$backend")" ]
+                then
+                    echo "$label: skipped, too many connections for this backend"
+                    report_row "$backend" "$active" "$idle" "$size" "$rate" "$skipped" "" "" "skipped"
+                    continue
+                fi
+
+                if [ $((size * rate)) -gt "$MAX_BANDWIDTH" ]
+                then
+                    echo "$label: skipped, over the bandwidth limit"
+                    report_row "$backend" "$active" "$idle" "$size" "$rate" "$skipped" "" "" "skipped"
+                    continue
+                fi
+
+                echo "$label"
+                $command > "$WORK_DIR/server.log" 2>&1 &
+                server_pid=$!
+
+                # a server that failed to bind exits at once, while something else may still own the port
+                if ! wait_for_port || ! kill -0 "$server_pid" 2>/dev/null
+                then
+                    echo "$label: server did not start" >&2
+                    stop_server "$server_pid"
+                    report_row "$backend" "$active" "$idle" "$size" "$rate" "$skipped" "" "" "server-failed"
+                    continue
+                fi
+
+                rm -f "$WORK_DIR/summary.csv"
+                ticks_before=$(cpu_ticks "$server_pid")
+                "$BIN_DIR/load-tester" --port "$PORT" --connections "$active" --idle "$idle" --size "$size" --rate "$rate" \
+                    --duration "$DURATION" --frame length --results "$WORK_DIR/results.csv" --summary "$WORK_DIR/summary.csv" \
+                    --histogram "$WORK_DIR/$backend-$active-$idle-$size-$rate.hgrm" > "$WORK_DIR/load-tester.log" 2>&1
+                status=$?
+                ticks_after=$(cpu_ticks "$server_pid" 2>/dev/null || echo "$ticks_before")
+                peak_rss=$(awk '/^VmHWM/ {print $2}' "/proc/$server_pid/status" 2>/dev/null)
+                stop_server "$server_pid"
+
+                if [ "$status" -ne 0 ] || [ ! -s "$WORK_DIR/summary.csv" ]
+                then
+                    tail -n 3 "$WORK_DIR/load-tester.log" >&2
+                    report_row "$backend" "$active" "$idle" "$size" "$rate" "$skipped" "" "${peak_rss:-}" "load-failed"
+                    continue
+                fi
+
+                # sent through max_us from the load tester's summary row
+                measured=$(tail -n 1 "$WORK_DIR/summary.csv" | cut -d, -f7-16)
+                completed=$(echo "$measured" | cut -d, -f2)
+                cpu_per_request=$(awk -v ticks=$((ticks_after - ticks_before)) -v hz="$CLK_TCK" -v n="$completed" \
+                    'BEGIN { if(n > 0) printf "%.2f", ticks / hz / n * 1000000 }')
+                tail -n 2 "$WORK_DIR/load-tester.log"
+                report_row "$backend" "$active" "$idle" "$size" "$rate" "$measured" "$cpu_per_request" "${peak_rss:-}" "ok"
+            done
+        done
+    done
+done
+
+echo "report written to $REPORT"
@@ -0,0 +1,57 @@
+#ifndef MULTIPLEX_ADMISSION_H
+#define MULTIPLEX_ADMISSION_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+
+#define ADMISSION_DEFAULT_BACKLOG SOMAXCONN
+#define ADMISSION_DEFAULT_BATCH 64
+
+
+/**
+ * decides when a loop takes new connections off its listener
+ * batch caps how many are accepted per wakeup so a connect storm cannot starve the clients already being served
+ * paused_at is the client count at which accepting stopped, SIZE_MAX while accepting, it resumes once a client leaves,
+ * until then new connections wait in the listen backlog instead of being accepted and closed straight away
+ * reserve_fd is a spare descriptor, when the process runs out of them it is given up for long enough to accept and
+ * close the pending connection, otherwise that connection would sit in the backlog and keep the listener readable forever
+ * */
+struct admission
+{
+    int batch;
+    int reserve_fd;
+    size_t paused_at;
+};
+
+
+void admission_init(const struct dc_env *env, struct dc_error *err, struct admission *admission, int batch);
+
+void admission_destroy(const struct dc_env *env, struct dc_error *err, struct admission *admission);
+
+/**
+ * accept4() with SOCK_NONBLOCK | SOCK_CLOEXEC, the listener has to be non-blocking
+ * returns -1 once the backlog is empty, and also when the connection had to be dropped for lack of descriptors,
+ * in which case dropped is set and the caller should pause like it does for a full table, err is only set for real errors
+ * */
+int admission_accept(const struct dc_env *env, struct dc_error *err, struct admission *admission, int listener, struct sockaddr *addr, socklen_t *addr_len, bool *dropped);
+
+/**
+ * stops accepting until the number of clients drops below clients
+ * */
+void admission_pause(struct admission *admission, size_t clients);
+
+/**
+ * true unless accepting is paused and no client has left since
+ * */
+bool admission_accepting(struct admission *admission, size_t clients);
+
+/**
+ * parses a positive count for --backlog, --accept-batch and --max-clients
+ * */
+bool admission_parse_count(const char *text, int *value);
+
+#endif // MULTIPLEX_ADMISSION_H
@@ -0,0 +1,107 @@
+#ifndef MULTIPLEX_BUFFER_POOL_H
+#define MULTIPLEX_BUFFER_POOL_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define BUFFER_POOL_MIN_SHIFT 12
+#define BUFFER_POOL_CLASS_COUNT 10
+#define BUFFER_POOL_MAX_SIZE (1UL << (BUFFER_POOL_MIN_SHIFT + BUFFER_POOL_CLASS_COUNT - 1))
+#define BUFFER_POOL_MAX_FREE_BYTES (8UL * 1024UL * 1024UL)
+#define BUFFER_CACHE_DEPTH 8
+
+
+struct buffer_cache;
+
+/**
+ * power of two size classes from 4 KiB to 2 MiB shared by every thread, anything larger comes straight from malloc
+ * free buffers are linked through their first bytes, each class keeps at most BUFFER_POOL_MAX_FREE_BYTES of them
+ * and frees the rest, so memory a burst needed goes back to the system once the burst is over
+ * caches lists every buffer_cache for the statistics, everything here is under lock
+ * */
+struct buffer_pool
+{
+    pthread_mutex_t lock;
+    void *free[BUFFER_POOL_CLASS_COUNT];
+    size_t free_count[BUFFER_POOL_CLASS_COUNT];
+    struct buffer_cache *caches;
+};
+
+/**
+ * one thread's stack of free buffers per class in front of the shared pool, so most allocations take no lock
+ * a miss takes half a cache's worth from the pool and a full cache gives half of it back, in one locked step each
+ * the counters only ever have the owning thread as writer
+ * */
+struct buffer_cache
+{
+    struct buffer_pool *pool;
+    const struct dc_env *env;
+    struct buffer_cache *next;
+    void *buffers[BUFFER_POOL_CLASS_COUNT][BUFFER_CACHE_DEPTH];
+    size_t counts[BUFFER_POOL_CLASS_COUNT];
+    atomic_uint_fast64_t in_use_bytes;
+    atomic_uint_fast64_t in_use_buffers;
+    atomic_uint_fast64_t cached_bytes;
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+};
+
+/**
+ * in_use is what has been handed out and not given back, free_bytes is what the caches and the pool hold on to
+ * hits were served by a cache, misses had to go to the pool or to malloc
+ * */
+struct buffer_pool_stats
+{
+    uint64_t in_use_bytes;
+    uint64_t in_use_buffers;
+    uint64_t free_bytes;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+
+void buffer_pool_init(const struct dc_env *env, struct buffer_pool *pool);
+
+/**
+ * every cache has to have been destroyed first
+ * */
+void buffer_pool_destroy(const struct dc_env *env, struct buffer_pool *pool);
+
+/**
+ * env is the owning thread's, it is used for every malloc and free the cache makes
+ * */
+void buffer_cache_init(const struct dc_env *env, struct buffer_cache *cache, struct buffer_pool *pool);
+
+/**
+ * gives the cached buffers back to the pool, buffers still in use must not be freed through this cache afterwards
+ * */
+void buffer_cache_destroy(struct buffer_cache *cache);
+
+/**
+ * returns at least size bytes and sets capacity to how many, the class size or exactly size above BUFFER_POOL_MAX_SIZE
+ * returns NULL with err set if memory ran out
+ * */
+char *buffer_alloc(struct dc_error *err, struct buffer_cache *cache, size_t size, size_t *capacity);
+
+/**
+ * size is either the size asked for or the capacity handed out, both lead to the same class
+ * */
+void buffer_free(struct buffer_cache *cache, char *data, size_t size);
+
+/**
+ * a snapshot summed over the pool and every cache, safe to take from any thread
+ * */
+void buffer_pool_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats);
+
+/**
+ * the resident set size of the process from /proc/self/statm, 0 where that cannot be read
+ * */
+uint64_t buffer_pool_rss(void);
+
+#endif // MULTIPLEX_BUFFER_POOL_H
@@ -0,0 +1,120 @@
+#ifndef MULTIPLEX_CONN_TABLE_H
+#define MULTIPLEX_CONN_TABLE_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer_pool.h"
+#include "out_buffer.h"
+#include "request.h"
+#include "zerocopy.h"
+
+
+#define CONN_TABLE_SLAB_SIZE 256
+
+
+struct count_job;
+
+
+/**
+ * per-connection state, lives in a slot of the connection table and keeps it, and its index in slot, until it is removed
+ * reading and writing mirror the interest the server has registered for the socket, so it only changes when they do
+ * admin connections are metrics scrapes, they skip the parser and are closed once answered
+ * last_read_ns and queued_since_ns are what the timeouts are measured from, see timeouts.h
+ * job is a large request being collected or counted off the event loop, stash holds what the client pipelined behind it
+ * zerocopy holds the read buffers of echoes sent with MSG_ZEROCOPY until the kernel is done with them
+ * */
+struct connection
+{
+    int fd;
+    bool in_use;
+    size_t slot;
+    size_t next_free;
+    struct request_parser parser;
+    struct out_buffer out;
+    bool reading;
+    bool writing;
+    bool admin;
+    uint64_t last_read_ns;
+    uint64_t queued_since_ns;
+    struct count_job *job;
+    char *stash;
+    size_t stash_len;
+    struct zerocopy zerocopy;
+};
+
+/**
+ * connections live in slots that are recycled through a free list, and a second array indexed by
+ * file descriptor maps a socket back to its slot, so insert, lookup and remove are all O(1)
+ * slots are carved from slabs of CONN_TABLE_SLAB_SIZE that are never moved or freed before the table is,
+ * so accepting a client allocates nothing once the table has seen that many at a time and connection pointers stay valid
+ * only the array of slab pointers and the fd index are reallocated, both double up to the RLIMIT_NOFILE soft limit
+ * buffers is the cache the connections' output rings and stashes are taken from
+ * lingering holds the sockets of removed connections until the kernel is done with their MSG_ZEROCOPY sends, see zerocopy.h
+ * */
+struct conn_table
+{
+    struct connection **slabs;
+    size_t *fd_to_slot;
+    struct buffer_cache *buffers;
+    size_t num_slots;
+    size_t num_slabs;
+    size_t slab_capacity;
+    size_t fd_capacity;
+    size_t count;
+    size_t max_connections;
+    size_t free_head;
+    struct zerocopy_lingering lingering;
+};
+
+
+/**
+ * raises the soft RLIMIT_NOFILE to the hard limit and returns it, the only cap on how many connections are held
+ * */
+size_t conn_table_fd_limit(void);
+
+/**
+ * allocates enough slabs for initial_capacity connections up front
+ * */
+void conn_table_init(const struct dc_env *env, struct dc_error *err, struct conn_table *table, size_t initial_capacity, struct buffer_cache *buffers);
+
+void conn_table_destroy(const struct dc_env *env, struct conn_table *table);
+
+/**
+ * returns the new connection, or NULL if the table is at max_connections or could not grow
+ * */
+struct connection *conn_table_insert(const struct dc_env *env, struct dc_error *err, struct conn_table *table, int fd);
+
+/**
+ * returns NULL if fd is not in the table
+ * */
+struct connection *conn_table_lookup(const struct conn_table *table, int fd);
+
+/**
+ * gives anything still queued, stashed or pinned for the client back to the buffer cache,
+ * closing the socket and dealing with its job are up to the caller, the socket has to be closed after this, not before,
+ * sends the kernel still has pinned are left lingering on a dup() of it
+ * */
+void conn_table_remove(const struct dc_env *env, struct conn_table *table, struct connection *connection);
+
+/**
+ * true once the table holds max_connections, servers stop accepting rather than accept and close
+ * */
+bool conn_table_full(const struct conn_table *table);
+
+/**
+ * the slot index is stable for the lifetime of the connection
+ * */
+size_t conn_table_slot(const struct conn_table *table, const struct connection *connection);
+
+/**
+ * the connection in slot, which is below num_slots, whether it is in use or not
+ * */
+static inline struct connection *conn_table_at(const struct conn_table *table, size_t slot)
+{
+    return &table->slabs[slot / CONN_TABLE_SLAB_SIZE][slot % CONN_TABLE_SLAB_SIZE];
+}
+
+#endif // MULTIPLEX_CONN_TABLE_H
@@ -0,0 +1,205 @@
+#ifndef MULTIPLEX_COUNT_POOL_H
+#define MULTIPLEX_COUNT_POOL_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define COUNT_POOL_DEFAULT_THRESHOLD (1024UL * 1024UL)
+#define COUNT_POOL_CHUNK_SIZE (256UL * 1024UL)
+#define COUNT_POOL_CACHE_LINE_SIZE 64
+#define COUNT_DEQUE_SIZE 1024
+
+
+/**
+ * fifo: every worker takes chunks of the job at the head of one shared queue, in order
+ * steal: a worker that takes a job splits it onto its own deque and idle workers steal chunks from there,
+ * a worker goes back to the shared queue as soon as its own deque is empty, so a small job waits for one chunk
+ * rather than for every chunk of the large jobs queued ahead of it
+ * */
+enum count_schedule
+{
+    COUNT_SCHEDULE_FIFO,
+    COUNT_SCHEDULE_STEAL,
+};
+
+
+/**
+ * what one chunk contributes, counted as if it started after whitespace
+ * starts_word and ends_in_word are what the merge needs to undo the double count of a word that straddles two chunks
+ * a chunk is also the unit of work on the deques, job leads back to the payload it is part of
+ * */
+struct count_chunk
+{
+    struct count_job *job;
+    uint64_t words;
+    bool starts_word;
+    bool ends_in_word;
+};
+
+/**
+ * one large payload, filled by the reactor that owns the connection and counted by the pool once it is complete
+ * next links the job into the pool's queue and afterwards into its reactor's completion list
+ * next_chunk is only touched under the pool's lock, chunks_done tells the worker that finishes the last chunk to merge
+ * cancelled is set by the reactor when the client goes away, the job is still handed back so the reactor can free it
+ * */
+struct count_job
+{
+    struct count_job *next;
+    struct count_completions *completions;
+    char *data;
+    size_t len;
+    size_t filled;
+    size_t slot;
+    uint32_t id;
+    uint64_t words;
+    uint64_t submitted_ns;
+    size_t num_chunks;
+    size_t next_chunk;
+    atomic_size_t chunks_done;
+    atomic_bool cancelled;
+    struct count_chunk chunks[];
+};
+
+/**
+ * finished jobs on their way back to one reactor, any worker may push so the list is under a lock,
+ * wake_fd is an eventfd the reactor watches and is written once per job
+ * */
+struct count_completions
+{
+    pthread_mutex_t lock;
+    struct count_job *head;
+    struct count_job *tail;
+    int wake_fd;
+};
+
+/**
+ * a Chase-Lev deque of chunks, the owning worker pushes and takes at the bottom and thieves take from the top,
+ * so the owner works newest first without a lock and the only contended step is a CAS on top for the last chunk
+ * top and bottom live on their own cache lines so thieves polling top do not slow down the owner's pushes
+ * */
+struct count_deque
+{
+    alignas(COUNT_POOL_CACHE_LINE_SIZE) atomic_long top;
+    alignas(COUNT_POOL_CACHE_LINE_SIZE) atomic_long bottom;
+    _Atomic(struct count_chunk *) tasks[COUNT_DEQUE_SIZE];
+};
+
+/**
+ * one thread of the pool, its statistics only ever have the worker itself as writer
+ * */
+struct count_worker
+{
+    struct count_deque deque;
+    struct count_pool *pool;
+    pthread_t thread;
+    uint64_t random;
+    atomic_uint_fast64_t chunks;
+    atomic_uint_fast64_t steals;
+    atomic_uint_fast64_t steal_misses;
+};
+
+/**
+ * a fixed set of workers sharing one fifo of jobs, a single large payload is spread over every worker rather than queued behind one
+ * queued_chunks counts the chunks of jobs still in that fifo and sleeping the workers waiting on ready, both under lock
+ * */
+struct count_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct count_job *head;
+    struct count_job *tail;
+    void *storage;
+    struct count_worker *workers;
+    int num_threads;
+    int sleeping;
+    size_t chunk_size;
+    size_t queued_chunks;
+    enum count_schedule schedule;
+    bool stopping;
+};
+
+/**
+ * queued_chunks is every chunk not yet picked up, in the fifo or on a deque
+ * steal_misses counts steal attempts that found the victim empty or lost the race for its last chunk
+ * */
+struct count_pool_stats
+{
+    uint64_t queued_chunks;
+    uint64_t chunks;
+    uint64_t steals;
+    uint64_t steal_misses;
+};
+
+
+void count_pool_init(const struct dc_env *env, struct dc_error *err, struct count_pool *pool, int num_threads, size_t chunk_size, enum count_schedule schedule);
+
+/**
+ * stops and joins the workers, chunks already on a deque are still counted, jobs that were never started are freed
+ * and finished ones stay on their completion lists
+ * */
+void count_pool_destroy(const struct dc_env *env, struct count_pool *pool);
+
+/**
+ * allocates a job for a payload of len bytes, to be filled before it is submitted, returns NULL if memory ran out
+ * */
+struct count_job *count_job_create(const struct dc_env *env, struct dc_error *err, const struct count_pool *pool, struct count_completions *completions, size_t len);
+
+void count_job_destroy(const struct dc_env *env, struct count_job *job);
+
+/**
+ * queues a filled job, the pool owns it until it turns up on its completion list
+ * */
+void count_pool_submit(struct count_pool *pool, struct count_job *job);
+
+/**
+ * a snapshot summed over the workers, the counts keep moving while it is taken
+ * */
+void count_pool_stats(struct count_pool *pool, struct count_pool_stats *stats);
+
+/**
+ * parses fifo or steal for --count-schedule
+ * */
+bool count_pool_parse_schedule(const char *text, enum count_schedule *schedule);
+
+/**
+ * parses a positive byte count for --offload-threshold, a leading sign or an overflow is an error rather than a wrap
+ * */
+bool count_pool_parse_threshold(const char *text, size_t *bytes);
+
+/**
+ * owner side, returns false if the deque already holds COUNT_DEQUE_SIZE chunks, a zeroed deque is empty
+ * */
+bool count_deque_push(struct count_deque *deque, struct count_chunk *chunk);
+
+/**
+ * owner side, takes the newest chunk, returns NULL if the deque is empty or a thief won the last chunk
+ * */
+struct count_chunk *count_deque_take(struct count_deque *deque);
+
+/**
+ * any thread, takes the oldest chunk, returns NULL if the deque is empty or another thread got there first
+ * */
+struct count_chunk *count_deque_steal(struct count_deque *deque);
+
+size_t count_deque_size(const struct count_deque *deque);
+
+void count_completions_init(const struct dc_env *env, struct dc_error *err, struct count_completions *completions);
+
+/**
+ * frees every job still on the list, the pool has to have been destroyed first
+ * */
+void count_completions_destroy(const struct dc_env *env, struct dc_error *err, struct count_completions *completions);
+
+/**
+ * resets the eventfd and detaches the whole list, the jobs come back in the order they finished
+ * */
+struct count_job *count_completions_take(struct dc_error *err, struct count_completions *completions);
+
+#endif // MULTIPLEX_COUNT_POOL_H
@@ -0,0 +1,56 @@
+#ifndef MULTIPLEX_ENDPOINT_H
+#define MULTIPLEX_ENDPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+#define ENDPOINT_DEFAULT_PORT 4981
+#define ENDPOINT_NAME_SIZE 128
+#define ENDPOINT_PATH_MAX (sizeof(((struct sockaddr_un *)NULL)->sun_path) - 1)
+
+
+/**
+ * a stream socket address written the same way on both ends of a connection
+ *   tcp:PORT, tcp:ADDRESS:PORT, ADDRESS or ADDRESS:PORT for IPv4, a missing address is INADDR_ANY and a missing port the default
+ *   unix:PATH for a socket file, unix:@NAME for a name in the abstract namespace, which has no file and vanishes with its last socket
+ * name is the text it was parsed from, for logs
+ * */
+struct endpoint
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    char name[ENDPOINT_NAME_SIZE];
+};
+
+
+/**
+ * returns false if text is none of the forms above with errno EINVAL,
+ * or with ENAMETOOLONG if a unix path or name is longer than ENDPOINT_PATH_MAX, rather than cutting it short
+ * */
+bool endpoint_parse(const char *text, uint16_t default_port, struct endpoint *endpoint);
+
+/**
+ * true for an AF_UNIX endpoint, abstract or not
+ * */
+bool endpoint_is_unix(const struct endpoint *endpoint);
+
+/**
+ * the path of a socket file, NULL for tcp and for abstract names, which have nothing to unlink
+ * */
+const char *endpoint_path(const struct endpoint *endpoint);
+
+/**
+ * a blocking connect() on a new SOCK_CLOEXEC socket, returns -1 with errno set if either step fails
+ * */
+int endpoint_connect(const struct endpoint *endpoint);
+
+/**
+ * writes who is on the other end of an accepted socket, ADDRESS:PORT for tcp and unix:PATH, unix:@NAME or unix for the rest
+ * */
+void endpoint_peer_name(const struct sockaddr_storage *addr, socklen_t addr_len, char *name, size_t size);
+
+#endif // MULTIPLEX_ENDPOINT_H
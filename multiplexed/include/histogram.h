@@ -0,0 +1,69 @@
+#ifndef MULTIPLEX_HISTOGRAM_H
+#define MULTIPLEX_HISTOGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/**
+ * a high dynamic range histogram of non-negative integer values (HdrHistogram layout)
+ * values are kept to a fixed number of significant decimal digits across the whole range, so a 3 digit histogram
+ * tells 1000 ns from 1001 ns and 1.000 s from 1.001 s using a few hundred KiB
+ * each bucket covers twice the range of the previous one with the same number of sub-buckets,
+ * so recording is a count leading zeros, two shifts and an increment, with no search and no allocation
+ * values above highest are recorded as highest so a stall never goes missing from the count
+ * */
+struct histogram
+{
+    uint64_t highest_trackable;
+    int significant_figures;
+    int unit_magnitude;
+    int sub_bucket_half_count_magnitude;
+    uint64_t sub_bucket_count;
+    uint64_t sub_bucket_half_count;
+    uint64_t sub_bucket_mask;
+    int bucket_count;
+    size_t counts_len;
+    uint64_t total_count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t *counts;
+};
+
+
+/**
+ * tracks values from 1 to highest_trackable with significant_figures (1 to 5) digits of precision
+ * returns false if the arguments are out of range or the counts could not be allocated
+ * */
+bool histogram_init(struct histogram *histogram, uint64_t highest_trackable, int significant_figures);
+
+void histogram_destroy(struct histogram *histogram);
+
+void histogram_reset(struct histogram *histogram);
+
+void histogram_record(struct histogram *histogram, uint64_t value);
+
+/**
+ * adds every count in from to into, both must have been created with the same arguments
+ * */
+void histogram_add(struct histogram *into, const struct histogram *from);
+
+/**
+ * the smallest recorded value that percentile (0 to 100) percent of the values are at or below,
+ * reported as the highest value equivalent to it at the histogram's precision, 0 when nothing was recorded
+ * */
+uint64_t histogram_value_at_percentile(const struct histogram *histogram, double percentile);
+
+double histogram_mean(const struct histogram *histogram);
+
+double histogram_stddev(const struct histogram *histogram);
+
+/**
+ * writes the percentile distribution in the HdrHistogram .hgrm text format that the HdrHistogram plotters read,
+ * values are divided by unit_ratio (1000 turns nanoseconds into microseconds)
+ * */
+void histogram_write_percentiles(const struct histogram *histogram, FILE *stream, double unit_ratio);
+
+#endif // MULTIPLEX_HISTOGRAM_H
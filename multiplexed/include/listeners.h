@@ -0,0 +1,68 @@
+#ifndef MULTIPLEX_LISTENERS_H
+#define MULTIPLEX_LISTENERS_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "endpoint.h"
+
+
+#define LISTENERS_MAX 8
+#define LISTENERS_DEFAULT "tcp:4981"
+
+
+/**
+ * the sockets a server accepts on, one per --listen, tcp and unix side by side in the same event loop
+ * fds[i] is the listener for endpoints[i], -1 until it is opened
+ * owned is false for unix listeners shared with another reactor, those are closed here but their file is left to the owner
+ * */
+struct listeners
+{
+    struct endpoint endpoints[LISTENERS_MAX];
+    int fds[LISTENERS_MAX];
+    bool owned[LISTENERS_MAX];
+    size_t count;
+};
+
+
+/**
+ * empty, add() fills it from the command line and open() falls back to LISTENERS_DEFAULT if nothing was added
+ * */
+void listeners_init(struct listeners *listeners);
+
+/**
+ * parses one --listen argument, returns false if it is not an endpoint or there are already LISTENERS_MAX of them,
+ * errno is ENAMETOOLONG for a unix path that does not fit, see endpoint_parse()
+ * */
+bool listeners_add(struct listeners *listeners, const char *text);
+
+/**
+ * binds and listens on every endpoint, closing what was opened if any of them fails
+ * a leftover socket file nobody accepts on any more is removed first, one that is still being served is an error like a busy port
+ * reuse_port lets several reactors bind the same tcp port, nonblocking is for loops that accept until EAGAIN
+ * */
+void listeners_open(const struct dc_env *env, struct dc_error *err, struct listeners *listeners, int backlog, bool reuse_port, bool nonblocking);
+
+/**
+ * opens the same endpoints as first for another reactor, tcp gets its own SO_REUSEPORT socket,
+ * unix cannot be bound twice so the reactor gets a dup() of first's listener and they accept from one queue
+ * */
+void listeners_share(const struct dc_env *env, struct dc_error *err, struct listeners *listeners, const struct listeners *first, int backlog);
+
+/**
+ * closes every open listener and removes the socket files of the owned ones
+ * */
+void listeners_close(const struct dc_env *env, struct dc_error *err, struct listeners *listeners);
+
+/**
+ * the index of the listener fd in listeners, -1 if fd is not one of them
+ * */
+int listeners_find(const struct listeners *listeners, int fd);
+
+/**
+ * the endpoints as a comma separated list, for the startup message
+ * */
+void listeners_describe(const struct listeners *listeners, char *text, size_t size);
+
+#endif // MULTIPLEX_LISTENERS_H
@@ -0,0 +1,50 @@
+#ifndef MULTIPLEX_LOGGER_H
+#define MULTIPLEX_LOGGER_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+
+
+/**
+ * a record is kept if its level is at or below the configured one
+ * the request payload is only logged at LOG_LEVEL_TRACE
+ * */
+enum log_level
+{
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_TRACE,
+};
+
+
+/**
+ * opens path for appending, or uses stdout if path is NULL, and starts the thread that writes the log
+ * records are written as csv: time, thread, level, message
+ * call it once from main before any other thread logs, until then every record is discarded
+ * */
+void logger_init(const struct dc_env *env, struct dc_error *err, const char *path, enum log_level level);
+
+/**
+ * stops the writer thread after it has written everything that was queued, then frees the per-thread rings
+ * every other thread must have stopped logging
+ * */
+void logger_shutdown(void);
+
+bool logger_enabled(enum log_level level);
+
+/**
+ * formats the record into the calling thread's ring and returns, it never blocks and never does I/O
+ * if the ring is full the record is dropped and counted, the writer reports how many were lost
+ * messages longer than a record are truncated
+ * */
+void logger_write(enum log_level level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * parses "error", "warn", "info", "debug" or "trace", returns false for anything else
+ * */
+bool logger_parse_level(const char *name, enum log_level *level);
+
+#endif // MULTIPLEX_LOGGER_H
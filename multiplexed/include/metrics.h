@@ -0,0 +1,180 @@
+#ifndef MULTIPLEX_METRICS_H
+#define MULTIPLEX_METRICS_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+#define METRICS_CACHE_LINE_SIZE 64
+#define METRICS_FIRST_BUCKET_SHIFT 10
+#define METRICS_BUCKET_COUNT 25
+#define METRICS_NANOSECONDS_PER_SECOND 1000000000ULL
+
+
+enum metrics_counter
+{
+    METRICS_ACCEPTS,
+    METRICS_REJECTS,
+    METRICS_BYTES_IN,
+    METRICS_BYTES_OUT,
+    METRICS_REQUESTS,
+    METRICS_DISCONNECTS,
+    METRICS_POLL_ERRORS,
+    METRICS_TIMEOUTS,
+    METRICS_OFFLOADS,
+    METRICS_ZEROCOPY_SENDS,
+    METRICS_ZEROCOPY_COPIED,
+    METRICS_COUNTER_COUNT,
+};
+
+/**
+ * values kept by something other than an event loop, read through the sampler when the endpoint is scraped
+ * the count pool values stay 0 in a server without one
+ * */
+enum metrics_sampled
+{
+    METRICS_COUNT_QUEUE_DEPTH,
+    METRICS_COUNT_CHUNKS,
+    METRICS_COUNT_STEALS,
+    METRICS_COUNT_STEAL_MISSES,
+    METRICS_BUFFER_IN_USE_BYTES,
+    METRICS_BUFFER_IN_USE,
+    METRICS_BUFFER_FREE_BYTES,
+    METRICS_BUFFER_HITS,
+    METRICS_BUFFER_MISSES,
+    METRICS_RESIDENT_BYTES,
+    METRICS_SAMPLED_COUNT,
+};
+
+enum metrics_histogram
+{
+    METRICS_LOOP_TIME,
+    METRICS_SERVICE_TIME,
+    METRICS_OFFLOAD_TIME,
+    METRICS_HISTOGRAM_COUNT,
+};
+
+/**
+ * bucket i counts durations of at most 2^(10 + i) ns, from about 1 us to 8.6 s, and the last bucket is +Inf
+ * fixed power of two bounds make recording a count leading zeros and an increment, and map straight onto prometheus' le labels
+ * */
+struct metrics_buckets
+{
+    atomic_uint_fast64_t counts[METRICS_BUCKET_COUNT];
+    atomic_uint_fast64_t sum_ns;
+};
+
+/**
+ * everything one event loop records, only that loop's thread ever writes it so an update is a plain load and store
+ * shards start on their own cache line so two loops never write to the same line
+ * */
+struct metrics_shard
+{
+    alignas(METRICS_CACHE_LINE_SIZE) atomic_uint_fast64_t counters[METRICS_COUNTER_COUNT];
+    struct metrics_buckets histograms[METRICS_HISTOGRAM_COUNT];
+};
+
+typedef void (*metrics_sampler)(void *arg, uint64_t values[METRICS_SAMPLED_COUNT]);
+
+/**
+ * one shard per thread, only summed when the endpoint is scraped
+ * server is the value of the server label on every metric
+ * sampler is NULL unless metrics_set_sampler was called, the sampled metrics are left out without one
+ * */
+struct metrics
+{
+    void *storage;
+    struct metrics_shard *shards;
+    size_t shard_count;
+    const char *server;
+    metrics_sampler sampler;
+    void *sampler_arg;
+};
+
+
+void metrics_init(const struct dc_env *env, struct dc_error *err, struct metrics *metrics, size_t shard_count, const char *server);
+
+void metrics_destroy(const struct dc_env *env, struct metrics *metrics);
+
+/**
+ * the sampler is called on the scraping loop's thread, it has to be safe to call from there at any time
+ * */
+void metrics_set_sampler(struct metrics *metrics, metrics_sampler sampler, void *arg);
+
+/**
+ * writes every metric in the prometheus text exposition format, summed over the shards
+ * returns the length, or 0 if it does not fit in size bytes
+ * */
+size_t metrics_format(const struct metrics *metrics, char *buffer, size_t size);
+
+/**
+ * a non-blocking listener for the admin port, it is meant to be watched level-triggered by one of the event loops
+ * */
+int metrics_listen(const struct dc_env *env, struct dc_error *err, uint16_t port);
+
+/**
+ * accepts one scrape connection, returns -1 without raising an error if there was none waiting
+ * */
+int metrics_accept(const struct dc_env *env, struct dc_error *err, int listener);
+
+/**
+ * reads the request and answers GET /metrics with the current values and anything else with a 404,
+ * a body that does not fit in a MiB gets a 500 rather than an empty 200
+ * the whole response is written without blocking, a scraper that cannot take a few KiB at once gets it cut short
+ * returns true while the request has not arrived yet, false once the connection is done and can be closed
+ * */
+bool metrics_serve(const struct dc_env *env, struct dc_error *err, const struct metrics *metrics, int fd);
+
+/**
+ * parses a port number for --metrics-port, 0 is rejected
+ * */
+bool metrics_parse_port(const char *text, uint16_t *port);
+
+
+/**
+ * every loop reads the clock at least twice a pass, always_inline keeps gcc from calling out to it from a loop it guesses is cold
+ * */
+static inline __attribute__((always_inline)) uint64_t metrics_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * METRICS_NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * single writer, so there is no need for a locked read-modify-write, readers on other threads only see a stale value
+ * */
+static inline void metrics_add(struct metrics_shard *shard, enum metrics_counter counter, uint64_t amount)
+{
+    atomic_uint_fast64_t *value;
+
+    value = &shard->counters[counter];
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static inline void metrics_observe(struct metrics_shard *shard, enum metrics_histogram histogram, uint64_t duration_ns)
+{
+    struct metrics_buckets *buckets;
+    unsigned int bucket;
+
+    buckets = &shard->histograms[histogram];
+    bucket = duration_ns <= (1ULL << METRICS_FIRST_BUCKET_SHIFT) ? 0 : (unsigned int)(64 - __builtin_clzll(duration_ns - 1) - METRICS_FIRST_BUCKET_SHIFT);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(bucket >= METRICS_BUCKET_COUNT)
+    {
+        bucket = METRICS_BUCKET_COUNT - 1;
+    }
+
+    atomic_store_explicit(&buckets->counts[bucket], atomic_load_explicit(&buckets->counts[bucket], memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&buckets->sum_ns, atomic_load_explicit(&buckets->sum_ns, memory_order_relaxed) + duration_ns, memory_order_relaxed);
+}
+
+#endif // MULTIPLEX_METRICS_H
@@ -0,0 +1,77 @@
+#ifndef MULTIPLEX_OUT_BUFFER_H
+#define MULTIPLEX_OUT_BUFFER_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include "buffer_pool.h"
+
+
+#define OUT_BUFFER_DEFAULT_HIGH_WATER (1024UL * 1024UL)
+#define OUT_BATCH_SIZE 4096
+
+
+/**
+ * the bytes a connection still owes its client, kept in a ring so draining and appending never move data
+ * capacity is zero or a power of two, the buffer only grows when a reader falls behind
+ * the ring comes from cache, doubles while a client streams faster than it reads and goes back to the cache once it drains
+ * */
+struct out_buffer
+{
+    struct buffer_cache *cache;
+    char *data;
+    size_t capacity;
+    size_t head;
+    size_t len;
+};
+
+/**
+ * the replies to the requests one read completed, gathered on the stack so a pipelined burst goes out in one sendmsg()
+ * rather than one per request, and nothing is copied into the connection's ring unless the socket will not take it all
+ * */
+struct out_batch
+{
+    struct out_buffer *out;
+    int fd;
+    size_t len;
+    char data[OUT_BATCH_SIZE];
+};
+
+
+void out_buffer_destroy(const struct dc_env *env, struct out_buffer *out);
+
+/**
+ * gathers the iovecs into one sendmsg() straight to fd when nothing is queued, anything the socket does not take is queued
+ * when data is already queued the iovecs go behind it so replies stay in order
+ * returns false if the connection is dead, err is only set if the buffer could not grow
+ * */
+bool out_buffer_send(const struct dc_env *env, struct dc_error *err, struct out_buffer *out, int fd, const struct iovec *iov, size_t iovcnt);
+
+/**
+ * writes as much of the queue as the socket will take without blocking, returns false if the connection is dead
+ * */
+bool out_buffer_flush(struct out_buffer *out, int fd);
+
+size_t out_buffer_pending(const struct out_buffer *out);
+
+/**
+ * parses a positive byte count for --high-water, strtoul() alone would take "-1" and wrap it to SIZE_MAX
+ * */
+bool out_buffer_parse_high_water(const char *text, size_t *bytes);
+
+void out_batch_init(struct out_batch *batch, struct out_buffer *out, int fd);
+
+/**
+ * adds a reply behind the ones already in the batch, the batch is only sent early when it is full
+ * returns false if the connection is dead, err is only set if the buffer could not grow
+ * */
+bool out_batch_add(const struct dc_env *env, struct dc_error *err, struct out_batch *batch, const char *data, size_t len);
+
+/**
+ * sends whatever the batch holds through out_buffer_send(), call it once the read has been parsed
+ * */
+bool out_batch_flush(const struct dc_env *env, struct dc_error *err, struct out_batch *batch);
+
+#endif // MULTIPLEX_OUT_BUFFER_H
@@ -0,0 +1,135 @@
+#ifndef MULTIPLEX_REQUEST_H
+#define MULTIPLEX_REQUEST_H
+
+#include "word_count.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define REQUEST_LENGTH_PREFIX_SIZE 4
+#define REQUEST_BINARY_HEADER_SIZE 8
+#define REQUEST_BINARY_RESPONSE_SIZE 20
+#define REQUEST_HELLO_SIZE 4
+#define REQUEST_HELLO_MAGIC 0xFFU
+#define REQUEST_PROTOCOL_VERSION 1
+#define REQUEST_RESPONSE_SIZE 24
+
+
+/**
+ * how a connection's byte stream is split into requests
+ * FRAME_NONE is the original protocol, every read() is a request of its own
+ * FRAME_LINE ends a request at each newline
+ * FRAME_LENGTH starts each request with a 4 byte big-endian payload length, so a document can be any size
+ * FRAME_BINARY is only reached through the handshake, see below
+ * */
+enum frame_mode
+{
+    FRAME_NONE,
+    FRAME_LINE,
+    FRAME_LENGTH,
+    FRAME_BINARY,
+};
+
+/**
+ * in the framed modes a connection whose first byte is 0xFF is asking for a protocol version instead of sending a request,
+ * an unframed connection never negotiates, its first read is counted like any other
+ * the client's hello is 0xFF 'W' 'C' and the highest version it speaks, the server answers 0xFF 'W' 'S' and the
+ * version the connection will use, 0 means none in common and the connection stays in the mode the server was started with
+ * the answer has its own name so a client never takes its hello echoed back by something else for one
+ * version 1 requests: u32 payload length, u32 request id, payload
+ * version 1 responses: u32 body length, u32 request id, u16 status, u16 reserved, u64 word count as the body when the status is ok
+ * every field is big-endian, the id is the client's own and comes back unchanged so replies can be matched in any order
+ * */
+enum request_type
+{
+    REQUEST_COUNT,
+    REQUEST_HELLO,
+    REQUEST_PAYLOAD,
+};
+
+enum request_status
+{
+    REQUEST_STATUS_OK,
+    REQUEST_STATUS_ERROR,
+};
+
+/**
+ * what one completed request asks for, id is zero outside the binary protocol and version is only set for a hello
+ * a REQUEST_PAYLOAD is a piece of a payload at or above the parser's offload threshold, handed over instead of counted,
+ * data and len are the piece and remaining is how much of the payload is still to come, so the first piece gives
+ * away the size and the last one has remaining 0
+ * */
+struct request
+{
+    enum request_type type;
+    uint32_t id;
+    uint64_t words;
+    unsigned int version;
+    const char *data;
+    size_t len;
+    uint64_t remaining;
+};
+
+/**
+ * per-connection parser state, a request can arrive in any number of reads of any size
+ * in_request is set while part of a request has been consumed and the rest has not arrived yet
+ * negotiable is only set before the first byte of a framed connection, that is the only place a hello can start
+ * offload_threshold is zero after init, set it to have payloads of at least that many bytes handed over as REQUEST_PAYLOAD
+ * pieces, only the length-prefixed modes know a payload's size up front so line and unframed requests are always counted
+ * */
+struct request_parser
+{
+    enum frame_mode mode;
+    struct word_counter counter;
+    uint64_t remaining;
+    uint64_t offload_threshold;
+    uint32_t id;
+    unsigned char prefix[REQUEST_BINARY_HEADER_SIZE];
+    size_t prefix_len;
+    bool in_request;
+    bool negotiable;
+    bool offloading;
+};
+
+
+void request_parser_init(struct request_parser *parser, enum frame_mode mode);
+
+/**
+ * consumes bytes from data up to the end of the current request at most and stores how many in consumed
+ * returns true when that completed a request, which is stored in request
+ * call it again with the rest of the buffer until everything has been consumed
+ * */
+bool request_parser_feed(struct request_parser *parser, const char *data, size_t len, size_t *consumed, struct request *request);
+
+/**
+ * called for each request a buffer completes, in order, returns false to stop feeding
+ * */
+typedef bool (*request_handler)(void *arg, const struct request *request);
+
+/**
+ * runs all of data through the parser and calls handler for every request it completes,
+ * a trailing partial request stays in the parser for the next call
+ * returns false as soon as handler does, the rest of data is not consumed
+ * */
+bool request_parser_feed_all(struct request_parser *parser, const char *data, size_t len, request_handler handler, void *arg);
+
+/**
+ * the framed modes answer each request with its word count in decimal followed by a newline
+ * buffer must hold REQUEST_RESPONSE_SIZE bytes, returns the length without the terminating nul
+ * */
+size_t request_format_response(char *buffer, uint64_t words);
+
+/**
+ * formats the answer to any request in a framed mode, mode is the parser's after the request completed
+ * so the hello that switched a connection to the binary protocol is itself answered as a hello
+ * buffer must hold REQUEST_RESPONSE_SIZE bytes, returns the length
+ * */
+size_t request_format_reply(char *buffer, enum frame_mode mode, const struct request *request);
+
+/**
+ * parses "none", "line" or "length", returns false for anything else
+ * */
+bool request_parse_frame_mode(const char *name, enum frame_mode *mode);
+
+#endif // MULTIPLEX_REQUEST_H
@@ -0,0 +1,52 @@
+#ifndef MULTIPLEX_SPSC_QUEUE_H
+#define MULTIPLEX_SPSC_QUEUE_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+#define SPSC_CACHE_LINE_SIZE 64
+
+
+/**
+ * a bounded lock-free ring with exactly one producer thread and one consumer thread
+ * head is only written by the consumer and tail only by the producer, each on its own cache line
+ * elements are copied in and out by value, the capacity is rounded up to a power of two
+ * */
+struct spsc_queue
+{
+    alignas(SPSC_CACHE_LINE_SIZE) atomic_size_t head;
+    alignas(SPSC_CACHE_LINE_SIZE) atomic_size_t tail;
+    alignas(SPSC_CACHE_LINE_SIZE) size_t mask;
+    size_t element_size;
+    unsigned char *slots;
+};
+
+
+/**
+ * allocates the slots, capacity is the minimum number of elements the queue must hold
+ * */
+void spsc_queue_init(const struct dc_env *env, struct dc_error *err, struct spsc_queue *queue, size_t capacity, size_t element_size);
+
+void spsc_queue_destroy(const struct dc_env *env, struct spsc_queue *queue);
+
+/**
+ * producer side, returns false without copying anything if the queue is full
+ * */
+bool spsc_queue_push(struct spsc_queue *queue, const void *element);
+
+/**
+ * consumer side, returns false if the queue is empty
+ * */
+bool spsc_queue_pop(struct spsc_queue *queue, void *element);
+
+/**
+ * an approximate count, exact only when called from the producer or consumer with the other side idle
+ * */
+size_t spsc_queue_size(struct spsc_queue *queue);
+
+#endif // MULTIPLEX_SPSC_QUEUE_H
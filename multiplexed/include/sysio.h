@@ -0,0 +1,47 @@
+#ifndef MULTIPLEX_SYSIO_H
+#define MULTIPLEX_SYSIO_H
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+
+/**
+ * the calls the servers make once per request, inlined straight onto the system call
+ * they report failure the way the system call does, -1 with errno set, and never touch a dc_error
+ * so the read, count and reply path pays nothing for tracing or error bookkeeping
+ * setup and teardown keep using the dc wrappers
+ * */
+
+
+/**
+ * a non-blocking read, a socket with nothing to read fails with EAGAIN instead of waiting
+ * */
+static inline ssize_t sysio_recv(int fd, void *buffer, size_t len)
+{
+    return recv(fd, buffer, len, MSG_DONTWAIT);
+}
+
+static inline int sysio_poll(struct pollfd *fds, nfds_t count, int timeout)
+{
+    return poll(fds, count, timeout);
+}
+
+static inline int sysio_select(int nfds, fd_set *read_fds, fd_set *write_fds, struct timeval *timeout)
+{
+    return select(nfds, read_fds, write_fds, NULL, timeout);
+}
+
+/**
+ * true if error only means the socket had nothing to give or take right now
+ * */
+static inline bool sysio_would_block(int error)
+{
+    return error == EAGAIN || error == EWOULDBLOCK;
+}
+
+#endif // MULTIPLEX_SYSIO_H
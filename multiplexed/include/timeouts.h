@@ -0,0 +1,69 @@
+#ifndef MULTIPLEX_TIMEOUTS_H
+#define MULTIPLEX_TIMEOUTS_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "conn_table.h"
+#include "timer_wheel.h"
+
+
+#define TIMEOUTS_TICK_NS (10ULL * 1000000ULL)
+
+
+/**
+ * how long a connection may go without progress before it is closed, zero turns that timeout off
+ * idle: nothing received and no reply waiting to go out
+ * read: part of a request received and nothing more for that long, a tighter bound than idle for clients that stall mid-request
+ * write: replies queued and the client has not taken any of them for that long
+ * */
+struct timeouts
+{
+    uint64_t idle_ns;
+    uint64_t read_ns;
+    uint64_t write_ns;
+};
+
+enum timeout_kind
+{
+    TIMEOUT_NONE,
+    TIMEOUT_IDLE,
+    TIMEOUT_READ,
+    TIMEOUT_WRITE,
+};
+
+
+/**
+ * parses a number of milliseconds, 0 included
+ * */
+bool timeouts_parse(const char *text, uint64_t *ns);
+
+bool timeouts_enabled(const struct timeouts *timeouts);
+
+/**
+ * call after servicing a connection, read says whether anything arrived and wrote whether the client took queued bytes
+ * */
+void timeouts_touch(struct connection *connection, uint64_t now_ns, bool read, bool wrote);
+
+/**
+ * returns which timeout is the earliest to apply to the connection and stores when, or TIMEOUT_NONE if none does
+ * */
+enum timeout_kind timeouts_deadline(const struct timeouts *timeouts, const struct connection *connection, uint64_t *deadline_ns);
+
+/**
+ * makes sure the wheel fires for id no later than the connection's deadline
+ * a timer that is already due earlier is left alone, timeouts_expired() sorts it out when it fires,
+ * so a busy connection costs a comparison per read rather than a move in the wheel
+ * */
+bool timeouts_arm(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, const struct timeouts *timeouts, const struct connection *connection, size_t id);
+
+/**
+ * for a timer that has fired, returns the timeout that has run out or TIMEOUT_NONE if the connection made progress since it was armed
+ * */
+enum timeout_kind timeouts_expired(const struct timeouts *timeouts, const struct connection *connection, uint64_t now_ns);
+
+const char *timeouts_kind_name(enum timeout_kind kind);
+
+#endif // MULTIPLEX_TIMEOUTS_H
@@ -0,0 +1,86 @@
+#ifndef MULTIPLEX_TIMER_WHEEL_H
+#define MULTIPLEX_TIMER_WHEEL_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_SLOT_BITS)
+
+
+/**
+ * timers are named by a caller-chosen id, the servers use the connection's slot in the connection table,
+ * and linked through indexes rather than pointers so the node array can grow without breaking the lists
+ * */
+struct timer_wheel_node
+{
+    size_t next;
+    size_t prev;
+    uint64_t expires;
+    unsigned int level;
+    unsigned int slot;
+    bool scheduled;
+};
+
+/**
+ * a hierarchical timing wheel, four levels of 64 slots with each level's slot spanning a whole turn of the level below
+ * a timer lands in the lowest level whose range covers it and moves down a level each time the level above turns over,
+ * so scheduling and cancelling are O(1) and a tick only touches the one slot that is due
+ * with a 10 ms tick the wheel covers 64^4 ticks, about 46 hours, anything further out waits in the top level and is placed again
+ * occupied has a bit per non-empty slot so finding the next expiry is a few bit scans instead of a walk over the slots
+ * */
+struct timer_wheel
+{
+    struct timer_wheel_node *nodes;
+    size_t capacity;
+    size_t heads[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    uint64_t tick_ns;
+    uint64_t origin_ns;
+    uint64_t current;
+    size_t count;
+};
+
+/**
+ * called for each timer that expires, the timer has already been removed so it can be scheduled again from here
+ * */
+typedef void (*timer_wheel_handler)(void *arg, size_t id);
+
+
+/**
+ * tick_ns is the resolution, a timer fires on the first tick at or after its expiry
+ * */
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t tick_ns, uint64_t now_ns);
+
+void timer_wheel_destroy(const struct dc_env *env, struct timer_wheel *wheel);
+
+/**
+ * sets id's timer to expires_ns, moving it if it was already scheduled
+ * returns false if the node array could not grow to hold id
+ * */
+bool timer_wheel_schedule(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, size_t id, uint64_t expires_ns);
+
+void timer_wheel_cancel(struct timer_wheel *wheel, size_t id);
+
+/**
+ * returns false if id has no timer, otherwise stores when it expires
+ * */
+bool timer_wheel_expiry(const struct timer_wheel *wheel, size_t id, uint64_t *expires_ns);
+
+/**
+ * runs the wheel forward to now_ns and calls handler for every timer that is due
+ * */
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ns, timer_wheel_handler handler, void *arg);
+
+/**
+ * milliseconds until the wheel next has work to do, rounded up, for poll() and friends
+ * -1 when nothing is scheduled, 0 if something is already due
+ * */
+int timer_wheel_timeout_ms(const struct timer_wheel *wheel, uint64_t now_ns);
+
+#endif // MULTIPLEX_TIMER_WHEEL_H
@@ -0,0 +1,17 @@
+#ifndef MULTIPLEX_TRACE_H
+#define MULTIPLEX_TRACE_H
+
+#include <dc_env/env.h>
+
+
+/**
+ * DC_TRACE is a call into dc_env on entry to every function, even when no tracer is installed
+ * a release build defines MULTIPLEX_NO_TRACE and every DC_TRACE after this header compiles to nothing
+ * include it after the dc headers, env.h's include guard keeps them from defining the macro again
+ * */
+#ifdef MULTIPLEX_NO_TRACE
+#undef DC_TRACE
+#define DC_TRACE(env) ((void)(env))
+#endif
+
+#endif // MULTIPLEX_TRACE_H
@@ -0,0 +1,68 @@
+#ifndef MULTIPLEX_WORD_COUNT_H
+#define MULTIPLEX_WORD_COUNT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * the counting kernels, word_count_init() picks the widest one the cpu supports
+ * */
+enum word_count_kernel
+{
+    WORD_COUNT_SCALAR,
+    WORD_COUNT_SSE2,
+    WORD_COUNT_AVX2,
+    WORD_COUNT_AVX512,
+    WORD_COUNT_KERNEL_COUNT,
+};
+
+/**
+ * counts words across any number of reads, a word is counted when a non-whitespace byte follows whitespace
+ * in_word is carried from one buffer to the next so a word split over two reads is only counted once,
+ * and runs of whitespace never count as extra words
+ * */
+struct word_counter
+{
+    bool in_word;
+    uint64_t words;
+};
+
+
+/**
+ * checks CPUID and selects the kernel every word_counter uses, call it once at startup before any threads are created
+ * until then the scalar kernel is used
+ * */
+void word_count_init(void);
+
+bool word_count_kernel_supported(enum word_count_kernel kernel);
+
+const char *word_count_kernel_name(enum word_count_kernel kernel);
+
+enum word_count_kernel word_count_kernel_active(void);
+
+/**
+ * runs one specific kernel, returns the number of words that start in buffer and updates in_word
+ * the kernel must be supported
+ * */
+uint64_t word_count_run(enum word_count_kernel kernel, const char *buffer, size_t len, bool *in_word);
+
+void word_counter_init(struct word_counter *counter);
+
+/**
+ * adds the words that start in buffer to the running count
+ * */
+void word_counter_feed(struct word_counter *counter, const char *buffer, size_t len);
+
+/**
+ * returns the count so far and starts a new one, in_word is kept so the next buffer continues the current word
+ * */
+uint64_t word_counter_take(struct word_counter *counter);
+
+/**
+ * space, tab, newline, carriage return, vertical tab and form feed
+ * */
+bool word_count_is_space(char c);
+
+#endif // MULTIPLEX_WORD_COUNT_H
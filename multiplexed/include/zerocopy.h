@@ -0,0 +1,104 @@
+#ifndef MULTIPLEX_ZEROCOPY_H
+#define MULTIPLEX_ZEROCOPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "buffer_pool.h"
+
+
+#define ZEROCOPY_MIN_SIZE 16384
+#define ZEROCOPY_MAX_PINNED 8
+#define ZEROCOPY_MAX_LINGERING 64
+#define ZEROCOPY_LINGER_POLL_MS 10
+
+
+/**
+ * a buffer the kernel may still be reading from, seq is the number the kernel gave the send that handed it over
+ * */
+struct zerocopy_pin
+{
+    char *data;
+    size_t size;
+    uint32_t seq;
+    bool done;
+};
+
+/**
+ * the buffers of one socket's MSG_ZEROCOPY sends, in the order they were sent, until the error queue reports them complete
+ * the kernel numbers every successful MSG_ZEROCOPY send on a socket from 0, next_seq mirrors that count
+ * at most ZEROCOPY_MAX_PINNED are held at once, a send that finds no room is copied like any other
+ * */
+struct zerocopy
+{
+    struct zerocopy_pin pins[ZEROCOPY_MAX_PINNED];
+    size_t head;
+    size_t count;
+    uint32_t next_seq;
+    bool enabled;
+};
+
+/**
+ * sockets that were closed while the kernel still had some of their sends pinned, each one kept open on a dup() of its fd
+ * so its error queue can still be read, until then its buffers must not go back to the cache where the next allocation would
+ * overwrite bytes the kernel has yet to send, abandoned counts the buffers given up on because there was no room here
+ * */
+struct zerocopy_lingering
+{
+    int fds[ZEROCOPY_MAX_LINGERING];
+    struct zerocopy zerocopies[ZEROCOPY_MAX_LINGERING];
+    size_t count;
+    uint64_t abandoned;
+};
+
+/**
+ * turns on SO_ZEROCOPY for fd, returns false and leaves zerocopy off where the socket or kernel does not support it
+ * */
+bool zerocopy_enable(struct zerocopy *zerocopy, int fd);
+
+/**
+ * true if a send of len bytes is worth pinning a buffer for, below ZEROCOPY_MIN_SIZE the page pinning costs more than the copy
+ * */
+bool zerocopy_ready(const struct zerocopy *zerocopy, size_t len);
+
+/**
+ * sends the iovecs with MSG_ZEROCOPY and, if any of them went out, pins data, the buffer of size bytes from the cache they point into
+ * returns what sendmsg() returned, on -1 nothing was pinned and errno says why, ENOBUFS means the kernel would not pin more pages
+ * */
+ssize_t zerocopy_send(struct zerocopy *zerocopy, int fd, const struct iovec *iov, size_t iovcnt, char *data, size_t size);
+
+/**
+ * drains the socket's error queue and gives every buffer the kernel is done with back to cache
+ * copied counts the sends the kernel reported having copied after all, which is what happens over loopback
+ * returns how many buffers were given back
+ * */
+size_t zerocopy_reap(struct zerocopy *zerocopy, struct buffer_cache *cache, int fd, uint64_t *copied);
+
+/**
+ * for a socket that is about to be closed, has to be called while fd is still open
+ * gives back what the kernel is done with and moves the rest to lingering along with a dup() of fd, shut down so the peer still sees the end,
+ * with lingering full the rest is abandoned, never freed, as malloc would hand it out again just the same
+ * */
+void zerocopy_release(struct zerocopy *zerocopy, struct zerocopy_lingering *lingering, struct buffer_cache *cache, int fd);
+
+/**
+ * gives back every pinned buffer without waiting for the kernel, only for shutdown, once nothing takes buffers from cache again
+ * */
+void zerocopy_discard(struct zerocopy *zerocopy, struct buffer_cache *cache);
+
+void zerocopy_lingering_init(struct zerocopy_lingering *lingering);
+
+/**
+ * drains the error queue of every lingering socket and closes the ones that have nothing pinned left
+ * returns how many buffers were given back
+ * */
+size_t zerocopy_lingering_reap(struct zerocopy_lingering *lingering, struct buffer_cache *cache);
+
+/**
+ * closes every lingering socket and discards what it still had pinned, only for shutdown like zerocopy_discard
+ * */
+void zerocopy_lingering_destroy(struct zerocopy_lingering *lingering, struct buffer_cache *cache);
+
+#endif // MULTIPLEX_ZEROCOPY_H
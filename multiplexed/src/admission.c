@@ -0,0 +1,115 @@
+#include "admission.h"
+#include <dc_posix/dc_unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "trace.h"
+
+
+static int open_reserve(void);
+
+
+void admission_init(const struct dc_env *env, struct dc_error *err, struct admission *admission, int batch)
+{
+    DC_TRACE(env);
+    admission->batch = batch;
+    admission->paused_at = SIZE_MAX;
+    admission->reserve_fd = open_reserve();
+
+    if(admission->reserve_fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void admission_destroy(const struct dc_env *env, struct dc_error *err, struct admission *admission)
+{
+    DC_TRACE(env);
+
+    if(admission->reserve_fd != -1)
+    {
+        dc_close(env, err, admission->reserve_fd);
+        admission->reserve_fd = -1;
+    }
+}
+
+int admission_accept(const struct dc_env *env, struct dc_error *err, struct admission *admission, int listener, struct sockaddr *addr, socklen_t *addr_len, bool *dropped)
+{
+    int fd;
+
+    DC_TRACE(env);
+    *dropped = false;
+    fd = accept4(listener, addr, addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);   // NOLINT(hicpp-signed-bitwise)
+
+    if(fd != -1)
+    {
+        return fd;
+    }
+
+    // the peer gave up while it was queued, there may be more behind it but the next wakeup will get them
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR)
+    {
+        return -1;
+    }
+
+    if((errno == EMFILE || errno == ENFILE) && admission->reserve_fd != -1)
+    {
+        close(admission->reserve_fd);
+        fd = accept(listener, NULL, NULL);
+
+        if(fd != -1)
+        {
+            close(fd);
+        }
+
+        // even if the connection could not be taken, the caller must stop accepting or the listener stays readable
+        *dropped = true;
+        admission->reserve_fd = open_reserve();
+
+        return -1;
+    }
+
+    DC_ERROR_RAISE_ERRNO(err, errno);
+
+    return -1;
+}
+
+void admission_pause(struct admission *admission, size_t clients)
+{
+    admission->paused_at = clients;
+}
+
+bool admission_accepting(struct admission *admission, size_t clients)
+{
+    if(admission->paused_at != SIZE_MAX && clients < admission->paused_at)
+    {
+        admission->paused_at = SIZE_MAX;
+    }
+
+    return admission->paused_at == SIZE_MAX;
+}
+
+bool admission_parse_count(const char *text, int *value)
+{
+    char *end;
+    long count;
+
+    count = strtol(text, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(*end != '\0' || count < 1 || count > INT_MAX)
+    {
+        return false;
+    }
+
+    *value = (int)count;
+
+    return true;
+}
+
+static int open_reserve(void)
+{
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);     // NOLINT(hicpp-signed-bitwise,cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+}
@@ -0,0 +1,316 @@
+#include "buffer_pool.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+
+static size_t class_of(size_t size);
+static void refill(struct buffer_cache *cache, size_t class);
+static void spill(struct buffer_cache *cache, size_t class);
+static void *pop_free(struct buffer_pool *pool, size_t class);
+static void increase(atomic_uint_fast64_t *value, uint64_t amount);
+static void decrease(atomic_uint_fast64_t *value, uint64_t amount);
+
+
+void buffer_pool_init(const struct dc_env *env, struct buffer_pool *pool)
+{
+    DC_TRACE(env);
+    dc_memset(env, pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+void buffer_pool_destroy(const struct dc_env *env, struct buffer_pool *pool)
+{
+    DC_TRACE(env);
+
+    for(size_t class = 0; class < BUFFER_POOL_CLASS_COUNT; class++)
+    {
+        void *data;
+
+        while((data = pop_free(pool, class)) != NULL)
+        {
+            dc_free(env, data);
+        }
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+}
+
+void buffer_cache_init(const struct dc_env *env, struct buffer_cache *cache, struct buffer_pool *pool)
+{
+    DC_TRACE(env);
+    dc_memset(env, cache, 0, sizeof(*cache));
+    cache->pool = pool;
+    cache->env = env;
+    pthread_mutex_lock(&pool->lock);
+    cache->next = pool->caches;
+    pool->caches = cache;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void buffer_cache_destroy(struct buffer_cache *cache)
+{
+    struct buffer_pool *pool;
+    struct buffer_cache **link;
+
+    DC_TRACE(cache->env);
+    pool = cache->pool;
+
+    for(size_t class = 0; class < BUFFER_POOL_CLASS_COUNT; class++)
+    {
+        while(cache->counts[class] > 0)
+        {
+            spill(cache, class);
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    link = &pool->caches;
+
+    while(*link != cache)
+    {
+        link = &(*link)->next;
+    }
+
+    *link = cache->next;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+char *buffer_alloc(struct dc_error *err, struct buffer_cache *cache, size_t size, size_t *capacity)
+{
+    size_t class;
+    char *data;
+
+    class = class_of(size);
+
+    if(class == BUFFER_POOL_CLASS_COUNT)
+    {
+        *capacity = size;
+        increase(&cache->misses, 1);
+        data = dc_malloc(cache->env, err, size);
+    }
+    else
+    {
+        *capacity = (size_t)1 << (BUFFER_POOL_MIN_SHIFT + class);
+
+        if(cache->counts[class] == 0)
+        {
+            increase(&cache->misses, 1);
+            refill(cache, class);
+        }
+        else
+        {
+            increase(&cache->hits, 1);
+        }
+
+        if(cache->counts[class] == 0)
+        {
+            data = dc_malloc(cache->env, err, *capacity);
+        }
+        else
+        {
+            data = cache->buffers[class][--cache->counts[class]];
+            decrease(&cache->cached_bytes, *capacity);
+        }
+    }
+
+    if(data != NULL)
+    {
+        increase(&cache->in_use_bytes, *capacity);
+        increase(&cache->in_use_buffers, 1);
+    }
+
+    return data;
+}
+
+void buffer_free(struct buffer_cache *cache, char *data, size_t size)
+{
+    size_t class;
+    size_t capacity;
+
+    class = class_of(size);
+    capacity = class == BUFFER_POOL_CLASS_COUNT ? size : (size_t)1 << (BUFFER_POOL_MIN_SHIFT + class);
+    decrease(&cache->in_use_bytes, capacity);
+    decrease(&cache->in_use_buffers, 1);
+
+    if(class == BUFFER_POOL_CLASS_COUNT)
+    {
+        dc_free(cache->env, data);
+        return;
+    }
+
+    if(cache->counts[class] == BUFFER_CACHE_DEPTH)
+    {
+        spill(cache, class);
+    }
+
+    cache->buffers[class][cache->counts[class]++] = data;
+    increase(&cache->cached_bytes, capacity);
+}
+
+void buffer_pool_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&pool->lock);
+
+    for(size_t class = 0; class < BUFFER_POOL_CLASS_COUNT; class++)
+    {
+        stats->free_bytes += (uint64_t)pool->free_count[class] << (BUFFER_POOL_MIN_SHIFT + class);
+    }
+
+    for(const struct buffer_cache *cache = pool->caches; cache != NULL; cache = cache->next)
+    {
+        stats->in_use_bytes += atomic_load_explicit(&cache->in_use_bytes, memory_order_relaxed);
+        stats->in_use_buffers += atomic_load_explicit(&cache->in_use_buffers, memory_order_relaxed);
+        stats->free_bytes += atomic_load_explicit(&cache->cached_bytes, memory_order_relaxed);
+        stats->hits += atomic_load_explicit(&cache->hits, memory_order_relaxed);
+        stats->misses += atomic_load_explicit(&cache->misses, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * the second field of statm is the resident page count
+ * */
+uint64_t buffer_pool_rss(void)
+{
+    FILE *statm;
+    uint64_t size;
+    uint64_t resident;
+    long page_size;
+    int fields;
+
+    statm = fopen("/proc/self/statm", "r");
+
+    if(statm == NULL)
+    {
+        return 0;
+    }
+
+    fields = fscanf(statm, "%" SCNu64 " %" SCNu64, &size, &resident);     // NOLINT(cert-err34-c)
+    fclose(statm);      // NOLINT(cert-err33-c)
+    page_size = sysconf(_SC_PAGESIZE);
+
+    return fields == 2 && page_size > 0 ? resident * (uint64_t)page_size : 0;
+}
+
+/**
+ * the smallest class that holds size, BUFFER_POOL_CLASS_COUNT when no class does
+ * */
+static size_t class_of(size_t size)
+{
+    size_t class;
+
+    if(size <= ((size_t)1 << BUFFER_POOL_MIN_SHIFT))
+    {
+        return 0;
+    }
+
+    if(size > BUFFER_POOL_MAX_SIZE)
+    {
+        return BUFFER_POOL_CLASS_COUNT;
+    }
+
+    class = (size_t)(64 - __builtin_clzll((unsigned long long)size - 1)) - BUFFER_POOL_MIN_SHIFT;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return class;
+}
+
+static void refill(struct buffer_cache *cache, size_t class)
+{
+    struct buffer_pool *pool;
+    size_t taken;
+
+    pool = cache->pool;
+    taken = 0;
+    pthread_mutex_lock(&pool->lock);
+
+    while(cache->counts[class] < BUFFER_CACHE_DEPTH / 2)
+    {
+        void *data;
+
+        data = pop_free(pool, class);
+
+        if(data == NULL)
+        {
+            break;
+        }
+
+        cache->buffers[class][cache->counts[class]++] = data;
+        taken++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    increase(&cache->cached_bytes, (uint64_t)taken << (BUFFER_POOL_MIN_SHIFT + class));
+}
+
+/**
+ * half the cache goes back to the pool, whatever the pool has no room for is freed
+ * */
+static void spill(struct buffer_cache *cache, size_t class)
+{
+    struct buffer_pool *pool;
+    size_t capacity;
+    size_t keep;
+
+    pool = cache->pool;
+    capacity = (size_t)1 << (BUFFER_POOL_MIN_SHIFT + class);
+    keep = cache->counts[class] / 2;
+    decrease(&cache->cached_bytes, (uint64_t)(cache->counts[class] - keep) * capacity);
+    pthread_mutex_lock(&pool->lock);
+
+    while(cache->counts[class] > keep)
+    {
+        char *data;
+
+        data = cache->buffers[class][--cache->counts[class]];
+
+        if((pool->free_count[class] + 1) * capacity > BUFFER_POOL_MAX_FREE_BYTES)
+        {
+            dc_free(cache->env, data);
+            continue;
+        }
+
+        dc_memcpy(cache->env, data, &pool->free[class], sizeof(void *));
+        pool->free[class] = data;
+        pool->free_count[class]++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * the caller holds the lock, or is the only thread left
+ * */
+static void *pop_free(struct buffer_pool *pool, size_t class)
+{
+    void *data;
+
+    data = pool->free[class];
+
+    if(data != NULL)
+    {
+        memcpy(&pool->free[class], data, sizeof(void *));
+        pool->free_count[class]--;
+    }
+
+    return data;
+}
+
+/**
+ * single writer, like the metrics counters
+ * */
+static void increase(atomic_uint_fast64_t *value, uint64_t amount)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static void decrease(atomic_uint_fast64_t *value, uint64_t amount)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) - amount, memory_order_relaxed);
+}
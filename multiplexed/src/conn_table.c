@@ -0,0 +1,290 @@
+#include "conn_table.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include "trace.h"
+
+
+#define NO_SLOT SIZE_MAX
+
+
+static bool add_slab(const struct dc_env *env, struct dc_error *err, struct conn_table *table);
+static bool grow_fd_index(const struct dc_env *env, struct dc_error *err, struct conn_table *table, size_t fd);
+
+
+size_t conn_table_fd_limit(void)
+{
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        return FD_SETSIZE;
+    }
+
+    if(limit.rlim_cur < limit.rlim_max)
+    {
+        struct rlimit raised;
+
+        raised.rlim_cur = limit.rlim_max;
+        raised.rlim_max = limit.rlim_max;
+
+        if(setrlimit(RLIMIT_NOFILE, &raised) == 0)
+        {
+            limit = raised;
+        }
+    }
+
+    if(limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > SIZE_MAX / 2)
+    {
+        return SIZE_MAX / 2;
+    }
+
+    return (size_t)limit.rlim_cur;
+}
+
+void conn_table_init(const struct dc_env *env, struct dc_error *err, struct conn_table *table, size_t initial_capacity, struct buffer_cache *buffers)
+{
+    DC_TRACE(env);
+    dc_memset(env, table, 0, sizeof(*table));
+    table->buffers = buffers;
+    table->free_head = NO_SLOT;
+    table->max_connections = conn_table_fd_limit();
+    zerocopy_lingering_init(&table->lingering);
+
+    if(initial_capacity > table->max_connections)
+    {
+        initial_capacity = table->max_connections;
+    }
+
+    if(initial_capacity == 0)
+    {
+        initial_capacity = 1;
+    }
+
+    while(table->num_slabs * CONN_TABLE_SLAB_SIZE < initial_capacity)
+    {
+        if(!(add_slab(env, err, table)))
+        {
+            return;
+        }
+    }
+
+    grow_fd_index(env, err, table, initial_capacity);
+}
+
+void conn_table_destroy(const struct dc_env *env, struct conn_table *table)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < table->num_slots; i++)
+    {
+        struct connection *connection;
+
+        connection = conn_table_at(table, i);
+
+        if(connection->in_use)
+        {
+            out_buffer_destroy(env, &connection->out);
+
+            if(connection->stash != NULL)
+            {
+                buffer_free(table->buffers, connection->stash, connection->stash_len);
+            }
+
+            zerocopy_discard(&connection->zerocopy, table->buffers);
+        }
+    }
+
+    zerocopy_lingering_destroy(&table->lingering, table->buffers);
+
+    for(size_t i = 0; i < table->num_slabs; i++)
+    {
+        dc_free(env, table->slabs[i]);
+    }
+
+    if(table->slabs != NULL)
+    {
+        dc_free(env, table->slabs);
+    }
+
+    if(table->fd_to_slot != NULL)
+    {
+        dc_free(env, table->fd_to_slot);
+    }
+
+    dc_memset(env, table, 0, sizeof(*table));
+}
+
+struct connection *conn_table_insert(const struct dc_env *env, struct dc_error *err, struct conn_table *table, int fd)
+{
+    size_t slot;
+    struct connection *connection;
+
+    DC_TRACE(env);
+
+    if(fd < 0 || table->count >= table->max_connections)
+    {
+        return NULL;
+    }
+
+    if((size_t)fd >= table->fd_capacity && !(grow_fd_index(env, err, table, (size_t)fd)))
+    {
+        return NULL;
+    }
+
+    if(table->free_head != NO_SLOT)
+    {
+        slot = table->free_head;
+        table->free_head = conn_table_at(table, slot)->next_free;
+    }
+    else
+    {
+        if(table->num_slots == table->num_slabs * CONN_TABLE_SLAB_SIZE && !(add_slab(env, err, table)))
+        {
+            return NULL;
+        }
+
+        slot = table->num_slots;
+        table->num_slots++;
+    }
+
+    connection = conn_table_at(table, slot);
+    dc_memset(env, connection, 0, sizeof(*connection));
+    connection->fd = fd;
+    connection->in_use = true;
+    connection->slot = slot;
+    connection->out.cache = table->buffers;
+    connection->next_free = NO_SLOT;
+    table->fd_to_slot[fd] = slot;
+    table->count++;
+
+    return connection;
+}
+
+struct connection *conn_table_lookup(const struct conn_table *table, int fd)
+{
+    size_t slot;
+
+    if(fd < 0 || (size_t)fd >= table->fd_capacity)
+    {
+        return NULL;
+    }
+
+    slot = table->fd_to_slot[fd];
+
+    if(slot == NO_SLOT)
+    {
+        return NULL;
+    }
+
+    return conn_table_at(table, slot);
+}
+
+void conn_table_remove(const struct dc_env *env, struct conn_table *table, struct connection *connection)
+{
+    out_buffer_destroy(env, &connection->out);
+
+    if(connection->stash != NULL)
+    {
+        buffer_free(table->buffers, connection->stash, connection->stash_len);
+        connection->stash = NULL;
+    }
+
+    zerocopy_release(&connection->zerocopy, &table->lingering, table->buffers, connection->fd);
+
+    table->fd_to_slot[connection->fd] = NO_SLOT;
+    connection->fd = -1;
+    connection->in_use = false;
+    connection->next_free = table->free_head;
+    table->free_head = connection->slot;
+    table->count--;
+}
+
+bool conn_table_full(const struct conn_table *table)
+{
+    return table->count >= table->max_connections;
+}
+
+size_t conn_table_slot(const struct conn_table *table, const struct connection *connection)
+{
+    (void)table;
+
+    return connection->slot;
+}
+
+/**
+ * the slab pointers double when they run out, the slabs themselves never move
+ * */
+static bool add_slab(const struct dc_env *env, struct dc_error *err, struct conn_table *table)
+{
+    struct connection *slab;
+
+    if(table->num_slabs * CONN_TABLE_SLAB_SIZE >= table->max_connections)
+    {
+        return false;
+    }
+
+    if(table->num_slabs == table->slab_capacity)
+    {
+        size_t capacity;
+        struct connection **slabs;
+
+        capacity = table->slab_capacity == 0 ? 1 : table->slab_capacity * 2;
+        slabs = dc_realloc(env, err, table->slabs, capacity * sizeof(struct connection *));
+
+        if(slabs == NULL)
+        {
+            return false;
+        }
+
+        table->slabs = slabs;
+        table->slab_capacity = capacity;
+    }
+
+    slab = dc_malloc(env, err, CONN_TABLE_SLAB_SIZE * sizeof(struct connection));
+
+    if(slab == NULL)
+    {
+        return false;
+    }
+
+    table->slabs[table->num_slabs] = slab;
+    table->num_slabs++;
+
+    return true;
+}
+
+/**
+ * sized so fd fits, new entries are marked as not in use
+ * */
+static bool grow_fd_index(const struct dc_env *env, struct dc_error *err, struct conn_table *table, size_t fd)
+{
+    size_t capacity;
+    size_t *fd_to_slot;
+
+    capacity = table->fd_capacity == 0 ? 1 : table->fd_capacity;
+
+    while(capacity <= fd)
+    {
+        capacity *= 2;
+    }
+
+    fd_to_slot = dc_realloc(env, err, table->fd_to_slot, capacity * sizeof(size_t));
+
+    if(fd_to_slot == NULL)
+    {
+        return false;
+    }
+
+    for(size_t i = table->fd_capacity; i < capacity; i++)
+    {
+        fd_to_slot[i] = NO_SLOT;
+    }
+
+    table->fd_to_slot = fd_to_slot;
+    table->fd_capacity = capacity;
+
+    return true;
+}
@@ -0,0 +1,764 @@
+#include "count_pool.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "trace.h"
+#include "word_count.h"
+
+
+static void *worker_main(void *arg);
+static void run_fifo(struct count_worker *worker);
+static void run_stealing(struct count_worker *worker);
+static struct count_chunk *take_job(struct count_worker *worker);
+static struct count_chunk *steal_chunk(struct count_worker *worker);
+static bool wait_for_work(struct count_worker *worker);
+static bool deques_pending(const struct count_pool *pool);
+static void run_chunk(struct count_worker *worker, struct count_chunk *chunk);
+static void count_chunk(struct count_job *job, size_t chunk, size_t chunk_size);
+static uint64_t merge_chunks(const struct count_job *job);
+static void complete(struct count_job *job);
+static void bump(atomic_uint_fast64_t *value);
+
+
+void count_pool_init(const struct dc_env *env, struct dc_error *err, struct count_pool *pool, int num_threads, size_t chunk_size, enum count_schedule schedule)
+{
+    uintptr_t aligned;
+
+    DC_TRACE(env);
+    dc_memset(env, pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->ready, NULL);
+    pool->chunk_size = chunk_size;
+    pool->schedule = schedule;
+
+    // one spare worker so the first one can be moved up to a cache line boundary, the deques rely on it
+    pool->storage = dc_calloc(env, err, (size_t)num_threads + 1, sizeof(struct count_worker));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    aligned = ((uintptr_t)pool->storage + COUNT_POOL_CACHE_LINE_SIZE - 1) & ~(uintptr_t)(COUNT_POOL_CACHE_LINE_SIZE - 1);
+    pool->workers = (struct count_worker *)aligned;     // NOLINT(performance-no-int-to-ptr)
+
+    // workers take the lock before they look at num_threads, so they only start once all of them have been created
+    pthread_mutex_lock(&pool->lock);
+
+    for(int i = 0; i < num_threads; i++)
+    {
+        struct count_worker *worker;
+        int ret;
+
+        worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->random = (uint64_t)i * 0x9E3779B97F4A7C15ULL + 1;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        ret = pthread_create(&worker->thread, NULL, worker_main, worker);
+
+        if(ret != 0)
+        {
+            DC_ERROR_RAISE_ERRNO(err, ret);
+            break;
+        }
+
+        pool->num_threads++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void count_pool_destroy(const struct dc_env *env, struct count_pool *pool)
+{
+    DC_TRACE(env);
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    // a job still queued has chunks nobody claimed, every claimed chunk was finished before its worker stopped
+    while(pool->head != NULL)
+    {
+        struct count_job *job;
+
+        job = pool->head;
+        pool->head = job->next;
+        count_job_destroy(env, job);
+    }
+
+    if(pool->storage != NULL)
+    {
+        dc_free(env, pool->storage);
+    }
+
+    pthread_cond_destroy(&pool->ready);
+    pthread_mutex_destroy(&pool->lock);
+    pool->storage = NULL;
+    pool->workers = NULL;
+    pool->num_threads = 0;
+}
+
+struct count_job *count_job_create(const struct dc_env *env, struct dc_error *err, const struct count_pool *pool, struct count_completions *completions, size_t len)
+{
+    struct count_job *job;
+    size_t num_chunks;
+
+    DC_TRACE(env);
+    num_chunks = len == 0 ? 1 : (len + pool->chunk_size - 1) / pool->chunk_size;
+    job = dc_malloc(env, err, sizeof(struct count_job) + num_chunks * sizeof(struct count_chunk));
+
+    if(dc_error_has_error(err))
+    {
+        return NULL;
+    }
+
+    job->data = len == 0 ? NULL : dc_malloc(env, err, len);
+
+    if(dc_error_has_error(err))
+    {
+        dc_free(env, job);
+        return NULL;
+    }
+
+    job->next = NULL;
+    job->completions = completions;
+    job->len = len;
+    job->filled = 0;
+    job->slot = 0;
+    job->id = 0;
+    job->words = 0;
+    job->submitted_ns = 0;
+    job->num_chunks = num_chunks;
+    job->next_chunk = 0;
+    atomic_init(&job->chunks_done, 0);
+    atomic_init(&job->cancelled, false);
+
+    for(size_t i = 0; i < num_chunks; i++)
+    {
+        job->chunks[i].job = job;
+    }
+
+    return job;
+}
+
+void count_job_destroy(const struct dc_env *env, struct count_job *job)
+{
+    if(job->data != NULL)
+    {
+        dc_free(env, job->data);
+    }
+
+    dc_free(env, job);
+}
+
+/**
+ * with the fifo a job of several chunks wakes every idle worker, one of a single chunk only needs one,
+ * when stealing one worker takes the job and wakes the others itself once it has split it
+ * */
+void count_pool_submit(struct count_pool *pool, struct count_job *job)
+{
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+
+    if(pool->tail == NULL)
+    {
+        pool->head = job;
+    }
+    else
+    {
+        pool->tail->next = job;
+    }
+
+    pool->tail = job;
+    pool->queued_chunks += job->num_chunks;
+
+    if(job->num_chunks > 1 && pool->schedule == COUNT_SCHEDULE_FIFO)
+    {
+        pthread_cond_broadcast(&pool->ready);
+    }
+    else
+    {
+        pthread_cond_signal(&pool->ready);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void count_pool_stats(struct count_pool *pool, struct count_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    stats->queued_chunks = pool->queued_chunks;
+    pthread_mutex_unlock(&pool->lock);
+    stats->chunks = 0;
+    stats->steals = 0;
+    stats->steal_misses = 0;
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        const struct count_worker *worker;
+
+        worker = &pool->workers[i];
+        stats->queued_chunks += (uint64_t)count_deque_size(&worker->deque);
+        stats->chunks += atomic_load_explicit(&worker->chunks, memory_order_relaxed);
+        stats->steals += atomic_load_explicit(&worker->steals, memory_order_relaxed);
+        stats->steal_misses += atomic_load_explicit(&worker->steal_misses, memory_order_relaxed);
+    }
+}
+
+bool count_pool_parse_schedule(const char *text, enum count_schedule *schedule)
+{
+    if(strcmp(text, "fifo") == 0)
+    {
+        *schedule = COUNT_SCHEDULE_FIFO;
+    }
+    else if(strcmp(text, "steal") == 0)
+    {
+        *schedule = COUNT_SCHEDULE_STEAL;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool count_pool_parse_threshold(const char *text, size_t *bytes)
+{
+    char *end;
+    unsigned long value;
+
+    if(*text < '0' || *text > '9')
+    {
+        return false;
+    }
+
+    errno = 0;
+    value = strtoul(text, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(*end != '\0' || errno == ERANGE || value == 0)
+    {
+        return false;
+    }
+
+    *bytes = value;
+
+    return true;
+}
+
+void count_completions_init(const struct dc_env *env, struct dc_error *err, struct count_completions *completions)
+{
+    DC_TRACE(env);
+    pthread_mutex_init(&completions->lock, NULL);
+    completions->head = NULL;
+    completions->tail = NULL;
+    completions->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);  // NOLINT(hicpp-signed-bitwise)
+
+    if(completions->wake_fd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+void count_completions_destroy(const struct dc_env *env, struct dc_error *err, struct count_completions *completions)
+{
+    DC_TRACE(env);
+
+    while(completions->head != NULL)
+    {
+        struct count_job *job;
+
+        job = completions->head;
+        completions->head = job->next;
+        count_job_destroy(env, job);
+    }
+
+    if(completions->wake_fd != -1)
+    {
+        dc_close(env, err, completions->wake_fd);
+        completions->wake_fd = -1;
+    }
+
+    pthread_mutex_destroy(&completions->lock);
+}
+
+struct count_job *count_completions_take(struct dc_error *err, struct count_completions *completions)
+{
+    uint64_t value;
+    struct count_job *jobs;
+
+    if(read(completions->wake_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    pthread_mutex_lock(&completions->lock);
+    jobs = completions->head;
+    completions->head = NULL;
+    completions->tail = NULL;
+    pthread_mutex_unlock(&completions->lock);
+
+    return jobs;
+}
+
+/**
+ * only the owner pushes, so bottom is its own to read, the release on bottom publishes the chunk to thieves
+ * */
+bool count_deque_push(struct count_deque *deque, struct count_chunk *chunk)
+{
+    long bottom;
+    long top;
+
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if(bottom - top >= COUNT_DEQUE_SIZE)
+    {
+        return false;
+    }
+
+    atomic_store_explicit(&deque->tasks[bottom & (COUNT_DEQUE_SIZE - 1)], chunk, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+
+    return true;
+}
+
+/**
+ * bottom is lowered before top is read, both sequentially consistent, so a thief either sees the lower bottom
+ * or the owner sees the thief's top, and only when one chunk is left do they race for it with a CAS on top
+ * */
+struct count_chunk *count_deque_take(struct count_deque *deque)
+{
+    struct count_chunk *chunk;
+    long bottom;
+    long top;
+
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+
+    if(top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    chunk = atomic_load_explicit(&deque->tasks[bottom & (COUNT_DEQUE_SIZE - 1)], memory_order_relaxed);
+
+    if(top == bottom)
+    {
+        if(!(atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)))
+        {
+            chunk = NULL;
+        }
+
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return chunk;
+}
+
+/**
+ * the slot is read before top is claimed, if the CAS fails someone else got that chunk and the value read is dropped
+ * */
+struct count_chunk *count_deque_steal(struct count_deque *deque)
+{
+    struct count_chunk *chunk;
+    long top;
+    long bottom;
+
+    top = atomic_load_explicit(&deque->top, memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_seq_cst);
+
+    if(top >= bottom)
+    {
+        return NULL;
+    }
+
+    chunk = atomic_load_explicit(&deque->tasks[top & (COUNT_DEQUE_SIZE - 1)], memory_order_relaxed);
+
+    if(!(atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)))
+    {
+        return NULL;
+    }
+
+    return chunk;
+}
+
+/**
+ * a racing steal or pop can leave top briefly past bottom, which reads as empty
+ * */
+size_t count_deque_size(const struct count_deque *deque)
+{
+    long bottom;
+    long top;
+
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    return bottom > top ? (size_t)((unsigned long)bottom - (unsigned long)top) : 0;
+}
+
+static void *worker_main(void *arg)
+{
+    struct count_worker *worker;
+
+    worker = arg;
+    pthread_mutex_lock(&worker->pool->lock);
+    pthread_mutex_unlock(&worker->pool->lock);
+
+    if(worker->pool->schedule == COUNT_SCHEDULE_STEAL)
+    {
+        run_stealing(worker);
+    }
+    else
+    {
+        run_fifo(worker);
+    }
+
+    return NULL;
+}
+
+/**
+ * a job leaves the queue as soon as its last chunk is claimed, the worker that finishes the last chunk merges and completes it
+ * */
+static void run_fifo(struct count_worker *worker)
+{
+    struct count_pool *pool;
+
+    pool = worker->pool;
+    pthread_mutex_lock(&pool->lock);
+
+    while(true)
+    {
+        struct count_job *job;
+        size_t chunk;
+
+        while(pool->head == NULL && !(pool->stopping))
+        {
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        }
+
+        if(pool->stopping)
+        {
+            break;
+        }
+
+        job = pool->head;
+        chunk = job->next_chunk++;
+        pool->queued_chunks--;
+
+        if(job->next_chunk == job->num_chunks)
+        {
+            pool->head = job->next;
+
+            if(pool->head == NULL)
+            {
+                pool->tail = NULL;
+            }
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        run_chunk(worker, &job->chunks[chunk]);
+        pthread_mutex_lock(&pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * own deque first, then the shared queue, then the other deques, and only then sleep
+ * once stopping no new job is started but whatever is already on a deque is finished, so no job is left half counted
+ * */
+static void run_stealing(struct count_worker *worker)
+{
+    do
+    {
+        struct count_chunk *chunk;
+
+        chunk = count_deque_take(&worker->deque);
+
+        if(chunk == NULL)
+        {
+            chunk = take_job(worker);
+        }
+
+        if(chunk == NULL)
+        {
+            chunk = steal_chunk(worker);
+        }
+
+        while(chunk != NULL)
+        {
+            run_chunk(worker, chunk);
+            chunk = count_deque_take(&worker->deque);
+        }
+    }
+    while(wait_for_work(worker));
+}
+
+/**
+ * every chunk but the first goes onto the worker's deque for the others to steal, the first is returned to be counted straight away
+ * a deque that is full leaves the rest of the job to this worker
+ * */
+static struct count_chunk *take_job(struct count_worker *worker)
+{
+    struct count_pool *pool;
+    struct count_job *job;
+    bool pushed;
+
+    pool = worker->pool;
+    pthread_mutex_lock(&pool->lock);
+    job = pool->stopping ? NULL : pool->head;
+
+    if(job != NULL)
+    {
+        pool->head = job->next;
+        pool->queued_chunks -= job->num_chunks;
+
+        if(pool->head == NULL)
+        {
+            pool->tail = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if(job == NULL)
+    {
+        return NULL;
+    }
+
+    pushed = false;
+
+    for(size_t i = job->num_chunks - 1; i > 0; i--)
+    {
+        if(!(count_deque_push(&worker->deque, &job->chunks[i])))
+        {
+            run_chunk(worker, &job->chunks[i]);
+            continue;
+        }
+
+        pushed = true;
+    }
+
+    if(pushed)
+    {
+        pthread_mutex_lock(&pool->lock);
+
+        if(pool->sleeping > 0)
+        {
+            pthread_cond_broadcast(&pool->ready);
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return &job->chunks[0];
+}
+
+/**
+ * the victims are visited once each from a random starting point, so thieves do not all pile onto worker 0
+ * */
+static struct count_chunk *steal_chunk(struct count_worker *worker)
+{
+    struct count_pool *pool;
+    int start;
+
+    pool = worker->pool;
+
+    if(pool->num_threads < 2)
+    {
+        return NULL;
+    }
+
+    worker->random ^= worker->random << 13U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    worker->random ^= worker->random >> 7U;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    worker->random ^= worker->random << 17U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    start = (int)(worker->random % (uint64_t)pool->num_threads);
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        struct count_worker *victim;
+        struct count_chunk *chunk;
+
+        victim = &pool->workers[(start + i) % pool->num_threads];
+
+        if(victim == worker || count_deque_size(&victim->deque) == 0)
+        {
+            continue;
+        }
+
+        chunk = count_deque_steal(&victim->deque);
+
+        if(chunk != NULL)
+        {
+            bump(&worker->steals);
+            return chunk;
+        }
+
+        bump(&worker->steal_misses);
+    }
+
+    return NULL;
+}
+
+/**
+ * sleeping is raised before the deques are looked at under the lock, a worker that pushes chunks takes the lock
+ * after its pushes and broadcasts if anyone is asleep, so either the pushes are seen here or the broadcast is
+ * returns false once stopping and there is nothing left on any deque
+ * */
+static bool wait_for_work(struct count_worker *worker)
+{
+    struct count_pool *pool;
+    bool working;
+
+    pool = worker->pool;
+    pthread_mutex_lock(&pool->lock);
+    pool->sleeping++;
+
+    while(true)
+    {
+        if(deques_pending(pool) || (pool->head != NULL && !(pool->stopping)))
+        {
+            working = true;
+            break;
+        }
+
+        if(pool->stopping)
+        {
+            working = false;
+            break;
+        }
+
+        pthread_cond_wait(&pool->ready, &pool->lock);
+    }
+
+    pool->sleeping--;
+    pthread_mutex_unlock(&pool->lock);
+
+    return working;
+}
+
+static bool deques_pending(const struct count_pool *pool)
+{
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        if(count_deque_size(&pool->workers[i].deque) > 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * nothing of the job is read after the last chunk is done, by then another worker may have completed it and the reactor freed it
+ * */
+static void run_chunk(struct count_worker *worker, struct count_chunk *chunk)
+{
+    struct count_job *job;
+    size_t num_chunks;
+
+    job = chunk->job;
+    num_chunks = job->num_chunks;
+
+    if(!(atomic_load_explicit(&job->cancelled, memory_order_relaxed)))
+    {
+        count_chunk(job, (size_t)(chunk - job->chunks), worker->pool->chunk_size);
+    }
+
+    bump(&worker->chunks);
+
+    if(atomic_fetch_add_explicit(&job->chunks_done, 1, memory_order_acq_rel) + 1 == num_chunks)
+    {
+        job->words = atomic_load_explicit(&job->cancelled, memory_order_relaxed) ? 0 : merge_chunks(job);
+        complete(job);
+    }
+}
+
+static void count_chunk(struct count_job *job, size_t chunk, size_t chunk_size)
+{
+    struct count_chunk *result;
+    size_t offset;
+    size_t len;
+    bool in_word;
+
+    result = &job->chunks[chunk];
+    offset = chunk * chunk_size;
+    len = job->len - offset < chunk_size ? job->len - offset : chunk_size;
+    in_word = false;
+    result->words = len == 0 ? 0 : word_count_run(word_count_kernel_active(), &job->data[offset], len, &in_word);
+    result->starts_word = len != 0 && !(word_count_is_space(job->data[offset]));
+    result->ends_in_word = in_word;
+}
+
+/**
+ * every chunk counted its first word as a new one, that word is the tail of the previous chunk's last word
+ * whenever the previous chunk ended inside a word and this one starts with a non-space byte
+ * */
+static uint64_t merge_chunks(const struct count_job *job)
+{
+    uint64_t words;
+
+    words = 0;
+
+    for(size_t i = 0; i < job->num_chunks; i++)
+    {
+        words += job->chunks[i].words;
+
+        if(i > 0 && job->chunks[i - 1].ends_in_word && job->chunks[i].starts_word)
+        {
+            words--;
+        }
+    }
+
+    return words;
+}
+
+static void complete(struct count_job *job)
+{
+    struct count_completions *completions;
+    uint64_t value;
+
+    completions = job->completions;
+    job->next = NULL;
+    pthread_mutex_lock(&completions->lock);
+
+    if(completions->tail == NULL)
+    {
+        completions->head = job;
+    }
+    else
+    {
+        completions->tail->next = job;
+    }
+
+    completions->tail = job;
+    pthread_mutex_unlock(&completions->lock);
+    value = 1;
+
+    // if the write fails the job still waits on the list, the reactor finds it on its next wakeup
+    if(write(completions->wake_fd, &value, sizeof(value)) == -1)
+    {
+        return;
+    }
+}
+
+/**
+ * single writer, like the metrics counters
+ * */
+static void bump(atomic_uint_fast64_t *value)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + 1, memory_order_relaxed);
+}
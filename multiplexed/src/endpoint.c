@@ -0,0 +1,246 @@
+#include "endpoint.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+#define TCP_PREFIX "tcp:"
+#define UNIX_PREFIX "unix:"
+#define ADDRESS_SIZE 64
+
+
+static bool parse_unix(const char *text, struct endpoint *endpoint);
+static bool parse_tcp(const char *address, const char *port, uint16_t default_port, struct endpoint *endpoint);
+static bool parse_port(const char *text, uint16_t *port);
+
+
+bool endpoint_parse(const char *text, uint16_t default_port, struct endpoint *endpoint)
+{
+    const char *colon;
+    char address[ADDRESS_SIZE];
+
+    memset(endpoint, 0, sizeof(*endpoint));
+    errno = EINVAL;
+
+    if(strlen(text) >= sizeof(endpoint->name))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    strcpy(endpoint->name, text);   // NOLINT(clang-analyzer-security.insecureAPI.strcpy)
+
+    if(strncmp(text, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0)
+    {
+        return parse_unix(text + strlen(UNIX_PREFIX), endpoint);
+    }
+
+    if(strncmp(text, TCP_PREFIX, strlen(TCP_PREFIX)) == 0)
+    {
+        text += strlen(TCP_PREFIX);
+        colon = strrchr(text, ':');
+
+        // tcp:PORT has no address, unlike the bare form where a lone token is the address
+        if(colon == NULL)
+        {
+            return parse_tcp(NULL, text, default_port, endpoint);
+        }
+    }
+    else
+    {
+        colon = strrchr(text, ':');
+    }
+
+    if(colon == NULL)
+    {
+        return parse_tcp(text, NULL, default_port, endpoint);
+    }
+
+    if((size_t)(colon - text) >= sizeof(address))
+    {
+        return false;
+    }
+
+    memcpy(address, text, (size_t)(colon - text));
+    address[colon - text] = '\0';
+
+    return parse_tcp(address, colon + 1, default_port, endpoint);
+}
+
+bool endpoint_is_unix(const struct endpoint *endpoint)
+{
+    return endpoint->addr.ss_family == AF_UNIX;
+}
+
+const char *endpoint_path(const struct endpoint *endpoint)
+{
+    const struct sockaddr_un *addr;
+
+    if(!(endpoint_is_unix(endpoint)))
+    {
+        return NULL;
+    }
+
+    addr = (const struct sockaddr_un *)&endpoint->addr;
+
+    return addr->sun_path[0] == '\0' ? NULL : addr->sun_path;
+}
+
+int endpoint_connect(const struct endpoint *endpoint)
+{
+    int fd;
+
+    fd = socket(endpoint->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);   // NOLINT(hicpp-signed-bitwise)
+
+    if(fd == -1)
+    {
+        return -1;
+    }
+
+    if(connect(fd, (const struct sockaddr *)&endpoint->addr, endpoint->addr_len) == -1)
+    {
+        int saved_errno;
+
+        saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * an abstract name is not terminated, its length is whatever of addr_len is left after the leading zero byte
+ * */
+void endpoint_peer_name(const struct sockaddr_storage *addr, socklen_t addr_len, char *name, size_t size)
+{
+    if(addr->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *in;
+        char address[INET_ADDRSTRLEN];
+
+        in = (const struct sockaddr_in *)addr;
+        inet_ntop(AF_INET, &in->sin_addr, address, sizeof(address));
+        snprintf(name, size, "%s:%d", address, ntohs(in->sin_port));     // NOLINT(cert-err33-c)
+    }
+    else if(addr->ss_family == AF_UNIX && addr_len > offsetof(struct sockaddr_un, sun_path) + 1)
+    {
+        const struct sockaddr_un *un;
+        size_t length;
+
+        un = (const struct sockaddr_un *)addr;
+        length = addr_len - offsetof(struct sockaddr_un, sun_path);
+
+        // the kernel never hands back more than sun_path holds, a path is cut at its terminator if it has one
+        if(length > sizeof(un->sun_path))
+        {
+            length = sizeof(un->sun_path);
+        }
+
+        if(un->sun_path[0] == '\0')
+        {
+            snprintf(name, size, "unix:@%.*s", (int)(length - 1), un->sun_path + 1);     // NOLINT(cert-err33-c)
+        }
+        else
+        {
+            snprintf(name, size, "unix:%.*s", (int)length, un->sun_path);     // NOLINT(cert-err33-c)
+        }
+    }
+    else
+    {
+        // a unix client that never bound its socket has no name
+        snprintf(name, size, "%s", addr->ss_family == AF_UNIX ? "unix" : "unknown");     // NOLINT(cert-err33-c)
+    }
+}
+
+/**
+ * the abstract namespace is marked by a leading zero byte in sun_path, the name follows it without a terminator
+ * */
+static bool parse_unix(const char *text, struct endpoint *endpoint)
+{
+    struct sockaddr_un *addr;
+    size_t length;
+
+    addr = (struct sockaddr_un *)&endpoint->addr;
+    addr->sun_family = AF_UNIX;
+    length = strlen(text);
+
+    if(length == 0 || (text[0] == '@' && length == 1))
+    {
+        return false;
+    }
+
+    // a path needs room for its terminator, an abstract name has none but needs the leading zero byte instead
+    if((text[0] == '@' ? length - 1 : length) > ENDPOINT_PATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    if(text[0] == '@')
+    {
+        memcpy(addr->sun_path + 1, text + 1, length - 1);
+        endpoint->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + length);
+    }
+    else
+    {
+        memcpy(addr->sun_path, text, length + 1);
+        endpoint->addr_len = (socklen_t)sizeof(*addr);
+    }
+
+    return true;
+}
+
+static bool parse_tcp(const char *address, const char *port, uint16_t default_port, struct endpoint *endpoint)
+{
+    struct sockaddr_in *addr;
+
+    addr = (struct sockaddr_in *)&endpoint->addr;
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_ANY);
+    addr->sin_port = htons(default_port);
+    endpoint->addr_len = (socklen_t)sizeof(*addr);
+
+    if(address != NULL && address[0] != '\0' && inet_pton(AF_INET, address, &addr->sin_addr) != 1)
+    {
+        return false;
+    }
+
+    if(port != NULL)
+    {
+        uint16_t value;
+
+        if(!(parse_port(port, &value)))
+        {
+            return false;
+        }
+
+        addr->sin_port = htons(value);
+    }
+
+    return true;
+}
+
+static bool parse_port(const char *text, uint16_t *port)
+{
+    char *end;
+    unsigned long value;
+
+    value = strtoul(text, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(end == text || *end != '\0' || value == 0 || value > UINT16_MAX)
+    {
+        return false;
+    }
+
+    *port = (uint16_t)value;
+
+    return true;
+}
@@ -0,0 +1,360 @@
+#include "histogram.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define TICKS_PER_HALF_DISTANCE 5
+#define PERCENT ((double)100)
+#define MAX_REPORTED_PERCENTILE ((double)999999 / 10000)
+
+
+static int bucket_index(const struct histogram *histogram, uint64_t value);
+static uint64_t sub_bucket_index(const struct histogram *histogram, uint64_t value, int bucket);
+static size_t counts_index(const struct histogram *histogram, int bucket, uint64_t sub_bucket);
+static size_t counts_index_for(const struct histogram *histogram, uint64_t value);
+static uint64_t value_at_index(const struct histogram *histogram, size_t index);
+static uint64_t equivalent_range(const struct histogram *histogram, uint64_t value);
+static uint64_t lowest_equivalent(const struct histogram *histogram, uint64_t value);
+static uint64_t highest_equivalent(const struct histogram *histogram, uint64_t value);
+static uint64_t count_at_or_below(const struct histogram *histogram, uint64_t value);
+
+
+bool histogram_init(struct histogram *histogram, uint64_t highest_trackable, int significant_figures)
+{
+    uint64_t largest_single_unit;
+    uint64_t smallest_untrackable;
+    int sub_bucket_count_magnitude;
+
+    memset(histogram, 0, sizeof(*histogram));
+
+    if(significant_figures < 1 || significant_figures > 5 || highest_trackable < 2)    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    {
+        return false;
+    }
+
+    // enough sub-buckets that every value below 2 * 10^digits gets its own count
+    largest_single_unit = 2;
+
+    for(int i = 0; i < significant_figures; i++)
+    {
+        largest_single_unit *= 10;  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    sub_bucket_count_magnitude = 64 - __builtin_clzll(largest_single_unit - 1);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    histogram->highest_trackable = highest_trackable;
+    histogram->significant_figures = significant_figures;
+    histogram->unit_magnitude = 0;
+    histogram->sub_bucket_half_count_magnitude = sub_bucket_count_magnitude - 1;
+    histogram->sub_bucket_count = UINT64_C(1) << sub_bucket_count_magnitude;
+    histogram->sub_bucket_half_count = histogram->sub_bucket_count / 2;
+    histogram->sub_bucket_mask = (histogram->sub_bucket_count - 1) << histogram->unit_magnitude;
+    smallest_untrackable = histogram->sub_bucket_count << histogram->unit_magnitude;
+    histogram->bucket_count = 1;
+
+    while(smallest_untrackable <= highest_trackable)
+    {
+        if(smallest_untrackable > UINT64_MAX / 2)
+        {
+            histogram->bucket_count++;
+            break;
+        }
+
+        smallest_untrackable <<= 1U;
+        histogram->bucket_count++;
+    }
+
+    histogram->counts_len = (size_t)(histogram->bucket_count + 1) * (size_t)histogram->sub_bucket_half_count;
+    histogram->counts = calloc(histogram->counts_len, sizeof(uint64_t));
+    histogram->min = UINT64_MAX;
+
+    return histogram->counts != NULL;
+}
+
+void histogram_destroy(struct histogram *histogram)
+{
+    free(histogram->counts);
+    histogram->counts = NULL;
+}
+
+void histogram_reset(struct histogram *histogram)
+{
+    memset(histogram->counts, 0, histogram->counts_len * sizeof(uint64_t));
+    histogram->total_count = 0;
+    histogram->min = UINT64_MAX;
+    histogram->max = 0;
+}
+
+void histogram_record(struct histogram *histogram, uint64_t value)
+{
+    if(value > histogram->highest_trackable)
+    {
+        value = histogram->highest_trackable;
+    }
+
+    histogram->counts[counts_index_for(histogram, value)]++;
+    histogram->total_count++;
+
+    if(value < histogram->min)
+    {
+        histogram->min = value;
+    }
+
+    if(value > histogram->max)
+    {
+        histogram->max = value;
+    }
+}
+
+void histogram_add(struct histogram *into, const struct histogram *from)
+{
+    for(size_t i = 0; i < into->counts_len; i++)
+    {
+        into->counts[i] += from->counts[i];
+    }
+
+    into->total_count += from->total_count;
+
+    if(from->min < into->min)
+    {
+        into->min = from->min;
+    }
+
+    if(from->max > into->max)
+    {
+        into->max = from->max;
+    }
+}
+
+uint64_t histogram_value_at_percentile(const struct histogram *histogram, double percentile)
+{
+    uint64_t target;
+    uint64_t running;
+
+    if(histogram->total_count == 0)
+    {
+        return 0;
+    }
+
+    if(percentile > PERCENT)
+    {
+        percentile = PERCENT;
+    }
+
+    target = (uint64_t)round(percentile / PERCENT * (double)histogram->total_count);
+
+    if(target == 0)
+    {
+        target = 1;
+    }
+
+    running = 0;
+
+    for(size_t i = 0; i < histogram->counts_len; i++)
+    {
+        running += histogram->counts[i];
+
+        if(running >= target)
+        {
+            uint64_t value;
+
+            value = highest_equivalent(histogram, value_at_index(histogram, i));
+
+            // the top bucket is wider than the values that landed in it
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+double histogram_mean(const struct histogram *histogram)
+{
+    double total;
+
+    if(histogram->total_count == 0)
+    {
+        return 0;
+    }
+
+    total = 0;
+
+    for(size_t i = 0; i < histogram->counts_len; i++)
+    {
+        if(histogram->counts[i] != 0)
+        {
+            uint64_t value;
+
+            value = value_at_index(histogram, i);
+            total += (double)histogram->counts[i] * (double)(lowest_equivalent(histogram, value) + equivalent_range(histogram, value) / 2);
+        }
+    }
+
+    return total / (double)histogram->total_count;
+}
+
+double histogram_stddev(const struct histogram *histogram)
+{
+    double mean;
+    double total;
+
+    if(histogram->total_count == 0)
+    {
+        return 0;
+    }
+
+    mean = histogram_mean(histogram);
+    total = 0;
+
+    for(size_t i = 0; i < histogram->counts_len; i++)
+    {
+        if(histogram->counts[i] != 0)
+        {
+            uint64_t value;
+            double deviation;
+
+            value = value_at_index(histogram, i);
+            deviation = (double)(lowest_equivalent(histogram, value) + equivalent_range(histogram, value) / 2) - mean;
+            total += (double)histogram->counts[i] * deviation * deviation;
+        }
+    }
+
+    return sqrt(total / (double)histogram->total_count);
+}
+
+/**
+ * reporting steps get finer as the percentile closes in on 100, every halving of the distance to 100 gets the same
+ * number of lines, which is the same iteration HdrHistogram's outputPercentileDistribution uses
+ * */
+void histogram_write_percentiles(const struct histogram *histogram, FILE *stream, double unit_ratio)
+{
+    double percentile;
+
+    fprintf(stream, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");    // NOLINT(cert-err33-c)
+    percentile = 0;
+
+    while(histogram->total_count > 0)
+    {
+        uint64_t value;
+        uint64_t count;
+        double half_distance;
+
+        value = histogram_value_at_percentile(histogram, percentile);
+        count = count_at_or_below(histogram, value);
+
+        if(count >= histogram->total_count || percentile >= MAX_REPORTED_PERCENTILE)
+        {
+            fprintf(stream, "%12.3f %1.12f %10" PRIu64 "\n", (double)histogram->max / unit_ratio, (double)1, histogram->total_count);   // NOLINT(cert-err33-c)
+            break;
+        }
+
+        fprintf(stream, "%12.3f %1.12f %10" PRIu64 " %14.2f\n", (double)value / unit_ratio, percentile / PERCENT, count, 1 / (1 - percentile / PERCENT));  // NOLINT(cert-err33-c)
+        half_distance = exp2(floor(log2(PERCENT / (PERCENT - percentile))) + 1);
+        percentile += PERCENT / (TICKS_PER_HALF_DISTANCE * half_distance);
+    }
+
+    fprintf(stream, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", histogram_mean(histogram) / unit_ratio, histogram_stddev(histogram) / unit_ratio);   // NOLINT(cert-err33-c)
+    fprintf(stream, "#[Max     = %12.3f, Total count    = %12" PRIu64 "]\n", (double)histogram->max / unit_ratio, histogram->total_count);  // NOLINT(cert-err33-c)
+    fprintf(stream, "#[Buckets = %12d, SubBuckets     = %12" PRIu64 "]\n", histogram->bucket_count, histogram->sub_bucket_count);  // NOLINT(cert-err33-c)
+}
+
+static int bucket_index(const struct histogram *histogram, uint64_t value)
+{
+    int pow2_ceiling;
+
+    // the mask keeps every value below sub_bucket_count in bucket 0
+    pow2_ceiling = 64 - __builtin_clzll(value | histogram->sub_bucket_mask);   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return pow2_ceiling - histogram->unit_magnitude - (histogram->sub_bucket_half_count_magnitude + 1);
+}
+
+static uint64_t sub_bucket_index(const struct histogram *histogram, uint64_t value, int bucket)
+{
+    return value >> (unsigned)(bucket + histogram->unit_magnitude);
+}
+
+/**
+ * bucket 0 uses all of its sub-buckets, every later bucket only its top half since its bottom half
+ * covers the same values as the whole of the bucket below it at a coarser resolution
+ * */
+static size_t counts_index(const struct histogram *histogram, int bucket, uint64_t sub_bucket)
+{
+    size_t bucket_base;
+
+    bucket_base = (size_t)(bucket + 1) << (unsigned)histogram->sub_bucket_half_count_magnitude;
+
+    return bucket_base + (size_t)sub_bucket - (size_t)histogram->sub_bucket_half_count;
+}
+
+static size_t counts_index_for(const struct histogram *histogram, uint64_t value)
+{
+    int bucket;
+
+    bucket = bucket_index(histogram, value);
+
+    return counts_index(histogram, bucket, sub_bucket_index(histogram, value, bucket));
+}
+
+static uint64_t value_at_index(const struct histogram *histogram, size_t index)
+{
+    int bucket;
+    uint64_t sub_bucket;
+
+    bucket = (int)(index >> (unsigned)histogram->sub_bucket_half_count_magnitude) - 1;
+    sub_bucket = (index & (histogram->sub_bucket_half_count - 1)) + histogram->sub_bucket_half_count;
+
+    if(bucket < 0)
+    {
+        sub_bucket -= histogram->sub_bucket_half_count;
+        bucket = 0;
+    }
+
+    return sub_bucket << (unsigned)(bucket + histogram->unit_magnitude);
+}
+
+static uint64_t equivalent_range(const struct histogram *histogram, uint64_t value)
+{
+    int bucket;
+    uint64_t sub_bucket;
+
+    bucket = bucket_index(histogram, value);
+    sub_bucket = sub_bucket_index(histogram, value, bucket);
+
+    if(sub_bucket >= histogram->sub_bucket_count)
+    {
+        bucket++;
+    }
+
+    return UINT64_C(1) << (unsigned)(histogram->unit_magnitude + bucket);
+}
+
+static uint64_t lowest_equivalent(const struct histogram *histogram, uint64_t value)
+{
+    int bucket;
+
+    bucket = bucket_index(histogram, value);
+
+    return sub_bucket_index(histogram, value, bucket) << (unsigned)(bucket + histogram->unit_magnitude);
+}
+
+static uint64_t highest_equivalent(const struct histogram *histogram, uint64_t value)
+{
+    return lowest_equivalent(histogram, value) + equivalent_range(histogram, value) - 1;
+}
+
+static uint64_t count_at_or_below(const struct histogram *histogram, uint64_t value)
+{
+    size_t last;
+    uint64_t count;
+
+    last = counts_index_for(histogram, value < histogram->highest_trackable ? value : histogram->highest_trackable);
+    count = 0;
+
+    for(size_t i = 0; i <= last && i < histogram->counts_len; i++)
+    {
+        count += histogram->counts[i];
+    }
+
+    return count;
+}
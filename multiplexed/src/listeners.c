@@ -0,0 +1,255 @@
+#include "listeners.h"
+#include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+
+static int open_listener(const struct dc_env *env, struct dc_error *err, const struct endpoint *endpoint, int backlog, bool reuse_port, bool nonblocking);
+static void remove_stale(const struct endpoint *endpoint);
+
+
+void listeners_init(struct listeners *listeners)
+{
+    memset(listeners, 0, sizeof(*listeners));
+
+    for(size_t i = 0; i < LISTENERS_MAX; i++)
+    {
+        listeners->fds[i] = -1;
+    }
+}
+
+bool listeners_add(struct listeners *listeners, const char *text)
+{
+    if(listeners->count == LISTENERS_MAX)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    if(!(endpoint_parse(text, ENDPOINT_DEFAULT_PORT, &listeners->endpoints[listeners->count])))
+    {
+        return false;
+    }
+
+    listeners->count++;
+
+    return true;
+}
+
+void listeners_open(const struct dc_env *env, struct dc_error *err, struct listeners *listeners, int backlog, bool reuse_port, bool nonblocking)
+{
+    DC_TRACE(env);
+
+    if(listeners->count == 0)
+    {
+        listeners_add(listeners, LISTENERS_DEFAULT);
+    }
+
+    for(size_t i = 0; i < listeners->count && dc_error_has_no_error(err); i++)
+    {
+        listeners->fds[i] = open_listener(env, err, &listeners->endpoints[i], backlog, reuse_port, nonblocking);
+        listeners->owned[i] = true;
+    }
+
+    if(dc_error_has_error(err))
+    {
+        listeners_close(env, err, listeners);
+    }
+}
+
+void listeners_share(const struct dc_env *env, struct dc_error *err, struct listeners *listeners, const struct listeners *first, int backlog)
+{
+    DC_TRACE(env);
+    listeners_init(listeners);
+
+    for(size_t i = 0; i < first->count && dc_error_has_no_error(err); i++)
+    {
+        listeners->endpoints[i] = first->endpoints[i];
+        listeners->count++;
+
+        if(endpoint_is_unix(&first->endpoints[i]))
+        {
+            listeners->fds[i] = fcntl(first->fds[i], F_DUPFD_CLOEXEC, 0);    // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+            listeners->owned[i] = false;
+
+            if(listeners->fds[i] == -1)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+        }
+        else
+        {
+            listeners->fds[i] = open_listener(env, err, &first->endpoints[i], backlog, true, true);
+            listeners->owned[i] = true;
+        }
+    }
+
+    if(dc_error_has_error(err))
+    {
+        listeners_close(env, err, listeners);
+    }
+}
+
+/**
+ * a socket file outlives its listener, it is removed here so the next run does not find it in the way
+ * */
+void listeners_close(const struct dc_env *env, struct dc_error *err, struct listeners *listeners)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < listeners->count; i++)
+    {
+        const char *path;
+
+        if(listeners->fds[i] == -1)
+        {
+            continue;
+        }
+
+        // a failed close must not leave the rest open or raise over the error that got us here
+        close(listeners->fds[i]);
+        listeners->fds[i] = -1;
+        path = endpoint_path(&listeners->endpoints[i]);
+
+        if(listeners->owned[i] && path != NULL && unlink(path) == -1 && errno != ENOENT && dc_error_has_no_error(err))
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+    }
+}
+
+int listeners_find(const struct listeners *listeners, int fd)
+{
+    for(size_t i = 0; i < listeners->count; i++)
+    {
+        if(listeners->fds[i] == fd)
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * stops at the first endpoint that does not fit whole, so the list is never cut off in the middle of a name
+ * */
+void listeners_describe(const struct listeners *listeners, char *text, size_t size)
+{
+    size_t length;
+
+    length = 0;
+    text[0] = '\0';
+
+    for(size_t i = 0; i < listeners->count; i++)
+    {
+        size_t separator;
+        size_t name_length;
+
+        separator = i == 0 ? 0 : strlen(", ");
+        name_length = strlen(listeners->endpoints[i].name);
+
+        if(length + separator + name_length >= size)
+        {
+            break;
+        }
+
+        memcpy(text + length, ", ", separator);
+        memcpy(text + length + separator, listeners->endpoints[i].name, name_length + 1);
+        length += separator + name_length;
+    }
+}
+
+/**
+ * the listener is created with SOCK_CLOEXEC so a spawned helper never inherits it, SO_REUSEADDR only means something for tcp
+ * */
+static int open_listener(const struct dc_env *env, struct dc_error *err, const struct endpoint *endpoint, int backlog, bool reuse_port, bool nonblocking)
+{
+    int listener;
+
+    DC_TRACE(env);
+    listener = dc_socket(env, err, endpoint->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);  // NOLINT(hicpp-signed-bitwise)
+
+    if(dc_error_has_error(err))
+    {
+        return -1;
+    }
+
+    if(endpoint_is_unix(endpoint))
+    {
+        remove_stale(endpoint);
+    }
+    else
+    {
+        static int optval = 1;
+
+        dc_setsockopt(env, err, listener, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+        // every reactor binds the same port, the kernel spreads incoming connections across the listeners
+        if(dc_error_has_no_error(err) && reuse_port)
+        {
+            dc_setsockopt(env, err, listener, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+        }
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        dc_bind(env, err, listener, (const struct sockaddr *)&endpoint->addr, endpoint->addr_len);
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        dc_listen(env, err, listener, backlog);
+    }
+
+    if(dc_error_has_no_error(err) && nonblocking)
+    {
+        int flags;
+
+        flags = fcntl(listener, F_GETFL);   // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+
+        if(flags == -1 || fcntl(listener, F_SETFL, flags | O_NONBLOCK) == -1)   // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg,hicpp-signed-bitwise)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+    }
+
+    if(dc_error_has_error(err))
+    {
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+/**
+ * a refused connect means the file is there but nothing is listening behind it, a server that crashed left it behind
+ * anything else, including a connect that works, is left alone for bind() to report
+ * */
+static void remove_stale(const struct endpoint *endpoint)
+{
+    const char *path;
+    int fd;
+
+    path = endpoint_path(endpoint);
+
+    if(path == NULL)
+    {
+        return;
+    }
+
+    fd = endpoint_connect(endpoint);
+
+    if(fd != -1)
+    {
+        close(fd);
+    }
+    else if(errno == ECONNREFUSED)
+    {
+        unlink(path);
+    }
+}
@@ -1,128 +1,1397 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <pthread.h>
+#include <sys/timerfd.h>
 #include <time.h>
-#include <dc_posix/dc_unistd.h>
+#include <unistd.h>
+#include "endpoint.h"
+#include "histogram.h"
+#include "word_count.h"
 
-#define BUFFER_SIZE 1024
 
-void *test_thread(void *arg);
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT ENDPOINT_DEFAULT_PORT
+#define DEFAULT_CONNECTIONS 64
+#define DEFAULT_RATE ((double)1000)
+#define DEFAULT_DURATION 10
+#define DEFAULT_THREADS 2
+#define DEFAULT_PAYLOAD "the quick brown fox jumps over the lazy dog"
+#define MAX_SYNTHETIC_WORD 8
+#define MAX_PAYLOAD_SIZE (64UL * 1024UL * 1024UL)
+#define LENGTH_PREFIX_SIZE 4
+#define MAX_EVENTS 64
+#define RECV_BUFFER_SIZE 65536
+#define INITIAL_INFLIGHT 64
+#define DRAIN_TIMEOUT_NS (2 * NANOSECONDS_PER_SECOND)
+#define REPORT_INTERVAL_NS NANOSECONDS_PER_SECOND
+#define NANOSECONDS_PER_SECOND UINT64_C(1000000000)
+#define NANOSECONDS_PER_MICROSECOND ((double)1000)
+#define PERCENTILE_50 ((double)50)
+#define PERCENTILE_90 ((double)90)
+#define PERCENTILE_99 ((double)99)
+#define PERCENTILE_999 ((double)999 / 10)
+#define HISTOGRAM_HIGHEST_NS (60 * NANOSECONDS_PER_SECOND)
+#define HISTOGRAM_SIGNIFICANT_FIGURES 3
+#define DEFAULT_RESULTS_FILE "results.csv"
+#define DEFAULT_SUMMARY_FILE "summary.csv"
+#define DEFAULT_HISTOGRAM_FILE "latency.hgrm"
 
-//global variables
-char *server_ip;
-int server_port;
-char *data_file;
-int test_duration;
-time_t start_time;
 
-int main(int argc, char *argv[]) {
-    // Check if all required arguments are provided
-    if (argc < 5) {
-        printf("Usage: %s <server IP> <server port> <data file> <test duration>\n", argv[0]);
-        return -1;
+enum frame_mode
+{
+    FRAME_LINE,
+    FRAME_LENGTH,
+};
+
+struct options
+{
+    const char *host;
+    int port;
+    struct endpoint server;
+    int connections;
+    double rate;
+    int duration;
+    int threads;
+    const char *data_file;
+    size_t payload_size;
+    int idle;
+    enum frame_mode frame_mode;
+    const char *results_file;
+    const char *summary_file;
+    const char *histogram_file;
+};
+
+/**
+ * the request is built once and sent as is on every connection, expected_words is what the server must answer
+ * */
+struct request
+{
+    char *bytes;
+    size_t len;
+    uint64_t expected_words;
+};
+
+/**
+ * replies come back in the order the requests went out, so each connection keeps a fifo of the times its requests
+ * were supposed to be sent, the reply at the head of the socket always belongs to the head of the fifo
+ * */
+struct lt_connection
+{
+    int fd;
+    bool alive;
+    bool writing;
+    char *out;
+    size_t out_len;
+    size_t out_capacity;
+    uint64_t *inflight;
+    size_t inflight_head;
+    size_t inflight_count;
+    size_t inflight_capacity;
+    uint64_t reply_value;
+    bool reply_digits;
+};
+
+/**
+ * written by one generator thread and read by main for the per-interval report
+ * latency holds the replies since the last report, main folds it into its own histograms and clears it under lock,
+ * the lock is only ever contended once per interval so recording stays a few nanoseconds
+ * */
+struct lt_stats
+{
+    atomic_uint_fast64_t sent;
+    atomic_uint_fast64_t completed;
+    atomic_uint_fast64_t errors;
+    pthread_mutex_t lock;
+    struct histogram latency;
+};
+
+/**
+ * what main keeps between reports, interval is rebuilt from the threads' histograms every report and added to total
+ * */
+struct report
+{
+    FILE *results;
+    struct histogram interval;
+    struct histogram total;
+    uint64_t last_sent;
+    uint64_t last_completed;
+    uint64_t last_errors;
+    uint64_t last_elapsed_ns;
+};
+
+/**
+ * one event loop driving its share of the connections at its share of the rate
+ * */
+struct generator
+{
+    const struct options *options;
+    const struct request *request;
+    pthread_t thread;
+    bool started;
+    int id;
+    int epfd;
+    int timer_fd;
+    struct lt_connection *connections;
+    int num_connections;
+    int next_connection;
+    uint64_t interval_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t next_send_ns;
+    struct lt_stats stats;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
+static bool build_request(const struct options *options, struct request *request);
+static char *load_payload(const struct options *options, size_t *payload_len);
+static int open_connection(const struct options *options);
+static bool open_idle_connections(const struct options *options, int *idle_fds);
+static bool setup_generators(const struct options *options, const struct request *request, struct generator *generators);
+static void schedule_generators(const struct options *options, struct generator *generators, uint64_t start_ns);
+static bool connect_one(const struct options *options, struct generator *generator, struct lt_connection *connection);
+static void *generator_main(void *arg);
+static void send_due_requests(struct generator *generator, uint64_t now);
+static void arm_timer(struct generator *generator, uint64_t when_ns);
+static bool queue_request(struct generator *generator, struct lt_connection *connection, uint64_t intended_ns);
+static bool flush_connection(struct generator *generator, struct lt_connection *connection);
+static bool read_replies(struct generator *generator, struct lt_connection *connection);
+static void complete_request(struct generator *generator, struct lt_connection *connection, uint64_t value, uint64_t now);
+static void fail_connection(struct generator *generator, struct lt_connection *connection);
+static void set_write_interest(struct generator *generator, struct lt_connection *connection, bool writing);
+static size_t pending_requests(const struct generator *generator);
+static bool report_init(const struct options *options, struct report *report);
+static void report_interval(struct report *report, struct generator *generators, const struct options *options, uint64_t elapsed_ns);
+static bool report_final(struct report *report, struct generator *generators, const struct options *options, const struct request *request, uint64_t elapsed_ns);
+static void report_destroy(struct report *report);
+static void collect_latency(struct report *report, struct generator *generators, const struct options *options);
+static void destroy_generators(struct generator *generators, const struct options *options);
+static uint64_t now_ns(void);
+static void sleep_until(uint64_t when_ns);
+
+
+/**
+ * an open-loop generator, requests are sent on a fixed schedule whether or not earlier ones have been answered,
+ * which is how real clients arrive, a closed loop that waits for each reply slows down with the server and hides its stalls
+ * latency is measured from when a request was scheduled to go out rather than when it actually went out,
+ * so time a request spent waiting behind a stalled server or a backed up socket is counted (coordinated omission)
+ * every latency goes into a histogram, the tail percentiles are reported per interval and for the whole run
+ * */
+int main(int argc, char *argv[])
+{
+    struct options options;
+    struct request request;
+    struct generator *generators;
+    struct report report;
+    int *idle_fds;
+    uint64_t start_ns;
+    uint64_t next_report_ns;
+    int ret_val;
+
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--host ADDRESS | unix:PATH | unix:@NAME] [--port PORT] [--connections C] [--rate R] [--duration SECONDS] [--threads T] [--data FILE | --size BYTES] [--idle N] [--frame line | length] [--results FILE] [--summary FILE] [--histogram FILE]\n", argv[0]);  // NOLINT(cert-err33-c)
+        fprintf(stderr, "the server must run with the same --frame, requests are sent at R per second in total across C connections\n");  // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
     }
 
-    // Parse command line arguments
-    server_ip = argv[1];
-    server_port = atoi(argv[2]);
-    data_file = argv[3];
-    test_duration = atoi(argv[4]);
+    if(!(build_request(&options, &request)))
+    {
+        return EXIT_FAILURE;
+    }
 
-    //checks if server port is valid
-    if (server_port < 1024 || server_port > 65535){
-        printf("Error: invalid server port number\n");
-        return -1;
+    generators = calloc((size_t)options.threads, sizeof(struct generator));
+
+    if(generators == NULL)
+    {
+        perror("calloc");
+        free(request.bytes);
+        return EXIT_FAILURE;
     }
 
-    // Open the data file
-    FILE *fp = fopen(data_file, "rb");
-    if (fp == NULL) {
-        perror("Unable to open data file");
-        return -1;
+    // one extra slot so --idle 0 still gets a valid allocation
+    idle_fds = calloc((size_t)options.idle + 1, sizeof(int));
+
+    if(idle_fds == NULL)
+    {
+        perror("calloc");
+        free(generators);
+        free(request.bytes);
+        return EXIT_FAILURE;
+    }
+
+    if(!(report_init(&options, &report)))
+    {
+        free(idle_fds);
+        free(generators);
+        free(request.bytes);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d connections on %d threads (%d idle), %.0f requests/s for %d s, %zu byte requests (%" PRIu64 " words)\n", options.connections, options.threads, options.idle, options.rate, options.duration, request.len, request.expected_words);
+    ret_val = EXIT_FAILURE;
+
+    if(open_idle_connections(&options, idle_fds) && setup_generators(&options, &request, generators))
+    {
+        ret_val = EXIT_SUCCESS;
+        start_ns = now_ns();
+        schedule_generators(&options, generators, start_ns);
+
+        for(int i = 0; i < options.threads; i++)
+        {
+            if(pthread_create(&generators[i].thread, NULL, generator_main, &generators[i]) != 0)
+            {
+                perror("pthread_create");
+                ret_val = EXIT_FAILURE;
+                break;
+            }
+
+            generators[i].started = true;
+        }
+
+        next_report_ns = start_ns + REPORT_INTERVAL_NS;
+
+        while(ret_val == EXIT_SUCCESS && next_report_ns <= start_ns + (uint64_t)options.duration * NANOSECONDS_PER_SECOND)
+        {
+            sleep_until(next_report_ns);
+            report_interval(&report, generators, &options, next_report_ns - start_ns);
+            next_report_ns += REPORT_INTERVAL_NS;
+        }
+
+        for(int i = 0; i < options.threads; i++)
+        {
+            if(generators[i].started)
+            {
+                pthread_join(generators[i].thread, NULL);
+            }
+        }
+
+        if(!(report_final(&report, generators, &options, &request, now_ns() - start_ns)))
+        {
+            ret_val = EXIT_FAILURE;
+        }
+    }
+
+    destroy_generators(generators, &options);
+    report_destroy(&report);
+
+    for(int i = 0; i < options.idle; i++)
+    {
+        if(idle_fds[i] != -1)
+        {
+            close(idle_fds[i]);
+        }
+    }
+
+    free(idle_fds);
+    free(generators);
+    free(request.bytes);
+
+    return ret_val;
+}
+
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"host",        required_argument, NULL, 'h'},
+        {"port",        required_argument, NULL, 'p'},
+        {"connections", required_argument, NULL, 'c'},
+        {"rate",        required_argument, NULL, 'r'},
+        {"duration",    required_argument, NULL, 'd'},
+        {"threads",     required_argument, NULL, 't'},
+        {"data",        required_argument, NULL, 'f'},
+        {"size",        required_argument, NULL, 's'},
+        {"idle",        required_argument, NULL, 'i'},
+        {"frame",       required_argument, NULL, 'm'},
+        {"results",     required_argument, NULL, 'R'},
+        {"summary",     required_argument, NULL, 'S'},
+        {"histogram",   required_argument, NULL, 'H'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    options->host = DEFAULT_HOST;
+    options->port = DEFAULT_PORT;
+    options->connections = DEFAULT_CONNECTIONS;
+    options->rate = DEFAULT_RATE;
+    options->duration = DEFAULT_DURATION;
+    options->threads = DEFAULT_THREADS;
+    options->data_file = NULL;
+    options->payload_size = 0;
+    options->idle = 0;
+    options->frame_mode = FRAME_LENGTH;
+    options->results_file = DEFAULT_RESULTS_FILE;
+    options->summary_file = DEFAULT_SUMMARY_FILE;
+    options->histogram_file = DEFAULT_HISTOGRAM_FILE;
+
+    while((opt = getopt_long(argc, argv, "h:p:c:r:d:t:f:s:i:m:R:S:H:", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'h':
+            {
+                options->host = optarg;
+                break;
+            }
+            case 'p':
+            {
+                options->port = atoi(optarg);
+                break;
+            }
+            case 'c':
+            {
+                options->connections = atoi(optarg);
+                break;
+            }
+            case 'r':
+            {
+                options->rate = strtod(optarg, NULL);
+                break;
+            }
+            case 'd':
+            {
+                options->duration = atoi(optarg);
+                break;
+            }
+            case 't':
+            {
+                options->threads = atoi(optarg);
+                break;
+            }
+            case 'f':
+            {
+                options->data_file = optarg;
+                break;
+            }
+            case 's':
+            {
+                options->payload_size = (size_t)strtoull(optarg, NULL, 10);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'i':
+            {
+                options->idle = atoi(optarg);
+                break;
+            }
+            case 'm':
+            {
+                if(strcmp(optarg, "line") == 0)
+                {
+                    options->frame_mode = FRAME_LINE;
+                }
+                else if(strcmp(optarg, "length") == 0)
+                {
+                    options->frame_mode = FRAME_LENGTH;
+                }
+                else
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'R':
+            {
+                options->results_file = optarg;
+                break;
+            }
+            case 'S':
+            {
+                options->summary_file = optarg;
+                break;
+            }
+            case 'H':
+            {
+                options->histogram_file = optarg;
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
     }
 
-    // Read the contents of the data file into a buffer
-    char buffer[BUFFER_SIZE];
-    size_t bytes_read = fread(buffer, 1, BUFFER_SIZE, fp);
-    fclose(fp);
+    if(options->port < 1 || options->port > UINT16_MAX || options->connections < 1 || options->rate <= 0 || options->duration < 1 || options->threads < 1 || options->idle < 0 || options->payload_size > MAX_PAYLOAD_SIZE)
+    {
+        return false;
+    }
 
-    // Create an infinite loop that runs for the test duration
-    start_time = time(NULL);
-    while (difftime(time(NULL), start_time) < test_duration) {
-        // Create a thread to send data to the server
-        pthread_t thread;
-        if (pthread_create(&thread, NULL, test_thread, (void *) buffer) != 0) {
-            perror("Unable to create test thread");
-            return -1;
+    // a unix host ignores --port, an address can carry its own
+    if(!(endpoint_parse(options->host, (uint16_t)options->port, &options->server)))
+    {
+        if(errno == ENAMETOOLONG)
+        {
+            fprintf(stderr, "%s: a unix socket path or name can be at most %zu bytes\n", options->host, ENDPOINT_PATH_MAX);    // NOLINT(cert-err33-c)
+        }
+        else
+        {
+            fprintf(stderr, "Unable to parse server %s\n", options->host);    // NOLINT(cert-err33-c)
         }
 
-        pthread_join(thread, NULL);
+        return false;
     }
-    return 0;
+
+    // every thread needs at least one connection
+    if(options->threads > options->connections)
+    {
+        options->threads = options->connections;
+    }
+
+    return optind == argc;
 }
 
-void *test_thread(void *arg) {
-    // Get the data buffer from the argument
-    char *data = (char *) arg;
+/**
+ * the payload is framed the way the server expects
+ * a newline ends a request in line mode, so any inside the payload are sent as spaces
+ * */
+static bool build_request(const struct options *options, struct request *request)
+{
+    char *payload;
+    size_t payload_len;
+    struct word_counter counter;
+    size_t offset;
+
+    payload = load_payload(options, &payload_len);
+
+    if(payload == NULL)
+    {
+        return false;
+    }
+
+    word_count_init();
+    request->len = payload_len + (options->frame_mode == FRAME_LENGTH ? LENGTH_PREFIX_SIZE : 1);
+    request->bytes = malloc(request->len);
+
+    if(request->bytes == NULL)
+    {
+        perror("malloc");
+        free(payload);
+        return false;
+    }
+
+    offset = 0;
+
+    if(options->frame_mode == FRAME_LENGTH)
+    {
+        uint32_t prefix;
+
+        prefix = htonl((uint32_t)payload_len);
+        memcpy(request->bytes, &prefix, sizeof(prefix));
+        offset = sizeof(prefix);
+    }
+
+    memcpy(&request->bytes[offset], payload, payload_len);
+
+    if(options->frame_mode == FRAME_LINE)
+    {
+        for(size_t i = 0; i < payload_len; i++)
+        {
+            if(request->bytes[i] == '\n')
+            {
+                request->bytes[i] = ' ';
+            }
+        }
+
+        request->bytes[payload_len] = '\n';
+    }
+
+    word_counter_init(&counter);
+    word_counter_feed(&counter, &request->bytes[offset], payload_len);
+    request->expected_words = word_counter_take(&counter);
+    free(payload);
+
+    return true;
+}
+
+/**
+ * --data sends a file, --size a generated run of words of 1 to 8 letters, otherwise a short sentence
+ * */
+static char *load_payload(const struct options *options, size_t *payload_len)
+{
+    char *payload;
+
+    if(options->data_file != NULL)
+    {
+        FILE *fp;
+
+        fp = fopen(options->data_file, "rb");
+
+        if(fp == NULL)
+        {
+            perror("Unable to open data file");
+            return NULL;
+        }
+
+        payload = malloc(MAX_PAYLOAD_SIZE);
 
-    // Open a socket and connect to the server
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("Unable to create socket");
-        pthread_exit(NULL);
+        if(payload == NULL)
+        {
+            perror("malloc");
+            fclose(fp);     // NOLINT(cert-err33-c)
+            return NULL;
+        }
+
+        *payload_len = fread(payload, 1, MAX_PAYLOAD_SIZE, fp);
+        fclose(fp);     // NOLINT(cert-err33-c)
+    }
+    else if(options->payload_size > 0)
+    {
+        uint32_t state;
+        size_t word_left;
+
+        *payload_len = options->payload_size;
+        payload = malloc(*payload_len);
+
+        if(payload == NULL)
+        {
+            perror("malloc");
+            return NULL;
+        }
+
+        state = 1;
+        word_left = 0;
+
+        for(size_t i = 0; i < *payload_len; i++)
+        {
+            // xorshift keeps the text the same from run to run
+            state ^= state << 13U;  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            state ^= state >> 17U;  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            state ^= state << 5U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+            if(word_left == 0)
+            {
+                payload[i] = ' ';
+                word_left = 1 + state % MAX_SYNTHETIC_WORD;
+            }
+            else
+            {
+                payload[i] = (char)('a' + state % 26);  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                word_left--;
+            }
+        }
     }
+    else
+    {
+        *payload_len = strlen(DEFAULT_PAYLOAD);
+        payload = malloc(*payload_len);
 
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(server_port);
-    if (inet_pton(AF_INET, server_ip, &serv_addr.sin_addr) <= 0) {
-        perror("Unable to convert server IP");
-        close(sockfd);
-        pthread_exit(NULL);
+        if(payload == NULL)
+        {
+            perror("malloc");
+            return NULL;
+        }
+
+        memcpy(payload, DEFAULT_PAYLOAD, *payload_len);
     }
 
-    if (connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
+    return payload;
+}
+
+/**
+ * a blocking connect, the caller makes the socket non-blocking if it needs to
+ * */
+static int open_connection(const struct options *options)
+{
+    int fd;
+    int optval;
+
+    fd = endpoint_connect(&options->server);
+
+    if(fd == -1)
+    {
         perror("Unable to connect to server");
-        close(sockfd);
-        pthread_exit(NULL);
+        return -1;
+    }
+
+    // small requests must not sit in Nagle's buffer waiting for the previous reply, a unix socket has no Nagle to turn off
+    if(!(endpoint_is_unix(&options->server)))
+    {
+        optval = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    }
+
+    return fd;
+}
+
+/**
+ * idle connections only make the server carry more descriptors and connection state, they never send anything
+ * so the backends that scan every descriptor on each wakeup pay for them and the ones that only see ready ones do not
+ * */
+static bool open_idle_connections(const struct options *options, int *idle_fds)
+{
+    for(int i = 0; i < options->idle; i++)
+    {
+        idle_fds[i] = -1;
+    }
+
+    for(int i = 0; i < options->idle; i++)
+    {
+        idle_fds[i] = open_connection(options);
+
+        if(idle_fds[i] == -1)
+        {
+            fprintf(stderr, "only %d of %d idle connections opened\n", i, options->idle);    // NOLINT(cert-err33-c)
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * connections are opened up front so the run measures requests and not connection setup
+ * thread i gets connections [C * i / T, C * (i + 1) / T) and an equal share of the rate
+ * */
+static bool setup_generators(const struct options *options, const struct request *request, struct generator *generators)
+{
+    for(int i = 0; i < options->threads; i++)
+    {
+        pthread_mutex_init(&generators[i].stats.lock, NULL);
+    }
+
+    for(int i = 0; i < options->threads; i++)
+    {
+        if(!(histogram_init(&generators[i].stats.latency, HISTOGRAM_HIGHEST_NS, HISTOGRAM_SIGNIFICANT_FIGURES)))
+        {
+            fprintf(stderr, "Unable to allocate latency histogram\n");    // NOLINT(cert-err33-c)
+            return false;
+        }
+    }
+
+    for(int i = 0; i < options->threads; i++)
+    {
+        struct generator *generator;
+        int first;
+
+        generator = &generators[i];
+        first = options->connections * i / options->threads;
+        generator->options = options;
+        generator->request = request;
+        generator->id = i;
+        generator->num_connections = options->connections * (i + 1) / options->threads - first;
+        generator->interval_ns = (uint64_t)((double)NANOSECONDS_PER_SECOND * options->threads / options->rate);
+        generator->epfd = epoll_create1(EPOLL_CLOEXEC);
+        generator->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        generator->connections = calloc((size_t)generator->num_connections, sizeof(struct lt_connection));
+
+        if(generator->epfd == -1 || generator->timer_fd == -1 || generator->connections == NULL)
+        {
+            perror("setup");
+            return false;
+        }
+
+        for(int j = 0; j < generator->num_connections; j++)
+        {
+            generator->connections[j].fd = -1;
+        }
+
+        {
+            struct epoll_event event;
+
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.ptr = NULL;
+
+            if(epoll_ctl(generator->epfd, EPOLL_CTL_ADD, generator->timer_fd, &event) == -1)
+            {
+                perror("epoll_ctl");
+                return false;
+            }
+        }
+
+        for(int j = 0; j < generator->num_connections; j++)
+        {
+            if(!(connect_one(options, generator, &generator->connections[j])))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * the clock starts once every connection is up
+ * the threads start staggered across one interval so their sends interleave instead of bunching up
+ * */
+static void schedule_generators(const struct options *options, struct generator *generators, uint64_t start_ns)
+{
+    for(int i = 0; i < options->threads; i++)
+    {
+        struct generator *generator;
+
+        generator = &generators[i];
+        generator->start_ns = start_ns + generator->interval_ns * (uint64_t)i / (uint64_t)options->threads;
+        generator->end_ns = start_ns + (uint64_t)options->duration * NANOSECONDS_PER_SECOND;
+        generator->next_send_ns = generator->start_ns;
+    }
+}
+
+static bool connect_one(const struct options *options, struct generator *generator, struct lt_connection *connection)
+{
+    struct epoll_event event;
+    int flags;
+
+    connection->fd = open_connection(options);
+
+    if(connection->fd == -1)
+    {
+        return false;
+    }
+
+    flags = fcntl(connection->fd, F_GETFL);   // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+
+    if(flags == -1 || fcntl(connection->fd, F_SETFL, flags | O_NONBLOCK) == -1)   // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg,hicpp-signed-bitwise)
+    {
+        perror("fcntl");
+        return false;
+    }
+
+    connection->inflight = malloc(INITIAL_INFLIGHT * sizeof(uint64_t));
+
+    if(connection->inflight == NULL)
+    {
+        perror("malloc");
+        return false;
+    }
+
+    connection->inflight_capacity = INITIAL_INFLIGHT;
+    connection->alive = true;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;    // NOLINT(hicpp-signed-bitwise)
+    event.data.ptr = connection;
+
+    if(epoll_ctl(generator->epfd, EPOLL_CTL_ADD, connection->fd, &event) == -1)
+    {
+        perror("epoll_ctl");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * the timer fires at the next scheduled send, everything that is due by then goes out, even if the thread fell behind,
+ * so the offered load stays at the requested rate instead of sagging when the server or this thread stalls
+ * after the last send the loop keeps reading until every reply is in or the drain timeout passes
+ * */
+static void *generator_main(void *arg)
+{
+    struct generator *generator;
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t drain_deadline_ns;
+
+    generator = arg;
+    drain_deadline_ns = generator->end_ns + DRAIN_TIMEOUT_NS;
+    arm_timer(generator, generator->next_send_ns);
+
+    for(;;)
+    {
+        int num_events;
+        uint64_t now;
+
+        now = now_ns();
+
+        if(now >= generator->end_ns && (pending_requests(generator) == 0 || now >= drain_deadline_ns))
+        {
+            break;
+        }
+
+        num_events = epoll_wait(generator->epfd, events, MAX_EVENTS, now >= generator->end_ns ? (int)((drain_deadline_ns - now) / 1000000 + 1) : -1);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+        if(num_events == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            perror("epoll_wait");
+            break;
+        }
+
+        for(int i = 0; i < num_events; i++)
+        {
+            struct lt_connection *connection;
+
+            connection = events[i].data.ptr;
+
+            if(connection == NULL)
+            {
+                uint64_t expirations;
+
+                if(read(generator->timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+                {
+                    perror("timerfd");
+                }
+
+                send_due_requests(generator, now_ns());
+                continue;
+            }
+
+            if(!(connection->alive))
+            {
+                continue;
+            }
+
+            if(events[i].events & EPOLLOUT && !(flush_connection(generator, connection)))
+            {
+                fail_connection(generator, connection);
+                continue;
+            }
+
+            if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) && !(read_replies(generator, connection)))     // NOLINT(hicpp-signed-bitwise)
+            {
+                fail_connection(generator, connection);
+            }
+        }
+    }
+
+    // whatever is still outstanding never got a reply
+    for(int i = 0; i < generator->num_connections; i++)
+    {
+        atomic_fetch_add_explicit(&generator->stats.errors, generator->connections[i].inflight_count, memory_order_relaxed);
+        generator->connections[i].inflight_count = 0;
+    }
+
+    return NULL;
+}
+
+/**
+ * each request is stamped with the time it was scheduled for, not the time it is being sent
+ * */
+static void send_due_requests(struct generator *generator, uint64_t now)
+{
+    while(generator->next_send_ns <= now && generator->next_send_ns < generator->end_ns)
+    {
+        struct lt_connection *connection;
+        int tries;
+
+        connection = NULL;
+
+        for(tries = 0; tries < generator->num_connections; tries++)
+        {
+            struct lt_connection *candidate;
+
+            candidate = &generator->connections[generator->next_connection];
+            generator->next_connection = (generator->next_connection + 1) % generator->num_connections;
+
+            if(candidate->alive)
+            {
+                connection = candidate;
+                break;
+            }
+        }
+
+        if(connection == NULL)
+        {
+            // every connection has failed, there is nothing left to send on
+            atomic_fetch_add_explicit(&generator->stats.errors, 1, memory_order_relaxed);
+        }
+        else if(!(queue_request(generator, connection, generator->next_send_ns)))
+        {
+            fail_connection(generator, connection);
+        }
+
+        generator->next_send_ns += generator->interval_ns;
+    }
+
+    // once the schedule is done the timer still has to wake the loop at the end of the run to start the drain
+    if(generator->next_send_ns < generator->end_ns)
+    {
+        arm_timer(generator, generator->next_send_ns);
+    }
+    else if(now < generator->end_ns)
+    {
+        arm_timer(generator, generator->end_ns);
+    }
+}
+
+static void arm_timer(struct generator *generator, uint64_t when_ns)
+{
+    struct itimerspec timer;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = (time_t)(when_ns / NANOSECONDS_PER_SECOND);
+    timer.it_value.tv_nsec = (long)(when_ns % NANOSECONDS_PER_SECOND);
+
+    if(timerfd_settime(generator->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) == -1)
+    {
+        perror("timerfd_settime");
+    }
+}
+
+/**
+ * the request is appended to whatever the socket has not taken yet, then as much as possible is sent right away
+ * */
+static bool queue_request(struct generator *generator, struct lt_connection *connection, uint64_t intended_ns)
+{
+    const struct request *request;
+
+    request = generator->request;
+
+    if(connection->inflight_count == connection->inflight_capacity)
+    {
+        uint64_t *inflight;
+        size_t capacity;
+
+        capacity = connection->inflight_capacity * 2;
+        inflight = malloc(capacity * sizeof(uint64_t));
+
+        if(inflight == NULL)
+        {
+            return false;
+        }
+
+        for(size_t i = 0; i < connection->inflight_count; i++)
+        {
+            inflight[i] = connection->inflight[(connection->inflight_head + i) % connection->inflight_capacity];
+        }
+
+        free(connection->inflight);
+        connection->inflight = inflight;
+        connection->inflight_capacity = capacity;
+        connection->inflight_head = 0;
+    }
+
+    if(connection->out_len + request->len > connection->out_capacity)
+    {
+        char *out;
+        size_t capacity;
+
+        capacity = connection->out_capacity == 0 ? request->len : connection->out_capacity;
+
+        while(capacity < connection->out_len + request->len)
+        {
+            capacity *= 2;
+        }
+
+        out = realloc(connection->out, capacity);
+
+        if(out == NULL)
+        {
+            return false;
+        }
+
+        connection->out = out;
+        connection->out_capacity = capacity;
+    }
+
+    memcpy(&connection->out[connection->out_len], request->bytes, request->len);
+    connection->out_len += request->len;
+    connection->inflight[(connection->inflight_head + connection->inflight_count) % connection->inflight_capacity] = intended_ns;
+    connection->inflight_count++;
+    atomic_fetch_add_explicit(&generator->stats.sent, 1, memory_order_relaxed);
+
+    return flush_connection(generator, connection);
+}
+
+static bool flush_connection(struct generator *generator, struct lt_connection *connection)
+{
+    while(connection->out_len > 0)
+    {
+        ssize_t written;
+
+        written = send(connection->fd, connection->out, connection->out_len, MSG_NOSIGNAL);
+
+        if(written == -1)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        memmove(connection->out, &connection->out[written], connection->out_len - (size_t)written);
+        connection->out_len -= (size_t)written;
+    }
+
+    set_write_interest(generator, connection, connection->out_len > 0);
+
+    return true;
+}
+
+/**
+ * every reply is a decimal count and a newline, a reply can be split across reads or several can arrive in one
+ * */
+static bool read_replies(struct generator *generator, struct lt_connection *connection)
+{
+    char buffer[RECV_BUFFER_SIZE];
+
+    for(;;)
+    {
+        ssize_t bytes_read;
+        uint64_t now;
+
+        bytes_read = recv(connection->fd, buffer, sizeof(buffer), 0);
+
+        if(bytes_read == -1)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        if(bytes_read == 0)
+        {
+            return false;
+        }
+
+        now = now_ns();
+
+        for(ssize_t i = 0; i < bytes_read; i++)
+        {
+            char c;
+
+            c = buffer[i];
+
+            if(c >= '0' && c <= '9')
+            {
+                connection->reply_value = connection->reply_value * 10 + (uint64_t)(c - '0');   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                connection->reply_digits = true;
+            }
+            else if(c == '\n' && connection->reply_digits)
+            {
+                complete_request(generator, connection, connection->reply_value, now);
+                connection->reply_value = 0;
+                connection->reply_digits = false;
+            }
+            else
+            {
+                // not the framed protocol, the server is probably running without --frame
+                return false;
+            }
+        }
+    }
+}
+
+static void complete_request(struct generator *generator, struct lt_connection *connection, uint64_t value, uint64_t now)
+{
+    uint64_t intended_ns;
+    uint64_t latency;
+
+    if(connection->inflight_count == 0)
+    {
+        atomic_fetch_add_explicit(&generator->stats.errors, 1, memory_order_relaxed);
+        return;
+    }
+
+    intended_ns = connection->inflight[connection->inflight_head];
+    connection->inflight_head = (connection->inflight_head + 1) % connection->inflight_capacity;
+    connection->inflight_count--;
+
+    if(value != generator->request->expected_words)
+    {
+        atomic_fetch_add_explicit(&generator->stats.errors, 1, memory_order_relaxed);
+        return;
     }
 
-    // Send the data to the server
-    ssize_t bytes_sent = send(sockfd, data, strlen(data), 0);
-    if (bytes_sent < 0) {
-        perror("Unable to send data to server");
-        close(sockfd);
-        pthread_exit(NULL);
+    latency = now > intended_ns ? now - intended_ns : 0;
+    pthread_mutex_lock(&generator->stats.lock);
+    histogram_record(&generator->stats.latency, latency);
+    pthread_mutex_unlock(&generator->stats.lock);
+    atomic_fetch_add_explicit(&generator->stats.completed, 1, memory_order_relaxed);
+}
+
+/**
+ * the connection is not reopened, its unanswered requests count as errors and its share of the rate moves to the others
+ * */
+static void fail_connection(struct generator *generator, struct lt_connection *connection)
+{
+    atomic_fetch_add_explicit(&generator->stats.errors, connection->inflight_count, memory_order_relaxed);
+    connection->inflight_count = 0;
+    connection->out_len = 0;
+    connection->alive = false;
+    close(connection->fd);
+    connection->fd = -1;
+}
+
+static void set_write_interest(struct generator *generator, struct lt_connection *connection, bool writing)
+{
+    struct epoll_event event;
+
+    if(connection->writing == writing)
+    {
+        return;
     }
 
-    // Receive the response from the server
-    char response[BUFFER_SIZE];
-    ssize_t bytes_recv = recv(sockfd, response, BUFFER_SIZE, 0);
-    if (bytes_recv < 0) {
-        perror("Unable to receive data from server");
-        close(sockfd);
-        pthread_exit(NULL);
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP | (writing ? EPOLLOUT : 0);  // NOLINT(hicpp-signed-bitwise)
+    event.data.ptr = connection;
+
+    if(epoll_ctl(generator->epfd, EPOLL_CTL_MOD, connection->fd, &event) == 0)
+    {
+        connection->writing = writing;
     }
+}
 
-    close(sockfd);
+static size_t pending_requests(const struct generator *generator)
+{
+    size_t pending;
 
-    // Log the time taken to send and receive data to a CSV file
-    FILE *fp = fopen("results.csv", "a");
-    if (fp == NULL) {
+    pending = 0;
+
+    for(int i = 0; i < generator->num_connections; i++)
+    {
+        pending += generator->connections[i].inflight_count;
+    }
+
+    return pending;
+}
+
+/**
+ * results.csv gets one row per interval, the summary and the histogram log are written once the run is over
+ * */
+static bool report_init(const struct options *options, struct report *report)
+{
+    memset(report, 0, sizeof(*report));
+
+    if(!(histogram_init(&report->interval, HISTOGRAM_HIGHEST_NS, HISTOGRAM_SIGNIFICANT_FIGURES)) || !(histogram_init(&report->total, HISTOGRAM_HIGHEST_NS, HISTOGRAM_SIGNIFICANT_FIGURES)))
+    {
+        fprintf(stderr, "Unable to allocate latency histogram\n");    // NOLINT(cert-err33-c)
+        report_destroy(report);
+        return false;
+    }
+
+    report->results = fopen(options->results_file, "w");
+
+    if(report->results == NULL)
+    {
         perror("Unable to open results file");
-        pthread_exit(NULL);
+        report_destroy(report);
+        return false;
+    }
+
+    fprintf(report->results, "second,sent,completed,errors,throughput,p50_us,p90_us,p99_us,p999_us,max_us\n");   // NOLINT(cert-err33-c)
+
+    return true;
+}
+
+static void report_interval(struct report *report, struct generator *generators, const struct options *options, uint64_t elapsed_ns)
+{
+    uint64_t sent;
+    uint64_t completed;
+    uint64_t errors;
+    double seconds;
+    double throughput;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+
+    sent = 0;
+    completed = 0;
+    errors = 0;
+
+    for(int i = 0; i < options->threads; i++)
+    {
+        sent += atomic_load_explicit(&generators[i].stats.sent, memory_order_relaxed);
+        completed += atomic_load_explicit(&generators[i].stats.completed, memory_order_relaxed);
+        errors += atomic_load_explicit(&generators[i].stats.errors, memory_order_relaxed);
+    }
+
+    collect_latency(report, generators, options);
+    seconds = (double)(elapsed_ns - report->last_elapsed_ns) / (double)NANOSECONDS_PER_SECOND;
+    throughput = seconds > 0 ? (double)(completed - report->last_completed) / seconds : 0;
+    p50 = (double)histogram_value_at_percentile(&report->interval, PERCENTILE_50) / NANOSECONDS_PER_MICROSECOND;
+    p90 = (double)histogram_value_at_percentile(&report->interval, PERCENTILE_90) / NANOSECONDS_PER_MICROSECOND;
+    p99 = (double)histogram_value_at_percentile(&report->interval, PERCENTILE_99) / NANOSECONDS_PER_MICROSECOND;
+    p999 = (double)histogram_value_at_percentile(&report->interval, PERCENTILE_999) / NANOSECONDS_PER_MICROSECOND;
+    max = (double)report->interval.max / NANOSECONDS_PER_MICROSECOND;
+    printf("%3" PRIu64 " s: %" PRIu64 " sent, %.0f/s, %" PRIu64 " errors, latency us p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n", elapsed_ns / NANOSECONDS_PER_SECOND, sent - report->last_sent, throughput, errors - report->last_errors, p50, p90, p99, p999, max);
+    fprintf(report->results, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", elapsed_ns / NANOSECONDS_PER_SECOND, sent - report->last_sent, completed - report->last_completed, errors - report->last_errors, throughput, p50, p90, p99, p999, max);  // NOLINT(cert-err33-c)
+    fflush(stdout);     // NOLINT(cert-err33-c)
+    report->last_sent = sent;
+    report->last_completed = completed;
+    report->last_errors = errors;
+    report->last_elapsed_ns = elapsed_ns;
+}
+
+/**
+ * the summary is a header and a single row so runs against different server builds can be concatenated and compared
+ * */
+static bool report_final(struct report *report, struct generator *generators, const struct options *options, const struct request *request, uint64_t elapsed_ns)
+{
+    uint64_t sent;
+    uint64_t completed;
+    uint64_t errors;
+    double throughput;
+    FILE *summary;
+    FILE *histogram_log;
+
+    sent = 0;
+    completed = 0;
+    errors = 0;
+
+    for(int i = 0; i < options->threads; i++)
+    {
+        sent += atomic_load_explicit(&generators[i].stats.sent, memory_order_relaxed);
+        completed += atomic_load_explicit(&generators[i].stats.completed, memory_order_relaxed);
+        errors += atomic_load_explicit(&generators[i].stats.errors, memory_order_relaxed);
+    }
+
+    // replies that came in while draining after the last interval
+    collect_latency(report, generators, options);
+    throughput = (double)completed / ((double)elapsed_ns / (double)NANOSECONDS_PER_SECOND);
+    printf("total: %" PRIu64 " sent, %" PRIu64 " completed (%.0f/s), %" PRIu64 " errors\n", sent, completed, throughput, errors);
+    printf("latency us: mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+           histogram_mean(&report->total) / NANOSECONDS_PER_MICROSECOND,
+           (double)histogram_value_at_percentile(&report->total, PERCENTILE_50) / NANOSECONDS_PER_MICROSECOND,
+           (double)histogram_value_at_percentile(&report->total, PERCENTILE_90) / NANOSECONDS_PER_MICROSECOND,
+           (double)histogram_value_at_percentile(&report->total, PERCENTILE_99) / NANOSECONDS_PER_MICROSECOND,
+           (double)histogram_value_at_percentile(&report->total, PERCENTILE_999) / NANOSECONDS_PER_MICROSECOND,
+           (double)report->total.max / NANOSECONDS_PER_MICROSECOND);
+    summary = fopen(options->summary_file, "w");
+
+    if(summary == NULL)
+    {
+        perror("Unable to open summary file");
+        return false;
+    }
+
+    fprintf(summary, "connections,idle,threads,rate,duration,request_bytes,sent,completed,errors,throughput,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");    // NOLINT(cert-err33-c)
+    fprintf(summary, "%d,%d,%d,%.0f,%d,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",   // NOLINT(cert-err33-c)
+            options->connections, options->idle, options->threads, options->rate, options->duration, request->len, sent, completed, errors, throughput,
+            histogram_mean(&report->total) / NANOSECONDS_PER_MICROSECOND,
+            (double)histogram_value_at_percentile(&report->total, PERCENTILE_50) / NANOSECONDS_PER_MICROSECOND,
+            (double)histogram_value_at_percentile(&report->total, PERCENTILE_90) / NANOSECONDS_PER_MICROSECOND,
+            (double)histogram_value_at_percentile(&report->total, PERCENTILE_99) / NANOSECONDS_PER_MICROSECOND,
+            (double)histogram_value_at_percentile(&report->total, PERCENTILE_999) / NANOSECONDS_PER_MICROSECOND,
+            (double)report->total.max / NANOSECONDS_PER_MICROSECOND);
+    fclose(summary);    // NOLINT(cert-err33-c)
+    histogram_log = fopen(options->histogram_file, "w");
+
+    if(histogram_log == NULL)
+    {
+        perror("Unable to open histogram file");
+        return false;
+    }
+
+    histogram_write_percentiles(&report->total, histogram_log, NANOSECONDS_PER_MICROSECOND);
+    fclose(histogram_log);  // NOLINT(cert-err33-c)
+
+    return true;
+}
+
+static void report_destroy(struct report *report)
+{
+    if(report->results != NULL)
+    {
+        fclose(report->results);    // NOLINT(cert-err33-c)
+    }
+
+    histogram_destroy(&report->interval);
+    histogram_destroy(&report->total);
+}
+
+/**
+ * moves what the threads recorded since the last call into interval and total
+ * */
+static void collect_latency(struct report *report, struct generator *generators, const struct options *options)
+{
+    histogram_reset(&report->interval);
+
+    for(int i = 0; i < options->threads; i++)
+    {
+        struct lt_stats *stats;
+
+        stats = &generators[i].stats;
+        pthread_mutex_lock(&stats->lock);
+        histogram_add(&report->interval, &stats->latency);
+        histogram_reset(&stats->latency);
+        pthread_mutex_unlock(&stats->lock);
     }
 
-    time_t current_time = time(NULL);
-    double time_taken = difftime(current_time, start_time);
-    fprintf(fp, "%.0f,%ld\n", time_taken, bytes_recv);
+    histogram_add(&report->total, &report->interval);
+}
+
+static void destroy_generators(struct generator *generators, const struct options *options)
+{
+    for(int i = 0; i < options->threads; i++)
+    {
+        struct generator *generator;
 
-    fclose(fp);
-    pthread_exit(NULL);
+        generator = &generators[i];
+
+        if(generator->connections != NULL)
+        {
+            for(int j = 0; j < generator->num_connections; j++)
+            {
+                if(generator->connections[j].fd != -1)
+                {
+                    close(generator->connections[j].fd);
+                }
+
+                free(generator->connections[j].out);
+                free(generator->connections[j].inflight);
+            }
+
+            free(generator->connections);
+        }
+
+        histogram_destroy(&generator->stats.latency);
+        pthread_mutex_destroy(&generator->stats.lock);
+
+        if(generator->timer_fd > 0)
+        {
+            close(generator->timer_fd);
+        }
+
+        if(generator->epfd > 0)
+        {
+            close(generator->epfd);
+        }
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+static void sleep_until(uint64_t when_ns)
+{
+    struct timespec when;
+
+    when.tv_sec = (time_t)(when_ns / NANOSECONDS_PER_SECOND);
+    when.tv_nsec = (long)(when_ns % NANOSECONDS_PER_SECOND);
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &when, NULL) == EINTR)
+    {
+    }
 }
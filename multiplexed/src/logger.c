@@ -0,0 +1,454 @@
+#include "logger.h"
+#include "spsc_queue.h"
+#include <dc_c/dc_stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdalign.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+
+#define MAX_THREADS 256
+#define RECORDS_PER_THREAD 4096
+#define MESSAGE_SIZE 240
+#define BATCH_SIZE 65536
+// a message can double in size when it is escaped, plus the time, thread and level columns
+#define MAX_LINE_SIZE (MESSAGE_SIZE * 2 + 64)
+#define IDLE_SLEEP_NS 5000000L
+#define NANOSECONDS_PER_SECOND UINT64_C(1000000000)
+
+
+struct log_record
+{
+    uint64_t time_ns;
+    uint32_t level;
+    uint32_t len;
+    char message[MESSAGE_SIZE];
+};
+
+/**
+ * each logging thread gets its own ring the first time it logs, so producers never contend with each other
+ * rings are only added, the writer sees one once num_queues has been published
+ * err is the logger's own so registering a thread never touches an error another thread is using
+ * */
+struct logger
+{
+    const struct dc_env *env;
+    struct dc_error *err;
+    char *batch;
+    int fd;
+    bool close_fd;
+    enum log_level level;
+    bool running;
+    atomic_bool stop;
+    pthread_t thread;
+    pthread_mutex_t register_lock;
+    struct spsc_queue *queues[MAX_THREADS];
+    void *queue_storage[MAX_THREADS];
+    atomic_size_t num_queues;
+    atomic_uint_fast64_t dropped;
+};
+
+
+static struct spsc_queue *register_thread(void);
+static void *writer_main(void *arg);
+static size_t drain(char *batch, size_t used);
+static size_t format_record(char *line, const struct log_record *record, size_t thread);
+static void write_batch(const char *batch, size_t len);
+static uint64_t now_ns(void);
+
+
+static const char *const level_names[] =
+{
+    "error",
+    "warn",
+    "info",
+    "debug",
+    "trace",
+};
+
+static struct logger logger =   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+{
+    .fd = -1,
+    .register_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Thread_local struct spsc_queue *thread_queue = NULL;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+
+void logger_init(const struct dc_env *env, struct dc_error *err, const char *path, enum log_level level)
+{
+    sigset_t all_signals;
+    sigset_t old_signals;
+    int ret;
+
+    DC_TRACE(env);
+    logger.env = env;
+    logger.err = dc_error_create(true);
+    logger.level = level;
+    logger.batch = dc_malloc(env, err, BATCH_SIZE);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    logger.fd = STDOUT_FILENO;
+    logger.close_fd = false;
+
+    if(path != NULL)
+    {
+        logger.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);   // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg,hicpp-signed-bitwise,cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+        if(logger.fd == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            dc_free(env, logger.batch);
+            logger.batch = NULL;
+            return;
+        }
+
+        logger.close_fd = true;
+
+        // a new file gets the column names
+        if(lseek(logger.fd, 0, SEEK_END) == 0)
+        {
+            static const char header[] = "time,thread,level,message\n";
+
+            write_batch(header, sizeof(header) - 1);
+        }
+    }
+
+    // the writer blocks every signal so ctrl-c always reaches the thread that is waiting for it
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+    atomic_store(&logger.stop, false);
+    ret = pthread_create(&logger.thread, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    if(ret != 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, ret);
+
+        if(logger.close_fd)
+        {
+            close(logger.fd);
+        }
+
+        logger.fd = -1;
+        dc_free(env, logger.batch);
+        logger.batch = NULL;
+        return;
+    }
+
+    logger.running = true;
+}
+
+void logger_shutdown(void)
+{
+    size_t num_queues;
+
+    if(!(logger.running))
+    {
+        return;
+    }
+
+    atomic_store(&logger.stop, true);
+    pthread_join(logger.thread, NULL);
+    logger.running = false;
+    num_queues = atomic_load(&logger.num_queues);
+
+    for(size_t i = 0; i < num_queues; i++)
+    {
+        spsc_queue_destroy(logger.env, logger.queues[i]);
+        dc_free(logger.env, logger.queue_storage[i]);
+        logger.queues[i] = NULL;
+        logger.queue_storage[i] = NULL;
+    }
+
+    atomic_store(&logger.num_queues, 0);
+
+    if(logger.close_fd)
+    {
+        close(logger.fd);
+    }
+
+    logger.fd = -1;
+    dc_free(logger.env, logger.batch);
+    logger.batch = NULL;
+}
+
+bool logger_enabled(enum log_level level)
+{
+    return logger.running && level <= logger.level;
+}
+
+void logger_write(enum log_level level, const char *format, ...)
+{
+    struct log_record record;
+    va_list args;
+    int len;
+
+    if(!(logger_enabled(level)))
+    {
+        return;
+    }
+
+    if(thread_queue == NULL)
+    {
+        thread_queue = register_thread();
+
+        if(thread_queue == NULL)
+        {
+            atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    va_start(args, format);
+    len = vsnprintf(record.message, sizeof(record.message), format, args);
+    va_end(args);
+    record.time_ns = now_ns();
+    record.level = (uint32_t)level;
+    record.len = len < 0 ? 0 : (len >= (int)sizeof(record.message) ? (uint32_t)sizeof(record.message) - 1 : (uint32_t)len);
+
+    if(!(spsc_queue_push(thread_queue, &record)))
+    {
+        atomic_fetch_add_explicit(&logger.dropped, 1, memory_order_relaxed);
+    }
+}
+
+bool logger_parse_level(const char *name, enum log_level *level)
+{
+    for(size_t i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++)
+    {
+        if(strcmp(name, level_names[i]) == 0)
+        {
+            *level = (enum log_level)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * runs once per thread, the lock only serialises registration and never touches the logging path
+ * */
+static struct spsc_queue *register_thread(void)
+{
+    struct spsc_queue *queue;
+    void *storage;
+    size_t num_queues;
+
+    queue = NULL;
+    pthread_mutex_lock(&logger.register_lock);
+    num_queues = atomic_load_explicit(&logger.num_queues, memory_order_relaxed);
+
+    if(num_queues < MAX_THREADS)
+    {
+        // one spare queue so the ring can be moved up to a cache line boundary, its indices are alignas(64)
+        storage = dc_calloc(logger.env, logger.err, 2, sizeof(struct spsc_queue));
+
+        if(storage != NULL)
+        {
+            uintptr_t aligned;
+
+            aligned = ((uintptr_t)storage + alignof(struct spsc_queue) - 1) & ~(uintptr_t)(alignof(struct spsc_queue) - 1);
+            queue = (struct spsc_queue *)aligned;   // NOLINT(performance-no-int-to-ptr)
+            spsc_queue_init(logger.env, logger.err, queue, RECORDS_PER_THREAD, sizeof(struct log_record));
+
+            if(dc_error_has_error(logger.err))
+            {
+                dc_free(logger.env, storage);
+                dc_error_reset(logger.err);
+                queue = NULL;
+            }
+            else
+            {
+                logger.queues[num_queues] = queue;
+                logger.queue_storage[num_queues] = storage;
+                atomic_store_explicit(&logger.num_queues, num_queues + 1, memory_order_release);
+            }
+        }
+        else
+        {
+            dc_error_reset(logger.err);
+        }
+    }
+
+    pthread_mutex_unlock(&logger.register_lock);
+
+    return queue;
+}
+
+/**
+ * sweeps every ring into one batch and writes it with a single write(), then sleeps briefly if there was nothing to do
+ * once asked to stop it makes one last sweep so nothing that was logged before the stop is lost
+ * */
+static void *writer_main(void *arg)
+{
+    char *batch;
+    uint64_t reported;
+
+    (void)arg;
+    batch = logger.batch;
+    reported = 0;
+
+    for(;;)
+    {
+        bool stopping;
+        uint64_t dropped;
+        size_t used;
+
+        stopping = atomic_load(&logger.stop);
+        used = drain(batch, 0);
+        dropped = atomic_load_explicit(&logger.dropped, memory_order_relaxed);
+
+        if(dropped != reported)
+        {
+            struct log_record record;
+
+            record.time_ns = now_ns();
+            record.level = LOG_LEVEL_WARN;
+            record.len = (uint32_t)snprintf(record.message, sizeof(record.message), "dropped %" PRIu64 " log records, the rings were full", dropped - reported);
+
+            if(used + MAX_LINE_SIZE > BATCH_SIZE)
+            {
+                write_batch(batch, used);
+                used = 0;
+            }
+
+            used += format_record(&batch[used], &record, MAX_THREADS);
+            reported = dropped;
+        }
+
+        write_batch(batch, used);
+
+        if(stopping)
+        {
+            break;
+        }
+
+        if(used == 0)
+        {
+            struct timespec idle;
+
+            idle.tv_sec = 0;
+            idle.tv_nsec = IDLE_SLEEP_NS;
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+static size_t drain(char *batch, size_t used)
+{
+    size_t num_queues;
+
+    num_queues = atomic_load_explicit(&logger.num_queues, memory_order_acquire);
+
+    for(size_t i = 0; i < num_queues; i++)
+    {
+        struct log_record record;
+
+        while(spsc_queue_pop(logger.queues[i], &record))
+        {
+            if(used + MAX_LINE_SIZE > BATCH_SIZE)
+            {
+                write_batch(batch, used);
+                used = 0;
+            }
+
+            used += format_record(&batch[used], &record, i);
+        }
+    }
+
+    return used;
+}
+
+/**
+ * the message is quoted with embedded quotes doubled, newlines become \n and other control characters a space,
+ * so every record is exactly one line
+ * */
+static size_t format_record(char *line, const struct log_record *record, size_t thread)
+{
+    int prefix;
+    size_t len;
+
+    prefix = snprintf(line, MAX_LINE_SIZE, "%" PRIu64 ".%09" PRIu64 ",%zu,%s,\"", record->time_ns / NANOSECONDS_PER_SECOND, record->time_ns % NANOSECONDS_PER_SECOND, thread, level_names[record->level]);
+    len = prefix < 0 ? 0 : (size_t)prefix;
+
+    for(uint32_t i = 0; i < record->len; i++)
+    {
+        char c;
+
+        c = record->message[i];
+
+        if(c == '"')
+        {
+            line[len++] = '"';
+            line[len++] = '"';
+        }
+        else if(c == '\n')
+        {
+            line[len++] = '\\';
+            line[len++] = 'n';
+        }
+        else if((unsigned char)c < ' ')
+        {
+            line[len++] = ' ';
+        }
+        else
+        {
+            line[len++] = c;
+        }
+    }
+
+    line[len++] = '"';
+    line[len++] = '\n';
+
+    return len;
+}
+
+static void write_batch(const char *batch, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t written;
+
+        written = write(logger.fd, batch, len);
+
+        if(written == -1)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            return;
+        }
+
+        batch += written;
+        len -= (size_t)written;
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
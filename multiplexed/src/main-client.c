@@ -1,78 +1,500 @@
 #include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include "endpoint.h"
 
-#define SERVER_PORT 4981
 #define BUF_SIZE 256
+#define PROTOCOL_VERSION 1
+#define HELLO_SIZE 4
+#define HELLO_MAGIC 0xFF
+#define HELLO_NAME "WC"
+#define HELLO_REPLY_NAME "WS"
+#define REQUEST_HEADER_SIZE 8
+#define RESPONSE_HEADER_SIZE 12
+#define COUNT_SIZE 8
+
+/*
+ * every line of stdin is one request, --frame has to match the server's
+ * none, the default, sends a line at a time and reads back the echo and count the unframed server answers each read with
+ * line needs the server to run with --frame line, every reply is one line
+ * binary asks a framed server for the binary protocol, each request then carries an id and each reply a status and a 64 bit
+ * count, if the server turns it down the client falls back to lines
+ * with --pipeline N up to N lines go out in a single send before the client waits for their N replies, the unframed protocol
+ * cannot tell where one request ends so it stays at one
+ * the server is an IPv4 address with an optional :PORT, or unix:PATH or unix:@NAME for a server on the same host
+ */
+
+enum client_frame
+{
+    CLIENT_FRAME_NONE,
+    CLIENT_FRAME_LINE,
+    CLIENT_FRAME_BINARY,
+};
+
+static int parse_frame(const char *name, enum client_frame *frame);
+static int negotiate(int sockfd);
+static int send_all(int sockfd, const char *data, size_t len);
+static int read_echo_reply(int sockfd, size_t len);
+static int read_replies(int sockfd, char *pending, size_t *pending_len, size_t expected);
+static int read_binary_replies(int sockfd, uint32_t first_id, size_t expected);
+static int recv_all(int sockfd, unsigned char *data, size_t len);
+static void put_be32(char *bytes, uint32_t value);
+static uint32_t get_be32(const unsigned char *bytes);
 
 int main(int argc, char *argv[])
 {
+    static const struct option long_options[] =
+    {
+        {"frame", required_argument, NULL, 'f'},
+        {"pipeline", required_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0},
+    };
     int sockfd;
-    struct sockaddr_in server_addr;
-    char buffer[BUF_SIZE];
+    struct endpoint server;
+    char pending[BUF_SIZE];
+    size_t pending_len;
+    char *batch;
+    size_t batch_len;
+    size_t batch_cap;
+    char *line;
+    size_t line_cap;
+    long pipeline;
+    enum client_frame frame;
+    int opt;
+    int eof;
+    int binary;
+    uint32_t next_id;
+
+    pipeline = 1;
+    frame = CLIENT_FRAME_NONE;
 
-    if (argc < 2)
+    while ((opt = getopt_long(argc, argv, "f:p:", long_options, NULL)) != -1)
     {
-        printf("Usage: %s <server_ip>\n", argv[0]);
-        return EXIT_FAILURE;
-    }
+        char *end;
+
+        if (opt == 'f')
+        {
+            if (!parse_frame(optarg, &frame))
+            {
+                printf("Usage: %s [--frame none | line | binary] [--pipeline N] <server>\n", argv[0]);
+                return EXIT_FAILURE;
+            }
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+            continue;
+        }
 
-    if (sockfd < 0)
+        if (opt != 'p')
+        {
+            printf("Usage: %s [--frame none | line | binary] [--pipeline N] <server>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        pipeline = strtol(optarg, &end, 10);
+
+        if (*end != '\0' || pipeline < 1)
+        {
+            printf("Usage: %s [--frame none | line | binary] [--pipeline N] <server>\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || (frame == CLIENT_FRAME_NONE && pipeline > 1))
     {
-        perror("socket");
+        printf("Usage: %s [--frame none | line | binary] [--pipeline N] <server>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-
-    if (inet_pton(AF_INET, argv[1], &server_addr.sin_addr) <= 0)
+    if (!endpoint_parse(argv[optind], ENDPOINT_DEFAULT_PORT, &server))
     {
-        perror("inet_pton");
+        if (errno == ENAMETOOLONG)
+        {
+            fprintf(stderr, "%s: a unix socket path or name can be at most %zu bytes\n", argv[optind], ENDPOINT_PATH_MAX);
+        }
+
+        printf("Usage: %s [--frame none | line | binary] [--pipeline N] <server>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
-    if (connect(sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0)
+    sockfd = endpoint_connect(&server);
+
+    if (sockfd < 0)
     {
         perror("connect");
         return EXIT_FAILURE;
     }
 
     printf("Connected to server.\n");
+    binary = frame == CLIENT_FRAME_BINARY ? negotiate(sockfd) : 0;
 
-    while(fgets(buffer, BUF_SIZE, stdin) != NULL)
+    if (binary < 0)
     {
-        ssize_t n = send(sockfd, buffer, strlen(buffer), 0);
-        if (n < 0)
+        return EXIT_FAILURE;
+    }
+
+    batch = NULL;
+    batch_cap = 0;
+    line = NULL;
+    line_cap = 0;
+    pending_len = 0;
+    eof = 0;
+    next_id = 0;
+
+    while (!eof)
+    {
+        size_t count;
+        uint32_t first_id;
+
+        batch_len = 0;
+        count = 0;
+        first_id = next_id;
+
+        while (count < (size_t)pipeline)
+        {
+            ssize_t n = getline(&line, &line_cap, stdin);
+
+            if (n < 0)
+            {
+                eof = 1;
+                break;
+            }
+
+            // a last line without a newline still has to end its request, a binary one has a header instead
+            if (batch_len + (size_t)n + REQUEST_HEADER_SIZE > batch_cap)
+            {
+                char *grown;
+
+                batch_cap = (batch_len + (size_t)n + REQUEST_HEADER_SIZE) * 2;
+                grown = realloc(batch, batch_cap);
+
+                if (grown == NULL)
+                {
+                    perror("realloc");
+                    return EXIT_FAILURE;
+                }
+
+                batch = grown;
+            }
+
+            if (binary)
+            {
+                put_be32(&batch[batch_len], (uint32_t)n);
+                put_be32(&batch[batch_len + 4], next_id++);
+                batch_len += REQUEST_HEADER_SIZE;
+            }
+
+            memcpy(&batch[batch_len], line, (size_t)n);
+            batch_len += (size_t)n;
+
+            if (!binary && line[n - 1] != '\n')
+            {
+                batch[batch_len++] = '\n';
+            }
+
+            count++;
+        }
+
+        if (count == 0)
+        {
+            break;
+        }
+
+        if (send_all(sockfd, batch, batch_len) < 0)
         {
             perror("send");
             return EXIT_FAILURE;
         }
 
-        printf("Written to server\n");
-        write(STDOUT_FILENO, buffer, n);
-        ssize_t m = recv(sockfd, buffer, BUF_SIZE, 0);
+        printf("Written %zu request%s to server\n", count, count == 1 ? "" : "s");
+
+        if (frame == CLIENT_FRAME_NONE)
+        {
+            if (read_echo_reply(sockfd, batch_len) < 0)
+            {
+                return EXIT_FAILURE;
+            }
+        }
+        else if (binary ? read_binary_replies(sockfd, first_id, count) < 0 : read_replies(sockfd, pending, &pending_len, count) < 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    free(line);
+    free(batch);
+    close(sockfd);
+
+    return EXIT_SUCCESS;
+}
+
+static int parse_frame(const char *name, enum client_frame *frame)
+{
+    if (strcmp(name, "none") == 0)
+    {
+        *frame = CLIENT_FRAME_NONE;
+    }
+    else if (strcmp(name, "line") == 0)
+    {
+        *frame = CLIENT_FRAME_LINE;
+    }
+    else if (strcmp(name, "binary") == 0)
+    {
+        *frame = CLIENT_FRAME_BINARY;
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * returns 1 for the binary protocol, 0 when the server only offers the line protocol
+ * only a reply named HELLO_REPLY_NAME counts, a peer that echoes the hello back does not speak the protocol
+ */
+static int negotiate(int sockfd)
+{
+    const char hello[HELLO_SIZE] = {(char)HELLO_MAGIC, HELLO_NAME[0], HELLO_NAME[1], PROTOCOL_VERSION};
+    unsigned char reply[HELLO_SIZE];
+
+    if (send_all(sockfd, hello, sizeof(hello)) < 0)
+    {
+        perror("send");
+        return -1;
+    }
+
+    if (recv_all(sockfd, reply, sizeof(reply)) < 0)
+    {
+        return -1;
+    }
+
+    if (reply[0] != HELLO_MAGIC || memcmp(&reply[1], HELLO_REPLY_NAME, 2) != 0)
+    {
+        fprintf(stderr, "the server does not know the handshake, is it running with --frame line or length?\n");
+        return -1;
+    }
+
+    if (reply[3] == 0)
+    {
+        printf("Server turned down the binary protocol, using lines.\n");
+        return 0;
+    }
+
+    printf("Using protocol version %d.\n", reply[3]);
+
+    return 1;
+}
+
+static int send_all(int sockfd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(sockfd, data, len, 0);
+
+        if (n < 0)
+        {
+            return -1;
+        }
+
+        data += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/*
+ * the unframed server sends back what it read followed by the count as a native int,
+ * a line is small enough to arrive in one read so its echo is exactly what was sent
+ */
+static int read_echo_reply(int sockfd, size_t len)
+{
+    unsigned char echo[BUF_SIZE];
+    int word_count;
+
+    while (len > 0)
+    {
+        size_t chunk = len < sizeof(echo) ? len : sizeof(echo);
+
+        if (recv_all(sockfd, echo, chunk) < 0)
+        {
+            return -1;
+        }
+
+        len -= chunk;
+    }
+
+    if (recv_all(sockfd, (unsigned char *)&word_count, sizeof(word_count)) < 0)
+    {
+        return -1;
+    }
+
+    printf("Word count: %d\n", word_count);
+
+    return 0;
+}
+
+/*
+ * replies can arrive split across reads or several to a read, anything past the last one expected is kept for the next batch
+ */
+static int read_replies(int sockfd, char *pending, size_t *pending_len, size_t expected)
+{
+    while (expected > 0)
+    {
+        char *newline = memchr(pending, '\n', *pending_len);
+
+        if (newline != NULL)
+        {
+            size_t used = (size_t)(newline - pending) + 1;
+
+            *newline = '\0';
+            printf("Word count: %s\n", pending);
+            memmove(pending, &pending[used], *pending_len - used);
+            *pending_len -= used;
+            expected--;
+            continue;
+        }
+
+        if (*pending_len == BUF_SIZE)
+        {
+            fprintf(stderr, "reply too long, is the server running with --frame line?\n");
+            return -1;
+        }
+
+        ssize_t m = recv(sockfd, &pending[*pending_len], BUF_SIZE - *pending_len, 0);
 
         if (m < 0)
         {
             perror("recv");
-            return EXIT_FAILURE;
+            return -1;
         }
 
-        buffer[m] = '\0';
-        int word_count = atoi(buffer);
-        printf("Word count: %d\n", word_count);
+        if (m == 0)
+        {
+            fprintf(stderr, "server closed the connection\n");
+            return -1;
+        }
 
+        *pending_len += (size_t)m;
     }
 
-    close(sockfd);
+    return 0;
+}
 
-    return EXIT_SUCCESS;
+/*
+ * the ids of a batch run from first_id, so a reply finds its line by id whatever order the replies come back in
+ */
+static int read_binary_replies(int sockfd, uint32_t first_id, size_t expected)
+{
+    uint64_t *counts;
+    int ok = 0;
+
+    counts = calloc(expected, sizeof(*counts));
+
+    if (counts == NULL)
+    {
+        perror("calloc");
+        return -1;
+    }
+
+    for (size_t received = 0; received < expected && ok == 0; received++)
+    {
+        unsigned char header[RESPONSE_HEADER_SIZE];
+        unsigned char body[COUNT_SIZE];
+        uint32_t body_len;
+        uint32_t slot;
+        unsigned int status;
+
+        if (recv_all(sockfd, header, sizeof(header)) < 0)
+        {
+            ok = -1;
+            break;
+        }
+
+        body_len = get_be32(header);
+        slot = get_be32(&header[4]) - first_id;
+        status = ((unsigned int)header[8] << 8U) | header[9];
+
+        if (slot >= expected || body_len != (status == 0 ? COUNT_SIZE : 0))
+        {
+            fprintf(stderr, "unexpected reply for request %u\n", (unsigned int)get_be32(&header[4]));
+            ok = -1;
+            break;
+        }
+
+        if (status != 0)
+        {
+            fprintf(stderr, "request %u failed with status %u\n", (unsigned int)(first_id + slot), status);
+            counts[slot] = UINT64_MAX;
+            continue;
+        }
+
+        if (recv_all(sockfd, body, sizeof(body)) < 0)
+        {
+            ok = -1;
+            break;
+        }
+
+        counts[slot] = ((uint64_t)get_be32(body) << 32U) | get_be32(&body[4]);
+    }
+
+    for (size_t i = 0; i < expected && ok == 0; i++)
+    {
+        if (counts[i] != UINT64_MAX)
+        {
+            printf("Word count: %llu\n", (unsigned long long)counts[i]);
+        }
+    }
+
+    free(counts);
+
+    return ok;
+}
+
+static int recv_all(int sockfd, unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t m = recv(sockfd, data, len, 0);
+
+        if (m < 0)
+        {
+            perror("recv");
+            return -1;
+        }
+
+        if (m == 0)
+        {
+            fprintf(stderr, "server closed the connection\n");
+            return -1;
+        }
+
+        data += m;
+        len -= (size_t)m;
+    }
+
+    return 0;
+}
+
+static void put_be32(char *bytes, uint32_t value)
+{
+    uint32_t network = htonl(value);
+
+    memcpy(bytes, &network, sizeof(network));
+}
+
+static uint32_t get_be32(const unsigned char *bytes)
+{
+    uint32_t network;
+
+    memcpy(&network, bytes, sizeof(network));
+
+    return ntohl(network);
 }
@@ -0,0 +1,2053 @@
+#include <dc_c/dc_signal.h>
+#include <dc_c/dc_stdio.h>
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include "admission.h"
+#include "buffer_pool.h"
+#include "conn_table.h"
+#include "count_pool.h"
+#include "endpoint.h"
+#include "listeners.h"
+#include "logger.h"
+#include "metrics.h"
+#include "spsc_queue.h"
+#include "sysio.h"
+#include "timeouts.h"
+#include "trace.h"
+
+
+#define INITIAL_CLIENTS 1024
+#define MAX_EVENTS 64
+#define BUFFER_SIZE 65536
+#define HANDOFF_QUEUE_SIZE 4096
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define DESCRIPTION_SIZE 512
+
+
+enum balance
+{
+    BALANCE_ROUND_ROBIN,
+    BALANCE_LEAST_LOADED,
+};
+
+struct options
+{
+    struct listeners listeners;
+    int backlog;
+    int accept_batch;
+    int max_clients;
+    bool edge_triggered;
+    int num_threads;
+    bool pin_threads;
+    bool acceptor;
+    enum balance balance;
+    enum frame_mode frame_mode;
+    size_t high_water;
+    int count_threads;
+    enum count_schedule count_schedule;
+    size_t offload_threshold;
+    const char *log_file;
+    enum log_level log_level;
+    uint16_t metrics_port;
+    struct timeouts timeouts;
+};
+
+/**
+ * what send_reply needs to answer the requests completed by one read
+ * */
+struct read_context
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct metrics_shard *metrics;
+    struct reactor *reactor;
+    struct connection *connection;
+    struct out_batch *replies;
+    const char *buffer;
+    size_t bytes_read;
+};
+
+/**
+ * an accepted socket on its way from the acceptor to a worker, stamped so the worker can measure the handoff latency
+ * */
+struct handoff
+{
+    int fd;
+    uint64_t enqueued_ns;
+};
+
+/**
+ * only the owning reactor writes these, the acceptor reads num_clients for least-loaded balancing
+ * */
+struct reactor_stats
+{
+    atomic_int num_clients;
+    atomic_uint_fast64_t total_clients;
+    atomic_uint_fast64_t handoffs;
+    atomic_uint_fast64_t handoff_ns_total;
+    atomic_uint_fast64_t handoff_ns_max;
+};
+
+/**
+ * one event loop, each reactor owns its listeners, its epoll set and its client table so nothing is shared on the hot path
+ * the exception is a unix listener, which cannot be bound twice, every reactor watches a dup() of reactor 0's one
+ * in acceptor mode the reactor has no listeners and is fed through its handoff queue, wake_fd tells it there is work
+ * reactor 0 also answers scrapes of the metrics port, which read every reactor's shard
+ * the wheel holds the timeouts of this reactor's clients, keyed by their slot in the client table
+ * accepting mirrors whether the listeners are registered for EPOLLIN, it is dropped while admission has accepting paused
+ * pool is shared by every reactor and NULL unless --count-threads is given, counted jobs come back through completions
+ * buffers is this reactor's cache in front of the shared buffer pool, every output ring and stash of its clients comes from it
+ * */
+struct reactor
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    const struct options *options;
+    struct metrics *metrics;
+    struct metrics_shard *shard;
+    struct count_pool *pool;
+    pthread_t thread;
+    int id;
+    struct listeners listeners;
+    int metrics_listener;
+    int epfd;
+    int shutdown_fd;
+    int wake_fd;
+    struct conn_table clients;
+    struct buffer_cache buffers;
+    struct timer_wheel wheel;
+    struct admission admission;
+    struct spsc_queue handoff_queue;
+    struct count_completions completions;
+    struct reactor_stats stats;
+    bool accepting;
+    bool started;
+    bool running;
+};
+
+/**
+ * what the metrics sampler reads, count is NULL unless --count-threads is given
+ * */
+struct sampled_pools
+{
+    struct count_pool *count;
+    struct buffer_pool *buffers;
+};
+
+/**
+ * owns the only listeners in acceptor mode and hands every accepted socket to one of the workers
+ * */
+struct acceptor
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    const struct options *options;
+    struct metrics_shard *shard;
+    struct reactor *workers;
+    struct admission admission;
+    pthread_t thread;
+    struct listeners listeners;
+    int epfd;
+    int shutdown_fd;
+    int next_worker;
+    uint64_t rejected;
+    bool started;
+    bool running;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
+static int setup_epoll(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, int shutdown_fd);
+static void watch_fd(struct dc_env *env, struct dc_error *err, int epfd, int fd, uint32_t events);
+static void setup_reactors(struct dc_error *err, struct reactor *reactors, struct metrics *metrics, struct count_pool *pool, struct buffer_pool *buffers, const struct options *options, int shutdown_fd);
+static void setup_metrics_listener(struct dc_error *err, struct reactor *reactor, uint16_t port);
+static void setup_acceptor(struct dc_error *err, struct acceptor *acceptor, struct reactor *workers, struct metrics *metrics, const struct options *options, int shutdown_fd);
+static void start_thread(struct dc_error *err, pthread_t *thread, bool *started, void *(*thread_main)(void *), void *arg, int cpu);
+static void start_reactors(struct dc_error *err, struct reactor *reactors, const struct options *options);
+static void destroy_reactors(struct reactor *reactors, struct count_pool *pool, const struct options *options);
+static void release_jobs(struct reactor *reactor);
+static void destroy_acceptor(struct acceptor *acceptor);
+static void print_stats(const struct reactor *reactors, const struct acceptor *acceptor, const struct options *options);
+static void sample_pools(void *arg, uint64_t values[METRICS_SAMPLED_COUNT]);
+static void wait_for_shutdown(struct dc_error *err, const sigset_t *signals, int shutdown_fd);
+static uint64_t now_ns(void);
+static void *reactor_main(void *arg);
+static void *acceptor_main(void *arg);
+static void run_server(struct reactor *reactor);
+static void run_acceptor(struct acceptor *acceptor);
+static int wait_for_data(struct dc_env *env, struct dc_error *err, int epfd, struct epoll_event *events, int timeout);
+static void handle_new_connections(struct reactor *reactor, size_t index);
+static void update_accepting(struct reactor *reactor);
+static void handle_handoffs(struct reactor *reactor);
+static void handle_completions(struct reactor *reactor);
+static void finish_offload(struct reactor *reactor, const struct count_job *job);
+static void handle_metrics_connection(struct reactor *reactor);
+static void hand_off_connections(struct acceptor *acceptor, size_t index);
+static struct reactor *choose_worker(struct acceptor *acceptor);
+static void add_client(struct reactor *reactor, int client_fd);
+static void handle_client_data(struct reactor *reactor, int client_fd, uint32_t events);
+static bool update_interest(struct reactor *reactor, struct connection *connection);
+static void close_client(struct reactor *reactor, int client_fd);
+static void drop_job(struct reactor *reactor, struct connection *connection);
+static bool awaiting_count(const struct connection *connection);
+static void expire_client(void *arg, size_t id);
+static bool process_request(struct reactor *reactor, struct connection *connection, const char *buffer, size_t bytes_read);
+static bool send_reply(void *arg, const struct request *request);
+static bool collect_payload(struct read_context *context, const struct request *request);
+
+
+int main(int argc, char *argv[])
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct options options;
+    struct reactor *reactors;
+    struct reactor *reactor_storage;
+    struct acceptor acceptor;
+    struct metrics metrics;
+    struct count_pool count_pool;
+    struct count_pool *pool;
+    struct buffer_pool buffer_pool;
+    struct sampled_pools sampled;
+    sigset_t signals;
+    char description[DESCRIPTION_SIZE];
+    int shutdown_fd;
+    int ret_val;
+
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--listen tcp:[ADDRESS:]PORT | unix:PATH | unix:@NAME]... [--backlog N] [--accept-batch K] [--max-clients N] [--level-triggered | --edge-triggered] [--threads N] [--pin] [--acceptor [--balance round-robin | least-loaded]] [--frame none | line | length] [--high-water BYTES] [--count-threads N [--count-schedule fifo | steal] [--offload-threshold BYTES]] [--log-file PATH] [--log-level error | warn | info | debug | trace] [--metrics-port PORT] [--idle-timeout MS] [--read-timeout MS] [--write-timeout MS]\n", argv[0]);  // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    word_count_init();
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+
+    // the reactors inherit the blocked mask, ctrl-c is only ever seen by sigwait in this thread
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    logger_init(env, err, options.log_file, options.log_level);
+
+    dc_memset(env, &acceptor, 0, sizeof(acceptor));
+    listeners_init(&acceptor.listeners);
+    acceptor.epfd = -1;
+    acceptor.admission.reserve_fd = -1;
+    dc_memset(env, &metrics, 0, sizeof(metrics));
+    buffer_pool_init(env, &buffer_pool);
+    pool = NULL;
+    reactors = NULL;
+
+    // one spare reactor so the first one can be moved up to a cache line boundary, the handoff queues rely on it
+    reactor_storage = dc_error_has_no_error(err) ? dc_calloc(env, err, (size_t)options.num_threads + 1, sizeof(struct reactor)) : NULL;
+
+    if(reactor_storage != NULL)
+    {
+        uintptr_t aligned;
+
+        aligned = ((uintptr_t)reactor_storage + alignof(struct reactor) - 1) & ~(uintptr_t)(alignof(struct reactor) - 1);
+        reactors = (struct reactor *)aligned;   // NOLINT(performance-no-int-to-ptr)
+    }
+
+    // one shard per reactor and one for the acceptor
+    if(dc_error_has_no_error(err))
+    {
+        metrics_init(env, err, &metrics, (size_t)options.num_threads + 1, "epoll");
+    }
+
+    if(dc_error_has_no_error(err) && options.count_threads > 0)
+    {
+        count_pool_init(env, err, &count_pool, options.count_threads, COUNT_POOL_CHUNK_SIZE, options.count_schedule);
+        pool = &count_pool;
+    }
+
+    sampled.count = pool;
+    sampled.buffers = &buffer_pool;
+    metrics_set_sampler(&metrics, sample_pools, &sampled);
+
+    if(dc_error_has_no_error(err))
+    {
+        shutdown_fd = eventfd(0, EFD_CLOEXEC);
+
+        if(shutdown_fd == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+        else
+        {
+            setup_reactors(err, reactors, &metrics, pool, &buffer_pool, &options, shutdown_fd);
+
+            if(dc_error_has_no_error(err) && options.metrics_port != 0)
+            {
+                setup_metrics_listener(err, &reactors[0], options.metrics_port);
+            }
+
+            if(dc_error_has_no_error(err) && options.acceptor)
+            {
+                setup_acceptor(err, &acceptor, reactors, &metrics, &options, shutdown_fd);
+            }
+
+            if(dc_error_has_no_error(err))
+            {
+                listeners_describe(options.acceptor ? &acceptor.listeners : &reactors[0].listeners, description, sizeof(description));
+                printf("epoll server listening on %s (%s-triggered, %d thread%s%s)\n", description, options.edge_triggered ? "edge" : "level", options.num_threads, options.num_threads == 1 ? "" : "s", options.acceptor ? " behind an acceptor" : "");
+                start_reactors(err, reactors, &options);
+
+                if(dc_error_has_no_error(err) && options.acceptor)
+                {
+                    start_thread(err, &acceptor.thread, &acceptor.started, acceptor_main, &acceptor, -1);
+                }
+
+                wait_for_shutdown(err, &signals, shutdown_fd);
+            }
+
+            destroy_acceptor(&acceptor);
+            destroy_reactors(reactors, pool, &options);
+            pool = NULL;
+            print_stats(reactors, &acceptor, &options);
+            dc_close(env, err, shutdown_fd);
+        }
+
+        metrics_destroy(env, &metrics);
+    }
+
+    // the reactors never started, so no job can be in flight
+    if(pool != NULL)
+    {
+        count_pool_destroy(env, pool);
+    }
+
+    if(reactor_storage != NULL)
+    {
+        dc_free(env, reactor_storage);
+    }
+
+    buffer_pool_destroy(env, &buffer_pool);
+
+    logger_shutdown();
+
+    if(dc_error_has_no_error(err))
+    {
+        ret_val = EXIT_SUCCESS;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR (%d) %s\n", dc_errno_get_errno(err), dc_error_get_message(err)); // NOLINT(cert-err33-c)
+        ret_val = EXIT_FAILURE;
+    }
+
+    return ret_val;
+}
+
+/**
+ * level-triggered is the default, it behaves exactly like the poll server
+ * edge-triggered only reports a socket when new data arrives, so every ready socket is drained until EAGAIN
+ * --listen adds a tcp or unix stream endpoint to accept on and can be repeated, LISTENERS_DEFAULT if there is none
+ * --threads N runs N reactors that each bind their own SO_REUSEPORT tcp listeners and share the unix ones, --pin pins reactor i to cpu i
+ * --acceptor keeps a single set of listeners on its own thread that hands sockets to the N reactors instead,
+ * for kernels where SO_REUSEPORT spreads connections unevenly
+ * --backlog sizes each listen queue, --accept-batch caps how many connections are accepted per wakeup
+ * --max-clients stops a reactor accepting at that many clients, new connections wait in the backlog until one leaves
+ * --frame picks how requests are delimited for clients that do not negotiate the binary protocol, none keeps the original one request per read() protocol
+ * --high-water stops reading from a client once that many reply bytes are queued for it
+ * --count-threads N counts length and binary framed requests of at least --offload-threshold bytes on a pool of N threads
+ * instead of on the reactor, off by default, the threshold defaults to 1 MiB
+ * --count-schedule steal (the default) gives each pool thread a deque that idle threads steal chunks from, fifo has them all share one queue
+ * --log-file sends the log to a csv file instead of stdout, --log-level picks how much is logged, the payload only at trace
+ * --metrics-port serves prometheus metrics on that port from reactor 0's loop, off by default
+ * --idle-timeout, --read-timeout and --write-timeout close clients that make no progress for that many milliseconds, all off by default
+ * */
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"listen",          required_argument, NULL, 'L'},
+        {"backlog",         required_argument, NULL, 'B'},
+        {"accept-batch",    required_argument, NULL, 'k'},
+        {"max-clients",     required_argument, NULL, 'c'},
+        {"level-triggered", no_argument,       NULL, 'l'},
+        {"edge-triggered",  no_argument,       NULL, 'e'},
+        {"threads",         required_argument, NULL, 't'},
+        {"pin",             no_argument,       NULL, 'p'},
+        {"acceptor",        no_argument,       NULL, 'a'},
+        {"balance",         required_argument, NULL, 'b'},
+        {"frame",           required_argument, NULL, 'f'},
+        {"high-water",      required_argument, NULL, 'w'},
+        {"count-threads",   required_argument, NULL, 'C'},
+        {"count-schedule",  required_argument, NULL, 'S'},
+        {"offload-threshold", required_argument, NULL, 'T'},
+        {"log-file",        required_argument, NULL, 'o'},
+        {"log-level",       required_argument, NULL, 'v'},
+        {"metrics-port",    required_argument, NULL, 'm'},
+        {"idle-timeout",    required_argument, NULL, 'I'},
+        {"read-timeout",    required_argument, NULL, 'R'},
+        {"write-timeout",   required_argument, NULL, 'W'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    listeners_init(&options->listeners);
+    options->backlog = ADMISSION_DEFAULT_BACKLOG;
+    options->accept_batch = ADMISSION_DEFAULT_BATCH;
+    options->max_clients = 0;
+    options->edge_triggered = false;
+    options->num_threads = 1;
+    options->pin_threads = false;
+    options->acceptor = false;
+    options->balance = BALANCE_ROUND_ROBIN;
+    options->frame_mode = FRAME_NONE;
+    options->high_water = OUT_BUFFER_DEFAULT_HIGH_WATER;
+    options->count_threads = 0;
+    options->count_schedule = COUNT_SCHEDULE_STEAL;
+    options->offload_threshold = COUNT_POOL_DEFAULT_THRESHOLD;
+    options->log_file = NULL;
+    options->log_level = LOG_LEVEL_INFO;
+    options->metrics_port = 0;
+    options->timeouts.idle_ns = 0;
+    options->timeouts.read_ns = 0;
+    options->timeouts.write_ns = 0;
+
+    while((opt = getopt_long(argc, argv, "L:B:k:c:let:pab:f:w:C:S:T:o:v:m:I:R:W:", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'L':
+            {
+                if(!(listeners_add(&options->listeners, optarg)))
+                {
+                    if(errno == ENAMETOOLONG)
+                    {
+                        fprintf(stderr, "%s: a unix socket path or name can be at most %zu bytes\n", optarg, ENDPOINT_PATH_MAX);    // NOLINT(cert-err33-c)
+                    }
+
+                    return false;
+                }
+
+                break;
+            }
+            case 'B':
+            {
+                if(!(admission_parse_count(optarg, &options->backlog)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'k':
+            {
+                if(!(admission_parse_count(optarg, &options->accept_batch)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'c':
+            {
+                if(!(admission_parse_count(optarg, &options->max_clients)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'l':
+            {
+                options->edge_triggered = false;
+                break;
+            }
+            case 'e':
+            {
+                options->edge_triggered = true;
+                break;
+            }
+            case 't':
+            {
+                char *end;
+                long num_threads;
+
+                num_threads = strtol(optarg, &end, 10); // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                if(*end != '\0' || num_threads < 1 || num_threads > CPU_SETSIZE)
+                {
+                    return false;
+                }
+
+                options->num_threads = (int)num_threads;
+                break;
+            }
+            case 'p':
+            {
+                options->pin_threads = true;
+                break;
+            }
+            case 'a':
+            {
+                options->acceptor = true;
+                break;
+            }
+            case 'b':
+            {
+                if(strcmp(optarg, "round-robin") == 0)
+                {
+                    options->balance = BALANCE_ROUND_ROBIN;
+                }
+                else if(strcmp(optarg, "least-loaded") == 0)
+                {
+                    options->balance = BALANCE_LEAST_LOADED;
+                }
+                else
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'f':
+            {
+                if(!(request_parse_frame_mode(optarg, &options->frame_mode)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'w':
+            {
+                if(!(out_buffer_parse_high_water(optarg, &options->high_water)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'C':
+            {
+                if(!(admission_parse_count(optarg, &options->count_threads)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'S':
+            {
+                if(!(count_pool_parse_schedule(optarg, &options->count_schedule)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'T':
+            {
+                if(!(count_pool_parse_threshold(optarg, &options->offload_threshold)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'o':
+            {
+                options->log_file = optarg;
+                break;
+            }
+            case 'v':
+            {
+                if(!(logger_parse_level(optarg, &options->log_level)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'm':
+            {
+                if(!(metrics_parse_port(optarg, &options->metrics_port)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'I':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.idle_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'R':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.read_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'W':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.write_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    return optind == argc;
+}
+
+/**
+ * creates the epoll instance and registers the listeners and the shutdown eventfd once
+ * the interest list lives in the kernel, so nothing is rebuilt between calls to epoll_wait()
+ * workers in acceptor mode have no listeners
+ * the listeners are always non-blocking, a batch of accepts ends when the backlog is empty
+ * */
+static int setup_epoll(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, int shutdown_fd)
+{
+    int epfd;
+
+    DC_TRACE(env);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(epfd == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+    else
+    {
+        for(size_t i = 0; i < listeners->count && dc_error_has_no_error(err); i++)
+        {
+            watch_fd(env, err, epfd, listeners->fds[i], EPOLLIN);
+        }
+
+        // the eventfd is never read, so once it is signalled every thread sees it on its next wakeup
+        if(dc_error_has_no_error(err))
+        {
+            watch_fd(env, err, epfd, shutdown_fd, EPOLLIN);
+        }
+    }
+
+    return epfd;
+}
+
+static void watch_fd(struct dc_env *env, struct dc_error *err, int epfd, int fd, uint32_t events)
+{
+    struct epoll_event event;
+
+    DC_TRACE(env);
+    dc_memset(env, &event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+/**
+ * the listeners and epoll sets are all created up front so a bind failure is reported before anything runs
+ * */
+static void setup_reactors(struct dc_error *err, struct reactor *reactors, struct metrics *metrics, struct count_pool *pool, struct buffer_pool *buffers, const struct options *options, int shutdown_fd)
+{
+    for(int i = 0; i < options->num_threads; i++)
+    {
+        reactors[i].id = i;
+        reactors[i].options = options;
+        reactors[i].metrics = metrics;
+        reactors[i].shard = &metrics->shards[i];
+        reactors[i].pool = pool;
+        reactors[i].completions.wake_fd = -1;
+        reactors[i].shutdown_fd = shutdown_fd;
+        listeners_init(&reactors[i].listeners);
+        reactors[i].metrics_listener = -1;
+        reactors[i].epfd = -1;
+        reactors[i].wake_fd = -1;
+        reactors[i].admission.reserve_fd = -1;
+    }
+
+    for(int i = 0; i < options->num_threads; i++)
+    {
+        struct reactor *reactor;
+
+        reactor = &reactors[i];
+        reactor->err = dc_error_create(true);
+        reactor->env = dc_env_create(reactor->err, true, NULL);
+        buffer_cache_init(reactor->env, &reactor->buffers, buffers);
+        conn_table_init(reactor->env, reactor->err, &reactor->clients, INITIAL_CLIENTS, &reactor->buffers);
+        timer_wheel_init(&reactor->wheel, TIMEOUTS_TICK_NS, now_ns());
+
+        if(options->max_clients != 0 && (size_t)options->max_clients < reactor->clients.max_connections)
+        {
+            reactor->clients.max_connections = (size_t)options->max_clients;
+        }
+
+        if(dc_error_has_no_error(reactor->err))
+        {
+            admission_init(reactor->env, reactor->err, &reactor->admission, options->accept_batch);
+        }
+
+        if(dc_error_has_no_error(reactor->err) && options->acceptor)
+        {
+            spsc_queue_init(reactor->env, reactor->err, &reactor->handoff_queue, HANDOFF_QUEUE_SIZE, sizeof(struct handoff));
+
+            if(dc_error_has_no_error(reactor->err))
+            {
+                reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);  // NOLINT(hicpp-signed-bitwise)
+
+                if(reactor->wake_fd == -1)
+                {
+                    DC_ERROR_RAISE_ERRNO(reactor->err, errno);
+                }
+            }
+        }
+        else if(dc_error_has_no_error(reactor->err))
+        {
+            if(i == 0)
+            {
+                reactor->listeners = options->listeners;
+                listeners_open(reactor->env, reactor->err, &reactor->listeners, options->backlog, options->num_threads > 1, true);
+            }
+            else
+            {
+                listeners_share(reactor->env, reactor->err, &reactor->listeners, &reactors[0].listeners, options->backlog);
+            }
+
+            reactor->accepting = true;
+        }
+
+        if(dc_error_has_no_error(reactor->err))
+        {
+            reactor->epfd = setup_epoll(reactor->env, reactor->err, &reactor->listeners, shutdown_fd);
+        }
+
+        if(dc_error_has_no_error(reactor->err) && reactor->wake_fd != -1)
+        {
+            watch_fd(reactor->env, reactor->err, reactor->epfd, reactor->wake_fd, EPOLLIN);
+        }
+
+        if(dc_error_has_no_error(reactor->err) && pool != NULL)
+        {
+            count_completions_init(reactor->env, reactor->err, &reactor->completions);
+
+            if(dc_error_has_no_error(reactor->err))
+            {
+                watch_fd(reactor->env, reactor->err, reactor->epfd, reactor->completions.wake_fd, EPOLLIN);
+            }
+        }
+
+        if(dc_error_has_error(reactor->err))
+        {
+            DC_ERROR_RAISE_ERRNO(err, dc_errno_get_errno(reactor->err));
+            return;
+        }
+
+        reactor->running = true;
+    }
+}
+
+/**
+ * the admin port is watched level-triggered even by edge-triggered reactors, one scrape is accepted per wakeup
+ * */
+static void setup_metrics_listener(struct dc_error *err, struct reactor *reactor, uint16_t port)
+{
+    reactor->metrics_listener = metrics_listen(reactor->env, reactor->err, port);
+
+    if(dc_error_has_no_error(reactor->err))
+    {
+        watch_fd(reactor->env, reactor->err, reactor->epfd, reactor->metrics_listener, EPOLLIN);
+    }
+
+    if(dc_error_has_error(reactor->err))
+    {
+        DC_ERROR_RAISE_ERRNO(err, dc_errno_get_errno(reactor->err));
+    }
+}
+
+static void setup_acceptor(struct dc_error *err, struct acceptor *acceptor, struct reactor *workers, struct metrics *metrics, const struct options *options, int shutdown_fd)
+{
+    acceptor->options = options;
+    acceptor->shard = &metrics->shards[options->num_threads];
+    acceptor->workers = workers;
+    acceptor->shutdown_fd = shutdown_fd;
+    acceptor->err = dc_error_create(true);
+    acceptor->env = dc_env_create(acceptor->err, true, NULL);
+    acceptor->listeners = options->listeners;
+    listeners_open(acceptor->env, acceptor->err, &acceptor->listeners, options->backlog, false, true);
+
+    if(dc_error_has_no_error(acceptor->err))
+    {
+        admission_init(acceptor->env, acceptor->err, &acceptor->admission, options->accept_batch);
+    }
+
+    if(dc_error_has_no_error(acceptor->err))
+    {
+        acceptor->epfd = setup_epoll(acceptor->env, acceptor->err, &acceptor->listeners, shutdown_fd);
+    }
+
+    if(dc_error_has_error(acceptor->err))
+    {
+        DC_ERROR_RAISE_ERRNO(err, dc_errno_get_errno(acceptor->err));
+        return;
+    }
+
+    acceptor->running = true;
+}
+
+/**
+ * cpu is the core to pin the thread to, or -1 to leave it to the scheduler
+ * */
+static void start_thread(struct dc_error *err, pthread_t *thread, bool *started, void *(*thread_main)(void *), void *arg, int cpu)
+{
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+
+    if(cpu >= 0)
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET((size_t)cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    ret = pthread_create(thread, &attr, thread_main, arg);
+    pthread_attr_destroy(&attr);
+
+    if(ret != 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, ret);
+        return;
+    }
+
+    *started = true;
+}
+
+static void start_reactors(struct dc_error *err, struct reactor *reactors, const struct options *options)
+{
+    long num_cpus;
+
+    num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for(int i = 0; i < options->num_threads && dc_error_has_no_error(err); i++)
+    {
+        int cpu;
+
+        cpu = (options->pin_threads && num_cpus > 0) ? (int)(i % num_cpus) : -1;
+        start_thread(err, &reactors[i].thread, &reactors[i].started, reactor_main, &reactors[i], cpu);
+    }
+}
+
+/**
+ * every reactor is joined before the pool is stopped, after that no job can be submitted or completed,
+ * so each one is either still being filled by its connection, freed by the pool or waiting on a completion list
+ * the connections let go of the submitted ones before the pool frees them, nothing may look at those afterwards
+ * */
+static void destroy_reactors(struct reactor *reactors, struct count_pool *pool, const struct options *options)
+{
+    for(int i = 0; i < options->num_threads; i++)
+    {
+        if(reactors[i].started)
+        {
+            pthread_join(reactors[i].thread, NULL);
+        }
+    }
+
+    for(int i = 0; i < options->num_threads; i++)
+    {
+        release_jobs(&reactors[i]);
+    }
+
+    if(pool != NULL)
+    {
+        count_pool_destroy(reactors[0].env, pool);
+    }
+
+    for(int i = 0; i < options->num_threads; i++)
+    {
+        struct reactor *reactor;
+
+        reactor = &reactors[i];
+
+        if(reactor->epfd != -1)
+        {
+            dc_close(reactor->env, reactor->err, reactor->epfd);
+        }
+
+        if(reactor->env != NULL)
+        {
+            listeners_close(reactor->env, reactor->err, &reactor->listeners);
+        }
+
+        if(reactor->metrics_listener != -1)
+        {
+            dc_close(reactor->env, reactor->err, reactor->metrics_listener);
+        }
+
+        if(reactor->wake_fd != -1)
+        {
+            struct handoff handoff;
+
+            // sockets that were accepted but never picked up
+            while(spsc_queue_pop(&reactor->handoff_queue, &handoff))
+            {
+                dc_close(reactor->env, reactor->err, handoff.fd);
+            }
+
+            dc_close(reactor->env, reactor->err, reactor->wake_fd);
+        }
+
+        if(reactor->env != NULL)
+        {
+            for(size_t j = 0; j < reactor->clients.num_slots; j++)
+            {
+                struct connection *connection;
+
+                connection = conn_table_at(&reactor->clients, j);
+
+                if(connection->in_use)
+                {
+                    dc_close(reactor->env, reactor->err, connection->fd);
+                }
+            }
+
+            if(reactor->completions.wake_fd != -1)
+            {
+                count_completions_destroy(reactor->env, reactor->err, &reactor->completions);
+            }
+
+            conn_table_destroy(reactor->env, &reactor->clients);
+            buffer_cache_destroy(&reactor->buffers);
+            timer_wheel_destroy(reactor->env, &reactor->wheel);
+            admission_destroy(reactor->env, reactor->err, &reactor->admission);
+            spsc_queue_destroy(reactor->env, &reactor->handoff_queue);
+        }
+    }
+}
+
+/**
+ * a job still being filled was never submitted and is the connection's to free, any other is left to the pool or its completion list
+ * */
+static void release_jobs(struct reactor *reactor)
+{
+    if(reactor->env == NULL)
+    {
+        return;
+    }
+
+    for(size_t i = 0; i < reactor->clients.num_slots; i++)
+    {
+        struct connection *connection;
+
+        connection = conn_table_at(&reactor->clients, i);
+
+        if(connection->in_use && connection->job != NULL)
+        {
+            if(connection->job->filled < connection->job->len)
+            {
+                count_job_destroy(reactor->env, connection->job);
+            }
+
+            connection->job = NULL;
+        }
+    }
+}
+
+static void destroy_acceptor(struct acceptor *acceptor)
+{
+    if(acceptor->started)
+    {
+        pthread_join(acceptor->thread, NULL);
+    }
+
+    if(acceptor->epfd != -1)
+    {
+        dc_close(acceptor->env, acceptor->err, acceptor->epfd);
+    }
+
+    if(acceptor->env != NULL)
+    {
+        listeners_close(acceptor->env, acceptor->err, &acceptor->listeners);
+        admission_destroy(acceptor->env, acceptor->err, &acceptor->admission);
+    }
+}
+
+/**
+ * per-reactor connection counts, and in acceptor mode how long sockets sat in the handoff queues
+ * */
+static void print_stats(const struct reactor *reactors, const struct acceptor *acceptor, const struct options *options)
+{
+    for(int i = 0; i < options->num_threads; i++)
+    {
+        const struct reactor_stats *stats;
+        uint64_t handoffs;
+
+        stats = &reactors[i].stats;
+        handoffs = atomic_load(&stats->handoffs);
+        printf("reactor %d: %" PRIuFAST64 " connections, %d open", i, atomic_load(&stats->total_clients), atomic_load(&stats->num_clients));
+
+        if(options->acceptor)
+        {
+            printf(", %" PRIu64 " handoffs, latency avg %" PRIu64 " ns max %" PRIuFAST64 " ns", handoffs, handoffs == 0 ? 0 : atomic_load(&stats->handoff_ns_total) / handoffs, atomic_load(&stats->handoff_ns_max));
+        }
+
+        printf("\n");
+    }
+
+    if(options->acceptor)
+    {
+        printf("acceptor: %" PRIu64 " connections rejected\n", acceptor->rejected);
+    }
+}
+
+/**
+ * runs on reactor 0 when metrics are scraped, the pools' counters are read without stopping their workers or the other reactors
+ * */
+static void sample_pools(void *arg, uint64_t values[METRICS_SAMPLED_COUNT])
+{
+    const struct sampled_pools *sampled;
+    struct count_pool_stats stats;
+    struct buffer_pool_stats buffers;
+
+    sampled = arg;
+    memset(&stats, 0, sizeof(stats));
+
+    if(sampled->count != NULL)
+    {
+        count_pool_stats(sampled->count, &stats);
+    }
+
+    values[METRICS_COUNT_QUEUE_DEPTH] = stats.queued_chunks;
+    values[METRICS_COUNT_CHUNKS] = stats.chunks;
+    values[METRICS_COUNT_STEALS] = stats.steals;
+    values[METRICS_COUNT_STEAL_MISSES] = stats.steal_misses;
+    buffer_pool_stats(sampled->buffers, &buffers);
+    values[METRICS_BUFFER_IN_USE_BYTES] = buffers.in_use_bytes;
+    values[METRICS_BUFFER_IN_USE] = buffers.in_use_buffers;
+    values[METRICS_BUFFER_FREE_BYTES] = buffers.free_bytes;
+    values[METRICS_BUFFER_HITS] = buffers.hits;
+    values[METRICS_BUFFER_MISSES] = buffers.misses;
+    values[METRICS_RESIDENT_BYTES] = buffer_pool_rss();
+}
+
+/**
+ * sleeps until ctrl-c and then signals the shutdown eventfd that every thread is watching
+ * */
+static void wait_for_shutdown(struct dc_error *err, const sigset_t *signals, int shutdown_fd)
+{
+    int signum;
+    uint64_t value;
+
+    sigwait(signals, &signum);
+    value = 1;
+
+    if(write(shutdown_fd, &value, sizeof(value)) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+static void *reactor_main(void *arg)
+{
+    struct reactor *reactor;
+
+    reactor = arg;
+    run_server(reactor);
+
+    return NULL;
+}
+
+static void *acceptor_main(void *arg)
+{
+    struct acceptor *acceptor;
+
+    acceptor = arg;
+    run_acceptor(acceptor);
+
+    return NULL;
+}
+
+/**
+ * the loop time runs from epoll_wait() returning to the last ready descriptor being handled
+ * epoll_wait() sleeps until the next timer in the reactor's wheel is due, the wheel is run after every wakeup
+ * */
+static void run_server(struct reactor *reactor)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    DC_TRACE(reactor->env);
+
+    while(reactor->running)
+    {
+        int num_events;
+        uint64_t woke_ns;
+
+        update_accepting(reactor);
+        num_events = wait_for_data(reactor->env, reactor->err, reactor->epfd, events, timer_wheel_timeout_ms(&reactor->wheel, now_ns()));
+        woke_ns = metrics_now_ns();
+
+        if(dc_error_has_error(reactor->err))
+        {
+            metrics_add(reactor->shard, METRICS_POLL_ERRORS, 1);
+        }
+
+        // only the descriptors that are actually ready are visited, idle connections cost nothing
+        for(int i = 0; i < num_events; i++)
+        {
+            int listener;
+
+            listener = listeners_find(&reactor->listeners, events[i].data.fd);
+
+            if(events[i].data.fd == reactor->shutdown_fd)
+            {
+                reactor->running = false;
+            }
+            else if(events[i].data.fd == reactor->wake_fd)
+            {
+                handle_handoffs(reactor);
+            }
+            else if(events[i].data.fd == reactor->completions.wake_fd)
+            {
+                handle_completions(reactor);
+            }
+            else if(listener != -1)
+            {
+                handle_new_connections(reactor, (size_t)listener);
+            }
+            else if(events[i].data.fd == reactor->metrics_listener)
+            {
+                handle_metrics_connection(reactor);
+            }
+            else
+            {
+                handle_client_data(reactor, events[i].data.fd, events[i].events);
+            }
+
+            // an error belongs to the descriptor that raised it, the rest of the batch is still handled,
+            // with edge-triggered events an event skipped here would never be reported again
+            if(dc_error_has_error(reactor->err))
+            {
+                logger_write(LOG_LEVEL_ERROR, "reactor %d: fd %d: (%d) %s", reactor->id, events[i].data.fd, dc_errno_get_errno(reactor->err), dc_error_get_message(reactor->err));
+                dc_error_reset(reactor->err);
+            }
+        }
+
+        if(dc_error_has_no_error(reactor->err))
+        {
+            timer_wheel_advance(&reactor->wheel, now_ns(), expire_client, reactor);
+        }
+
+        if(num_events > 0)
+        {
+            metrics_observe(reactor->shard, METRICS_LOOP_TIME, metrics_now_ns() - woke_ns);
+        }
+
+        if(dc_error_has_error(reactor->err))
+        {
+            logger_write(LOG_LEVEL_ERROR, "reactor %d: (%d) %s", reactor->id, dc_errno_get_errno(reactor->err), dc_error_get_message(reactor->err));
+        }
+
+        dc_error_reset(reactor->err);
+    }
+}
+
+static void run_acceptor(struct acceptor *acceptor)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    DC_TRACE(acceptor->env);
+
+    while(acceptor->running)
+    {
+        int num_events;
+
+        num_events = wait_for_data(acceptor->env, acceptor->err, acceptor->epfd, events, -1);
+
+        if(dc_error_has_error(acceptor->err))
+        {
+            metrics_add(acceptor->shard, METRICS_POLL_ERRORS, 1);
+        }
+
+        for(int i = 0; i < num_events; i++)
+        {
+            int listener;
+
+            listener = listeners_find(&acceptor->listeners, events[i].data.fd);
+
+            if(events[i].data.fd == acceptor->shutdown_fd)
+            {
+                acceptor->running = false;
+            }
+            else if(listener != -1)
+            {
+                hand_off_connections(acceptor, (size_t)listener);
+            }
+
+            // an accept error does not keep the rest of the batch, shutdown included, from being handled
+            if(dc_error_has_error(acceptor->err))
+            {
+                logger_write(LOG_LEVEL_ERROR, "acceptor: fd %d: (%d) %s", events[i].data.fd, dc_errno_get_errno(acceptor->err), dc_error_get_message(acceptor->err));
+                dc_error_reset(acceptor->err);
+            }
+        }
+
+        if(dc_error_has_error(acceptor->err))
+        {
+            logger_write(LOG_LEVEL_ERROR, "acceptor: (%d) %s", dc_errno_get_errno(acceptor->err), dc_error_get_message(acceptor->err));
+        }
+
+        dc_error_reset(acceptor->err);
+    }
+}
+
+static int wait_for_data(struct dc_env *env, struct dc_error *err, int epfd, struct epoll_event *events, int timeout)
+{
+    int num_events;
+
+    DC_TRACE(env);
+    num_events = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+
+    if(num_events == -1)
+    {
+        if(errno != EINTR)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+        }
+
+        num_events = 0;
+    }
+
+    return num_events;
+}
+
+/**
+ * takes up to a batch of connections per wakeup, the listeners are level-triggered in both modes so anything left over
+ * is reported again on the next epoll_wait() instead of starving the clients this reactor already serves
+ * a shared unix listener wakes every reactor, the ones that lose the race get EAGAIN and go back to their clients
+ * */
+static void handle_new_connections(struct reactor *reactor, size_t index)
+{
+    struct dc_env *env;
+    struct dc_error *err;
+
+    env = reactor->env;
+    err = reactor->err;
+    DC_TRACE(env);
+
+    for(int i = 0; i < reactor->admission.batch && reactor->running && dc_error_has_no_error(err); i++)
+    {
+        int new_socket;
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len;
+        char peer[ENDPOINT_NAME_SIZE];
+        bool dropped;
+
+        if(conn_table_full(&reactor->clients))
+        {
+            logger_write(LOG_LEVEL_WARN, "reactor %d: %zu clients, pausing accept", reactor->id, reactor->clients.count);
+            admission_pause(&reactor->admission, reactor->clients.count);
+            return;
+        }
+
+        client_addr_len = sizeof(client_addr);
+        new_socket = admission_accept(env, err, &reactor->admission, reactor->listeners.fds[index], (struct sockaddr *)&client_addr, &client_addr_len, &dropped);
+
+        if(new_socket == -1)
+        {
+            if(dropped)
+            {
+                logger_write(LOG_LEVEL_WARN, "reactor %d: out of file descriptors, dropping new connection and pausing accept", reactor->id);
+                metrics_add(reactor->shard, METRICS_REJECTS, 1);
+                admission_pause(&reactor->admission, reactor->clients.count);
+            }
+
+            return;
+        }
+
+        if(logger_enabled(LOG_LEVEL_INFO))
+        {
+            endpoint_peer_name(&client_addr, client_addr_len, peer, sizeof(peer));
+            logger_write(LOG_LEVEL_INFO, "fd %d: new connection from %s on %s (reactor %d)", new_socket, peer, reactor->listeners.endpoints[index].name, reactor->id);
+        }
+
+        add_client(reactor, new_socket);
+    }
+}
+
+/**
+ * the listeners stay in the epoll set while paused, only their EPOLLIN interest is dropped,
+ * with SO_REUSEPORT the kernel keeps routing connections to them and they wait in the backlogs
+ * */
+static void update_accepting(struct reactor *reactor)
+{
+    bool accepting;
+
+    if(reactor->listeners.count == 0)
+    {
+        return;
+    }
+
+    accepting = admission_accepting(&reactor->admission, reactor->clients.count);
+
+    if(accepting == reactor->accepting)
+    {
+        return;
+    }
+
+    for(size_t i = 0; i < reactor->listeners.count; i++)
+    {
+        struct epoll_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.events = accepting ? EPOLLIN : 0;
+        event.data.fd = reactor->listeners.fds[i];
+
+        if(epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, reactor->listeners.fds[i], &event) == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(reactor->err, errno);
+            return;
+        }
+    }
+
+    reactor->accepting = accepting;
+}
+
+/**
+ * the eventfd is reset before the queue is drained, so a handoff pushed after the drain always causes another wakeup
+ * */
+static void handle_handoffs(struct reactor *reactor)
+{
+    uint64_t value;
+    struct handoff handoff;
+
+    DC_TRACE(reactor->env);
+
+    if(read(reactor->wake_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+    {
+        DC_ERROR_RAISE_ERRNO(reactor->err, errno);
+        return;
+    }
+
+    while(spsc_queue_pop(&reactor->handoff_queue, &handoff))
+    {
+        uint64_t latency;
+
+        latency = now_ns() - handoff.enqueued_ns;
+        atomic_fetch_add_explicit(&reactor->stats.handoffs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&reactor->stats.handoff_ns_total, latency, memory_order_relaxed);
+
+        if(latency > atomic_load_explicit(&reactor->stats.handoff_ns_max, memory_order_relaxed))
+        {
+            atomic_store_explicit(&reactor->stats.handoff_ns_max, latency, memory_order_relaxed);
+        }
+
+        add_client(reactor, handoff.fd);
+    }
+}
+
+/**
+ * a scrape is tracked in the client table so its request is read when epoll reports it, it is never counted as a client
+ * */
+static void handle_metrics_connection(struct reactor *reactor)
+{
+    int fd;
+    struct connection *connection;
+    struct epoll_event event;
+
+    DC_TRACE(reactor->env);
+    fd = metrics_accept(reactor->env, reactor->err, reactor->metrics_listener);
+
+    if(fd == -1)
+    {
+        return;
+    }
+
+    connection = conn_table_insert(reactor->env, reactor->err, &reactor->clients, fd);
+
+    if(connection == NULL)
+    {
+        dc_close(reactor->env, reactor->err, fd);
+        return;
+    }
+
+    connection->admin = true;
+    connection->reading = true;
+    dc_memset(reactor->env, &event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    if(epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(reactor->err, errno);
+        conn_table_remove(reactor->env, &reactor->clients, connection);
+        dc_close(reactor->env, reactor->err, fd);
+    }
+}
+
+/**
+ * takes up to a batch of connections per wakeup, queueing every socket on the chosen worker and waking it through its eventfd
+ * the acceptor never pauses, a worker that is full turns the socket away when it picks it up
+ * */
+static void hand_off_connections(struct acceptor *acceptor, size_t index)
+{
+    struct dc_env *env;
+    struct dc_error *err;
+
+    env = acceptor->env;
+    err = acceptor->err;
+    DC_TRACE(env);
+
+    for(int i = 0; i < acceptor->admission.batch && acceptor->running; i++)
+    {
+        int new_socket;
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len;
+        char peer[ENDPOINT_NAME_SIZE];
+        struct reactor *worker;
+        struct handoff handoff;
+        uint64_t value;
+        bool dropped;
+
+        client_addr_len = sizeof(client_addr);
+        new_socket = admission_accept(env, err, &acceptor->admission, acceptor->listeners.fds[index], (struct sockaddr *)&client_addr, &client_addr_len, &dropped);
+
+        if(new_socket == -1)
+        {
+            if(dropped)
+            {
+                logger_write(LOG_LEVEL_WARN, "acceptor: out of file descriptors, dropping new connection");
+                acceptor->rejected++;
+                metrics_add(acceptor->shard, METRICS_REJECTS, 1);
+            }
+
+            return;
+        }
+
+        worker = choose_worker(acceptor);
+
+        if(logger_enabled(LOG_LEVEL_INFO))
+        {
+            endpoint_peer_name(&client_addr, client_addr_len, peer, sizeof(peer));
+            logger_write(LOG_LEVEL_INFO, "fd %d: new connection from %s on %s (reactor %d)", new_socket, peer, acceptor->listeners.endpoints[index].name, worker->id);
+        }
+
+        handoff.fd = new_socket;
+        handoff.enqueued_ns = now_ns();
+
+        if(!(spsc_queue_push(&worker->handoff_queue, &handoff)))
+        {
+            logger_write(LOG_LEVEL_WARN, "fd %d: too many clients, dropping new connection", new_socket);
+            dc_close(env, err, new_socket);
+            acceptor->rejected++;
+            metrics_add(acceptor->shard, METRICS_REJECTS, 1);
+            continue;
+        }
+
+        value = 1;
+
+        if(write(worker->wake_fd, &value, sizeof(value)) == -1)
+        {
+            DC_ERROR_RAISE_ERRNO(err, errno);
+            return;
+        }
+    }
+}
+
+/**
+ * least-loaded counts sockets still waiting in a worker's queue as load, otherwise a burst of accepts
+ * would all go to the same worker before it had a chance to pick any of them up
+ * */
+static struct reactor *choose_worker(struct acceptor *acceptor)
+{
+    struct reactor *workers;
+    int num_workers;
+    int chosen;
+
+    workers = acceptor->workers;
+    num_workers = acceptor->options->num_threads;
+
+    if(acceptor->options->balance == BALANCE_LEAST_LOADED)
+    {
+        size_t least_load;
+
+        chosen = 0;
+        least_load = SIZE_MAX;
+
+        for(int i = 0; i < num_workers; i++)
+        {
+            size_t load;
+
+            load = (size_t)atomic_load_explicit(&workers[i].stats.num_clients, memory_order_relaxed) + spsc_queue_size(&workers[i].handoff_queue);
+
+            if(load < least_load)
+            {
+                least_load = load;
+                chosen = i;
+            }
+        }
+    }
+    else
+    {
+        chosen = acceptor->next_worker;
+        acceptor->next_worker = (acceptor->next_worker + 1) % num_workers;
+    }
+
+    return &workers[chosen];
+}
+
+/**
+ * clients are non-blocking so a slow reader can never stall the reactor, replies it cannot take yet wait in its out buffer
+ * accept4() has already made the socket non-blocking, whether it came from this reactor's listener or the acceptor
+ * */
+static void add_client(struct reactor *reactor, int client_fd)
+{
+    struct connection *connection;
+    struct epoll_event event;
+
+    DC_TRACE(reactor->env);
+    connection = conn_table_insert(reactor->env, reactor->err, &reactor->clients, client_fd);
+
+    if(connection == NULL)
+    {
+        logger_write(LOG_LEVEL_WARN, "fd %d: too many clients, dropping new connection", client_fd);
+        metrics_add(reactor->shard, METRICS_REJECTS, 1);
+        dc_close(reactor->env, reactor->err, client_fd);
+        admission_pause(&reactor->admission, reactor->clients.count);
+        return;
+    }
+
+    request_parser_init(&connection->parser, reactor->options->frame_mode);
+    connection->parser.offload_threshold = reactor->pool != NULL ? reactor->options->offload_threshold : 0;
+    connection->reading = true;
+    connection->writing = false;
+    dc_memset(reactor->env, &event, 0, sizeof(event));
+    event.events = reactor->options->edge_triggered ? (EPOLLIN | EPOLLRDHUP | EPOLLET) : (EPOLLIN | EPOLLRDHUP);    // NOLINT(hicpp-signed-bitwise)
+    event.data.fd = client_fd;
+
+    if(epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, client_fd, &event) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(reactor->err, errno);
+        conn_table_remove(reactor->env, &reactor->clients, connection);
+        dc_close(reactor->env, reactor->err, client_fd);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&reactor->stats.num_clients, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&reactor->stats.total_clients, 1, memory_order_relaxed);
+    metrics_add(reactor->shard, METRICS_ACCEPTS, 1);
+
+    if(timeouts_enabled(&reactor->options->timeouts))
+    {
+        timeouts_touch(connection, now_ns(), true, false);
+        timeouts_arm(reactor->env, reactor->err, &reactor->wheel, &reactor->options->timeouts, connection, conn_table_slot(&reactor->clients, connection));
+    }
+}
+
+/**
+ * queued replies are drained first, then the socket is read if the client is still under its high-water mark
+ * level-triggered reads once per wakeup and lets epoll report the socket again if more is pending
+ * edge-triggered has to keep reading until the socket would block, otherwise the remaining data is never reported,
+ * unless the client crosses its high-water mark, EPOLL_CTL_MOD re-arms the edge once reading resumes
+ * */
+static void handle_client_data(struct reactor *reactor, int client_fd, uint32_t events)
+{
+    struct connection *connection;
+    bool alive;
+    bool read;
+    bool wrote;
+
+    DC_TRACE(reactor->env);
+    connection = conn_table_lookup(&reactor->clients, client_fd);
+
+    // closed earlier in the same batch by a completion or a dropped job, its event was already waiting
+    if(connection == NULL)
+    {
+        return;
+    }
+
+    alive = true;
+    read = false;
+    wrote = false;
+
+    if(connection->admin)
+    {
+        if(!(metrics_serve(reactor->env, reactor->err, reactor->metrics, client_fd)))
+        {
+            conn_table_remove(reactor->env, &reactor->clients, connection);
+            dc_close(reactor->env, reactor->err, client_fd);
+        }
+
+        return;
+    }
+
+    if(events & EPOLLOUT)
+    {
+        size_t pending;
+
+        pending = out_buffer_pending(&connection->out);
+        alive = out_buffer_flush(&connection->out, client_fd);
+        wrote = out_buffer_pending(&connection->out) < pending;
+    }
+
+    // nothing is read while the pool counts, a hang-up would otherwise be reported on every wakeup until the job came back
+    if(alive && awaiting_count(connection) && events & (EPOLLHUP | EPOLLERR))    // NOLINT(hicpp-signed-bitwise)
+    {
+        alive = false;
+    }
+
+    while(alive && connection->reading && !(awaiting_count(connection)) && events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))    // NOLINT(hicpp-signed-bitwise)
+    {
+        ssize_t bytes_read;
+        char buffer[BUFFER_SIZE];
+        uint64_t started_ns;
+
+        bytes_read = sysio_recv(client_fd, buffer, sizeof(buffer));
+
+        if(bytes_read == -1 && sysio_would_block(errno))
+        {
+            break;
+        }
+
+        if(bytes_read <= 0)
+        {
+            alive = false;
+            break;
+        }
+
+        started_ns = metrics_now_ns();
+        read = true;
+        metrics_add(reactor->shard, METRICS_BYTES_IN, (uint64_t)bytes_read);
+        alive = process_request(reactor, connection, buffer, (size_t)bytes_read);
+        metrics_observe(reactor->shard, METRICS_SERVICE_TIME, metrics_now_ns() - started_ns);
+
+        if(!(reactor->options->edge_triggered) || dc_error_has_error(reactor->err) || out_buffer_pending(&connection->out) >= reactor->options->high_water)
+        {
+            break;
+        }
+    }
+
+    if(!(alive) || !(update_interest(reactor, connection)))
+    {
+        close_client(reactor, client_fd);
+        return;
+    }
+
+    if(timeouts_enabled(&reactor->options->timeouts))
+    {
+        timeouts_touch(connection, now_ns(), read, wrote);
+        timeouts_arm(reactor->env, reactor->err, &reactor->wheel, &reactor->options->timeouts, connection, conn_table_slot(&reactor->clients, connection));
+    }
+}
+
+/**
+ * EPOLLOUT is only registered while replies are queued and EPOLLIN is dropped while too much is queued,
+ * so a client that stops reading stops being read from instead of growing its buffer without bound,
+ * it is also dropped while the pool counts a request, anything read then would only have to be stashed
+ * */
+static bool update_interest(struct reactor *reactor, struct connection *connection)
+{
+    struct epoll_event event;
+    size_t pending;
+    bool reading;
+    bool writing;
+
+    pending = out_buffer_pending(&connection->out);
+    reading = pending < reactor->options->high_water && !(awaiting_count(connection));
+    writing = pending > 0;
+
+    if(reading == connection->reading && writing == connection->writing)
+    {
+        return true;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = (reading ? (EPOLLIN | EPOLLRDHUP) : 0) | (writing ? EPOLLOUT : 0) | (reactor->options->edge_triggered ? EPOLLET : 0);    // NOLINT(hicpp-signed-bitwise)
+    event.data.fd = connection->fd;
+
+    if(epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, connection->fd, &event) == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(reactor->err, errno);
+        return false;
+    }
+
+    connection->reading = reading;
+    connection->writing = writing;
+
+    return true;
+}
+
+/**
+ * closing the descriptor also removes it from the epoll interest list
+ * */
+static void close_client(struct reactor *reactor, int client_fd)
+{
+    struct connection *connection;
+
+    DC_TRACE(reactor->env);
+    connection = conn_table_lookup(&reactor->clients, client_fd);
+
+    // already closed, the descriptor number may belong to the next connection by now
+    if(connection == NULL)
+    {
+        return;
+    }
+
+    logger_write(LOG_LEVEL_INFO, "fd %d: client disconnected", client_fd);
+
+    if(connection->job != NULL)
+    {
+        drop_job(reactor, connection);
+    }
+
+    timer_wheel_cancel(&reactor->wheel, conn_table_slot(&reactor->clients, connection));
+    conn_table_remove(reactor->env, &reactor->clients, connection);
+    dc_close(reactor->env, reactor->err, client_fd);
+    atomic_fetch_sub_explicit(&reactor->stats.num_clients, 1, memory_order_relaxed);
+    metrics_add(reactor->shard, METRICS_DISCONNECTS, 1);
+}
+
+/**
+ * a job the pool already has cannot be taken back, it is flagged so its workers skip the counting
+ * and the reactor frees it when it comes back instead of answering a connection that is gone
+ * */
+static void drop_job(struct reactor *reactor, struct connection *connection)
+{
+    struct count_job *job;
+
+    job = connection->job;
+    connection->job = NULL;
+
+    if(job->filled == job->len)
+    {
+        atomic_store_explicit(&job->cancelled, true, memory_order_relaxed);
+    }
+    else
+    {
+        count_job_destroy(reactor->env, job);
+    }
+}
+
+/**
+ * true from the moment a job is submitted until its reply has been sent, the connection is neither read nor parsed meanwhile
+ * */
+static bool awaiting_count(const struct connection *connection)
+{
+    return connection->job != NULL && connection->job->filled == connection->job->len;
+}
+
+/**
+ * a timer can fire for a connection that has made progress since it was armed, that only moves the timer
+ * */
+static void expire_client(void *arg, size_t id)
+{
+    struct reactor *reactor;
+    struct connection *connection;
+    enum timeout_kind kind;
+
+    reactor = arg;
+    connection = conn_table_at(&reactor->clients, id);
+
+    if(!(connection->in_use) || connection->admin)
+    {
+        return;
+    }
+
+    kind = timeouts_expired(&reactor->options->timeouts, connection, now_ns());
+
+    if(kind == TIMEOUT_NONE)
+    {
+        timeouts_arm(reactor->env, reactor->err, &reactor->wheel, &reactor->options->timeouts, connection, id);
+        return;
+    }
+
+    logger_write(LOG_LEVEL_INFO, "fd %d: %s timeout, closing connection", connection->fd, timeouts_kind_name(kind));
+    metrics_add(reactor->shard, METRICS_TIMEOUTS, 1);
+    close_client(reactor, connection->fd);
+}
+
+/**
+ * a read can hold part of a request or several of them, the parser carries what is left over to the next read
+ * a client may pipeline requests, their replies are answered in order and sent together once the whole read is parsed
+ * once a request has gone to the pool the rest of the read is stashed, it is parsed after that request has been answered
+ * returns false if the client has gone away
+ * */
+static bool process_request(struct reactor *reactor, struct connection *connection, const char *buffer, size_t bytes_read)
+{
+    struct read_context context;
+    struct out_batch replies;
+    size_t offset;
+
+    DC_TRACE(reactor->env);
+    out_batch_init(&replies, &connection->out, connection->fd);
+    context.env = reactor->env;
+    context.err = reactor->err;
+    context.metrics = reactor->shard;
+    context.reactor = reactor;
+    context.connection = connection;
+    context.replies = &replies;
+    context.buffer = buffer;
+    context.bytes_read = bytes_read;
+    offset = 0;
+
+    while(offset < bytes_read && !(awaiting_count(connection)))
+    {
+        size_t consumed;
+        struct request request;
+
+        if(request_parser_feed(&connection->parser, &buffer[offset], bytes_read - offset, &consumed, &request) && !(send_reply(&context, &request)))
+        {
+            return false;
+        }
+
+        offset += consumed;
+    }
+
+    if(dc_error_has_error(reactor->err))
+    {
+        return false;
+    }
+
+    if(offset < bytes_read)
+    {
+        size_t capacity;
+
+        connection->stash = buffer_alloc(reactor->err, &reactor->buffers, bytes_read - offset, &capacity);
+
+        if(connection->stash == NULL)
+        {
+            return false;
+        }
+
+        dc_memcpy(reactor->env, connection->stash, &buffer[offset], bytes_read - offset);
+        connection->stash_len = bytes_read - offset;
+    }
+
+    return out_batch_flush(reactor->env, reactor->err, &replies) && dc_error_has_no_error(reactor->err);
+}
+
+/**
+ * without framing each read is still answered with the payload followed by the raw int count
+ * that reply goes out as a single gathered write, framed and binary replies wait in the read's batch
+ * */
+static bool send_reply(void *arg, const struct request *request)
+{
+    struct read_context *context;
+    struct iovec iov[2];
+    size_t iovcnt;
+    int word_count;
+    char response[REQUEST_RESPONSE_SIZE];
+
+    context = arg;
+    DC_TRACE(context->env);
+
+    if(request->type == REQUEST_PAYLOAD)
+    {
+        return collect_payload(context, request);
+    }
+
+    if(context->connection->parser.mode == FRAME_NONE && request->type == REQUEST_COUNT)
+    {
+        word_count = (int)request->words;
+        logger_write(LOG_LEVEL_DEBUG, "fd %d: read %zu bytes, %d words", context->connection->fd, context->bytes_read, word_count);
+        logger_write(LOG_LEVEL_TRACE, "fd %d: payload %.*s", context->connection->fd, (int)context->bytes_read, context->buffer);
+        iov[0].iov_base = (void *)(uintptr_t)context->buffer;
+        iov[0].iov_len = context->bytes_read;
+        iov[1].iov_base = &word_count;
+        iov[1].iov_len = sizeof(word_count);
+        iovcnt = 2;
+    }
+    else
+    {
+        if(request->type == REQUEST_HELLO)
+        {
+            logger_write(LOG_LEVEL_INFO, "fd %d: negotiated protocol version %u", context->connection->fd, request->version);
+        }
+        else
+        {
+            logger_write(LOG_LEVEL_DEBUG, "fd %d: request %" PRIu32 " of %" PRIu64 " words", context->connection->fd, request->id, request->words);
+            metrics_add(context->metrics, METRICS_REQUESTS, 1);
+        }
+
+        iov[0].iov_base = response;
+        iov[0].iov_len = request_format_reply(response, context->connection->parser.mode, request);
+        iovcnt = 1;
+    }
+
+    if(iovcnt == 2)
+    {
+        metrics_add(context->metrics, METRICS_REQUESTS, 1);
+    }
+
+    metrics_add(context->metrics, METRICS_BYTES_OUT, iovcnt == 1 ? iov[0].iov_len : iov[0].iov_len + iov[1].iov_len);
+
+    if(iovcnt == 1)
+    {
+        return out_batch_add(context->env, context->err, context->replies, response, iov[0].iov_len) && dc_error_has_no_error(context->err);
+    }
+
+    return out_buffer_send(context->env, context->err, &context->connection->out, context->connection->fd, iov, iovcnt) && dc_error_has_no_error(context->err);
+}
+
+/**
+ * the payload is copied out of the read buffer piece by piece, the pool gets it once the last piece is in
+ * */
+static bool collect_payload(struct read_context *context, const struct request *request)
+{
+    struct reactor *reactor;
+    struct connection *connection;
+    struct count_job *job;
+
+    reactor = context->reactor;
+    connection = context->connection;
+
+    if(connection->job == NULL)
+    {
+        connection->job = count_job_create(context->env, context->err, reactor->pool, &reactor->completions, request->len + (size_t)request->remaining);
+
+        if(connection->job == NULL)
+        {
+            return false;
+        }
+
+        connection->job->id = request->id;
+        connection->job->slot = conn_table_slot(&reactor->clients, connection);
+    }
+
+    job = connection->job;
+    dc_memcpy(context->env, &job->data[job->filled], request->data, request->len);
+    job->filled += request->len;
+
+    if(request->remaining > 0)
+    {
+        return true;
+    }
+
+    logger_write(LOG_LEVEL_DEBUG, "fd %d: request %" PRIu32 " of %zu bytes handed to the count pool", connection->fd, job->id, job->len);
+    metrics_add(context->metrics, METRICS_OFFLOADS, 1);
+    job->submitted_ns = metrics_now_ns();
+    count_pool_submit(reactor->pool, job);
+
+    return true;
+}
+
+/**
+ * cancelled jobs belonged to connections that have since closed, their slot may already hold another client
+ * */
+static void handle_completions(struct reactor *reactor)
+{
+    struct count_job *job;
+
+    DC_TRACE(reactor->env);
+    job = count_completions_take(reactor->err, &reactor->completions);
+
+    while(job != NULL)
+    {
+        struct count_job *next;
+
+        next = job->next;
+
+        if(!(atomic_load_explicit(&job->cancelled, memory_order_relaxed)))
+        {
+            finish_offload(reactor, job);
+        }
+
+        count_job_destroy(reactor->env, job);
+        job = next;
+    }
+}
+
+/**
+ * the reply goes out before anything the client pipelined behind the request is parsed, so replies stay in order,
+ * then reading resumes, for edge-triggered sockets the EPOLL_CTL_MOD reports data that arrived in the meantime
+ * */
+static void finish_offload(struct reactor *reactor, const struct count_job *job)
+{
+    struct connection *connection;
+    struct request request;
+    struct iovec iov;
+    char response[REQUEST_RESPONSE_SIZE];
+    char *stash;
+    size_t stash_len;
+    int client_fd;
+    bool alive;
+
+    connection = conn_table_at(&reactor->clients, job->slot);
+    client_fd = connection->fd;
+    connection->job = NULL;
+    metrics_observe(reactor->shard, METRICS_OFFLOAD_TIME, metrics_now_ns() - job->submitted_ns);
+    dc_memset(reactor->env, &request, 0, sizeof(request));
+    request.type = REQUEST_COUNT;
+    request.id = job->id;
+    request.words = job->words;
+    logger_write(LOG_LEVEL_DEBUG, "fd %d: request %" PRIu32 " of %" PRIu64 " words", client_fd, request.id, request.words);
+    iov.iov_base = response;
+    iov.iov_len = request_format_reply(response, connection->parser.mode, &request);
+    metrics_add(reactor->shard, METRICS_REQUESTS, 1);
+    metrics_add(reactor->shard, METRICS_BYTES_OUT, iov.iov_len);
+    alive = out_buffer_send(reactor->env, reactor->err, &connection->out, client_fd, &iov, 1) && dc_error_has_no_error(reactor->err);
+
+    if(alive && connection->stash != NULL)
+    {
+        stash = connection->stash;
+        stash_len = connection->stash_len;
+        connection->stash = NULL;
+        alive = process_request(reactor, connection, stash, stash_len);
+        buffer_free(&reactor->buffers, stash, stash_len);
+    }
+
+    if(!(alive) || !(update_interest(reactor, connection)))
+    {
+        close_client(reactor, client_fd);
+        return;
+    }
+
+    if(timeouts_enabled(&reactor->options->timeouts))
+    {
+        timeouts_touch(connection, now_ns(), false, false);
+        timeouts_arm(reactor->env, reactor->err, &reactor->wheel, &reactor->options->timeouts, connection, conn_table_slot(&reactor->clients, connection));
+    }
+}
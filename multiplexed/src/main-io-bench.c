@@ -0,0 +1,497 @@
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <dc_posix/dc_poll.h>
+#include <dc_posix/dc_unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "request.h"
+#include "sysio.h"
+#include "word_count.h"
+
+
+#define DEFAULT_MIN_TIME ((double)1 / 5)
+#define TARGET_OVERSHOOT ((double)14 / 10)
+#define MAX_GROWTH 10
+#define MAX_ITERATIONS 1000000000ULL
+#define READ_SIZE 65536
+#define NANOSECONDS_PER_SECOND ((double)1000000000)
+#define NAME_SIZE 96
+
+
+enum io_path
+{
+    IO_PATH_DC,
+    IO_PATH_SYSIO,
+};
+
+struct options
+{
+    const char *filter;
+    double min_time;
+};
+
+typedef bool (*bench_fn)(void *arg, uint64_t iterations, uint64_t *sink);
+
+/**
+ * one request travelling over a socket pair, client_fd plays the client and server_fd the server's side of the connection
+ * */
+struct io_case
+{
+    enum io_path path;
+    struct dc_env *env;
+    struct dc_error *err;
+    const char *request;
+    size_t len;
+    uint64_t expected;
+    int client_fd;
+    int server_fd;
+    struct request_parser parser;
+    uint64_t replies;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
+static bool run_io_benchmarks(const struct options *options, struct dc_env *env, struct dc_error *err);
+static void run_benchmark(const struct options *options, const char *name, bench_fn fn, void *arg);
+static bool bench_trace(void *arg, uint64_t iterations, uint64_t *sink);
+static bool bench_request(void *arg, uint64_t iterations, uint64_t *sink);
+static bool round_trip(struct io_case *io_case, uint64_t *words);
+static bool serve_dc(struct io_case *io_case);
+static bool service_dc(struct io_case *io_case, struct pollfd *pfd);
+static bool reply_dc(void *arg, const struct request *request);
+static bool serve_sysio(struct io_case *io_case);
+static bool service_sysio(struct io_case *io_case, struct pollfd *pfd);
+static bool reply_sysio(void *arg, const struct request *request);
+static char *make_request(size_t payload_size, size_t *len, uint64_t *words);
+static double now_seconds(void);
+
+
+// results land here once per benchmark so the work cannot be optimised away
+static volatile uint64_t bench_sink;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+
+/**
+ * what the dc wrappers cost on a server's hot path, the same request answered two ways over a unix socket pair:
+ * request/dc/SIZE goes through dc_poll, dc_read and dc_write with a DC_TRACE on entry to every step, the way the servers used to
+ * request/sysio/SIZE goes through the inlined sysio calls with no tracing, the way the servers do in a release build
+ * both include the client's write and read, so the difference between them is what the wrappers add per request
+ * trace/DC_TRACE times a single DC_TRACE with no tracer installed
+ * this file never includes trace.h, so its DC_TRACE calls stay whatever the build mode
+ * usage: io-bench [--filter TEXT] [--min-time SECONDS]
+ * */
+int main(int argc, char *argv[])
+{
+    struct options options;
+    struct dc_env *env;
+    struct dc_error *err;
+    bool ok;
+
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--filter TEXT] [--min-time SECONDS]\n", argv[0]);   // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    word_count_init();
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "ERROR (%d) %s\n", dc_errno_get_errno(err), dc_error_get_message(err)); // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    printf("min time %.2f s\n", options.min_time);
+    printf("%-32s %14s %14s %12s\n", "benchmark", "time/request", "requests/s", "iterations");
+    run_benchmark(&options, "trace/DC_TRACE", bench_trace, env);
+    ok = run_io_benchmarks(&options, env, err);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"filter",   required_argument, NULL, 'f'},
+        {"min-time", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    options->filter = NULL;
+    options->min_time = DEFAULT_MIN_TIME;
+
+    while((opt = getopt_long(argc, argv, "f:t:", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'f':
+            {
+                options->filter = optarg;
+                break;
+            }
+            case 't':
+            {
+                options->min_time = strtod(optarg, NULL);
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    return optind == argc && options->min_time > 0;
+}
+
+/**
+ * every request is checked once, untimed, before either path is timed
+ * */
+static bool run_io_benchmarks(const struct options *options, struct dc_env *env, struct dc_error *err)
+{
+    static const size_t sizes[] = {16, 1024, 16384};
+    static const enum io_path paths[] = {IO_PATH_DC, IO_PATH_SYSIO};
+    static const char *const path_names[] = {"dc", "sysio"};
+    int fds[2];
+    bool ok;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+        perror("socketpair");
+        return false;
+    }
+
+    ok = true;
+
+    for(size_t size = 0; size < sizeof(sizes) / sizeof(sizes[0]) && ok; size++)
+    {
+        struct io_case io_case;
+        char *request;
+
+        request = make_request(sizes[size], &io_case.len, &io_case.expected);
+
+        if(request == NULL)
+        {
+            perror("malloc");
+            ok = false;
+            break;
+        }
+
+        for(size_t path = 0; path < sizeof(paths) / sizeof(paths[0]); path++)
+        {
+            char name[NAME_SIZE];
+            uint64_t words;
+
+            io_case.path = paths[path];
+            io_case.env = env;
+            io_case.err = err;
+            io_case.request = request;
+            io_case.client_fd = fds[0];
+            io_case.server_fd = fds[1];
+            io_case.replies = 0;
+            request_parser_init(&io_case.parser, FRAME_LINE);
+            snprintf(name, sizeof(name), "request/%s/%zu", path_names[path], sizes[size]);    // NOLINT(cert-err33-c)
+
+            if(!(round_trip(&io_case, &words)) || words != io_case.expected)
+            {
+                printf("%-32s WRONG REPLY\n", name);
+                ok = false;
+                break;
+            }
+
+            run_benchmark(options, name, bench_request, &io_case);
+        }
+
+        free(request);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return ok;
+}
+
+/**
+ * the iteration count grows until a run lasts min_time, aiming 40% past it the way google benchmark does
+ * */
+static void run_benchmark(const struct options *options, const char *name, bench_fn fn, void *arg)
+{
+    uint64_t iterations;
+    uint64_t sink;
+    double elapsed;
+
+    if(options->filter != NULL && strstr(name, options->filter) == NULL)
+    {
+        return;
+    }
+
+    iterations = 1;
+    sink = 0;
+
+    for(;;)
+    {
+        double start;
+        double next;
+
+        start = now_seconds();
+
+        if(!(fn(arg, iterations, &sink)))
+        {
+            printf("%-32s FAILED\n", name);
+            return;
+        }
+
+        elapsed = now_seconds() - start;
+
+        if(elapsed >= options->min_time || iterations >= MAX_ITERATIONS)
+        {
+            break;
+        }
+
+        next = elapsed > 0 ? (double)iterations * options->min_time * TARGET_OVERSHOOT / elapsed : (double)iterations * MAX_GROWTH;
+
+        if(next > (double)iterations * MAX_GROWTH)
+        {
+            next = (double)iterations * MAX_GROWTH;
+        }
+
+        iterations = next > (double)MAX_ITERATIONS ? MAX_ITERATIONS : (uint64_t)next + 1;
+    }
+
+    bench_sink = sink;
+    printf("%-32s %11.1f ns %14.0f %12" PRIu64 "\n", name, elapsed * NANOSECONDS_PER_SECOND / (double)iterations, (double)iterations / elapsed, iterations);
+    fflush(stdout);     // NOLINT(cert-err33-c)
+}
+
+static bool bench_trace(void *arg, uint64_t iterations, uint64_t *sink)
+{
+    struct dc_env *env;
+
+    env = arg;
+
+    for(uint64_t i = 0; i < iterations; i++)
+    {
+        DC_TRACE(env);
+    }
+
+    *sink += iterations;
+
+    return true;
+}
+
+static bool bench_request(void *arg, uint64_t iterations, uint64_t *sink)
+{
+    struct io_case *io_case;
+
+    io_case = arg;
+
+    for(uint64_t i = 0; i < iterations; i++)
+    {
+        uint64_t words;
+
+        if(!(round_trip(io_case, &words)))
+        {
+            return false;
+        }
+
+        *sink += words;
+    }
+
+    return true;
+}
+
+/**
+ * the client side is plain system calls for both paths, the reply is one line of ascii digits
+ * */
+static bool round_trip(struct io_case *io_case, uint64_t *words)
+{
+    char reply[REQUEST_RESPONSE_SIZE];
+    size_t reply_len;
+    uint64_t replies;
+    bool served;
+
+    if(write(io_case->client_fd, io_case->request, io_case->len) != (ssize_t)io_case->len)
+    {
+        return false;
+    }
+
+    replies = io_case->replies;
+
+    do
+    {
+        served = io_case->path == IO_PATH_DC ? serve_dc(io_case) : serve_sysio(io_case);
+    }
+    while(served && io_case->replies == replies);
+
+    if(!(served))
+    {
+        return false;
+    }
+
+    reply_len = 0;
+    *words = 0;
+
+    while(reply_len == 0 || reply[reply_len - 1] != '\n')
+    {
+        ssize_t bytes_read;
+
+        bytes_read = read(io_case->client_fd, &reply[reply_len], sizeof(reply) - reply_len);
+
+        if(bytes_read <= 0)
+        {
+            return false;
+        }
+
+        reply_len += (size_t)bytes_read;
+    }
+
+    for(size_t i = 0; i + 1 < reply_len; i++)
+    {
+        *words = *words * 10 + (uint64_t)(reply[i] - '0');  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    return true;
+}
+
+static bool serve_dc(struct io_case *io_case)
+{
+    struct pollfd pfd;
+    int ready;
+
+    DC_TRACE(io_case->env);
+    pfd.fd = io_case->server_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ready = dc_poll(io_case->env, io_case->err, &pfd, 1, -1);
+
+    if(dc_error_has_error(io_case->err) || ready != 1)
+    {
+        return false;
+    }
+
+    return service_dc(io_case, &pfd);
+}
+
+static bool service_dc(struct io_case *io_case, struct pollfd *pfd)
+{
+    char buffer[READ_SIZE];
+    ssize_t bytes_read;
+
+    DC_TRACE(io_case->env);
+    bytes_read = dc_read(io_case->env, io_case->err, pfd->fd, buffer, sizeof(buffer));
+
+    if(bytes_read <= 0)
+    {
+        return false;
+    }
+
+    return request_parser_feed_all(&io_case->parser, buffer, (size_t)bytes_read, reply_dc, io_case) && dc_error_has_no_error(io_case->err);
+}
+
+static bool reply_dc(void *arg, const struct request *request)
+{
+    struct io_case *io_case;
+    char response[REQUEST_RESPONSE_SIZE];
+    size_t len;
+
+    io_case = arg;
+    DC_TRACE(io_case->env);
+    len = request_format_response(response, request->words);
+    io_case->replies++;
+
+    return dc_write(io_case->env, io_case->err, io_case->server_fd, response, len) == (ssize_t)len;
+}
+
+static bool serve_sysio(struct io_case *io_case)
+{
+    struct pollfd pfd;
+
+    pfd.fd = io_case->server_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if(sysio_poll(&pfd, 1, -1) != 1)
+    {
+        return false;
+    }
+
+    return service_sysio(io_case, &pfd);
+}
+
+static bool service_sysio(struct io_case *io_case, struct pollfd *pfd)
+{
+    char buffer[READ_SIZE];
+    ssize_t bytes_read;
+
+    bytes_read = sysio_recv(pfd->fd, buffer, sizeof(buffer));
+
+    if(bytes_read == -1 && sysio_would_block(errno))
+    {
+        return true;
+    }
+
+    if(bytes_read <= 0)
+    {
+        return false;
+    }
+
+    return request_parser_feed_all(&io_case->parser, buffer, (size_t)bytes_read, reply_sysio, io_case);
+}
+
+static bool reply_sysio(void *arg, const struct request *request)
+{
+    struct io_case *io_case;
+    char response[REQUEST_RESPONSE_SIZE];
+    size_t len;
+
+    io_case = arg;
+    len = request_format_response(response, request->words);
+    io_case->replies++;
+
+    return send(io_case->server_fd, response, len, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+/**
+ * one line of words of one to eight letters, payload_size bytes before the newline
+ * */
+static char *make_request(size_t payload_size, size_t *len, uint64_t *words)
+{
+    char *request;
+    bool in_word;
+
+    request = malloc(payload_size + 1);
+
+    if(request == NULL)
+    {
+        return NULL;
+    }
+
+    for(size_t i = 0; i < payload_size; i++)
+    {
+        request[i] = (i % 9 == 8) ? ' ' : (char)('a' + (char)(i % 26));    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    request[payload_size] = '\n';
+    *len = payload_size + 1;
+    in_word = false;
+    *words = word_count_run(WORD_COUNT_SCALAR, request, payload_size, &in_word);
+
+    return request;
+}
+
+static double now_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / NANOSECONDS_PER_SECOND;
+}
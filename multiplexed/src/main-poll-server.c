@@ -1,4 +1,3 @@
-#include <arpa/inet.h>
 #include <dc_c/dc_ctype.h>
 #include <dc_c/dc_signal.h>
 #include <dc_c/dc_stdio.h>
@@ -6,53 +5,186 @@
 #include <dc_c/dc_string.h>
 #include <dc_env/env.h>
 #include <dc_error/error.h>
-#include <dc_posix/dc_poll.h>
 #include <dc_posix/dc_unistd.h>
 #include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <signal.h>
+#include <string.h>
+#include "admission.h"
+#include "buffer_pool.h"
+#include "conn_table.h"
+#include "endpoint.h"
+#include "listeners.h"
+#include "logger.h"
+#include "metrics.h"
+#include "sysio.h"
+#include "timeouts.h"
+#include "trace.h"
+#include "zerocopy.h"
 
 
-#define SERVER_PORT 4981
-#define BACKLOG 10
-#define MAX_CLIENTS 100
-#define POLL_TIMEOUT (-1)
-#define BUFFER_SIZE 1024
+#define INITIAL_CLIENTS 128
+#define BUFFER_SIZE 65536
 
 
+struct options
+{
+    struct listeners listeners;
+    int backlog;
+    int accept_batch;
+    int max_clients;
+    enum frame_mode frame_mode;
+    size_t high_water;
+    const char *log_file;
+    enum log_level log_level;
+    uint16_t metrics_port;
+    struct timeouts timeouts;
+    bool zerocopy;
+};
+
+/**
+ * what send_reply needs to answer the requests completed by one read
+ * pinnable is the read buffer when it came from the buffer cache and may be handed to a MSG_ZEROCOPY send,
+ * NULL when it is on the stack, pinned says whether it was and so must not go back to the cache yet
+ * */
+struct read_context
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct metrics_shard *metrics;
+    struct connection *connection;
+    struct out_batch *replies;
+    const char *buffer;
+    size_t bytes_read;
+    char *pinnable;
+    size_t capacity;
+    bool pinned;
+};
+
+/**
+ * what expire_client needs to close a connection whose timer has fired
+ * */
+struct expiry_context
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct conn_table *clients;
+    struct timer_wheel *wheel;
+    struct metrics_shard *metrics;
+    const struct options *options;
+    uint64_t now_ns;
+    size_t expired;
+};
+
+/**
+ * fds[0..first_client) are the listeners and fds[first_client..count) are the clients, packed with no holes, the metrics listener sits among them
+ * the array is kept between calls to poll(), a connect appends one entry and a disconnect moves the last entry into its place
+ * */
+struct poll_set
+{
+    struct pollfd *fds;
+    size_t count;
+    size_t capacity;
+    size_t first_client;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
 static void ctrl_c_handler(int signum);
-static int setup_server(struct dc_env *env, struct dc_error *err);
-static void run_server(struct dc_env *env, struct dc_error *err, int listener, int *client_sockets);
-static void wait_for_data(struct dc_env *env, struct dc_error *err, int listener, const int *client_sockets, int num_clients, struct pollfd *fds);
-static void handle_new_connections(struct dc_env *env, struct dc_error *err, int listener, int *client_sockets, int *num_clients, struct pollfd *fds);
-static void handle_client_data(struct dc_env *env, struct dc_error *err, int *client_sockets, int *num_clients, struct pollfd *fds);
+static void run_server(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, int metrics_listener, struct conn_table *clients, struct metrics *metrics, const struct options *options);
+static void sample_buffers(void *arg, uint64_t values[METRICS_SAMPLED_COUNT]);
+static bool add_pollfd(struct dc_env *env, struct dc_error *err, struct poll_set *poll_set, int fd);
+static void remove_pollfd(struct poll_set *poll_set, size_t index);
+static void remove_closed_pollfds(struct poll_set *poll_set, const struct conn_table *clients, int metrics_listener);
+static int wait_for_data(struct dc_env *env, struct dc_error *err, struct poll_set *poll_set, int timeout);
+static void handle_new_connections(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, struct conn_table *clients, struct poll_set *poll_set, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options, int *ready);
+static void accept_connections(struct dc_env *env, struct dc_error *err, int listener, const struct endpoint *endpoint, struct conn_table *clients, struct poll_set *poll_set, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options);
+static void handle_metrics_connection(struct dc_env *env, struct dc_error *err, int metrics_listener, struct conn_table *clients, struct poll_set *poll_set);
+static void handle_client_data(struct dc_env *env, struct dc_error *err, int metrics_listener, struct conn_table *clients, struct poll_set *poll_set, struct timer_wheel *wheel, struct metrics *metrics, const struct options *options, int ready);
+static bool service_client(struct dc_env *env, struct dc_error *err, struct connection *connection, struct pollfd *pfd, struct metrics_shard *shard, const struct options *options);
+static void expire_clients(struct dc_env *env, struct dc_error *err, struct conn_table *clients, struct poll_set *poll_set, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options, int metrics_listener);
+static void expire_client(void *arg, size_t id);
+static bool process_request(struct dc_env *env, struct dc_error *err, struct connection *connection, struct metrics_shard *shard, char *buffer, size_t bytes_read, size_t capacity, bool *pinned);
+static bool send_reply(void *arg, const struct request *request);
+static bool send_zerocopy(struct read_context *context, int word_count);
 
 
 static volatile sig_atomic_t done = false;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
 
-int main(void)
+int main(int argc, char *argv[])
 {
     struct dc_env *env;
     struct dc_error *err;
-    int listener;
-    int client_sockets[MAX_CLIENTS];
+    struct options options;
+    int metrics_listener;
+    struct conn_table clients;
+    struct buffer_pool buffer_pool;
+    struct buffer_cache buffers;
+    struct metrics metrics;
     int ret_val;
 
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--listen tcp:[ADDRESS:]PORT | unix:PATH | unix:@NAME]... [--backlog N] [--accept-batch K] [--max-clients N] [--frame none | line | length] [--high-water BYTES] [--log-file PATH] [--log-level error | warn | info | debug | trace] [--metrics-port PORT] [--idle-timeout MS] [--read-timeout MS] [--write-timeout MS] [--zerocopy]\n", argv[0]);  // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    word_count_init();
     err = dc_error_create(true);
     env = dc_env_create(err, true, NULL);
-    listener = setup_server(env, err);
+    logger_init(env, err, options.log_file, options.log_level);
 
     if(dc_error_has_no_error(err))
     {
-        dc_signal(env, err, SIGINT, ctrl_c_handler);
+        listeners_open(env, err, &options.listeners, options.backlog, false, true);
 
         if(dc_error_has_no_error(err))
         {
-            run_server(env, err, listener, client_sockets);
+            metrics_listener = -1;
+            dc_signal(env, err, SIGINT, ctrl_c_handler);
+
+            if(dc_error_has_no_error(err) && options.metrics_port != 0)
+            {
+                metrics_listener = metrics_listen(env, err, options.metrics_port);
+            }
+
+            if(dc_error_has_no_error(err))
+            {
+                buffer_pool_init(env, &buffer_pool);
+                buffer_cache_init(env, &buffers, &buffer_pool);
+                metrics_init(env, err, &metrics, 1, "poll");
+                metrics_set_sampler(&metrics, sample_buffers, &buffer_pool);
+                conn_table_init(env, err, &clients, INITIAL_CLIENTS, &buffers);
+
+                if(options.max_clients != 0 && (size_t)options.max_clients < clients.max_connections)
+                {
+                    clients.max_connections = (size_t)options.max_clients;
+                }
+
+                if(dc_error_has_no_error(err))
+                {
+                    run_server(env, err, &options.listeners, metrics_listener, &clients, &metrics, &options);
+                }
+
+                conn_table_destroy(env, &clients);
+                buffer_cache_destroy(&buffers);
+                buffer_pool_destroy(env, &buffer_pool);
+                metrics_destroy(env, &metrics);
+            }
+
+            if(metrics_listener != -1)
+            {
+                dc_close(env, err, metrics_listener);
+            }
+
+            listeners_close(env, err, &options.listeners);
         }
 
-        dc_close(env, err, listener);
+        logger_shutdown();
     }
 
     if(dc_error_has_no_error(err))
@@ -68,6 +200,197 @@ int main(void)
     return ret_val;
 }
 
+/**
+ * runs on the event loop when metrics are scraped, there is no count pool so only the buffer values are filled in
+ * */
+static void sample_buffers(void *arg, uint64_t values[METRICS_SAMPLED_COUNT])
+{
+    struct buffer_pool_stats stats;
+
+    buffer_pool_stats(arg, &stats);
+    memset(values, 0, METRICS_SAMPLED_COUNT * sizeof(uint64_t));
+    values[METRICS_BUFFER_IN_USE_BYTES] = stats.in_use_bytes;
+    values[METRICS_BUFFER_IN_USE] = stats.in_use_buffers;
+    values[METRICS_BUFFER_FREE_BYTES] = stats.free_bytes;
+    values[METRICS_BUFFER_HITS] = stats.hits;
+    values[METRICS_BUFFER_MISSES] = stats.misses;
+    values[METRICS_RESIDENT_BYTES] = buffer_pool_rss();
+}
+
+/**
+ * --listen adds a tcp or unix stream endpoint to accept on and can be repeated, LISTENERS_DEFAULT if there is none
+ * --backlog sizes each listen queue, --accept-batch caps how many connections are accepted per wakeup
+ * --max-clients stops accepting at that many clients, new connections wait in the backlog until one leaves
+ * --frame picks how requests are delimited for clients that do not negotiate the binary protocol, none keeps the original one request per read() protocol
+ * --high-water stops reading from a client once that many reply bytes are queued for it
+ * --log-file sends the log to a csv file instead of stdout, --log-level picks how much is logged, the payload only at trace
+ * --metrics-port serves prometheus metrics on that port from the same loop, off by default
+ * --idle-timeout, --read-timeout and --write-timeout close clients that make no progress for that many milliseconds, all off by default
+ * --zerocopy echoes payloads of at least ZEROCOPY_MIN_SIZE with MSG_ZEROCOPY instead of copying them into the socket, without framing only
+ * */
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"listen",        required_argument, NULL, 'L'},
+        {"backlog",       required_argument, NULL, 'B'},
+        {"accept-batch",  required_argument, NULL, 'k'},
+        {"max-clients",   required_argument, NULL, 'c'},
+        {"frame",         required_argument, NULL, 'f'},
+        {"high-water",    required_argument, NULL, 'w'},
+        {"log-file",      required_argument, NULL, 'o'},
+        {"log-level",     required_argument, NULL, 'v'},
+        {"metrics-port",  required_argument, NULL, 'm'},
+        {"idle-timeout",  required_argument, NULL, 'I'},
+        {"read-timeout",  required_argument, NULL, 'R'},
+        {"write-timeout", required_argument, NULL, 'W'},
+        {"zerocopy",      no_argument,       NULL, 'z'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    listeners_init(&options->listeners);
+    options->backlog = ADMISSION_DEFAULT_BACKLOG;
+    options->accept_batch = ADMISSION_DEFAULT_BATCH;
+    options->max_clients = 0;
+    options->frame_mode = FRAME_NONE;
+    options->high_water = OUT_BUFFER_DEFAULT_HIGH_WATER;
+    options->log_file = NULL;
+    options->log_level = LOG_LEVEL_INFO;
+    options->metrics_port = 0;
+    options->timeouts.idle_ns = 0;
+    options->timeouts.read_ns = 0;
+    options->timeouts.write_ns = 0;
+    options->zerocopy = false;
+
+    while((opt = getopt_long(argc, argv, "L:B:k:c:f:w:o:v:m:I:R:W:z", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'L':
+            {
+                if(!(listeners_add(&options->listeners, optarg)))
+                {
+                    if(errno == ENAMETOOLONG)
+                    {
+                        fprintf(stderr, "%s: a unix socket path or name can be at most %zu bytes\n", optarg, ENDPOINT_PATH_MAX);    // NOLINT(cert-err33-c)
+                    }
+
+                    return false;
+                }
+
+                break;
+            }
+            case 'B':
+            {
+                if(!(admission_parse_count(optarg, &options->backlog)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'k':
+            {
+                if(!(admission_parse_count(optarg, &options->accept_batch)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'c':
+            {
+                if(!(admission_parse_count(optarg, &options->max_clients)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'f':
+            {
+                if(!(request_parse_frame_mode(optarg, &options->frame_mode)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'w':
+            {
+                if(!(out_buffer_parse_high_water(optarg, &options->high_water)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'o':
+            {
+                options->log_file = optarg;
+                break;
+            }
+            case 'v':
+            {
+                if(!(logger_parse_level(optarg, &options->log_level)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'm':
+            {
+                if(!(metrics_parse_port(optarg, &options->metrics_port)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'I':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.idle_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'R':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.read_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'W':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.write_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'z':
+            {
+                options->zerocopy = true;
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    return optind == argc;
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 static void ctrl_c_handler(int signum)
@@ -76,189 +399,677 @@ static void ctrl_c_handler(int signum)
 }
 #pragma GCC diagnostic pop
 
-static int setup_server(struct dc_env *env, struct dc_error *err)
+/**
+ * the loop time runs from poll() returning to the last ready descriptor being handled
+ * poll() sleeps until the next timer in the wheel is due, or forever when no timeouts are set
+ * the listeners' POLLIN is dropped while accepting is paused, so a full server leaves new connections in the backlogs
+ * */
+static void run_server(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, int metrics_listener, struct conn_table *clients, struct metrics *metrics, const struct options *options)
 {
-    int listener;
+    struct poll_set poll_set;
+    struct admission admission;
+    struct timer_wheel wheel;
+    struct metrics_shard *shard;
 
     DC_TRACE(env);
-    listener = dc_socket(env, err, AF_INET, SOCK_STREAM, 0);
 
-    if(dc_error_has_no_error(err))
-    {
-        static int optval = 1;
+    poll_set.fds = NULL;
+    poll_set.count = 0;
+    poll_set.capacity = 0;
+    poll_set.first_client = listeners->count;
+    shard = &metrics->shards[0];
+    timer_wheel_init(&wheel, TIMEOUTS_TICK_NS, metrics_now_ns());
+    admission_init(env, err, &admission, options->accept_batch);
 
-        dc_setsockopt(env, err, listener, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    for(size_t i = 0; i < listeners->count && dc_error_has_no_error(err); i++)
+    {
+        add_pollfd(env, err, &poll_set, listeners->fds[i]);
+    }
 
-        if(dc_error_has_no_error(err))
+    if(dc_error_has_no_error(err) && (metrics_listener == -1 || add_pollfd(env, err, &poll_set, metrics_listener)))
+    {
+        while(!(done))
         {
-            struct sockaddr_in server_addr;
+            short events;
+            int timeout;
+            int ready;
+
+            events = admission_accepting(&admission, clients->count) ? POLLIN : 0;
+
+            for(size_t i = 0; i < poll_set.first_client; i++)
+            {
+                poll_set.fds[i].events = events;
+            }
+
+            timeout = timer_wheel_timeout_ms(&wheel, metrics_now_ns());
+
+            // closed sockets the kernel still has sends of are not polled, they are looked at every time round the loop instead
+            if(clients->lingering.count > 0)
+            {
+                zerocopy_lingering_reap(&clients->lingering, clients->buffers);
 
-            dc_memset(env, &server_addr, 0, sizeof(server_addr));
-            server_addr.sin_family = AF_INET;
-            server_addr.sin_addr.s_addr = INADDR_ANY;
-            server_addr.sin_port = htons(SERVER_PORT);
+                if(clients->lingering.count > 0 && (timeout == -1 || timeout > ZEROCOPY_LINGER_POLL_MS))
+                {
+                    timeout = ZEROCOPY_LINGER_POLL_MS;
+                }
+            }
 
-            dc_bind(env, err, listener, (struct sockaddr*)&server_addr, sizeof(server_addr));
+            ready = wait_for_data(env, err, &poll_set, timeout);
 
             if(dc_error_has_no_error(err))
             {
-                dc_listen(env, err, listener, BACKLOG);
+                uint64_t woke_ns;
+
+                woke_ns = metrics_now_ns();
+                handle_new_connections(env, err, listeners, clients, &poll_set, &admission, &wheel, shard, options, &ready);
+
+                if(dc_error_has_no_error(err))
+                {
+                    handle_client_data(env, err, metrics_listener, clients, &poll_set, &wheel, metrics, options, ready);
+                }
+
+                if(dc_error_has_no_error(err))
+                {
+                    expire_clients(env, err, clients, &poll_set, &wheel, shard, options, metrics_listener);
+                }
+
+                metrics_observe(shard, METRICS_LOOP_TIME, metrics_now_ns() - woke_ns);
+            }
+            else if(dc_errno_get_errno(err) != EINTR)
+            {
+                metrics_add(shard, METRICS_POLL_ERRORS, 1);
+            }
+
+            // ctrl-c interrupting poll() is how the loop ends, not an error
+            if(dc_error_has_error(err) && dc_errno_get_errno(err) != EINTR)
+            {
+                logger_write(LOG_LEVEL_ERROR, "(%d) %s", dc_errno_get_errno(err), dc_error_get_message(err));
             }
+
+            dc_error_reset(err);
         }
     }
 
-    return listener;
+    if(poll_set.fds != NULL)
+    {
+        dc_free(env, poll_set.fds);
+    }
+
+    timer_wheel_destroy(env, &wheel);
+    admission_destroy(env, err, &admission);
+}
+
+/**
+ * appends fd, doubling the array when it is full
+ * */
+static bool add_pollfd(struct dc_env *env, struct dc_error *err, struct poll_set *poll_set, int fd)
+{
+    DC_TRACE(env);
+
+    if(poll_set->count == poll_set->capacity)
+    {
+        struct pollfd *fds;
+        size_t capacity;
+
+        capacity = poll_set->capacity == 0 ? INITIAL_CLIENTS + 1 : poll_set->capacity * 2;
+        fds = dc_realloc(env, err, poll_set->fds, capacity * sizeof(struct pollfd));
+
+        if(dc_error_has_error(err))
+        {
+            return false;
+        }
+
+        poll_set->fds = fds;
+        poll_set->capacity = capacity;
+    }
+
+    poll_set->fds[poll_set->count].fd = fd;
+    poll_set->fds[poll_set->count].events = POLLIN;
+    poll_set->fds[poll_set->count].revents = 0;
+    poll_set->count++;
+
+    return true;
+}
+
+/**
+ * keeps the array packed by moving the last entry into the hole, its revents come along with it
+ * */
+static void remove_pollfd(struct poll_set *poll_set, size_t index)
+{
+    poll_set->count--;
+    poll_set->fds[index] = poll_set->fds[poll_set->count];
+}
+
+/**
+ * drops the entries of clients that were closed without going through handle_client_data, one pass for however many there were
+ * */
+static void remove_closed_pollfds(struct poll_set *poll_set, const struct conn_table *clients, int metrics_listener)
+{
+    size_t i;
+
+    i = poll_set->first_client;
+
+    while(i < poll_set->count)
+    {
+        if(poll_set->fds[i].fd != metrics_listener && conn_table_lookup(clients, poll_set->fds[i].fd) == NULL)
+        {
+            remove_pollfd(poll_set, i);
+            continue;
+        }
+
+        i++;
+    }
 }
 
-static void run_server(struct dc_env *env, struct dc_error *err, int listener, int *client_sockets)
+static int wait_for_data(struct dc_env *env, struct dc_error *err, struct poll_set *poll_set, int timeout)
 {
-    struct pollfd fds[MAX_CLIENTS + 1];
-    int num_clients;
-    int i;
+    int ready;
 
     DC_TRACE(env);
+    ready = sysio_poll(poll_set->fds, poll_set->count, timeout);
 
-    num_clients = 0;
+    if(ready == -1)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return ready;
+}
 
-    for(i = 0; i < MAX_CLIENTS; i++)
+/**
+ * tcp and unix listeners are served alike, each readable one gets its own batch
+ * */
+static void handle_new_connections(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, struct conn_table *clients, struct poll_set *poll_set, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options, int *ready)
+{
+    DC_TRACE(env);
+
+    for(size_t i = 0; i < listeners->count && dc_error_has_no_error(err); i++)
     {
-        client_sockets[i] = -1;
+        if((unsigned int)poll_set->fds[i].revents & (unsigned int)POLLIN)
+        {
+            (*ready)--;
+            accept_connections(env, err, listeners->fds[i], &listeners->endpoints[i], clients, poll_set, admission, wheel, shard, options);
+        }
     }
+}
 
-    fds[0].fd = listener;
-    fds[0].events = POLLIN;
-    fds[0].revents = 0;
+/**
+ * takes up to a batch of connections per wakeup, accept4() hands them over already non-blocking
+ * clients are non-blocking so a slow reader can never stall the loop, replies it cannot take yet wait in its out buffer
+ * accepting pauses as soon as the table is full, the one connection that can still be turned away is one that arrives
+ * while the process is out of descriptors
+ * */
+static void accept_connections(struct dc_env *env, struct dc_error *err, int listener, const struct endpoint *endpoint, struct conn_table *clients, struct poll_set *poll_set, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options)
+{
+    DC_TRACE(env);
 
-    while(!(done))
+    for(int i = 0; i < admission->batch && dc_error_has_no_error(err); i++)
     {
-        wait_for_data(env, err, listener, client_sockets, num_clients, fds);
+        int new_socket;
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len;
+        char peer[ENDPOINT_NAME_SIZE];
+        struct connection *connection;
+        bool dropped;
 
-        if(dc_error_has_no_error(err))
+        if(conn_table_full(clients))
         {
-            handle_new_connections(env, err, listener, client_sockets, &num_clients, fds);
+            logger_write(LOG_LEVEL_WARN, "%zu clients, pausing accept", clients->count);
+            admission_pause(admission, clients->count);
+            return;
+        }
 
-            if(dc_error_has_no_error(err))
+        client_addr_len = sizeof(client_addr);
+        new_socket = admission_accept(env, err, admission, listener, (struct sockaddr *)&client_addr, &client_addr_len, &dropped);
+
+        if(new_socket == -1)
+        {
+            if(dropped)
+            {
+                logger_write(LOG_LEVEL_WARN, "out of file descriptors, dropping new connection and pausing accept");
+                metrics_add(shard, METRICS_REJECTS, 1);
+                admission_pause(admission, clients->count);
+            }
+
+            return;
+        }
+
+        if(logger_enabled(LOG_LEVEL_INFO))
+        {
+            endpoint_peer_name(&client_addr, client_addr_len, peer, sizeof(peer));
+            logger_write(LOG_LEVEL_INFO, "fd %d: new connection from %s on %s", new_socket, peer, endpoint->name);
+        }
+
+        connection = conn_table_insert(env, err, clients, new_socket);
+
+        if(connection == NULL || !(add_pollfd(env, err, poll_set, new_socket)))
+        {
+            logger_write(LOG_LEVEL_WARN, "fd %d: too many clients, dropping new connection", new_socket);
+            metrics_add(shard, METRICS_REJECTS, 1);
+
+            if(connection != NULL)
             {
-                handle_client_data(env, err, client_sockets, &num_clients, fds);
+                conn_table_remove(env, clients, connection);
             }
+
+            close(new_socket);
+            admission_pause(admission, clients->count);
+            return;
         }
 
-        // TODO what do we do if poll has an error?
-        // At least we should print out a message
-        // Should really log it
-        // we could make a csv file for the log and other than that just prints out the error_msg
-        dc_error_reset(err);
+        request_parser_init(&connection->parser, options->frame_mode);
+        connection->reading = true;
+        connection->writing = false;
+        metrics_add(shard, METRICS_ACCEPTS, 1);
+
+        // unix sockets have no SO_ZEROCOPY, and nothing to gain from it since they never leave the host
+        if(options->zerocopy && options->frame_mode == FRAME_NONE && client_addr.ss_family != AF_UNIX && !(zerocopy_enable(&connection->zerocopy, new_socket)))
+        {
+            logger_write(LOG_LEVEL_WARN, "fd %d: SO_ZEROCOPY is not supported, echoing with copies", new_socket);
+        }
+
+        if(timeouts_enabled(&options->timeouts))
+        {
+            timeouts_touch(connection, metrics_now_ns(), true, false);
+            timeouts_arm(env, err, wheel, &options->timeouts, connection, conn_table_slot(clients, connection));
+        }
     }
 }
 
-static void wait_for_data(struct dc_env *env, struct dc_error *err, int listener, const int *client_sockets, int num_clients, struct pollfd *fds)
+/**
+ * a scrape is tracked like a client so its request is read when poll() reports it, it is never counted as one
+ * */
+static void handle_metrics_connection(struct dc_env *env, struct dc_error *err, int metrics_listener, struct conn_table *clients, struct poll_set *poll_set)
 {
-    int i;
+    int fd;
+    struct connection *connection;
 
     DC_TRACE(env);
+    fd = metrics_accept(env, err, metrics_listener);
+
+    if(fd == -1)
+    {
+        return;
+    }
 
-    fds[0].fd = listener;
-    fds[0].events = POLLIN;
-    fds[0].revents = 0;
+    connection = conn_table_insert(env, err, clients, fd);
 
-    for (i = 0; i < num_clients; i++)
+    if(connection == NULL || !(add_pollfd(env, err, poll_set, fd)))
     {
-        fds[i + 1].fd = client_sockets[i];
-        fds[i + 1].events = POLLIN;
+        if(connection != NULL)
+        {
+            conn_table_remove(env, clients, connection);
+        }
+
+        close(fd);
+        return;
     }
 
-    dc_poll(env, err, fds, num_clients + 1, POLL_TIMEOUT);
+    connection->admin = true;
+    connection->reading = true;
 }
 
-static void handle_new_connections(struct dc_env *env, struct dc_error *err, int listener, int *client_sockets, int *num_clients, struct pollfd *fds)
+/**
+ * stops as soon as every descriptor poll() reported has been handled instead of walking the whole array
+ * */
+static void handle_client_data(struct dc_env *env, struct dc_error *err, int metrics_listener, struct conn_table *clients, struct poll_set *poll_set, struct timer_wheel *wheel, struct metrics *metrics, const struct options *options, int ready)
 {
-    int i;
-    int new_socket;
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len;
+    size_t i;
 
     DC_TRACE(env);
-    client_addr_len = sizeof(client_addr);
 
-    if((unsigned int)fds[0].revents & (unsigned int)POLLIN)
+    i = poll_set->first_client;
+
+    while(i < poll_set->count && ready > 0)
     {
-        new_socket = dc_accept(env, err, listener, (struct sockaddr *)&client_addr, &client_addr_len);
+        struct pollfd *pfd;
 
-        if(dc_error_has_no_error(err))
+        pfd = &poll_set->fds[i];
+
+        if(pfd->revents != 0 && pfd->fd == metrics_listener)
         {
-            printf("New connection from %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));    // NOLINT(concurrency-mt-unsafe)
+            ready--;
+            handle_metrics_connection(env, err, metrics_listener, clients, poll_set);
+        }
+        else if(pfd->revents != 0)
+        {
+            struct connection *connection;
+            bool alive;
+
+            ready--;
+            connection = conn_table_lookup(clients, pfd->fd);
+            alive = connection->admin ? metrics_serve(env, err, metrics, pfd->fd) : service_client(env, err, connection, pfd, &metrics->shards[0], options);
 
-            for(i = 0; i < MAX_CLIENTS; i++)
+            if(!(alive))
             {
-                if(client_sockets[i] == -1)
+                if(!(connection->admin))
                 {
-                    client_sockets[i] = new_socket;
-                    break;
+                    logger_write(LOG_LEVEL_INFO, "fd %d: client disconnected", pfd->fd);
+                    metrics_add(&metrics->shards[0], METRICS_DISCONNECTS, 1);
                 }
+
+                timer_wheel_cancel(wheel, conn_table_slot(clients, connection));
+                conn_table_remove(env, clients, connection);
+                dc_close(env, err, pfd->fd);
+
+                // the last entry now sits at i, look at it before moving on
+                remove_pollfd(poll_set, i);
+                continue;
             }
 
-            if(i == MAX_CLIENTS)
+            if(!(connection->admin) && timeouts_enabled(&options->timeouts))
             {
-                printf("Too many clients, dropping new connection\n");
-                close(new_socket);
-                return;
+                timeouts_arm(env, err, wheel, &options->timeouts, connection, conn_table_slot(clients, connection));
             }
-
-            fds[i + 1].fd = new_socket;
-            fds[i + 1].events = POLLIN;
-            (*num_clients)++;
         }
+
+        i++;
     }
 }
 
-static void handle_client_data(struct dc_env *env, struct dc_error *err, int *client_sockets, int *num_clients, struct pollfd *fds)
+/**
+ * drains queued replies first, then reads one request's worth if the client is still under its high-water mark
+ * POLLOUT is only asked for while something is queued and POLLIN is dropped while too much is queued,
+ * so a client that stops reading stops being read from instead of growing its buffer without bound
+ * with zerocopy on, POLLERR is how the kernel says it is done with echoed buffers and the read buffer comes from the cache,
+ * it is kept back from the count so the count can follow the payload in the same pinned buffer
+ * returns false once the client has gone away
+ * */
+static bool service_client(struct dc_env *env, struct dc_error *err, struct connection *connection, struct pollfd *pfd, struct metrics_shard *shard, const struct options *options)
 {
+    size_t pending;
+    bool read;
+    bool wrote;
+
     DC_TRACE(env);
+    read = false;
+    wrote = false;
 
-    for(int i = 0; i < *num_clients; i++)
+    if(connection->zerocopy.enabled && (unsigned int)pfd->revents & (unsigned int)POLLERR)
     {
-        if((unsigned int)fds[i + 1].revents & (unsigned int)POLLIN)
+        uint64_t copied;
+
+        copied = 0;
+        zerocopy_reap(&connection->zerocopy, connection->out.cache, pfd->fd, &copied);
+        metrics_add(shard, METRICS_ZEROCOPY_COPIED, copied);
+    }
+
+    if((unsigned int)pfd->revents & (unsigned int)POLLOUT)
+    {
+        pending = out_buffer_pending(&connection->out);
+
+        if(!(out_buffer_flush(&connection->out, pfd->fd)))
         {
-            ssize_t bytes_read;
-            char buffer[BUFFER_SIZE];
+            return false;
+        }
 
-            bytes_read = dc_read(env, err, client_sockets[i], buffer, sizeof(buffer));
+        wrote = out_buffer_pending(&connection->out) < pending;
+    }
 
-            if(bytes_read <= 0)
-            {
-                printf("Client disconnected\n");
-                dc_close(env, err, client_sockets[i]);
-                client_sockets[i] = -1;
+    if(connection->reading && (unsigned int)pfd->revents & (unsigned int)(POLLIN | POLLHUP | POLLERR))
+    {
+        ssize_t bytes_read;
+        char stack_buffer[BUFFER_SIZE];
+        char *buffer;
+        size_t capacity;
+        size_t size;
+        bool pinned;
 
-                for(int j = i; j < (*num_clients) - 1; j++)
-                {
-                    client_sockets[j] = client_sockets[j + 1];
-                    fds[j + 1] = fds[j + 2];
-                }
+        buffer = stack_buffer;
+        capacity = 0;
+        size = sizeof(stack_buffer);
+        pinned = false;
 
-                (*num_clients)--;
-                i--;
-                continue;
+        if(connection->zerocopy.enabled && connection->parser.mode == FRAME_NONE)
+        {
+            buffer = buffer_alloc(err, connection->out.cache, BUFFER_SIZE, &capacity);
+
+            if(buffer == NULL)
+            {
+                return false;
             }
 
-            int word_count = 0;
-            printf("Read from client\n");
-            dc_write(env, err, STDOUT_FILENO, buffer, bytes_read);
+            size = capacity - sizeof(int);
+        }
+
+        bytes_read = sysio_recv(pfd->fd, buffer, size);
 
-            for(int j = 0; j < bytes_read; j++)
+        if(bytes_read > 0)
+        {
+            uint64_t started_ns;
+
+            started_ns = metrics_now_ns();
+            read = true;
+            metrics_add(shard, METRICS_BYTES_IN, (uint64_t)bytes_read);
+
+            if(!(process_request(env, err, connection, shard, buffer, (size_t)bytes_read, capacity, &pinned)))
             {
-                //buffer[j] = (char)dc_toupper(env, buffer[j]);
-                if (buffer[j] == ' ' || buffer[j] == '\n' || buffer[j] == '\t')
-                    word_count++;
+                bytes_read = 0;
             }
 
-            printf("Writing to client\n");
-            printf("word count: %d\n", word_count);
-            char count_buffer[BUFFER_SIZE];
-            snprintf(count_buffer, BUFFER_SIZE, "%d", word_count);
-            dc_write(env, err, STDOUT_FILENO, buffer, bytes_read);
-            dc_write(env, err, client_sockets[i], buffer, bytes_read);
-            dc_write(env, err, client_sockets[i], &word_count, sizeof(word_count));
+            metrics_observe(shard, METRICS_SERVICE_TIME, metrics_now_ns() - started_ns);
+        }
+
+        if(capacity != 0 && !(pinned))
+        {
+            buffer_free(connection->out.cache, buffer, capacity);
+        }
+
+        if(bytes_read == 0 || (bytes_read == -1 && !(sysio_would_block(errno))))
+        {
+            return false;
+        }
+    }
+
+    if(timeouts_enabled(&options->timeouts))
+    {
+        timeouts_touch(connection, metrics_now_ns(), read, wrote);
+    }
+
+    pending = out_buffer_pending(&connection->out);
+    connection->reading = pending < options->high_water;
+    connection->writing = pending > 0;
+    pfd->events = (short)((connection->reading ? POLLIN : 0) | (connection->writing ? POLLOUT : 0));   // NOLINT(hicpp-signed-bitwise)
+
+    return true;
+}
+
+/**
+ * fires every timer that is due, the entries of the clients that were closed are removed from the poll set afterwards in one pass
+ * */
+static void expire_clients(struct dc_env *env, struct dc_error *err, struct conn_table *clients, struct poll_set *poll_set, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options, int metrics_listener)
+{
+    struct expiry_context context;
+
+    DC_TRACE(env);
+    context.env = env;
+    context.err = err;
+    context.clients = clients;
+    context.wheel = wheel;
+    context.metrics = shard;
+    context.options = options;
+    context.now_ns = metrics_now_ns();
+    context.expired = 0;
+    timer_wheel_advance(wheel, context.now_ns, expire_client, &context);
+
+    if(context.expired > 0)
+    {
+        remove_closed_pollfds(poll_set, clients, metrics_listener);
+    }
+}
+
+/**
+ * a timer can fire for a connection that has made progress since it was armed, that only moves the timer
+ * */
+static void expire_client(void *arg, size_t id)
+{
+    struct expiry_context *context;
+    struct connection *connection;
+    enum timeout_kind kind;
+    int fd;
+
+    context = arg;
+    connection = conn_table_at(context->clients, id);
+
+    if(!(connection->in_use) || connection->admin)
+    {
+        return;
+    }
+
+    kind = timeouts_expired(&context->options->timeouts, connection, context->now_ns);
+
+    if(kind == TIMEOUT_NONE)
+    {
+        timeouts_arm(context->env, context->err, context->wheel, &context->options->timeouts, connection, id);
+        return;
+    }
+
+    logger_write(LOG_LEVEL_INFO, "fd %d: %s timeout, closing connection", connection->fd, timeouts_kind_name(kind));
+    metrics_add(context->metrics, METRICS_TIMEOUTS, 1);
+    metrics_add(context->metrics, METRICS_DISCONNECTS, 1);
+    fd = connection->fd;
+    conn_table_remove(context->env, context->clients, connection);
+    dc_close(context->env, context->err, fd);
+    context->expired++;
+}
+
+/**
+ * a read can hold part of a request or several of them, the parser carries what is left over to the next read
+ * a client may pipeline requests, their replies are answered in order and sent together once the whole read is parsed
+ * returns false if the client has gone away
+ * */
+static bool process_request(struct dc_env *env, struct dc_error *err, struct connection *connection, struct metrics_shard *shard, char *buffer, size_t bytes_read, size_t capacity, bool *pinned)
+{
+    bool alive;
+
+    struct read_context context;
+    struct out_batch replies;
+
+    DC_TRACE(env);
+    out_batch_init(&replies, &connection->out, connection->fd);
+    context.env = env;
+    context.err = err;
+    context.metrics = shard;
+    context.connection = connection;
+    context.replies = &replies;
+    context.buffer = buffer;
+    context.bytes_read = bytes_read;
+    context.pinnable = capacity == 0 ? NULL : buffer;
+    context.capacity = capacity;
+    context.pinned = false;
+    alive = request_parser_feed_all(&connection->parser, buffer, bytes_read, send_reply, &context) && dc_error_has_no_error(err) && out_batch_flush(env, err, &replies) && dc_error_has_no_error(err);
+    *pinned = context.pinned;
+
+    return alive;
+}
+
+/**
+ * without framing each read is still answered with the payload followed by the raw int count
+ * that reply goes out as a single gathered write, framed and binary replies wait in the read's batch
+ * */
+static bool send_reply(void *arg, const struct request *request)
+{
+    struct read_context *context;
+    struct iovec iov[2];
+    size_t iovcnt;
+    int word_count;
+    char response[REQUEST_RESPONSE_SIZE];
+
+    context = arg;
+    DC_TRACE(context->env);
+
+    if(context->connection->parser.mode == FRAME_NONE && request->type == REQUEST_COUNT)
+    {
+        word_count = (int)request->words;
+        logger_write(LOG_LEVEL_DEBUG, "fd %d: read %zu bytes, %d words", context->connection->fd, context->bytes_read, word_count);
+        logger_write(LOG_LEVEL_TRACE, "fd %d: payload %.*s", context->connection->fd, (int)context->bytes_read, context->buffer);
+
+        if(context->pinnable != NULL && !(context->pinned) && out_buffer_pending(&context->connection->out) == 0 && zerocopy_ready(&context->connection->zerocopy, context->bytes_read))
+        {
+            metrics_add(context->metrics, METRICS_REQUESTS, 1);
+            metrics_add(context->metrics, METRICS_BYTES_OUT, context->bytes_read + sizeof(word_count));
+
+            return send_zerocopy(context, word_count);
         }
+
+        iov[0].iov_base = (void *)(uintptr_t)context->buffer;
+        iov[0].iov_len = context->bytes_read;
+        iov[1].iov_base = &word_count;
+        iov[1].iov_len = sizeof(word_count);
+        iovcnt = 2;
     }
+    else
+    {
+        if(request->type == REQUEST_HELLO)
+        {
+            logger_write(LOG_LEVEL_INFO, "fd %d: negotiated protocol version %u", context->connection->fd, request->version);
+        }
+        else
+        {
+            logger_write(LOG_LEVEL_DEBUG, "fd %d: request %" PRIu32 " of %" PRIu64 " words", context->connection->fd, request->id, request->words);
+            metrics_add(context->metrics, METRICS_REQUESTS, 1);
+        }
+
+        iov[0].iov_base = response;
+        iov[0].iov_len = request_format_reply(response, context->connection->parser.mode, request);
+        iovcnt = 1;
+    }
+
+    if(iovcnt == 2)
+    {
+        metrics_add(context->metrics, METRICS_REQUESTS, 1);
+    }
+
+    metrics_add(context->metrics, METRICS_BYTES_OUT, iovcnt == 1 ? iov[0].iov_len : iov[0].iov_len + iov[1].iov_len);
+
+    if(iovcnt == 1)
+    {
+        return out_batch_add(context->env, context->err, context->replies, response, iov[0].iov_len) && dc_error_has_no_error(context->err);
+    }
+
+    return out_buffer_send(context->env, context->err, &context->connection->out, context->connection->fd, iov, iovcnt) && dc_error_has_no_error(context->err);
+}
+
+/**
+ * the count goes into the read buffer right behind the payload, the kernel reads both from the pinned pages
+ * after the reply has been sent, so nothing the send points at may live on the stack
+ * whatever the socket did not take is copied into the out buffer as usual, ENOBUFS means the kernel is
+ * out of memory to pin pages with and the whole reply takes the copy path
+ * */
+static bool send_zerocopy(struct read_context *context, int word_count)
+{
+    struct connection *connection;
+    struct iovec iov;
+    ssize_t written;
+
+    connection = context->connection;
+    dc_memcpy(context->env, &context->pinnable[context->bytes_read], &word_count, sizeof(word_count));
+    iov.iov_base = context->pinnable;
+    iov.iov_len = context->bytes_read + sizeof(word_count);
+    written = zerocopy_send(&connection->zerocopy, connection->fd, &iov, 1, context->pinnable, context->capacity);
+
+    if(written == -1)
+    {
+        if(!(sysio_would_block(errno)) && errno != ENOBUFS)
+        {
+            return false;
+        }
+
+        written = 0;
+    }
+    else
+    {
+        context->pinned = true;
+        metrics_add(context->metrics, METRICS_ZEROCOPY_SENDS, 1);
+    }
+
+    if((size_t)written == iov.iov_len)
+    {
+        return true;
+    }
+
+    iov.iov_base = &context->pinnable[written];
+    iov.iov_len -= (size_t)written;
+
+    return out_buffer_send(context->env, context->err, &connection->out, connection->fd, &iov, 1) && dc_error_has_no_error(context->err);
 }
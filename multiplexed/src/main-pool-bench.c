@@ -0,0 +1,409 @@
+#include <dc_c/dc_string.h>
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "count_pool.h"
+#include "histogram.h"
+#include "word_count.h"
+
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_REQUESTS 20000
+#define DEFAULT_LARGE_EVERY 100
+#define DEFAULT_INFLIGHT 64
+#define SMALL_SIZE 100
+#define LARGE_SIZE (10UL * 1024UL * 1024UL)
+#define NANOSECONDS_PER_SECOND UINT64_C(1000000000)
+#define NANOSECONDS_PER_MICROSECOND ((double)1000)
+#define BYTES_PER_MIB ((double)(1024 * 1024))
+#define PERCENTILE_50 ((double)50)
+#define PERCENTILE_99 ((double)99)
+#define HISTOGRAM_HIGHEST_NS (60ULL * 1000000000ULL)
+#define HISTOGRAM_SIGNIFICANT_FIGURES 3
+
+
+struct options
+{
+    int threads;
+    long requests;
+    long large_every;
+    int inflight;
+};
+
+/**
+ * one schedule's run, jobs are created once and resubmitted as they come back so the producer only ever copies
+ * when a job is first filled, free_small and free_large are stacks of the jobs not in flight
+ * */
+struct run
+{
+    const struct options *options;
+    struct count_pool pool;
+    struct count_completions completions;
+    struct count_job **free_small;
+    struct count_job **free_large;
+    size_t num_small;
+    size_t num_large;
+    size_t small_total;
+    size_t large_total;
+    uint64_t small_words;
+    uint64_t large_words;
+    struct histogram small_latency;
+    struct histogram large_latency;
+    bool wrong;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
+static bool run_schedule(struct dc_env *env, struct dc_error *err, const struct options *options, enum count_schedule schedule, const char *name, const char *small, const char *large);
+static bool create_jobs(struct dc_env *env, struct dc_error *err, struct run *run, struct count_job **stack, size_t count, const char *data, size_t len);
+static void destroy_jobs(struct dc_env *env, struct count_job **stack, size_t count);
+static void submit(struct run *run, struct count_job *job);
+static int collect(struct dc_error *err, struct run *run);
+static char *make_payload(size_t size);
+static uint64_t next_random(uint64_t *state);
+static uint64_t now_ns(void);
+
+
+/**
+ * mixed traffic through the count pool with and without work stealing, no sockets involved
+ * every large_every-th request is a 10 MiB payload and the rest are 100 B, up to inflight of them are queued at once
+ * and each is resubmitted as soon as it is back, so the pool never runs dry and a small request waits behind whatever is queued
+ * small latency is what the stealing is for, a small request should only ever wait for a chunk, not for a whole large job,
+ * the large latency and the throughput show what the stealing costs
+ * usage: pool-bench [--threads N] [--requests N] [--large-every K] [--inflight N]
+ * */
+int main(int argc, char *argv[])
+{
+    struct options options;
+    struct dc_env *env;
+    struct dc_error *err;
+    char *small;
+    char *large;
+    bool ok;
+
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--threads N] [--requests N] [--large-every K] [--inflight N]\n", argv[0]);   // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    word_count_init();
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+    small = make_payload(SMALL_SIZE);
+    large = make_payload(LARGE_SIZE);
+
+    if(dc_error_has_error(err) || small == NULL || large == NULL)
+    {
+        fprintf(stderr, "could not set up the benchmark\n");    // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    printf("%d threads, %ld requests, 1 in %ld of %lu bytes and the rest of %d bytes, %d in flight\n", options.threads, options.requests, options.large_every, LARGE_SIZE, SMALL_SIZE, options.inflight);
+    printf("%-8s %10s %10s %10s %10s %10s %10s %10s %10s\n", "schedule", "seconds", "MiB/s", "small p50", "small p99", "small max", "large p50", "large p99", "steals");
+    ok = run_schedule(env, err, &options, COUNT_SCHEDULE_FIFO, "fifo", small, large);
+    ok = ok && run_schedule(env, err, &options, COUNT_SCHEDULE_STEAL, "steal", small, large);
+    printf("latencies in microseconds\n");
+    free(small);
+    free(large);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"threads",     required_argument, NULL, 't'},
+        {"requests",    required_argument, NULL, 'n'},
+        {"large-every", required_argument, NULL, 'l'},
+        {"inflight",    required_argument, NULL, 'i'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    options->threads = DEFAULT_THREADS;
+    options->requests = DEFAULT_REQUESTS;
+    options->large_every = DEFAULT_LARGE_EVERY;
+    options->inflight = DEFAULT_INFLIGHT;
+
+    while((opt = getopt_long(argc, argv, "t:n:l:i:", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 't':
+            {
+                options->threads = atoi(optarg);    // NOLINT(cert-err34-c)
+                break;
+            }
+            case 'n':
+            {
+                options->requests = atol(optarg);   // NOLINT(cert-err34-c)
+                break;
+            }
+            case 'l':
+            {
+                options->large_every = atol(optarg);    // NOLINT(cert-err34-c)
+                break;
+            }
+            case 'i':
+            {
+                options->inflight = atoi(optarg);   // NOLINT(cert-err34-c)
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    return optind == argc && options->threads > 0 && options->requests > 0 && options->large_every > 0 && options->inflight > 0;
+}
+
+/**
+ * every reply is checked against the count of its payload, a wrong merge fails the run
+ * */
+static bool run_schedule(struct dc_env *env, struct dc_error *err, const struct options *options, enum count_schedule schedule, const char *name, const char *small, const char *large)
+{
+    struct run run;
+    struct count_pool_stats stats;
+    uint64_t started_ns;
+    uint64_t bytes;
+    long submitted;
+    long done;
+    double seconds;
+    bool in_word;
+    bool created;
+
+    dc_memset(env, &run, 0, sizeof(run));
+    run.options = options;
+    run.small_total = (size_t)options->inflight;
+    run.large_total = (size_t)(options->inflight / options->large_every) + 2;
+    in_word = false;
+    run.small_words = word_count_run(word_count_kernel_active(), small, SMALL_SIZE, &in_word);
+    in_word = false;
+    run.large_words = word_count_run(word_count_kernel_active(), large, LARGE_SIZE, &in_word);
+    run.free_small = calloc(run.small_total, sizeof(struct count_job *));
+    run.free_large = calloc(run.large_total, sizeof(struct count_job *));
+
+    if(run.free_small == NULL || run.free_large == NULL || !(histogram_init(&run.small_latency, HISTOGRAM_HIGHEST_NS, HISTOGRAM_SIGNIFICANT_FIGURES)) || !(histogram_init(&run.large_latency, HISTOGRAM_HIGHEST_NS, HISTOGRAM_SIGNIFICANT_FIGURES)))
+    {
+        return false;
+    }
+
+    count_pool_init(env, err, &run.pool, options->threads, COUNT_POOL_CHUNK_SIZE, schedule);
+    count_completions_init(env, err, &run.completions);
+
+    created = dc_error_has_no_error(err) && create_jobs(env, err, &run, run.free_small, run.small_total, small, SMALL_SIZE);
+
+    if(created)
+    {
+        run.num_small = run.small_total;
+        created = create_jobs(env, err, &run, run.free_large, run.large_total, large, LARGE_SIZE);
+        run.num_large = created ? run.large_total : 0;
+    }
+
+    submitted = 0;
+    done = 0;
+    bytes = 0;
+    started_ns = now_ns();
+
+    while(created && dc_error_has_no_error(err) && done < options->requests && !(run.wrong))
+    {
+        bool large_next;
+
+        large_next = submitted % options->large_every == 0;
+
+        // a request only goes out once a job of its size is free, the order of sizes is the same for both schedules
+        if(submitted < options->requests && (large_next ? run.num_large : run.num_small) > 0 && submitted - done < options->inflight)
+        {
+            submit(&run, large_next ? run.free_large[--run.num_large] : run.free_small[--run.num_small]);
+            bytes += large_next ? LARGE_SIZE : SMALL_SIZE;
+            submitted++;
+            continue;
+        }
+
+        done += collect(err, &run);
+    }
+
+    seconds = (double)(now_ns() - started_ns) / (double)NANOSECONDS_PER_SECOND;
+
+    // everything still in flight is waited for so the jobs can be freed
+    while(dc_error_has_no_error(err) && submitted > done)
+    {
+        done += collect(err, &run);
+    }
+
+    count_pool_stats(&run.pool, &stats);
+    count_pool_destroy(env, &run.pool);
+    count_completions_destroy(env, err, &run.completions);
+    destroy_jobs(env, run.free_small, run.num_small);
+    destroy_jobs(env, run.free_large, run.num_large);
+    free(run.free_small);
+    free(run.free_large);
+
+    if(run.wrong || dc_error_has_error(err))
+    {
+        printf("%-8s WRONG COUNT\n", name);
+        histogram_destroy(&run.small_latency);
+        histogram_destroy(&run.large_latency);
+        return false;
+    }
+
+    printf("%-8s %10.3f %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f %10" PRIu64 "\n", name, seconds, (double)bytes / BYTES_PER_MIB / seconds,
+           (double)histogram_value_at_percentile(&run.small_latency, PERCENTILE_50) / NANOSECONDS_PER_MICROSECOND,
+           (double)histogram_value_at_percentile(&run.small_latency, PERCENTILE_99) / NANOSECONDS_PER_MICROSECOND,
+           (double)run.small_latency.max / NANOSECONDS_PER_MICROSECOND,
+           (double)histogram_value_at_percentile(&run.large_latency, PERCENTILE_50) / NANOSECONDS_PER_MICROSECOND,
+           (double)histogram_value_at_percentile(&run.large_latency, PERCENTILE_99) / NANOSECONDS_PER_MICROSECOND,
+           stats.steals);
+    fflush(stdout);     // NOLINT(cert-err33-c)
+    histogram_destroy(&run.small_latency);
+    histogram_destroy(&run.large_latency);
+
+    return true;
+}
+
+static bool create_jobs(struct dc_env *env, struct dc_error *err, struct run *run, struct count_job **stack, size_t count, const char *data, size_t len)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        stack[i] = count_job_create(env, err, &run->pool, &run->completions, len);
+
+        if(stack[i] == NULL)
+        {
+            destroy_jobs(env, stack, i);
+            return false;
+        }
+
+        dc_memcpy(env, stack[i]->data, data, len);
+        stack[i]->filled = len;
+    }
+
+    return true;
+}
+
+static void destroy_jobs(struct dc_env *env, struct count_job **stack, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        count_job_destroy(env, stack[i]);
+    }
+}
+
+/**
+ * a job that came back is put back to the state count_job_create left it in, its data is already filled
+ * */
+static void submit(struct run *run, struct count_job *job)
+{
+    job->words = 0;
+    job->next_chunk = 0;
+    atomic_store_explicit(&job->chunks_done, 0, memory_order_relaxed);
+    atomic_store_explicit(&job->cancelled, false, memory_order_relaxed);
+    job->submitted_ns = now_ns();
+    count_pool_submit(&run->pool, job);
+}
+
+/**
+ * waits for the completion eventfd and returns how many jobs came back
+ * */
+static int collect(struct dc_error *err, struct run *run)
+{
+    struct pollfd pfd;
+    struct count_job *job;
+    uint64_t finished_ns;
+    int count;
+
+    pfd.fd = run->completions.wake_fd;
+    pfd.events = POLLIN;
+
+    if(poll(&pfd, 1, -1) == -1 && errno != EINTR)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+        return 0;
+    }
+
+    job = count_completions_take(err, &run->completions);
+    finished_ns = now_ns();
+    count = 0;
+
+    while(job != NULL)
+    {
+        struct count_job *next;
+        bool large;
+
+        next = job->next;
+        large = job->len == LARGE_SIZE;
+        histogram_record(large ? &run->large_latency : &run->small_latency, finished_ns - job->submitted_ns);
+        run->wrong = run->wrong || job->words != (large ? run->large_words : run->small_words);
+
+        if(large)
+        {
+            run->free_large[run->num_large++] = job;
+        }
+        else
+        {
+            run->free_small[run->num_small++] = job;
+        }
+
+        count++;
+        job = next;
+    }
+
+    return count;
+}
+
+/**
+ * short words and the odd run of spaces, tabs or newlines, enough that words straddle the chunk boundaries
+ * */
+static char *make_payload(size_t size)
+{
+    static const char spaces[] = "   \t\n";
+    char *text;
+    uint64_t state;
+
+    text = malloc(size);
+
+    if(text == NULL)
+    {
+        return NULL;
+    }
+
+    state = UINT64_C(0x9E3779B97F4A7C15);
+
+    for(size_t i = 0; i < size; i++)
+    {
+        uint64_t r;
+
+        r = next_random(&state);
+        text[i] = r % 6 == 0 ? spaces[r / 6 % (sizeof(spaces) - 1)] : (char)('a' + r / 6 % 26);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    return text;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *state ^= *state >> 7U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *state ^= *state << 17U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return *state;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)ts.tv_nsec;
+}
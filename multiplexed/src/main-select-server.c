@@ -1,4 +1,3 @@
-#include <arpa/inet.h>
 #include <dc_c/dc_ctype.h>
 #include <dc_c/dc_signal.h>
 #include <dc_c/dc_stdio.h>
@@ -7,263 +6,979 @@
 #include <dc_env/env.h>
 #include <dc_error/error.h>
 #include <dc_posix/dc_unistd.h>
-#include <dc_posix/sys/dc_select.h>
 #include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <signal.h>
+#include <string.h>
+#include "admission.h"
+#include "buffer_pool.h"
+#include "conn_table.h"
+#include "endpoint.h"
+#include "listeners.h"
+#include "logger.h"
+#include "metrics.h"
+#include "sysio.h"
+#include "timeouts.h"
+#include "trace.h"
+
+
+#define INITIAL_CLIENTS 16
+#define BUF_SIZE 65536
+#define MILLISECONDS_PER_SECOND 1000
+#define MICROSECONDS_PER_MILLISECOND 1000
+
+
+struct options
+{
+    struct listeners listeners;
+    int backlog;
+    int accept_batch;
+    int max_clients;
+    enum frame_mode frame_mode;
+    size_t high_water;
+    const char *log_file;
+    enum log_level log_level;
+    uint16_t metrics_port;
+    struct timeouts timeouts;
+};
 
+/**
+ * what send_reply needs to answer the requests completed by one read
+ * */
+struct read_context
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct metrics_shard *metrics;
+    struct connection *connection;
+    struct out_batch *replies;
+    const char *buffer;
+    size_t bytes_read;
+};
 
-#define SERVER_PORT 4981
-#define MAX_PENDING 5
-#define MAX_CLIENTS 10
-#define BUF_SIZE 256
+/**
+ * what expire_client needs to close a connection whose timer has fired
+ * */
+struct expiry_context
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct conn_table *clients;
+    struct select_set *fds;
+    struct timer_wheel *wheel;
+    struct metrics_shard *metrics;
+    const struct options *options;
+    uint64_t now_ns;
+};
 
+/**
+ * master holds every descriptor we want to read from and write_master the clients that have replies queued
+ * they only change when a client connects, disconnects, queues output or drains it
+ * read_fds and write_fds are the copies that select() overwrites with the descriptors that are ready
+ * max_fd is always the highest descriptor in either set, it is lowered again when that client leaves
+ * */
+struct select_set
+{
+    fd_set master;
+    fd_set write_master;
+    fd_set read_fds;
+    fd_set write_fds;
+    int max_fd;
+};
 
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
 static void ctrl_c_handler(int signum);
-static int setup_server(struct dc_env *env, struct dc_error *err);
-static int run_server(struct dc_env *env, struct dc_error *err, int listener, int *clients, fd_set *read_fds, int *max_fd);
-static int wait_for_data(struct dc_env *env, struct dc_error *err, int listener, const int *clients, fd_set *read_fds, const int *max_fd);
-static void handle_new_connections(struct dc_env *env, struct dc_error *err, int listener, int *clients, fd_set *read_fds, int *max_fd);
-static void handle_client_data(struct dc_env *env, struct dc_error *err, int *clients, fd_set* read_fds);
+static int run_server(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, int metrics_listener, struct conn_table *clients, struct select_set *fds, struct metrics *metrics, const struct options *options);
+static void sample_buffers(void *arg, uint64_t values[METRICS_SAMPLED_COUNT]);
+static int wait_for_data(struct dc_env *env, struct dc_error *err, struct select_set *fds, int timeout);
+static void handle_new_connections(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, struct conn_table *clients, struct select_set *fds, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options, int *ready);
+static void accept_connections(struct dc_env *env, struct dc_error *err, int listener, const struct endpoint *endpoint, struct conn_table *clients, struct select_set *fds, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options);
+static void handle_metrics_connection(struct dc_env *env, struct dc_error *err, int metrics_listener, struct conn_table *clients, struct select_set *fds);
+static void handle_client_data(struct dc_env *env, struct dc_error *err, struct conn_table *clients, struct select_set *fds, struct timer_wheel *wheel, struct metrics *metrics, const struct options *options, int ready);
+static bool service_client(struct dc_env *env, struct dc_error *err, struct connection *connection, struct select_set *fds, struct metrics_shard *shard, const struct options *options);
+static void expire_clients(struct dc_env *env, struct dc_error *err, struct conn_table *clients, struct select_set *fds, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options);
+static void expire_client(void *arg, size_t id);
+static bool process_request(struct dc_env *env, struct dc_error *err, struct connection *connection, struct metrics_shard *shard, const char *buffer, size_t bytes_read);
+static bool send_reply(void *arg, const struct request *request);
+static void unwatch_fd(struct select_set *fds, int fd);
 
 
 static volatile sig_atomic_t done = false;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
 
-int main(void)
+int main(int argc, char *argv[])
 {
     struct dc_env *env;
     struct dc_error *err;
-    int listener;
-    fd_set read_fds;
-    int max_fd;
+    struct options options;
+    int metrics_listener;
+    struct select_set fds;
     // all the file descriptor we are interested in
-    int client_sockets[MAX_CLIENTS];
+    struct conn_table client_sockets;
+    struct buffer_pool buffer_pool;
+    struct buffer_cache buffers;
+    struct metrics metrics;
+    int ret_val;
 
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--listen tcp:[ADDRESS:]PORT | unix:PATH | unix:@NAME]... [--backlog N] [--accept-batch K] [--max-clients N] [--frame none | line | length] [--high-water BYTES] [--log-file PATH] [--log-level error | warn | info | debug | trace] [--metrics-port PORT] [--idle-timeout MS] [--read-timeout MS] [--write-timeout MS]\n", argv[0]);  // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    word_count_init();
     // this shows if a function call failed
     err = dc_error_create(true);
     // this helps to show the functions called in main
     //env = dc_env_create(err, true, dc_env_default_tracer);
-    listener = setup_server(env, err);
+    env = dc_env_create(err, true, NULL);
+    logger_init(env, err, options.log_file, options.log_level);
+
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "ERROR (%d) %s\n", dc_errno_get_errno(err), dc_error_get_message(err)); // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    listeners_open(env, err, &options.listeners, options.backlog, false, true);
+
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "ERROR (%d) %s\n", dc_errno_get_errno(err), dc_error_get_message(err)); // NOLINT(cert-err33-c)
+        logger_shutdown();
+        return EXIT_FAILURE;
+    }
+
+    metrics_listener = options.metrics_port != 0 ? metrics_listen(env, err, options.metrics_port) : -1;
+
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "ERROR (%d) %s\n", dc_errno_get_errno(err), dc_error_get_message(err)); // NOLINT(cert-err33-c)
+        listeners_close(env, err, &options.listeners);
+        logger_shutdown();
+        return EXIT_FAILURE;
+    }
+
+    FD_ZERO(&fds.master);
+    FD_ZERO(&fds.write_master);
+    fds.max_fd = metrics_listener;
+
+    for(size_t i = 0; i < options.listeners.count; i++)
+    {
+        FD_SET(options.listeners.fds[i], &fds.master);
+
+        if(options.listeners.fds[i] > fds.max_fd)
+        {
+            fds.max_fd = options.listeners.fds[i];
+        }
+    }
 
-    if(listener < 0)
+    if(metrics_listener != -1)
     {
+        FD_SET(metrics_listener, &fds.master);
+    }
+
+    buffer_pool_init(env, &buffer_pool);
+    buffer_cache_init(env, &buffers, &buffer_pool);
+    metrics_init(env, err, &metrics, 1, "select");
+    metrics_set_sampler(&metrics, sample_buffers, &buffer_pool);
+    conn_table_init(env, err, &client_sockets, INITIAL_CLIENTS, &buffers);
+
+    // select() cannot watch descriptors past FD_SETSIZE whatever the rlimit says
+    if(client_sockets.max_connections > FD_SETSIZE)
+    {
+        client_sockets.max_connections = FD_SETSIZE;
+    }
+
+    if(options.max_clients != 0 && (size_t)options.max_clients < client_sockets.max_connections)
+    {
+        client_sockets.max_connections = (size_t)options.max_clients;
+    }
+
+    if(dc_error_has_error(err))
+    {
+        conn_table_destroy(env, &client_sockets);
+        buffer_cache_destroy(&buffers);
+        buffer_pool_destroy(env, &buffer_pool);
+        metrics_destroy(env, &metrics);
+        listeners_close(env, err, &options.listeners);
+        logger_shutdown();
         return EXIT_FAILURE;
     }
 
-    max_fd = listener;
-    dc_memset(env, client_sockets, 0, sizeof(client_sockets));
     dc_signal(env, err, SIGINT, ctrl_c_handler);
-    run_server(env, err, listener, client_sockets, &read_fds, &max_fd);
-    dc_close(env, err, listener);
+    ret_val = run_server(env, err, &options.listeners, metrics_listener, &client_sockets, &fds, &metrics, &options);
+    conn_table_destroy(env, &client_sockets);
+    buffer_cache_destroy(&buffers);
+    buffer_pool_destroy(env, &buffer_pool);
+    metrics_destroy(env, &metrics);
 
-    return EXIT_SUCCESS;
+    if(metrics_listener != -1)
+    {
+        dc_close(env, err, metrics_listener);
+    }
+
+    listeners_close(env, err, &options.listeners);
+    logger_shutdown();
+
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "ERROR (%d) %s\n", dc_errno_get_errno(err), dc_error_get_message(err)); // NOLINT(cert-err33-c)
+        ret_val = EXIT_FAILURE;
+    }
+
+    return ret_val;
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-parameter"
-static void ctrl_c_handler(int signum)
+/**
+ * runs on the event loop when metrics are scraped, there is no count pool so only the buffer values are filled in
+ * */
+static void sample_buffers(void *arg, uint64_t values[METRICS_SAMPLED_COUNT])
 {
-    done = true;
+    struct buffer_pool_stats stats;
+
+    buffer_pool_stats(arg, &stats);
+    memset(values, 0, METRICS_SAMPLED_COUNT * sizeof(uint64_t));
+    values[METRICS_BUFFER_IN_USE_BYTES] = stats.in_use_bytes;
+    values[METRICS_BUFFER_IN_USE] = stats.in_use_buffers;
+    values[METRICS_BUFFER_FREE_BYTES] = stats.free_bytes;
+    values[METRICS_BUFFER_HITS] = stats.hits;
+    values[METRICS_BUFFER_MISSES] = stats.misses;
+    values[METRICS_RESIDENT_BYTES] = buffer_pool_rss();
 }
-#pragma GCC diagnostic pop
 
 /**
- * this function sets up a server using the socket API
+ * --backlog sizes the listen queue, --accept-batch caps how many connections are accepted per wakeup
+ * --max-clients stops accepting at that many clients, new connections wait in the backlog until one leaves
+ * --frame picks how requests are delimited for clients that do not negotiate the binary protocol, none keeps the original one request per read() protocol
+ * --high-water stops reading from a client once that many reply bytes are queued for it
+ * --log-file sends the log to a csv file instead of stdout, --log-level picks how much is logged, the payload only at trace
+ * --metrics-port serves prometheus metrics on that port from the same loop, off by default
+ * --idle-timeout, --read-timeout and --write-timeout close clients that make no progress for that many milliseconds, all off by default
  * */
-static int setup_server(struct dc_env *env, struct dc_error *err)
+static bool parse_arguments(int argc, char *argv[], struct options *options)
 {
-    int listener;
-    int optval;
-    struct sockaddr_in server_addr;
+    static const struct option long_options[] =
+    {
+        {"listen",        required_argument, NULL, 'L'},
+        {"backlog",       required_argument, NULL, 'B'},
+        {"accept-batch",  required_argument, NULL, 'k'},
+        {"max-clients",   required_argument, NULL, 'c'},
+        {"frame",         required_argument, NULL, 'f'},
+        {"high-water",    required_argument, NULL, 'w'},
+        {"log-file",      required_argument, NULL, 'o'},
+        {"log-level",     required_argument, NULL, 'v'},
+        {"metrics-port",  required_argument, NULL, 'm'},
+        {"idle-timeout",  required_argument, NULL, 'I'},
+        {"read-timeout",  required_argument, NULL, 'R'},
+        {"write-timeout", required_argument, NULL, 'W'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    listeners_init(&options->listeners);
+    options->backlog = ADMISSION_DEFAULT_BACKLOG;
+    options->accept_batch = ADMISSION_DEFAULT_BATCH;
+    options->max_clients = 0;
+    options->frame_mode = FRAME_NONE;
+    options->high_water = OUT_BUFFER_DEFAULT_HIGH_WATER;
+    options->log_file = NULL;
+    options->log_level = LOG_LEVEL_INFO;
+    options->metrics_port = 0;
+    options->timeouts.idle_ns = 0;
+    options->timeouts.read_ns = 0;
+    options->timeouts.write_ns = 0;
+
+    while((opt = getopt_long(argc, argv, "L:B:k:c:f:w:o:v:m:I:R:W:", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'L':
+            {
+                if(!(listeners_add(&options->listeners, optarg)))
+                {
+                    if(errno == ENAMETOOLONG)
+                    {
+                        fprintf(stderr, "%s: a unix socket path or name can be at most %zu bytes\n", optarg, ENDPOINT_PATH_MAX);    // NOLINT(cert-err33-c)
+                    }
 
-    DC_TRACE(env);
-    /*creates a socket using the dc_socket*/
-    listener = dc_socket(env, err, AF_INET, SOCK_STREAM, 0);
+                    return false;
+                }
 
-    if (listener < 0)
-    {
-        dc_perror(env, "socket");
-        return -1;
-    }
+                break;
+            }
+            case 'B':
+            {
+                if(!(admission_parse_count(optarg, &options->backlog)))
+                {
+                    return false;
+                }
 
-    optval = 1;
-    /*sets the SO_REUSEADDR option to allow for reuse of the socket address*/
-    dc_setsockopt(env, err, listener, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+                break;
+            }
+            case 'k':
+            {
+                if(!(admission_parse_count(optarg, &options->accept_batch)))
+                {
+                    return false;
+                }
 
-    /*sets up the server address using the sockaddr_in struct*/
-    dc_memset(env, &server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(SERVER_PORT);
+                break;
+            }
+            case 'c':
+            {
+                if(!(admission_parse_count(optarg, &options->max_clients)))
+                {
+                    return false;
+                }
 
-    /*it binds the socket using dc_bind*/
-    if(dc_bind(env, err, listener, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0)
-    {
-        dc_perror(env, "bind");
-        dc_close(env, err, listener);
-        return -1;
-    }
+                break;
+            }
+            case 'f':
+            {
+                if(!(request_parse_frame_mode(optarg, &options->frame_mode)))
+                {
+                    return false;
+                }
 
-    /*it listens for incoming connections here with a max number of MAX_PENDING using dc_listen*/
-    if(dc_listen(env, err, listener, MAX_PENDING) < 0)
-    {
-        dc_perror(env, "listen");
-        dc_close(env, err, listener);
-        return -1;
+                break;
+            }
+            case 'w':
+            {
+                if(!(out_buffer_parse_high_water(optarg, &options->high_water)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'o':
+            {
+                options->log_file = optarg;
+                break;
+            }
+            case 'v':
+            {
+                if(!(logger_parse_level(optarg, &options->log_level)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'm':
+            {
+                if(!(metrics_parse_port(optarg, &options->metrics_port)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'I':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.idle_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'R':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.read_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            case 'W':
+            {
+                if(!(timeouts_parse(optarg, &options->timeouts.write_ns)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
     }
 
-    return listener;
+    return optind == argc;
 }
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void ctrl_c_handler(int signum)
+{
+    done = true;
+}
+#pragma GCC diagnostic pop
+
 /**
  * this code is the main loop of the server program, it runs until "done" flag is set
  * inside the loop it waits for data using the wait_for_data() function
  * if the select() function returns any data, the handle_new_connection() function is called to handle new
    incoming connections and the client data
+ * the listeners are left out of master while accepting is paused, so a full server leaves new connections in the backlogs
  * */
-static int run_server(struct dc_env *env, struct dc_error *err, int listener, int *clients, fd_set *read_fds, int *max_fd)
+static int run_server(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, int metrics_listener, struct conn_table *clients, struct select_set *fds, struct metrics *metrics, const struct options *options)
 {
+    struct admission admission;
+    struct timer_wheel wheel;
+    struct metrics_shard *shard;
+
     DC_TRACE(env);
+    shard = &metrics->shards[0];
+    timer_wheel_init(&wheel, TIMEOUTS_TICK_NS, metrics_now_ns());
+    admission_init(env, err, &admission, options->accept_batch);
+
+    if(dc_error_has_error(err))
+    {
+        logger_write(LOG_LEVEL_ERROR, "reserve fd: (%d) %s", dc_errno_get_errno(err), dc_error_get_message(err));
+        return EXIT_FAILURE;
+    }
 
     /*main loop that runs until the flag is set*/
     while(!(done))
     {
         int ready;
 
-        /*waits for data*/
-        ready = wait_for_data(env, err, listener, clients, read_fds, max_fd);
+        /*only watches the listeners while there is room for another client*/
+        for(size_t i = 0; i < listeners->count; i++)
+        {
+            if(admission_accepting(&admission, clients->count))
+            {
+                FD_SET(listeners->fds[i], &fds->master);
+
+                // unwatch_fd may have walked max_fd below the listener while it was out of the set
+                if(listeners->fds[i] > fds->max_fd)
+                {
+                    fds->max_fd = listeners->fds[i];
+                }
+            }
+            else
+            {
+                FD_CLR(listeners->fds[i], &fds->master);
+            }
+        }
+
+        /*waits for data, or for the next connection to time out*/
+        ready = wait_for_data(env, err, fds, timer_wheel_timeout_ms(&wheel, metrics_now_ns()));
 
         /*error handling*/
         if(ready < 0)
         {
-            dc_perror(env, "select");
-            continue;
+            // ctrl-c interrupting select() is how the loop ends, not an error
+            if(dc_errno_get_errno(err) != EINTR)
+            {
+                logger_write(LOG_LEVEL_ERROR, "select: (%d) %s", dc_errno_get_errno(err), dc_error_get_message(err));
+                metrics_add(shard, METRICS_POLL_ERRORS, 1);
+            }
+        }
+        else
+        {
+            uint64_t woke_ns;
+
+            woke_ns = metrics_now_ns();
+            /*handles new connection*/
+            handle_new_connections(env, err, listeners, clients, fds, &admission, &wheel, shard, options, &ready);
+
+            /*handles a scrape of the metrics port*/
+            if(metrics_listener != -1 && FD_ISSET(metrics_listener, &fds->read_fds))
+            {
+                ready--;
+                handle_metrics_connection(env, err, metrics_listener, clients, fds);
+            }
+
+            /*handles clients data*/
+            handle_client_data(env, err, clients, fds, &wheel, metrics, options, ready);
+
+            /*closes the clients that have timed out*/
+            expire_clients(env, err, clients, fds, &wheel, shard, options);
+            metrics_observe(shard, METRICS_LOOP_TIME, metrics_now_ns() - woke_ns);
         }
 
-        /*handles new connection*/
-        handle_new_connections(env, err, listener, clients, read_fds, max_fd);
-        /*handles clients data*/
-        handle_client_data(env, err, clients, read_fds);
+        // a failed call on one client must not stop the loop from serving the others
+        dc_error_reset(err);
     }
 
+    timer_wheel_destroy(env, &wheel);
+    admission_destroy(env, err, &admission);
+
     return EXIT_SUCCESS;
 }
 
 /**
  * this code uses the select function to wait for data from either the listener socket or one of the connected clients
- * it first clears the file descriptor sets read_fds using FD_ZERO
- * it then sets the listener socket and all connected clients in the read_fds set using FD_SET
+ * the listener and all connected clients are already in the master sets, so they are copied into read_fds and write_fds
+ * instead of being rebuilt with FD_ZERO and FD_SET every time around the loop
  * the select() function is then called with the highest file descriptor value plus 1 as the last parameter
  * it returns the number of file descriptors that file descriptors that have data ready to read
  * the final result of this code is a file descriptor set that keeps track of which sockets have data available to be read
+ * timeout is in milliseconds, -1 blocks until a descriptor is ready and 0 returns at once
  * */
-static int wait_for_data(struct dc_env *env, struct dc_error *err, int listener, const int *clients, fd_set *read_fds, const int *max_fd)
+static int wait_for_data(struct dc_env *env, struct dc_error *err, struct select_set *fds, int timeout)
 {
+    int ready;
+    struct timeval tv;
+
     DC_TRACE(env);
-    FD_ZERO(read_fds);
-    FD_SET(listener, read_fds);
+    fds->read_fds = fds->master;
+    fds->write_fds = fds->write_master;
+    tv.tv_sec = timeout / MILLISECONDS_PER_SECOND;
+    tv.tv_usec = (timeout % MILLISECONDS_PER_SECOND) * MICROSECONDS_PER_MILLISECOND;
+    ready = sysio_select(fds->max_fd + 1, &fds->read_fds, &fds->write_fds, timeout < 0 ? NULL : &tv);
 
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    if(ready == -1)
     {
-        if (clients[i] > 0)
-        {
-            FD_SET(clients[i], read_fds);
-        }
+        DC_ERROR_RAISE_ERRNO(err, errno);
     }
 
-    return dc_select(env, err, *max_fd + 1, read_fds, NULL, NULL, NULL);
+    return ready;
 }
 
 /**
  * this function handles new incoming connections from clients to the server
- * if the listener socket has new data to be read, it means that a new client has connected to the server
- * the function then accepts the connection using the dc_accept() and stores the clients fd in the clients array
+ * if a listener socket has new data to be read, it means that one or more clients have connected to the server
+ * the function then accepts up to a batch of them using accept4(), which makes each socket non-blocking on the way in,
+ * and stores the clients fd in the clients table and the master set
  * it also updates the value of max_fd if the new clients file descriptor is larger than the current value of max_fd
  * the function also prints a message to the console indicating a new connection has been established
+ * select() cannot watch descriptors at or above FD_SETSIZE, so those are dropped like a full table
+ * clients are non-blocking so a slow reader can never stall the loop, replies it cannot take yet wait in its out buffer
+ * once the table is full accepting pauses instead of accepting connections only to close them
  * */
-static void handle_new_connections(struct dc_env *env, struct dc_error *err, int listener, int *clients, fd_set *read_fds, int *max_fd)
+static void handle_new_connections(struct dc_env *env, struct dc_error *err, const struct listeners *listeners, struct conn_table *clients, struct select_set *fds, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options, int *ready)
 {
     DC_TRACE(env);
 
-    if (FD_ISSET(listener, read_fds))
+    for(size_t i = 0; i < listeners->count; i++)
     {
-        struct sockaddr_in client_addr;
+        if (FD_ISSET(listeners->fds[i], &fds->read_fds))
+        {
+            (*ready)--;
+            accept_connections(env, err, listeners->fds[i], &listeners->endpoints[i], clients, fds, admission, wheel, shard, options);
+        }
+    }
+}
+
+/**
+ * accepts up to a batch from one listener, a tcp and a unix one are handled the same way
+ * */
+static void accept_connections(struct dc_env *env, struct dc_error *err, int listener, const struct endpoint *endpoint, struct conn_table *clients, struct select_set *fds, struct admission *admission, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options)
+{
+    DC_TRACE(env);
+
+    for(int i = 0; i < admission->batch; i++)
+    {
+        struct sockaddr_storage client_addr;
         socklen_t client_len;
+        char peer[ENDPOINT_NAME_SIZE];
         int client_fd;
+        bool dropped;
+        struct connection *connection;
+
+        if(conn_table_full(clients))
+        {
+            logger_write(LOG_LEVEL_WARN, "%zu clients, pausing accept", clients->count);
+            admission_pause(admission, clients->count);
+            return;
+        }
 
         dc_memset(env, &client_addr, 0, sizeof(client_addr));
         client_len = sizeof(client_addr);
-        client_fd = dc_accept(env, err, listener, (struct sockaddr*) &client_addr, &client_len);
+        client_fd = admission_accept(env, err, admission, listener, (struct sockaddr*) &client_addr, &client_len, &dropped);
 
         if(client_fd < 0)
         {
-            dc_perror(env, "accept");
+            if(dropped)
+            {
+                logger_write(LOG_LEVEL_WARN, "out of file descriptors, dropping new connection and pausing accept");
+                metrics_add(shard, METRICS_REJECTS, 1);
+                admission_pause(admission, clients->count);
+            }
+            else if(dc_error_has_error(err))
+            {
+                logger_write(LOG_LEVEL_ERROR, "accept: (%d) %s", dc_errno_get_errno(err), dc_error_get_message(err));
+            }
+
             return;
         }
 
-        printf("New connection from %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));    // NOLINT(concurrency-mt-unsafe)
+        if(logger_enabled(LOG_LEVEL_INFO))
+        {
+            endpoint_peer_name(&client_addr, client_len, peer, sizeof(peer));
+            logger_write(LOG_LEVEL_INFO, "fd %d: new connection from %s on %s", client_fd, peer, endpoint->name);
+        }
+
+        connection = client_fd < FD_SETSIZE ? conn_table_insert(env, err, clients, client_fd) : NULL;
 
-        for(int i = 0; i < MAX_CLIENTS; i++)
+        if(connection == NULL)
         {
-            if(clients[i] == 0)
-            {
-                clients[i] = client_fd;
-                break;
-            }
+            logger_write(LOG_LEVEL_WARN, "fd %d: too many clients, dropping new connection", client_fd);
+            metrics_add(shard, METRICS_REJECTS, 1);
+            dc_close(env, err, client_fd);
+            admission_pause(admission, clients->count);
+            return;
+        }
+
+        request_parser_init(&connection->parser, options->frame_mode);
+        connection->reading = true;
+        connection->writing = false;
+        metrics_add(shard, METRICS_ACCEPTS, 1);
+        FD_SET(client_fd, &fds->master);
+
+        if (client_fd > fds->max_fd)
+        {
+            fds->max_fd = client_fd;
         }
 
-        if (client_fd > *max_fd)
+        if(timeouts_enabled(&options->timeouts))
         {
-            *max_fd = client_fd;
+            timeouts_touch(connection, metrics_now_ns(), true, false);
+            timeouts_arm(env, err, wheel, &options->timeouts, connection, conn_table_slot(clients, connection));
         }
     }
 }
 
-static void handle_client_data(struct dc_env *env, struct dc_error *err, int *clients, fd_set* read_fds)
+/**
+ * a scrape sits in the client table so its request is read when select() reports it, it is never counted as a client
+ * */
+static void handle_metrics_connection(struct dc_env *env, struct dc_error *err, int metrics_listener, struct conn_table *clients, struct select_set *fds)
 {
-    char buffer[BUF_SIZE];
+    int fd;
+    struct connection *connection;
 
     DC_TRACE(env);
+    fd = metrics_accept(env, err, metrics_listener);
+
+    if(fd == -1)
+    {
+        return;
+    }
+
+    connection = fd < FD_SETSIZE ? conn_table_insert(env, err, clients, fd) : NULL;
+
+    if(connection == NULL)
+    {
+        dc_close(env, err, fd);
+        return;
+    }
 
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    connection->admin = true;
+    connection->reading = true;
+    FD_SET(fd, &fds->master);
+
+    if (fd > fds->max_fd)
     {
-        if (clients[i] > 0 && FD_ISSET(clients[i], read_fds))
+        fds->max_fd = fd;
+    }
+}
+
+/**
+ * stops once every descriptor select() reported has been handled, a client that is both readable and writable counts twice
+ * */
+static void handle_client_data(struct dc_env *env, struct dc_error *err, struct conn_table *clients, struct select_set *fds, struct timer_wheel *wheel, struct metrics *metrics, const struct options *options, int ready)
+{
+    DC_TRACE(env);
+
+    for (size_t i = 0; i < clients->num_slots && ready > 0; i++)
+    {
+        struct connection *connection;
+        int events;
+
+        connection = conn_table_at(clients, i);
+
+        if (!connection->in_use)
+        {
+            continue;
+        }
+
+        events = (FD_ISSET(connection->fd, &fds->read_fds) ? 1 : 0) + (FD_ISSET(connection->fd, &fds->write_fds) ? 1 : 0);
+
+        if (events > 0)
         {
-            ssize_t bytes_read;
+            bool alive;
 
-            bytes_read = dc_read(env, err, clients[i], buffer, BUF_SIZE);
+            ready -= events;
+            alive = connection->admin ? metrics_serve(env, err, metrics, connection->fd) : service_client(env, err, connection, fds, &metrics->shards[0], options);
 
-            if(bytes_read <= 0)
+            if(!(alive))
             {
-                printf("Client disconnected\n");
-                dc_close(env, err, clients[i]);
-                clients[i] = 0;
-                continue;
+                if(!(connection->admin))
+                {
+                    logger_write(LOG_LEVEL_INFO, "fd %d: client disconnected", connection->fd);
+                    metrics_add(&metrics->shards[0], METRICS_DISCONNECTS, 1);
+                }
+
+                timer_wheel_cancel(wheel, i);
+                unwatch_fd(fds, connection->fd);
+                dc_close(env, err, connection->fd);
+                conn_table_remove(env, clients, connection);
             }
+            else if(!(connection->admin) && timeouts_enabled(&options->timeouts))
+            {
+                timeouts_arm(env, err, wheel, &options->timeouts, connection, i);
+            }
+        }
+    }
+}
+
+/**
+ * drains queued replies first, then reads one request's worth if the client is still under its high-water mark
+ * the client is only in write_master while something is queued and leaves master while too much is queued,
+ * so a client that stops reading stops being read from instead of growing its buffer without bound
+ * returns false once the client has gone away
+ * */
+static bool service_client(struct dc_env *env, struct dc_error *err, struct connection *connection, struct select_set *fds, struct metrics_shard *shard, const struct options *options)
+{
+    size_t pending;
+    bool read;
+    bool wrote;
 
-            // chat gpt initialized this to 1
-            int word_count = 0;
+    DC_TRACE(env);
+    read = false;
+    wrote = false;
 
-            printf("Read from client\n");
-            dc_write(env, err, STDOUT_FILENO, buffer, bytes_read);
+    if(FD_ISSET(connection->fd, &fds->write_fds))
+    {
+        pending = out_buffer_pending(&connection->out);
 
-            for(int j = 0; j < bytes_read; j++)
-            {
-                //buffer[j] = (char)dc_toupper(env, buffer[j]);
+        if(!(out_buffer_flush(&connection->out, connection->fd)))
+        {
+            return false;
+        }
+
+        wrote = out_buffer_pending(&connection->out) < pending;
+    }
+
+    if(connection->reading && FD_ISSET(connection->fd, &fds->read_fds))
+    {
+        char buffer[BUF_SIZE];
+        ssize_t bytes_read;
 
-                if (buffer[j] == ' ' || buffer[j] == '\n' || buffer[j] == '\t')
-                    word_count++;
+        bytes_read = sysio_recv(connection->fd, buffer, BUF_SIZE);
+
+        if(bytes_read == 0 || (bytes_read == -1 && !(sysio_would_block(errno))))
+        {
+            return false;
+        }
+
+        if(bytes_read > 0)
+        {
+            uint64_t started_ns;
+            bool alive;
+
+            started_ns = metrics_now_ns();
+            read = true;
+            metrics_add(shard, METRICS_BYTES_IN, (uint64_t)bytes_read);
+            alive = process_request(env, err, connection, shard, buffer, (size_t)bytes_read);
+            metrics_observe(shard, METRICS_SERVICE_TIME, metrics_now_ns() - started_ns);
+
+            if(!(alive))
+            {
+                return false;
             }
+        }
+    }
 
-            printf("Writing to client\n");
-            printf("word count: %d\n", word_count);
-            char count_buffer[BUF_SIZE];
-            snprintf(count_buffer, BUF_SIZE, "%d", word_count);
-            dc_write(env, err, STDOUT_FILENO, buffer, bytes_read);
-            dc_write(env, err, clients[i], count_buffer, dc_strlen(env, count_buffer));
-            //dc_write(env, err, clients[i], buffer, bytes_read);
-            dc_write(env, err, clients[i], &word_count, sizeof(word_count));
+    if(timeouts_enabled(&options->timeouts))
+    {
+        timeouts_touch(connection, metrics_now_ns(), read, wrote);
+    }
+
+    pending = out_buffer_pending(&connection->out);
+
+    if(connection->reading != (pending < options->high_water))
+    {
+        connection->reading = !connection->reading;
+
+        if(connection->reading)
+        {
+            FD_SET(connection->fd, &fds->master);
+        }
+        else
+        {
+            FD_CLR(connection->fd, &fds->master);
         }
     }
+
+    if(connection->writing != (pending > 0))
+    {
+        connection->writing = !connection->writing;
+
+        if(connection->writing)
+        {
+            FD_SET(connection->fd, &fds->write_master);
+        }
+        else
+        {
+            FD_CLR(connection->fd, &fds->write_master);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * fires every timer that is due, with select() there is nothing to compact so each client is closed on the spot
+ * */
+static void expire_clients(struct dc_env *env, struct dc_error *err, struct conn_table *clients, struct select_set *fds, struct timer_wheel *wheel, struct metrics_shard *shard, const struct options *options)
+{
+    struct expiry_context context;
+
+    DC_TRACE(env);
+    context.env = env;
+    context.err = err;
+    context.clients = clients;
+    context.fds = fds;
+    context.wheel = wheel;
+    context.metrics = shard;
+    context.options = options;
+    context.now_ns = metrics_now_ns();
+    timer_wheel_advance(wheel, context.now_ns, expire_client, &context);
+}
+
+/**
+ * a timer can fire for a connection that has made progress since it was armed, that only moves the timer
+ * */
+static void expire_client(void *arg, size_t id)
+{
+    struct expiry_context *context;
+    struct connection *connection;
+    enum timeout_kind kind;
+
+    context = arg;
+    connection = conn_table_at(context->clients, id);
+
+    if(!(connection->in_use) || connection->admin)
+    {
+        return;
+    }
+
+    kind = timeouts_expired(&context->options->timeouts, connection, context->now_ns);
+
+    if(kind == TIMEOUT_NONE)
+    {
+        timeouts_arm(context->env, context->err, context->wheel, &context->options->timeouts, connection, id);
+        return;
+    }
+
+    logger_write(LOG_LEVEL_INFO, "fd %d: %s timeout, closing connection", connection->fd, timeouts_kind_name(kind));
+    metrics_add(context->metrics, METRICS_TIMEOUTS, 1);
+    metrics_add(context->metrics, METRICS_DISCONNECTS, 1);
+    unwatch_fd(context->fds, connection->fd);
+    dc_close(context->env, context->err, connection->fd);
+    conn_table_remove(context->env, context->clients, connection);
+}
+
+/**
+ * a read can hold part of a request or several of them, the parser carries what is left over to the next read
+ * a client may pipeline requests, their replies are answered in order and sent together once the whole read is parsed
+ * returns false if the client has gone away
+ * */
+static bool process_request(struct dc_env *env, struct dc_error *err, struct connection *connection, struct metrics_shard *shard, const char *buffer, size_t bytes_read)
+{
+    struct read_context context;
+    struct out_batch replies;
+
+    DC_TRACE(env);
+    out_batch_init(&replies, &connection->out, connection->fd);
+    context.env = env;
+    context.err = err;
+    context.metrics = shard;
+    context.connection = connection;
+    context.replies = &replies;
+    context.buffer = buffer;
+    context.bytes_read = bytes_read;
+
+    if(!(request_parser_feed_all(&connection->parser, buffer, bytes_read, send_reply, &context)) || dc_error_has_error(err))
+    {
+        return false;
+    }
+
+    return out_batch_flush(env, err, &replies) && dc_error_has_no_error(err);
+}
+
+/**
+ * without framing each read is still answered with the count in ascii followed by the raw int
+ * that reply goes out as a single gathered write, framed and binary replies wait in the read's batch
+ * */
+static bool send_reply(void *arg, const struct request *request)
+{
+    struct read_context *context;
+    struct iovec iov[2];
+    size_t iovcnt;
+    int word_count;
+    char response[REQUEST_RESPONSE_SIZE];
+
+    context = arg;
+    DC_TRACE(context->env);
+
+    if(context->connection->parser.mode == FRAME_NONE && request->type == REQUEST_COUNT)
+    {
+        word_count = (int)request->words;
+        logger_write(LOG_LEVEL_DEBUG, "fd %d: read %zu bytes, %d words", context->connection->fd, context->bytes_read, word_count);
+        logger_write(LOG_LEVEL_TRACE, "fd %d: payload %.*s", context->connection->fd, (int)context->bytes_read, context->buffer);
+        snprintf(response, sizeof(response), "%d", word_count);
+        iov[0].iov_base = response;
+        iov[0].iov_len = dc_strlen(context->env, response);
+        iov[1].iov_base = &word_count;
+        iov[1].iov_len = sizeof(word_count);
+        iovcnt = 2;
+    }
+    else
+    {
+        if(request->type == REQUEST_HELLO)
+        {
+            logger_write(LOG_LEVEL_INFO, "fd %d: negotiated protocol version %u", context->connection->fd, request->version);
+        }
+        else
+        {
+            logger_write(LOG_LEVEL_DEBUG, "fd %d: request %" PRIu32 " of %" PRIu64 " words", context->connection->fd, request->id, request->words);
+            metrics_add(context->metrics, METRICS_REQUESTS, 1);
+        }
+
+        iov[0].iov_base = response;
+        iov[0].iov_len = request_format_reply(response, context->connection->parser.mode, request);
+        iovcnt = 1;
+    }
+
+    if(iovcnt == 2)
+    {
+        metrics_add(context->metrics, METRICS_REQUESTS, 1);
+    }
+
+    metrics_add(context->metrics, METRICS_BYTES_OUT, iovcnt == 1 ? iov[0].iov_len : iov[0].iov_len + iov[1].iov_len);
+
+    if(iovcnt == 1)
+    {
+        return out_batch_add(context->env, context->err, context->replies, response, iov[0].iov_len) && dc_error_has_no_error(context->err);
+    }
+
+    return out_buffer_send(context->env, context->err, &context->connection->out, context->connection->fd, iov, iovcnt) && dc_error_has_no_error(context->err);
+}
+
+/**
+ * if fd was the highest descriptor, max_fd walks down to the next one still in either master set
+ * */
+static void unwatch_fd(struct select_set *fds, int fd)
+{
+    FD_CLR(fd, &fds->master);
+    FD_CLR(fd, &fds->write_master);
+
+    while(fds->max_fd > 0 && !FD_ISSET(fds->max_fd, &fds->master) && !FD_ISSET(fds->max_fd, &fds->write_master))
+    {
+        fds->max_fd--;
+    }
 }
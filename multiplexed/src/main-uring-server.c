@@ -0,0 +1,590 @@
+#include <dc_c/dc_signal.h>
+#include <dc_c/dc_stdio.h>
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <getopt.h>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include "conn_table.h"
+#include "endpoint.h"
+#include "listeners.h"
+#include "logger.h"
+#include "trace.h"
+#include "word_count.h"
+
+
+#define BACKLOG 10
+#define QUEUE_DEPTH 4096
+#define BUFFER_GROUP_ID 0
+#define NUM_BUFFERS 1024
+#define BUFFER_SIZE 1024
+
+
+struct options
+{
+    struct listeners listeners;
+    const char *log_file;
+    enum log_level log_level;
+};
+
+/**
+ * every submission carries the operation and the socket it belongs to in its user_data
+ * */
+enum operation
+{
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+};
+
+/**
+ * a connection has at most one operation in flight, either a recv or a send, so replies stay in order
+ * the provided buffer that a recv landed in is kept until the echo has been sent and then handed back to the ring
+ * */
+struct uring_connection
+{
+    int fd;
+    bool in_use;
+    unsigned short buffer_id;
+    struct word_counter counter;
+    int word_count;
+    struct iovec iov[2];
+    struct msghdr msg;
+};
+
+struct server
+{
+    struct io_uring ring;
+    struct io_uring_buf_ring *buf_ring;
+    char *buffers;
+    struct uring_connection *connections;
+    size_t max_fds;
+    struct listeners listeners;
+    int num_clients;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
+static void ctrl_c_handler(int signum);
+static void setup_ring(struct dc_env *env, struct dc_error *err, struct server *server);
+static void destroy_ring(struct dc_env *env, struct dc_error *err, struct server *server);
+static void run_server(struct dc_env *env, struct dc_error *err, struct server *server);
+static struct io_uring_sqe *get_sqe(struct server *server);
+static uint64_t encode_user_data(enum operation op, int fd);
+static void submit_accept(struct server *server, int listener);
+static void submit_recv(struct server *server, int fd);
+static void submit_send(struct server *server, struct uring_connection *connection);
+static void handle_new_connection(struct dc_env *env, struct dc_error *err, struct server *server, int listener, const struct io_uring_cqe *cqe);
+static void handle_client_data(struct dc_env *env, struct dc_error *err, struct server *server, struct uring_connection *connection, const struct io_uring_cqe *cqe);
+static void handle_send_complete(struct dc_env *env, struct dc_error *err, struct server *server, struct uring_connection *connection, const struct io_uring_cqe *cqe);
+static void recycle_buffer(struct server *server, unsigned short buffer_id);
+static void close_client(struct dc_env *env, struct dc_error *err, struct server *server, struct uring_connection *connection);
+
+
+static volatile sig_atomic_t done = false;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+
+int main(int argc, char *argv[])
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct options options;
+    struct server server;
+    int ret_val;
+
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--listen tcp:[ADDRESS:]PORT | unix:PATH | unix:@NAME]... [--log-file PATH] [--log-level error | warn | info | debug | trace]\n", argv[0]);  // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    word_count_init();
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+    dc_memset(env, &server, 0, sizeof(server));
+    logger_init(env, err, options.log_file, options.log_level);
+
+    if(dc_error_has_no_error(err))
+    {
+        server.listeners = options.listeners;
+        listeners_open(env, err, &server.listeners, BACKLOG, false, false);
+
+        if(dc_error_has_no_error(err))
+        {
+            setup_ring(env, err, &server);
+
+            if(dc_error_has_no_error(err))
+            {
+                dc_signal(env, err, SIGINT, ctrl_c_handler);
+
+                if(dc_error_has_no_error(err))
+                {
+                    run_server(env, err, &server);
+                }
+            }
+
+            destroy_ring(env, err, &server);
+            listeners_close(env, err, &server.listeners);
+        }
+
+        logger_shutdown();
+    }
+
+    if(dc_error_has_no_error(err))
+    {
+        ret_val = EXIT_SUCCESS;
+    }
+    else
+    {
+        fprintf(stderr, "ERROR (%d) %s\n", dc_errno_get_errno(err), dc_error_get_message(err)); // NOLINT(cert-err33-c)
+        ret_val = EXIT_FAILURE;
+    }
+
+    return ret_val;
+}
+
+/**
+ * --listen adds a tcp or unix stream endpoint to accept on and can be repeated, LISTENERS_DEFAULT if there is none
+ * --log-file sends the log to a csv file instead of stdout, --log-level picks how much is logged
+ * */
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"listen",    required_argument, NULL, 'L'},
+        {"log-file",  required_argument, NULL, 'o'},
+        {"log-level", required_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    listeners_init(&options->listeners);
+    options->log_file = NULL;
+    options->log_level = LOG_LEVEL_INFO;
+
+    while((opt = getopt_long(argc, argv, "L:o:v:", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'L':
+            {
+                if(!(listeners_add(&options->listeners, optarg)))
+                {
+                    if(errno == ENAMETOOLONG)
+                    {
+                        fprintf(stderr, "%s: a unix socket path or name can be at most %zu bytes\n", optarg, ENDPOINT_PATH_MAX);    // NOLINT(cert-err33-c)
+                    }
+
+                    return false;
+                }
+
+                break;
+            }
+            case 'o':
+            {
+                options->log_file = optarg;
+                break;
+            }
+            case 'v':
+            {
+                if(!(logger_parse_level(optarg, &options->log_level)))
+                {
+                    return false;
+                }
+
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    return optind == argc;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void ctrl_c_handler(int signum)
+{
+    done = 1;
+}
+#pragma GCC diagnostic pop
+
+/**
+ * creates the ring, the connection table and the provided buffer ring that recv picks its buffers from
+ * */
+static void setup_ring(struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    int ret;
+
+    DC_TRACE(env);
+    ret = io_uring_queue_init(QUEUE_DEPTH, &server->ring, 0);
+
+    if(ret < 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, -ret);
+        return;
+    }
+
+    // connections are indexed by descriptor, so the descriptor limit is the only cap on how many are held
+    server->max_fds = conn_table_fd_limit();
+    server->connections = dc_calloc(env, err, server->max_fds, sizeof(struct uring_connection));
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    server->buffers = dc_malloc(env, err, (size_t)NUM_BUFFERS * BUFFER_SIZE);
+
+    if(dc_error_has_error(err))
+    {
+        return;
+    }
+
+    server->buf_ring = io_uring_setup_buf_ring(&server->ring, NUM_BUFFERS, BUFFER_GROUP_ID, 0, &ret);
+
+    if(server->buf_ring == NULL)
+    {
+        DC_ERROR_RAISE_ERRNO(err, -ret);
+        return;
+    }
+
+    for(unsigned short i = 0; i < NUM_BUFFERS; i++)
+    {
+        io_uring_buf_ring_add(server->buf_ring, &server->buffers[(size_t)i * BUFFER_SIZE], BUFFER_SIZE, i, io_uring_buf_ring_mask(NUM_BUFFERS), i);
+    }
+
+    io_uring_buf_ring_advance(server->buf_ring, NUM_BUFFERS);
+}
+
+static void destroy_ring(struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    if(server->connections != NULL)
+    {
+        for(size_t fd = 0; fd < server->max_fds; fd++)
+        {
+            if(server->connections[fd].in_use)
+            {
+                dc_close(env, err, (int)fd);
+            }
+        }
+
+        dc_free(env, server->connections);
+    }
+
+    if(server->buf_ring != NULL)
+    {
+        io_uring_free_buf_ring(&server->ring, server->buf_ring, NUM_BUFFERS, BUFFER_GROUP_ID);
+    }
+
+    if(server->buffers != NULL)
+    {
+        dc_free(env, server->buffers);
+    }
+
+    if(server->ring.ring_fd > 0)
+    {
+        io_uring_queue_exit(&server->ring);
+    }
+}
+
+/**
+ * one io_uring_submit_and_wait() call both submits everything queued by the previous batch of completions
+ * and waits for the next one, so an iteration is a single syscall no matter how many clients are active
+ * */
+static void run_server(struct dc_env *env, struct dc_error *err, struct server *server)
+{
+    DC_TRACE(env);
+
+    // the listeners stay blocking, io_uring waits for connections on its own
+    for(size_t i = 0; i < server->listeners.count; i++)
+    {
+        submit_accept(server, server->listeners.fds[i]);
+    }
+
+    while(!(done))
+    {
+        struct io_uring_cqe *cqe;
+        unsigned int head;
+        unsigned int count;
+        int ret;
+
+        ret = io_uring_submit_and_wait(&server->ring, 1);
+
+        if(ret < 0)
+        {
+            if(ret != -EINTR)
+            {
+                DC_ERROR_RAISE_ERRNO(err, -ret);
+                break;
+            }
+
+            continue;
+        }
+
+        count = 0;
+
+        io_uring_for_each_cqe(&server->ring, head, cqe)
+        {
+            uint64_t user_data;
+            enum operation op;
+            int fd;
+
+            user_data = io_uring_cqe_get_data64(cqe);
+            op = (enum operation)(user_data >> 32U);
+            fd = (int)(user_data & UINT32_MAX);
+            count++;
+
+            switch(op)
+            {
+                case OP_ACCEPT:
+                {
+                    handle_new_connection(env, err, server, fd, cqe);
+                    break;
+                }
+                case OP_RECV:
+                {
+                    handle_client_data(env, err, server, &server->connections[fd], cqe);
+                    break;
+                }
+                case OP_SEND:
+                {
+                    handle_send_complete(env, err, server, &server->connections[fd], cqe);
+                    break;
+                }
+                default:
+                {
+                    break;
+                }
+            }
+
+            if(dc_error_has_error(err))
+            {
+                logger_write(LOG_LEVEL_ERROR, "(%d) %s", dc_errno_get_errno(err), dc_error_get_message(err));
+                dc_error_reset(err);
+            }
+        }
+
+        io_uring_cq_advance(&server->ring, count);
+    }
+}
+
+/**
+ * when the submission queue is full it is flushed to the kernel to make room
+ * */
+static struct io_uring_sqe *get_sqe(struct server *server)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&server->ring);
+
+    while(sqe == NULL)
+    {
+        io_uring_submit(&server->ring);
+        sqe = io_uring_get_sqe(&server->ring);
+    }
+
+    return sqe;
+}
+
+static uint64_t encode_user_data(enum operation op, int fd)
+{
+    return ((uint64_t)op << 32U) | (uint32_t)fd;
+}
+
+/**
+ * a single multishot accept per listener keeps producing a completion per new connection until the kernel cancels it
+ * */
+static void submit_accept(struct server *server, int listener)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = get_sqe(server);
+    io_uring_prep_multishot_accept(sqe, listener, NULL, NULL, 0);
+    io_uring_sqe_set_data64(sqe, encode_user_data(OP_ACCEPT, listener));
+}
+
+/**
+ * no buffer is passed in, the kernel picks one from the provided buffer ring when data actually arrives
+ * */
+static void submit_recv(struct server *server, int fd)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = get_sqe(server);
+    io_uring_prep_recv(sqe, fd, NULL, BUFFER_SIZE, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP_ID;
+    io_uring_sqe_set_data64(sqe, encode_user_data(OP_RECV, fd));
+}
+
+/**
+ * the echo and the count go out in one sendmsg instead of two separate writes
+ * */
+static void submit_send(struct server *server, struct uring_connection *connection)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = get_sqe(server);
+    io_uring_prep_sendmsg(sqe, connection->fd, &connection->msg, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, encode_user_data(OP_SEND, connection->fd));
+}
+
+static void handle_new_connection(struct dc_env *env, struct dc_error *err, struct server *server, int listener, const struct io_uring_cqe *cqe)
+{
+    int new_socket;
+
+    DC_TRACE(env);
+
+    if(!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        submit_accept(server, listener);
+    }
+
+    new_socket = cqe->res;
+
+    if(new_socket < 0)
+    {
+        DC_ERROR_RAISE_ERRNO(err, -new_socket);
+        return;
+    }
+
+    // multishot accept does not hand back the address, only look it up if it is going to be logged
+    if(logger_enabled(LOG_LEVEL_INFO))
+    {
+        struct sockaddr_storage client_addr;
+        socklen_t client_addr_len;
+        char peer[ENDPOINT_NAME_SIZE];
+        int index;
+
+        client_addr_len = sizeof(client_addr);
+        index = listeners_find(&server->listeners, listener);
+
+        if(index != -1 && getpeername(new_socket, (struct sockaddr *)&client_addr, &client_addr_len) == 0)
+        {
+            endpoint_peer_name(&client_addr, client_addr_len, peer, sizeof(peer));
+            logger_write(LOG_LEVEL_INFO, "fd %d: new connection from %s on %s", new_socket, peer, server->listeners.endpoints[index].name);
+        }
+    }
+
+    if((size_t)new_socket >= server->max_fds)
+    {
+        logger_write(LOG_LEVEL_WARN, "fd %d: too many clients, dropping new connection", new_socket);
+        dc_close(env, err, new_socket);
+        return;
+    }
+
+    dc_memset(env, &server->connections[new_socket], 0, sizeof(struct uring_connection));
+    server->connections[new_socket].fd = new_socket;
+    server->connections[new_socket].in_use = true;
+    word_counter_init(&server->connections[new_socket].counter);
+    server->num_clients++;
+    submit_recv(server, new_socket);
+}
+
+static void handle_client_data(struct dc_env *env, struct dc_error *err, struct server *server, struct uring_connection *connection, const struct io_uring_cqe *cqe)
+{
+    ssize_t bytes_read;
+    char *buffer;
+
+    DC_TRACE(env);
+    bytes_read = cqe->res;
+
+    if(bytes_read == -ENOBUFS)
+    {
+        // every provided buffer is waiting on a send, try again once one has been recycled
+        submit_recv(server, connection->fd);
+        return;
+    }
+
+    if(bytes_read <= 0)
+    {
+        if(cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            recycle_buffer(server, (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+
+        close_client(env, err, server, connection);
+        return;
+    }
+
+    connection->buffer_id = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    buffer = &server->buffers[(size_t)connection->buffer_id * BUFFER_SIZE];
+    // the counter remembers whether the last recv ended inside a word, so a word split across two reads counts once
+    word_counter_feed(&connection->counter, buffer, (size_t)bytes_read);
+    connection->word_count = (int)word_counter_take(&connection->counter);
+    logger_write(LOG_LEVEL_DEBUG, "fd %d: read %zd bytes, %d words", connection->fd, bytes_read, connection->word_count);
+    logger_write(LOG_LEVEL_TRACE, "fd %d: payload %.*s", connection->fd, (int)bytes_read, buffer);
+    connection->iov[0].iov_base = buffer;
+    connection->iov[0].iov_len = (size_t)bytes_read;
+    connection->iov[1].iov_base = &connection->word_count;
+    connection->iov[1].iov_len = sizeof(connection->word_count);
+    dc_memset(env, &connection->msg, 0, sizeof(connection->msg));
+    connection->msg.msg_iov = connection->iov;
+    connection->msg.msg_iovlen = 2;
+    submit_send(server, connection);
+}
+
+/**
+ * a short send resubmits whatever is left, otherwise the buffer goes back to the ring and the next recv is armed
+ * */
+static void handle_send_complete(struct dc_env *env, struct dc_error *err, struct server *server, struct uring_connection *connection, const struct io_uring_cqe *cqe)
+{
+    size_t bytes_sent;
+
+    DC_TRACE(env);
+
+    if(cqe->res < 0)
+    {
+        recycle_buffer(server, connection->buffer_id);
+        close_client(env, err, server, connection);
+        return;
+    }
+
+    bytes_sent = (size_t)cqe->res;
+
+    while(connection->msg.msg_iovlen > 0 && bytes_sent >= connection->msg.msg_iov[0].iov_len)
+    {
+        bytes_sent -= connection->msg.msg_iov[0].iov_len;
+        connection->msg.msg_iov++;
+        connection->msg.msg_iovlen--;
+    }
+
+    if(connection->msg.msg_iovlen > 0)
+    {
+        connection->msg.msg_iov[0].iov_base = (char *)connection->msg.msg_iov[0].iov_base + bytes_sent;
+        connection->msg.msg_iov[0].iov_len -= bytes_sent;
+        submit_send(server, connection);
+        return;
+    }
+
+    recycle_buffer(server, connection->buffer_id);
+    submit_recv(server, connection->fd);
+}
+
+static void recycle_buffer(struct server *server, unsigned short buffer_id)
+{
+    io_uring_buf_ring_add(server->buf_ring, &server->buffers[(size_t)buffer_id * BUFFER_SIZE], BUFFER_SIZE, buffer_id, io_uring_buf_ring_mask(NUM_BUFFERS), 0);
+    io_uring_buf_ring_advance(server->buf_ring, 1);
+}
+
+static void close_client(struct dc_env *env, struct dc_error *err, struct server *server, struct uring_connection *connection)
+{
+    DC_TRACE(env);
+    logger_write(LOG_LEVEL_INFO, "fd %d: client disconnected", connection->fd);
+    dc_close(env, err, connection->fd);
+    connection->in_use = false;
+    server->num_clients--;
+}
@@ -0,0 +1,559 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "request.h"
+#include "word_count.h"
+
+
+#define MIN_SIZE 64
+#define MAX_SIZE (64UL * 1024UL * 1024UL)
+#define SIZE_STEP 4
+#define DEFAULT_MIN_TIME ((double)1 / 10)
+#define TARGET_OVERSHOOT ((double)14 / 10)
+#define MAX_GROWTH 10
+#define MAX_ITERATIONS 1000000000ULL
+#define READ_SIZE 65536
+#define REQUEST_STREAM_SIZE (4UL * 1024UL * 1024UL)
+#define NANOSECONDS_PER_SECOND ((double)1000000000)
+#define BYTES_PER_GB ((double)1000000000)
+#define MAX_SPACE_LENGTH 3
+#define NAME_SIZE 96
+
+
+enum corpus
+{
+    CORPUS_WHITESPACE,
+    CORPUS_NO_WHITESPACE,
+    CORPUS_ENGLISH,
+    CORPUS_RANDOM,
+    CORPUS_COUNT,
+};
+
+struct options
+{
+    const char *filter;
+    double min_time;
+    size_t max_size;
+};
+
+/**
+ * one benchmark body, runs its operation iterations times and folds every result into sink
+ * so the compiler cannot drop the work
+ * */
+typedef void (*bench_fn)(const void *arg, uint64_t iterations, uint64_t *sink);
+
+struct count_case
+{
+    enum word_count_kernel kernel;
+    const char *text;
+    size_t size;
+};
+
+/**
+ * a buffer of back to back framed requests, fed to the parser in server-sized reads
+ * */
+struct request_case
+{
+    enum frame_mode mode;
+    const char *stream;
+    size_t len;
+    size_t requests;
+};
+
+struct response_sink
+{
+    char buffer[READ_SIZE];
+    size_t len;
+    uint64_t responses;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
+static bool run_count_benchmarks(const struct options *options);
+static bool run_request_benchmarks(const struct options *options);
+static void run_benchmark(const struct options *options, const char *name, bench_fn fn, const void *arg, size_t bytes_per_iteration, size_t items_per_iteration);
+static void bench_count(const void *arg, uint64_t iterations, uint64_t *sink);
+static void bench_request(const void *arg, uint64_t iterations, uint64_t *sink);
+static bool collect_response(void *arg, const struct request *request);
+static char *make_corpus(enum corpus corpus, size_t size);
+static char *make_request_stream(enum frame_mode mode, const char *text, size_t payload_size, size_t *len, size_t *requests);
+static uint64_t next_random(uint64_t *state);
+static double now_seconds(void);
+
+
+// results land here once per benchmark so the work cannot be optimised away
+static volatile uint64_t bench_sink;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+static const char *const corpus_names[CORPUS_COUNT] =
+{
+    "whitespace",
+    "no-whitespace",
+    "english",
+    "random",
+};
+
+static const char *const english_words[] =
+{
+    "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on", "not", "he",
+    "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they", "you", "were", "their", "one",
+    "all", "we", "can", "her", "has", "there", "been", "if", "more", "when", "will", "would", "who", "so", "no",
+    "server", "connection", "request", "throughput", "latency", "descriptor", "multiplexing", "kernel", "buffer",
+};
+
+
+/**
+ * google-benchmark style: every benchmark runs with a growing iteration count until one run lasts --min-time seconds,
+ * and that run is reported as time per operation and bytes per second
+ * count/KERNEL/CORPUS/SIZE times word_count_run() alone, request/MODE/SIZE times the whole in-process path a
+ * server takes for a read, framing, counting and formatting the response, with no sockets involved
+ * usage: word-count-bench [--filter TEXT] [--min-time SECONDS] [--max-size BYTES]
+ * */
+int main(int argc, char *argv[])
+{
+    struct options options;
+    bool ok;
+
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--filter TEXT] [--min-time SECONDS] [--max-size BYTES]\n", argv[0]);   // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    word_count_init();
+    printf("dispatch picks %s, min time %.2f s\n", word_count_kernel_name(word_count_kernel_active()), options.min_time);
+    printf("%-44s %14s %12s %14s %12s\n", "benchmark", "time/op", "GB/s", "ops/s", "iterations");
+    ok = run_count_benchmarks(&options);
+    ok = run_request_benchmarks(&options) && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"filter",   required_argument, NULL, 'f'},
+        {"min-time", required_argument, NULL, 't'},
+        {"max-size", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+
+    options->filter = NULL;
+    options->min_time = DEFAULT_MIN_TIME;
+    options->max_size = MAX_SIZE;
+
+    while((opt = getopt_long(argc, argv, "f:t:s:", long_options, NULL)) != -1)    // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'f':
+            {
+                options->filter = optarg;
+                break;
+            }
+            case 't':
+            {
+                options->min_time = strtod(optarg, NULL);
+                break;
+            }
+            case 's':
+            {
+                options->max_size = (size_t)strtoull(optarg, NULL, 10);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    if(options->max_size > MAX_SIZE)
+    {
+        options->max_size = MAX_SIZE;
+    }
+
+    return optind == argc && options->min_time > 0 && options->max_size >= MIN_SIZE;
+}
+
+/**
+ * each corpus is generated once at the largest size and every smaller size times its prefix,
+ * so small sizes stay in cache the way a server's read buffer does
+ * every kernel's count is checked against the scalar kernel before it is timed
+ * */
+static bool run_count_benchmarks(const struct options *options)
+{
+    bool ok;
+
+    ok = true;
+
+    for(int corpus = 0; corpus < CORPUS_COUNT; corpus++)
+    {
+        char *text;
+
+        text = make_corpus((enum corpus)corpus, options->max_size);
+
+        if(text == NULL)
+        {
+            perror("malloc");
+            return false;
+        }
+
+        for(size_t size = MIN_SIZE; size <= options->max_size; size *= SIZE_STEP)
+        {
+            uint64_t expected;
+            bool in_word;
+
+            in_word = false;
+            expected = word_count_run(WORD_COUNT_SCALAR, text, size, &in_word);
+
+            for(int kernel = 0; kernel < WORD_COUNT_KERNEL_COUNT; kernel++)
+            {
+                struct count_case count_case;
+                char name[NAME_SIZE];
+
+                if(!(word_count_kernel_supported((enum word_count_kernel)kernel)))
+                {
+                    continue;
+                }
+
+                snprintf(name, sizeof(name), "count/%s/%s/%zu", word_count_kernel_name((enum word_count_kernel)kernel), corpus_names[corpus], size);   // NOLINT(cert-err33-c)
+                in_word = false;
+
+                if(word_count_run((enum word_count_kernel)kernel, text, size, &in_word) != expected)
+                {
+                    printf("%-44s WRONG COUNT\n", name);
+                    ok = false;
+                    continue;
+                }
+
+                count_case.kernel = (enum word_count_kernel)kernel;
+                count_case.text = text;
+                count_case.size = size;
+                run_benchmark(options, name, bench_count, &count_case, size, 1);
+            }
+        }
+
+        free(text);
+    }
+
+    return ok;
+}
+
+/**
+ * the stream holds as many requests of one payload size as fit in a few MiB (at least one),
+ * every response is formatted into a sink the way out_buffer_send would queue it
+ * */
+static bool run_request_benchmarks(const struct options *options)
+{
+    static const enum frame_mode modes[] = {FRAME_LINE, FRAME_LENGTH};
+    static const char *const mode_names[] = {"line", "length"};
+    char *text;
+    bool ok;
+
+    text = make_corpus(CORPUS_ENGLISH, options->max_size);
+
+    if(text == NULL)
+    {
+        perror("malloc");
+        return false;
+    }
+
+    ok = true;
+
+    for(size_t mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++)
+    {
+        for(size_t size = MIN_SIZE; size <= options->max_size; size *= SIZE_STEP)
+        {
+            struct request_case request_case;
+            struct request_parser parser;
+            struct response_sink sink;
+            char name[NAME_SIZE];
+            char *stream;
+
+            stream = make_request_stream(modes[mode], text, size, &request_case.len, &request_case.requests);
+
+            if(stream == NULL)
+            {
+                perror("malloc");
+                ok = false;
+                break;
+            }
+
+            snprintf(name, sizeof(name), "request/%s/%zu", mode_names[mode], size);    // NOLINT(cert-err33-c)
+            request_case.mode = modes[mode];
+            request_case.stream = stream;
+
+            // one untimed pass to make sure every request comes back out
+            request_parser_init(&parser, modes[mode]);
+            sink.len = 0;
+            sink.responses = 0;
+            request_parser_feed_all(&parser, stream, request_case.len, collect_response, &sink);
+
+            if(sink.responses != request_case.requests)
+            {
+                printf("%-44s WRONG RESPONSE COUNT %" PRIu64 " of %zu\n", name, sink.responses, request_case.requests);
+                ok = false;
+            }
+            else
+            {
+                run_benchmark(options, name, bench_request, &request_case, request_case.len, request_case.requests);
+            }
+
+            free(stream);
+        }
+    }
+
+    free(text);
+
+    return ok;
+}
+
+/**
+ * the iteration count grows until a run lasts min_time, aiming 40% past it the way google benchmark does
+ * ops/s counts items, one per count call or one per request
+ * */
+static void run_benchmark(const struct options *options, const char *name, bench_fn fn, const void *arg, size_t bytes_per_iteration, size_t items_per_iteration)
+{
+    uint64_t iterations;
+    uint64_t sink;
+    double elapsed;
+
+    if(options->filter != NULL && strstr(name, options->filter) == NULL)
+    {
+        return;
+    }
+
+    iterations = 1;
+    sink = 0;
+
+    for(;;)
+    {
+        double start;
+        double next;
+
+        start = now_seconds();
+        fn(arg, iterations, &sink);
+        elapsed = now_seconds() - start;
+
+        if(elapsed >= options->min_time || iterations >= MAX_ITERATIONS)
+        {
+            break;
+        }
+
+        next = elapsed > 0 ? (double)iterations * options->min_time * TARGET_OVERSHOOT / elapsed : (double)iterations * MAX_GROWTH;
+
+        if(next > (double)iterations * MAX_GROWTH)
+        {
+            next = (double)iterations * MAX_GROWTH;
+        }
+
+        iterations = next > (double)MAX_ITERATIONS ? MAX_ITERATIONS : (uint64_t)next + 1;
+    }
+
+    bench_sink = sink;
+    printf("%-44s %11.1f ns %12.2f %14.0f %12" PRIu64 "\n", name, elapsed * NANOSECONDS_PER_SECOND / (double)iterations,
+           (double)bytes_per_iteration * (double)iterations / elapsed / BYTES_PER_GB,
+           (double)items_per_iteration * (double)iterations / elapsed, iterations);
+    fflush(stdout);     // NOLINT(cert-err33-c)
+}
+
+static void bench_count(const void *arg, uint64_t iterations, uint64_t *sink)
+{
+    const struct count_case *count_case;
+
+    count_case = arg;
+
+    for(uint64_t i = 0; i < iterations; i++)
+    {
+        bool in_word;
+
+        in_word = false;
+        *sink += word_count_run(count_case->kernel, count_case->text, count_case->size, &in_word);
+    }
+}
+
+static void bench_request(const void *arg, uint64_t iterations, uint64_t *sink)
+{
+    const struct request_case *request_case;
+    struct request_parser parser;
+    struct response_sink responses;
+
+    request_case = arg;
+
+    for(uint64_t i = 0; i < iterations; i++)
+    {
+        request_parser_init(&parser, request_case->mode);
+        responses.len = 0;
+        responses.responses = 0;
+
+        for(size_t offset = 0; offset < request_case->len; offset += READ_SIZE)
+        {
+            size_t len;
+
+            len = request_case->len - offset < READ_SIZE ? request_case->len - offset : READ_SIZE;
+            request_parser_feed_all(&parser, &request_case->stream[offset], len, collect_response, &responses);
+        }
+
+        *sink += responses.responses + responses.len;
+    }
+}
+
+/**
+ * stands in for the send, the sink wraps around instead of being flushed to a socket
+ * */
+static bool collect_response(void *arg, const struct request *request)
+{
+    struct response_sink *sink;
+
+    sink = arg;
+
+    if(sink->len + REQUEST_RESPONSE_SIZE > sizeof(sink->buffer))
+    {
+        sink->len = 0;
+    }
+
+    sink->len += request_format_response(&sink->buffer[sink->len], request->words);
+    sink->responses++;
+
+    return true;
+}
+
+/**
+ * english is common words and a few technical ones separated mostly by single spaces with the odd newline or tab,
+ * random is uniform bytes, so about 2.3% of it is whitespace and words are short
+ * */
+static char *make_corpus(enum corpus corpus, size_t size)
+{
+    static const char spaces[] = " \t\n\r\v\f";
+    char *text;
+    uint64_t state;
+    size_t i;
+
+    text = malloc(size);
+
+    if(text == NULL)
+    {
+        return NULL;
+    }
+
+    state = UINT64_C(0x9E3779B97F4A7C15);
+    i = 0;
+
+    while(i < size)
+    {
+        switch(corpus)
+        {
+            case CORPUS_WHITESPACE:
+            {
+                text[i++] = spaces[next_random(&state) % (sizeof(spaces) - 1)];
+                break;
+            }
+            case CORPUS_NO_WHITESPACE:
+            {
+                text[i++] = (char)('a' + next_random(&state) % 26);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case CORPUS_RANDOM:
+            {
+                text[i++] = (char)(next_random(&state) & 0xFFU);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case CORPUS_ENGLISH:
+            case CORPUS_COUNT:
+            default:
+            {
+                const char *word;
+                size_t space_length;
+                uint64_t r;
+
+                word = english_words[next_random(&state) % (sizeof(english_words) / sizeof(english_words[0]))];
+
+                for(size_t j = 0; word[j] != '\0' && i < size; j++, i++)
+                {
+                    text[i] = word[j];
+                }
+
+                r = next_random(&state);
+                space_length = r % 8 == 0 ? 1 + r / 8 % MAX_SPACE_LENGTH : 1;  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+                for(size_t j = 0; j < space_length && i < size; j++, i++)
+                {
+                    text[i] = r % 16 == 0 ? "\n\t"[j % 2] : ' ';  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                }
+
+                break;
+            }
+        }
+    }
+
+    return text;
+}
+
+/**
+ * line requests have their newlines turned into spaces and one added at the end, length requests get the prefix
+ * */
+static char *make_request_stream(enum frame_mode mode, const char *text, size_t payload_size, size_t *len, size_t *requests)
+{
+    size_t frame_size;
+    char *stream;
+
+    frame_size = payload_size + (mode == FRAME_LENGTH ? REQUEST_LENGTH_PREFIX_SIZE : 1);
+    *requests = REQUEST_STREAM_SIZE / frame_size > 0 ? REQUEST_STREAM_SIZE / frame_size : 1;
+    *len = *requests * frame_size;
+    stream = malloc(*len);
+
+    if(stream == NULL)
+    {
+        return NULL;
+    }
+
+    for(size_t r = 0; r < *requests; r++)
+    {
+        char *frame;
+
+        frame = &stream[r * frame_size];
+
+        if(mode == FRAME_LENGTH)
+        {
+            frame[0] = (char)(payload_size >> 24U);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            frame[1] = (char)(payload_size >> 16U);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            frame[2] = (char)(payload_size >> 8U);      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            frame[3] = (char)payload_size;
+            memcpy(&frame[REQUEST_LENGTH_PREFIX_SIZE], text, payload_size);
+        }
+        else
+        {
+            for(size_t i = 0; i < payload_size; i++)
+            {
+                frame[i] = text[i] == '\n' ? ' ' : text[i];
+            }
+
+            frame[payload_size] = '\n';
+        }
+    }
+
+    return stream;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *state ^= *state >> 7U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *state ^= *state << 17U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return *state;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / NANOSECONDS_PER_SECOND;
+}
@@ -0,0 +1,518 @@
+#include <arpa/inet.h>
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "buffer_pool.h"
+#include "zerocopy.h"
+
+
+#define DEFAULT_GIB 1
+#define DEFAULT_SIZE 65536
+#define RECEIVE_SIZE (1024UL * 1024UL)
+#define BYTES_PER_GIB ((double)(1024UL * 1024UL * 1024UL))
+#define NANOSECONDS_PER_SECOND ((double)1000000000)
+#define MICROSECONDS_PER_SECOND ((double)1000000)
+#define PERCENT 100
+
+
+struct options
+{
+    double gib;
+    size_t size;
+    const char *address;
+    uint16_t port;
+};
+
+/**
+ * one mode's run, the sender is the calling thread and the receiver drains a loopback connection on its own thread
+ * unless --address points the sender at a sink on another machine
+ * */
+struct run
+{
+    const struct options *options;
+    struct dc_error *err;
+    struct buffer_cache *cache;
+    bool zerocopy;
+    int listener;
+    int receiver_fd;
+    pthread_t receiver;
+    uint64_t received;
+    uint64_t sends;
+    uint64_t copied;
+    double seconds;
+    double sender_cpu;
+    double process_cpu;
+};
+
+
+static bool parse_arguments(int argc, char *argv[], struct options *options);
+static bool fill_buffers(struct dc_error *err, struct buffer_cache *cache, size_t size);
+static bool run_mode(const struct options *options, struct dc_error *err, struct buffer_cache *cache, bool zerocopy, const char *name, double *sender_cpu);
+static int connect_sender(struct run *run);
+static bool send_all(struct run *run, int fd);
+static bool wait_for(int fd, short events);
+static void *receiver_main(void *arg);
+static double now_seconds(clockid_t clock);
+static double process_cpu_seconds(void);
+
+
+/**
+ * how much cpu a MSG_ZEROCOPY send saves over a plain one, the number the poll server's --zerocopy echo path is for
+ * copy sends one buffer over and over with sendmsg(), zerocopy sends buffers from the buffer pool with MSG_ZEROCOPY
+ * and gives each back once the error queue says the kernel is done with it, exactly as the server does
+ * sender cpu is the sending thread's own cpu time, process cpu adds the receiving thread's
+ * over loopback the kernel has to copy every zerocopy send after all, the copied column shows it and the saving is
+ * negative, point --address at a discard sink on another machine, such as nc -l PORT > /dev/null, for a real nic
+ * usage: zerocopy-bench [--gib N] [--size BYTES] [--address IPV4 --port PORT]
+ * */
+int main(int argc, char *argv[])
+{
+    struct options options;
+    struct dc_env *env;
+    struct dc_error *err;
+    struct buffer_pool pool;
+    struct buffer_cache cache;
+    double copy_cpu;
+    double zerocopy_cpu;
+    bool ok;
+
+    if(!(parse_arguments(argc, argv, &options)))
+    {
+        fprintf(stderr, "Usage: %s [--gib N] [--size BYTES] [--address IPV4 --port PORT]\n", argv[0]);   // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+
+    if(dc_error_has_error(err))
+    {
+        fprintf(stderr, "could not set up the benchmark\n");    // NOLINT(cert-err33-c)
+        return EXIT_FAILURE;
+    }
+
+    buffer_pool_init(env, &pool);
+    buffer_cache_init(env, &cache, &pool);
+    printf("%.2f GiB in sends of %zu bytes to %s\n", options.gib, options.size, options.address == NULL ? "a loopback receiver" : options.address);
+    printf("%-8s %10s %10s %16s %16s %10s\n", "mode", "seconds", "GiB/s", "sender cpu/GiB", "process cpu/GiB", "copied");
+    ok = fill_buffers(err, &cache, options.size);
+    ok = ok && run_mode(&options, err, &cache, false, "copy", &copy_cpu);
+    ok = ok && run_mode(&options, err, &cache, true, "zerocopy", &zerocopy_cpu);
+
+    if(ok)
+    {
+        printf("zerocopy saves %.3f s of sender cpu per GiB (%.1f%%)\n", copy_cpu - zerocopy_cpu, copy_cpu > 0 ? (copy_cpu - zerocopy_cpu) * PERCENT / copy_cpu : 0);
+    }
+
+    buffer_cache_destroy(&cache);
+    buffer_pool_destroy(env, &pool);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool parse_arguments(int argc, char *argv[], struct options *options)
+{
+    static const struct option long_options[] =
+    {
+        {"gib",     required_argument, NULL, 'g'},
+        {"size",    required_argument, NULL, 's'},
+        {"address", required_argument, NULL, 'a'},
+        {"port",    required_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    long port;
+
+    options->gib = DEFAULT_GIB;
+    options->size = DEFAULT_SIZE;
+    options->address = NULL;
+    options->port = 0;
+    port = 0;
+
+    while((opt = getopt_long(argc, argv, "g:s:a:p:", long_options, NULL)) != -1)  // NOLINT(concurrency-mt-unsafe)
+    {
+        switch(opt)
+        {
+            case 'g':
+            {
+                options->gib = strtod(optarg, NULL);
+                break;
+            }
+            case 's':
+            {
+                options->size = strtoul(optarg, NULL, 10);  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                break;
+            }
+            case 'a':
+            {
+                options->address = optarg;
+                break;
+            }
+            case 'p':
+            {
+                port = atol(optarg);    // NOLINT(cert-err34-c)
+                break;
+            }
+            default:
+            {
+                return false;
+            }
+        }
+    }
+
+    if(port <= 0 || port > UINT16_MAX)
+    {
+        port = 0;
+    }
+
+    options->port = (uint16_t)port;
+
+    return optind == argc && options->gib > 0 && options->size > 0 && options->size <= BUFFER_POOL_MAX_SIZE && (options->address == NULL) == (options->port == 0);
+}
+
+/**
+ * takes as many buffers as can be in flight at once and hands them back written, so neither mode pays for first touches
+ * */
+static bool fill_buffers(struct dc_error *err, struct buffer_cache *cache, size_t size)
+{
+    char *buffers[ZEROCOPY_MAX_PINNED + 1];
+    size_t capacity;
+    size_t count;
+
+    for(count = 0; count < ZEROCOPY_MAX_PINNED + 1; count++)
+    {
+        buffers[count] = buffer_alloc(err, cache, size, &capacity);
+
+        if(buffers[count] == NULL)
+        {
+            break;
+        }
+
+        memset(buffers[count], 'x', capacity);
+    }
+
+    for(size_t i = 0; i < count; i++)
+    {
+        buffer_free(cache, buffers[i], capacity);
+    }
+
+    return count == ZEROCOPY_MAX_PINNED + 1;
+}
+
+/**
+ * the clocks run from the first send to the receiver having seen the last byte, or to the last completion for a remote sink
+ * */
+static bool run_mode(const struct options *options, struct dc_error *err, struct buffer_cache *cache, bool zerocopy, const char *name, double *sender_cpu)
+{
+    struct run run;
+    double started;
+    double sender_started;
+    double process_started;
+    int fd;
+    bool ok;
+
+    memset(&run, 0, sizeof(run));
+    run.options = options;
+    run.err = err;
+    run.cache = cache;
+    run.zerocopy = zerocopy;
+    run.listener = -1;
+    run.receiver_fd = -1;
+    fd = connect_sender(&run);
+
+    if(fd == -1)
+    {
+        perror(name);
+        return false;
+    }
+
+    started = now_seconds(CLOCK_MONOTONIC);
+    sender_started = now_seconds(CLOCK_THREAD_CPUTIME_ID);
+    process_started = process_cpu_seconds();
+    ok = send_all(&run, fd);
+    run.sender_cpu = now_seconds(CLOCK_THREAD_CPUTIME_ID) - sender_started;
+    shutdown(fd, SHUT_WR);
+
+    if(run.receiver_fd != -1)
+    {
+        pthread_join(run.receiver, NULL);
+        close(run.receiver_fd);
+    }
+
+    run.seconds = now_seconds(CLOCK_MONOTONIC) - started;
+    run.process_cpu = process_cpu_seconds() - process_started;
+    close(fd);
+
+    if(!(ok))
+    {
+        printf("%-8s FAILED\n", name);
+        return false;
+    }
+
+    *sender_cpu = run.sender_cpu / options->gib;
+    printf("%-8s %10.3f %10.3f %14.3f s %14.3f s %9.1f%%\n", name, run.seconds, options->gib / run.seconds, *sender_cpu, run.process_cpu / options->gib, run.sends == 0 ? 0 : (double)run.copied * PERCENT / (double)run.sends);
+    fflush(stdout);     // NOLINT(cert-err33-c)
+
+    return options->address != NULL || run.received == (uint64_t)(options->gib * BYTES_PER_GIB);
+}
+
+/**
+ * for loopback the receiver is accepted here and started before anything is sent, the sender is non-blocking either way
+ * */
+static int connect_sender(struct run *run)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr_len = sizeof(addr);
+
+    if(run->options->address != NULL)
+    {
+        addr.sin_port = htons(run->options->port);
+
+        if(inet_pton(AF_INET, run->options->address, &addr.sin_addr) != 1)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    else
+    {
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        run->listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if(run->listener == -1 || bind(run->listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(run->listener, 1) == -1 || getsockname(run->listener, (struct sockaddr *)&addr, &addr_len) == -1)
+        {
+            return -1;
+        }
+    }
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        return -1;
+    }
+
+    if(run->listener != -1)
+    {
+        run->receiver_fd = accept4(run->listener, NULL, NULL, SOCK_CLOEXEC);
+        close(run->listener);
+
+        if(run->receiver_fd != -1 && pthread_create(&run->receiver, NULL, receiver_main, run) != 0)
+        {
+            close(run->receiver_fd);
+            run->receiver_fd = -1;
+        }
+
+        if(run->receiver_fd == -1)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)  // NOLINT(hicpp-signed-bitwise)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * copy sends the same buffer every time, zerocopy takes a fresh one from the cache for every send and waits on the
+ * error queue whenever ZEROCOPY_MAX_PINNED are still in flight, the buffers were filled once before the first run
+ * a send only counts what it took, a partial zerocopy send still pins its whole buffer
+ * */
+static bool send_all(struct run *run, int fd)
+{
+    struct zerocopy zerocopy;
+    uint64_t total;
+    uint64_t sent;
+    size_t capacity;
+    char *buffer;
+
+    memset(&zerocopy, 0, sizeof(zerocopy));
+
+    if(run->zerocopy && !(zerocopy_enable(&zerocopy, fd)))
+    {
+        perror("SO_ZEROCOPY");
+        return false;
+    }
+
+    total = (uint64_t)(run->options->gib * BYTES_PER_GIB);
+    sent = 0;
+    buffer = NULL;
+
+    if(!(run->zerocopy))
+    {
+        buffer = buffer_alloc(run->err, run->cache, run->options->size, &capacity);
+
+        if(buffer == NULL)
+        {
+            return false;
+        }
+    }
+
+    while(sent < total)
+    {
+        struct iovec iov;
+        ssize_t written;
+
+        iov.iov_len = total - sent < run->options->size ? (size_t)(total - sent) : run->options->size;
+
+        if(run->zerocopy)
+        {
+            if(zerocopy.count == ZEROCOPY_MAX_PINNED)
+            {
+                if(!(wait_for(fd, 0)))
+                {
+                    return false;
+                }
+
+                zerocopy_reap(&zerocopy, run->cache, fd, &run->copied);
+                continue;
+            }
+
+            iov.iov_base = buffer_alloc(run->err, run->cache, run->options->size, &capacity);
+
+            if(iov.iov_base == NULL)
+            {
+                return false;
+            }
+
+            written = zerocopy_send(&zerocopy, fd, &iov, 1, iov.iov_base, capacity);
+
+            if(written == -1)
+            {
+                buffer_free(run->cache, iov.iov_base, capacity);
+            }
+        }
+        else
+        {
+            iov.iov_base = buffer;
+            written = send(fd, buffer, iov.iov_len, MSG_NOSIGNAL);
+        }
+
+        if(written == -1)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+            {
+                return false;
+            }
+
+            if(!(wait_for(fd, POLLOUT)))
+            {
+                return false;
+            }
+
+            zerocopy_reap(&zerocopy, run->cache, fd, &run->copied);
+            continue;
+        }
+
+        sent += (uint64_t)written;
+        run->sends++;
+    }
+
+    while(zerocopy.count > 0)
+    {
+        if(!(wait_for(fd, 0)))
+        {
+            return false;
+        }
+
+        zerocopy_reap(&zerocopy, run->cache, fd, &run->copied);
+    }
+
+    if(buffer != NULL)
+    {
+        buffer_free(run->cache, buffer, capacity);
+    }
+
+    return true;
+}
+
+/**
+ * poll() always reports POLLERR, which is how a completion on the error queue shows up, so events can be 0
+ * */
+static bool wait_for(int fd, short events)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    while(poll(&pfd, 1, -1) == -1)
+    {
+        if(errno != EINTR)
+        {
+            return false;
+        }
+    }
+
+    return ((unsigned int)pfd.revents & (unsigned int)POLLHUP) == 0;
+}
+
+static void *receiver_main(void *arg)
+{
+    struct run *run;
+    char *buffer;
+    ssize_t received;
+
+    run = arg;
+    buffer = malloc(RECEIVE_SIZE);
+
+    if(buffer == NULL)
+    {
+        return NULL;
+    }
+
+    while((received = recv(run->receiver_fd, buffer, RECEIVE_SIZE, 0)) > 0 || (received == -1 && errno == EINTR))
+    {
+        if(received > 0)
+        {
+            run->received += (uint64_t)received;
+        }
+    }
+
+    free(buffer);
+
+    return NULL;
+}
+
+static double now_seconds(clockid_t clock)
+{
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / NANOSECONDS_PER_SECOND;
+}
+
+static double process_cpu_seconds(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / MICROSECONDS_PER_SECOND;
+}
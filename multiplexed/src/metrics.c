@@ -0,0 +1,405 @@
+#include "metrics.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "trace.h"
+
+
+#define METRICS_BACKLOG 16
+#define METRICS_REQUEST_SIZE 1024
+#define METRICS_BODY_SIZE 16384
+#define METRICS_BODY_MAX_SIZE (1024 * 1024)
+#define METRICS_HEADER_SIZE 256
+#define METRICS_PATH "GET /metrics"
+
+
+/**
+ * help text and name of each counter, in enum metrics_counter order
+ * */
+static const char *const counter_names[METRICS_COUNTER_COUNT][2] =
+{
+    {"multiplex_accepts_total",         "Connections accepted."},
+    {"multiplex_rejects_total",         "Connections dropped because the server had too many clients."},
+    {"multiplex_bytes_in_total",        "Bytes read from clients."},
+    {"multiplex_bytes_out_total",       "Reply bytes sent or queued for clients."},
+    {"multiplex_requests_total",        "Requests answered."},
+    {"multiplex_disconnects_total",     "Client connections closed."},
+    {"multiplex_poll_errors_total",     "Failed calls to select, poll or epoll_wait."},
+    {"multiplex_timeouts_total",        "Client connections closed by an idle, read or write timeout."},
+    {"multiplex_offloads_total",        "Requests counted by the worker pool instead of the event loop."},
+    {"multiplex_zerocopy_sends_total",  "Echoes sent with MSG_ZEROCOPY."},
+    {"multiplex_zerocopy_copied_total", "MSG_ZEROCOPY sends the kernel copied after all, as it always does over loopback."},
+};
+
+/**
+ * name, prometheus type and help text of each sampled value, in enum metrics_sampled order
+ * */
+static const char *const sampled_names[METRICS_SAMPLED_COUNT][3] =
+{
+    {"multiplex_count_queue_depth",         "gauge",   "Chunks waiting for a count pool worker, in the shared queue or on a deque."},
+    {"multiplex_count_chunks_total",        "counter", "Chunks counted by the count pool."},
+    {"multiplex_count_steals_total",        "counter", "Chunks a count pool worker took from another worker's deque."},
+    {"multiplex_count_steal_misses_total",  "counter", "Steal attempts that found the deque empty or lost the race for its last chunk."},
+    {"multiplex_buffer_in_use_bytes",       "gauge",   "Bytes of pooled buffers held by connections."},
+    {"multiplex_buffer_in_use",             "gauge",   "Pooled buffers held by connections."},
+    {"multiplex_buffer_free_bytes",         "gauge",   "Bytes of free buffers kept by the buffer pool and its caches."},
+    {"multiplex_buffer_cache_hits_total",   "counter", "Buffers served from a thread's cache without taking the pool's lock."},
+    {"multiplex_buffer_cache_misses_total", "counter", "Buffers that had to come from the shared pool or from malloc."},
+    {"multiplex_resident_bytes",            "gauge",   "Resident set size of the server process."},
+};
+
+static const char *const histogram_names[METRICS_HISTOGRAM_COUNT][2] =
+{
+    {"multiplex_loop_seconds",    "Time spent handling the descriptors reported by one wakeup of the event loop."},
+    {"multiplex_service_seconds", "Time spent parsing, counting and answering the requests in one read."},
+    {"multiplex_offload_seconds", "Time from a request being handed to the worker pool to its count being back on the event loop."},
+};
+
+
+static bool append(char *buffer, size_t size, size_t *length, const char *format, ...) __attribute__((format(printf, 4, 5)));
+static bool send_all(int fd, const char *data, size_t length);
+
+
+void metrics_init(const struct dc_env *env, struct dc_error *err, struct metrics *metrics, size_t shard_count, const char *server)
+{
+    uintptr_t aligned;
+
+    DC_TRACE(env);
+    dc_memset(env, metrics, 0, sizeof(*metrics));
+
+    // one spare shard so the first one can be moved up to a cache line boundary
+    metrics->storage = dc_calloc(env, err, shard_count + 1, sizeof(struct metrics_shard));
+
+    if(dc_error_has_no_error(err))
+    {
+        aligned = ((uintptr_t)metrics->storage + METRICS_CACHE_LINE_SIZE - 1) & ~(uintptr_t)(METRICS_CACHE_LINE_SIZE - 1);
+        metrics->shards = (struct metrics_shard *)aligned;  // NOLINT(performance-no-int-to-ptr)
+        metrics->shard_count = shard_count;
+        metrics->server = server;
+    }
+}
+
+void metrics_destroy(const struct dc_env *env, struct metrics *metrics)
+{
+    DC_TRACE(env);
+
+    if(metrics->storage != NULL)
+    {
+        dc_free(env, metrics->storage);
+    }
+
+    metrics->storage = NULL;
+    metrics->shards = NULL;
+    metrics->shard_count = 0;
+}
+
+void metrics_set_sampler(struct metrics *metrics, metrics_sampler sampler, void *arg)
+{
+    metrics->sampler = sampler;
+    metrics->sampler_arg = arg;
+}
+
+/**
+ * prometheus buckets are cumulative, each le line counts everything at or below its bound
+ * */
+size_t metrics_format(const struct metrics *metrics, char *buffer, size_t size)
+{
+    size_t length;
+
+    length = 0;
+
+    for(int counter = 0; counter < METRICS_COUNTER_COUNT; counter++)
+    {
+        uint64_t total;
+
+        total = 0;
+
+        for(size_t i = 0; i < metrics->shard_count; i++)
+        {
+            total += atomic_load_explicit(&metrics->shards[i].counters[counter], memory_order_relaxed);
+        }
+
+        if(!(append(buffer, size, &length, "# HELP %s %s\n# TYPE %s counter\n%s{server=\"%s\"} %" PRIu64 "\n", counter_names[counter][0], counter_names[counter][1], counter_names[counter][0], counter_names[counter][0], metrics->server, total)))
+        {
+            return 0;
+        }
+    }
+
+    if(metrics->sampler != NULL)
+    {
+        uint64_t values[METRICS_SAMPLED_COUNT];
+
+        metrics->sampler(metrics->sampler_arg, values);
+
+        for(int sampled = 0; sampled < METRICS_SAMPLED_COUNT; sampled++)
+        {
+            if(!(append(buffer, size, &length, "# HELP %s %s\n# TYPE %s %s\n%s{server=\"%s\"} %" PRIu64 "\n", sampled_names[sampled][0], sampled_names[sampled][2], sampled_names[sampled][0], sampled_names[sampled][1], sampled_names[sampled][0], metrics->server, values[sampled])))
+            {
+                return 0;
+            }
+        }
+    }
+
+    for(int histogram = 0; histogram < METRICS_HISTOGRAM_COUNT; histogram++)
+    {
+        const char *name;
+        uint64_t cumulative;
+        uint64_t sum_ns;
+
+        name = histogram_names[histogram][0];
+        cumulative = 0;
+        sum_ns = 0;
+
+        if(!(append(buffer, size, &length, "# HELP %s %s\n# TYPE %s histogram\n", name, histogram_names[histogram][1], name)))
+        {
+            return 0;
+        }
+
+        for(int bucket = 0; bucket < METRICS_BUCKET_COUNT; bucket++)
+        {
+            bool fits;
+
+            for(size_t i = 0; i < metrics->shard_count; i++)
+            {
+                cumulative += atomic_load_explicit(&metrics->shards[i].histograms[histogram].counts[bucket], memory_order_relaxed);
+            }
+
+            if(bucket == METRICS_BUCKET_COUNT - 1)
+            {
+                fits = append(buffer, size, &length, "%s_bucket{server=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", name, metrics->server, cumulative);
+            }
+            else
+            {
+                double bound;
+
+                bound = (double)(1ULL << (unsigned int)(METRICS_FIRST_BUCKET_SHIFT + bucket)) / (double)METRICS_NANOSECONDS_PER_SECOND;
+                fits = append(buffer, size, &length, "%s_bucket{server=\"%s\",le=\"%.9g\"} %" PRIu64 "\n", name, metrics->server, bound, cumulative);
+            }
+
+            if(!(fits))
+            {
+                return 0;
+            }
+        }
+
+        for(size_t i = 0; i < metrics->shard_count; i++)
+        {
+            sum_ns += atomic_load_explicit(&metrics->shards[i].histograms[histogram].sum_ns, memory_order_relaxed);
+        }
+
+        if(!(append(buffer, size, &length, "%s_sum{server=\"%s\"} %.9f\n%s_count{server=\"%s\"} %" PRIu64 "\n", name, metrics->server, (double)sum_ns / (double)METRICS_NANOSECONDS_PER_SECOND, name, metrics->server, cumulative)))
+        {
+            return 0;
+        }
+    }
+
+    return length;
+}
+
+int metrics_listen(const struct dc_env *env, struct dc_error *err, uint16_t port)
+{
+    int listener;
+
+    DC_TRACE(env);
+    listener = dc_socket(env, err, AF_INET, SOCK_STREAM, 0);
+
+    if(dc_error_has_no_error(err))
+    {
+        static int optval = 1;
+
+        dc_setsockopt(env, err, listener, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+        if(dc_error_has_no_error(err))
+        {
+            struct sockaddr_in server_addr;
+
+            dc_memset(env, &server_addr, 0, sizeof(server_addr));
+            server_addr.sin_family = AF_INET;
+            server_addr.sin_addr.s_addr = INADDR_ANY;
+            server_addr.sin_port = htons(port);
+
+            dc_bind(env, err, listener, (struct sockaddr*)&server_addr, sizeof(server_addr));
+
+            if(dc_error_has_no_error(err))
+            {
+                dc_listen(env, err, listener, METRICS_BACKLOG);
+            }
+        }
+
+        if(dc_error_has_no_error(err))
+        {
+            int flags;
+
+            flags = fcntl(listener, F_GETFL);   // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+
+            if(flags == -1 || fcntl(listener, F_SETFL, flags | O_NONBLOCK) == -1)   // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg,hicpp-signed-bitwise)
+            {
+                DC_ERROR_RAISE_ERRNO(err, errno);
+            }
+        }
+    }
+
+    return listener;
+}
+
+int metrics_accept(const struct dc_env *env, struct dc_error *err, int listener)
+{
+    int fd;
+
+    DC_TRACE(env);
+    fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);   // NOLINT(hicpp-signed-bitwise)
+
+    if(fd == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+    {
+        DC_ERROR_RAISE_ERRNO(err, errno);
+    }
+
+    return fd;
+}
+
+/**
+ * the request line always arrives in the first segment, so one read is enough and the rest of the request is ignored
+ * */
+bool metrics_serve(const struct dc_env *env, struct dc_error *err, const struct metrics *metrics, int fd)
+{
+    char request[METRICS_REQUEST_SIZE];
+    char header[METRICS_HEADER_SIZE];
+    char *body;
+    ssize_t bytes_read;
+    size_t body_length;
+    int header_length;
+
+    DC_TRACE(env);
+    bytes_read = recv(fd, request, sizeof(request), MSG_DONTWAIT);
+
+    if(bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return true;
+    }
+
+    if(bytes_read <= 0)
+    {
+        return false;
+    }
+
+    if((size_t)bytes_read <= strlen(METRICS_PATH) || memcmp(request, METRICS_PATH, strlen(METRICS_PATH)) != 0 || (request[strlen(METRICS_PATH)] != ' ' && request[strlen(METRICS_PATH)] != '?'))
+    {
+        static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+        send_all(fd, not_found, sizeof(not_found) - 1);
+
+        return false;
+    }
+
+    body = NULL;
+    body_length = 0;
+
+    // a long server label or many histograms can outgrow the first guess, the buffer doubles until the body fits
+    for(size_t size = METRICS_BODY_SIZE; body_length == 0 && size <= METRICS_BODY_MAX_SIZE && dc_error_has_no_error(err); size *= 2)
+    {
+        char *bigger;
+
+        bigger = dc_realloc(env, err, body, size);
+
+        if(dc_error_has_no_error(err))
+        {
+            body = bigger;
+            body_length = metrics_format(metrics, body, size);
+        }
+    }
+
+    // an empty 200 would read as a target with no metrics, a scraper has to see that this one failed
+    if(body_length == 0)
+    {
+        static const char server_error[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+        send_all(fd, server_error, sizeof(server_error) - 1);
+
+        if(body != NULL)
+        {
+            dc_free(env, body);
+        }
+
+        return false;
+    }
+
+    header_length = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body_length);
+
+    if(send_all(fd, header, (size_t)header_length))
+    {
+        send_all(fd, body, body_length);
+    }
+
+    dc_free(env, body);
+
+    return false;
+}
+
+bool metrics_parse_port(const char *text, uint16_t *port)
+{
+    char *end;
+    unsigned long value;
+
+    value = strtoul(text, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(*end != '\0' || value == 0 || value > UINT16_MAX)
+    {
+        return false;
+    }
+
+    *port = (uint16_t)value;
+
+    return true;
+}
+
+static bool append(char *buffer, size_t size, size_t *length, const char *format, ...)
+{
+    va_list args;
+    int written;
+
+    va_start(args, format);
+    written = vsnprintf(buffer + *length, size - *length, format, args);    // NOLINT(clang-analyzer-valist.Uninitialized)
+    va_end(args);
+
+    if(written < 0 || (size_t)written >= size - *length)
+    {
+        return false;
+    }
+
+    *length += (size_t)written;
+
+    return true;
+}
+
+/**
+ * never waits for the socket to drain, the event loop has better things to do than feed a slow scraper
+ * */
+static bool send_all(int fd, const char *data, size_t length)
+{
+    while(length > 0)
+    {
+        ssize_t sent;
+
+        sent = send(fd, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);    // NOLINT(hicpp-signed-bitwise)
+
+        if(sent <= 0)
+        {
+            return false;
+        }
+
+        data += sent;
+        length -= (size_t)sent;
+    }
+
+    return true;
+}
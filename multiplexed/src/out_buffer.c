@@ -0,0 +1,312 @@
+#include "out_buffer.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include "trace.h"
+
+
+#define MIN_CAPACITY 4096
+
+
+void out_batch_init(struct out_batch *batch, struct out_buffer *out, int fd)
+{
+    batch->out = out;
+    batch->fd = fd;
+    batch->len = 0;
+}
+
+bool out_batch_add(const struct dc_env *env, struct dc_error *err, struct out_batch *batch, const char *data, size_t len)
+{
+    if(batch->len + len > sizeof(batch->data))
+    {
+        if(!(out_batch_flush(env, err, batch)))
+        {
+            return false;
+        }
+
+        // too big to ever fit, it goes straight behind what was just sent
+        if(len > sizeof(batch->data))
+        {
+            struct iovec iov;
+
+            iov.iov_base = (void *)(uintptr_t)data;
+            iov.iov_len = len;
+
+            return out_buffer_send(env, err, batch->out, batch->fd, &iov, 1);
+        }
+    }
+
+    dc_memcpy(env, &batch->data[batch->len], data, len);
+    batch->len += len;
+
+    return true;
+}
+
+bool out_batch_flush(const struct dc_env *env, struct dc_error *err, struct out_batch *batch)
+{
+    struct iovec iov;
+
+    if(batch->len == 0)
+    {
+        return true;
+    }
+
+    iov.iov_base = batch->data;
+    iov.iov_len = batch->len;
+    batch->len = 0;
+
+    return out_buffer_send(env, err, batch->out, batch->fd, &iov, 1);
+}
+
+static bool append(const struct dc_env *env, struct dc_error *err, struct out_buffer *out, const char *data, size_t len);
+static bool grow(const struct dc_env *env, struct dc_error *err, struct out_buffer *out, size_t needed);
+static void consume(struct out_buffer *out, size_t len);
+static void release(struct out_buffer *out);
+static ssize_t send_iov(int fd, const struct iovec *iov, size_t iovcnt);
+
+
+void out_buffer_destroy(const struct dc_env *env, struct out_buffer *out)
+{
+    DC_TRACE(env);
+    release(out);
+    out->len = 0;
+}
+
+bool out_buffer_send(const struct dc_env *env, struct dc_error *err, struct out_buffer *out, int fd, const struct iovec *iov, size_t iovcnt)
+{
+    size_t sent;
+
+    sent = 0;
+
+    if(out->len == 0)
+    {
+        ssize_t written;
+
+        written = send_iov(fd, iov, iovcnt);
+
+        // a full socket takes nothing, the ring may have just drained into it, so everything is queued
+        if(written < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+
+            written = 0;
+        }
+
+        sent = (size_t)written;
+    }
+
+    for(size_t i = 0; i < iovcnt; i++)
+    {
+        if(sent >= iov[i].iov_len)
+        {
+            sent -= iov[i].iov_len;
+            continue;
+        }
+
+        if(!(append(env, err, out, (const char *)iov[i].iov_base + sent, iov[i].iov_len - sent)))
+        {
+            return false;
+        }
+
+        sent = 0;
+    }
+
+    return out_buffer_flush(out, fd);
+}
+
+/**
+ * the queued bytes are at most two pieces, the end of the ring and the part that wrapped around to the front
+ * */
+bool out_buffer_flush(struct out_buffer *out, int fd)
+{
+    struct iovec iov[2];
+    size_t first;
+    ssize_t written;
+
+    if(out->len == 0)
+    {
+        return true;
+    }
+
+    first = out->capacity - out->head;
+
+    if(first > out->len)
+    {
+        first = out->len;
+    }
+
+    iov[0].iov_base = &out->data[out->head];
+    iov[0].iov_len = first;
+    iov[1].iov_base = out->data;
+    iov[1].iov_len = out->len - first;
+    written = send_iov(fd, iov, iov[1].iov_len == 0 ? 1 : 2);
+
+    if(written < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    consume(out, (size_t)written);
+
+    return true;
+}
+
+size_t out_buffer_pending(const struct out_buffer *out)
+{
+    return out->len;
+}
+
+bool out_buffer_parse_high_water(const char *text, size_t *bytes)
+{
+    char *end;
+    unsigned long value;
+
+    if(*text < '0' || *text > '9')
+    {
+        return false;
+    }
+
+    errno = 0;
+    value = strtoul(text, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(*end != '\0' || errno == ERANGE || value == 0)
+    {
+        return false;
+    }
+
+    *bytes = value;
+
+    return true;
+}
+
+static bool append(const struct dc_env *env, struct dc_error *err, struct out_buffer *out, const char *data, size_t len)
+{
+    size_t tail;
+    size_t first;
+
+    if(len == 0)
+    {
+        return true;
+    }
+
+    if(out->len + len > out->capacity && !(grow(env, err, out, out->len + len)))
+    {
+        return false;
+    }
+
+    tail = (out->head + out->len) & (out->capacity - 1);
+    first = out->capacity - tail;
+
+    if(first > len)
+    {
+        first = len;
+    }
+
+    dc_memcpy(env, &out->data[tail], data, first);
+    dc_memcpy(env, out->data, &data[first], len - first);
+    out->len += len;
+
+    return true;
+}
+
+/**
+ * the queued bytes are unwrapped to the start of the new ring
+ * */
+static bool grow(const struct dc_env *env, struct dc_error *err, struct out_buffer *out, size_t needed)
+{
+    size_t capacity;
+    char *data;
+    size_t first;
+
+    capacity = out->capacity == 0 ? MIN_CAPACITY : out->capacity;
+
+    while(capacity < needed)
+    {
+        capacity *= 2;
+    }
+
+    // capacity is a power of two so the cache hands back exactly that, or a plain allocation above its largest class
+    data = buffer_alloc(err, out->cache, capacity, &capacity);
+
+    if(data == NULL)
+    {
+        return false;
+    }
+
+    if(out->len > 0)
+    {
+        first = out->capacity - out->head;
+
+        if(first > out->len)
+        {
+            first = out->len;
+        }
+
+        dc_memcpy(env, data, &out->data[out->head], first);
+        dc_memcpy(env, &data[first], out->data, out->len - first);
+    }
+
+    release(out);
+    out->data = data;
+    out->capacity = capacity;
+    out->head = 0;
+
+    return true;
+}
+
+/**
+ * an idle connection holds no ring, a drained one goes straight back to the cache
+ * */
+static void consume(struct out_buffer *out, size_t len)
+{
+    out->len -= len;
+    out->head = out->len == 0 ? 0 : (out->head + len) & (out->capacity - 1);
+
+    if(out->len == 0)
+    {
+        release(out);
+    }
+}
+
+static void release(struct out_buffer *out)
+{
+    if(out->data != NULL)
+    {
+        buffer_free(out->cache, out->data, out->capacity);
+    }
+
+    out->data = NULL;
+    out->capacity = 0;
+    out->head = 0;
+}
+
+/**
+ * sendmsg() is writev() for sockets, with MSG_NOSIGNAL a client that went away is an EPIPE instead of a SIGPIPE
+ * */
+static ssize_t send_iov(int fd, const struct iovec *iov, size_t iovcnt)
+{
+    struct msghdr msg;
+    ssize_t written;
+
+    msg.msg_name = NULL;
+    msg.msg_namelen = 0;
+    msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+    msg.msg_iovlen = iovcnt;
+    msg.msg_control = NULL;
+    msg.msg_controllen = 0;
+    msg.msg_flags = 0;
+
+    do
+    {
+        written = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    while(written == -1 && errno == EINTR);
+
+    return written;
+}
@@ -0,0 +1,341 @@
+#include "request.h"
+#include <string.h>
+
+
+#define HELLO_NAME_0 'W'
+#define HELLO_NAME_1 'C'
+#define HELLO_REPLY_NAME_1 'S'
+#define BINARY_RESPONSE_HEADER_SIZE 12
+
+
+static bool feed_hello(struct request_parser *parser, const char *data, size_t len, size_t *consumed, struct request *request);
+static bool feed_line(struct request_parser *parser, const char *data, size_t len, size_t *consumed, uint64_t *words);
+static bool feed_length(struct request_parser *parser, const char *data, size_t len, size_t *consumed, struct request *request);
+static uint32_t read_be32(const unsigned char *bytes);
+static void write_be(unsigned char *bytes, uint64_t value, size_t size);
+
+
+void request_parser_init(struct request_parser *parser, enum frame_mode mode)
+{
+    parser->mode = mode;
+    word_counter_init(&parser->counter);
+    parser->remaining = 0;
+    parser->offload_threshold = 0;
+    parser->id = 0;
+    parser->prefix_len = 0;
+    parser->in_request = false;
+    parser->negotiable = mode != FRAME_NONE;
+    parser->offloading = false;
+}
+
+bool request_parser_feed(struct request_parser *parser, const char *data, size_t len, size_t *consumed, struct request *request)
+{
+    if(parser->negotiable && len > 0)
+    {
+        if((unsigned char)data[0] == REQUEST_HELLO_MAGIC || parser->prefix_len > 0)
+        {
+            parser->in_request = !(feed_hello(parser, data, len, consumed, request));
+
+            return !(parser->in_request);
+        }
+
+        parser->negotiable = false;
+    }
+
+    request->type = REQUEST_COUNT;
+    request->version = 0;
+
+    switch(parser->mode)
+    {
+        case FRAME_LINE:
+        {
+            parser->in_request = !(feed_line(parser, data, len, consumed, &request->words));
+            request->id = 0;
+
+            return !(parser->in_request);
+        }
+        case FRAME_LENGTH:
+        case FRAME_BINARY:
+        {
+            bool completed;
+
+            completed = feed_length(parser, data, len, consumed, request);
+            parser->in_request = !(completed) || parser->offloading;
+
+            return completed;
+        }
+        case FRAME_NONE:
+        default:
+        {
+            word_counter_feed(&parser->counter, data, len);
+            *consumed = len;
+            request->words = word_counter_take(&parser->counter);
+            request->id = 0;
+
+            return true;
+        }
+    }
+}
+
+bool request_parser_feed_all(struct request_parser *parser, const char *data, size_t len, request_handler handler, void *arg)
+{
+    size_t offset;
+
+    offset = 0;
+
+    while(offset < len)
+    {
+        size_t consumed;
+        struct request request;
+
+        if(request_parser_feed(parser, &data[offset], len - offset, &consumed, &request) && !(handler(arg, &request)))
+        {
+            return false;
+        }
+
+        offset += consumed;
+    }
+
+    return true;
+}
+
+/**
+ * digits are written backwards into a scratch buffer and copied out, snprintf's format parsing cost more than
+ * the counting itself for small requests (see the request/ benchmarks in word-count-bench)
+ * */
+size_t request_format_response(char *buffer, uint64_t words)
+{
+    char digits[REQUEST_RESPONSE_SIZE];
+    size_t start;
+    size_t len;
+
+    start = sizeof(digits);
+    digits[--start] = '\0';
+    digits[--start] = '\n';
+
+    do
+    {
+        digits[--start] = (char)('0' + words % 10);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        words /= 10;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+    while(words != 0);
+
+    len = sizeof(digits) - start;
+    memcpy(buffer, &digits[start], len);
+
+    return len - 1;
+}
+
+size_t request_format_reply(char *buffer, enum frame_mode mode, const struct request *request)
+{
+    unsigned char *bytes;
+
+    bytes = (unsigned char *)buffer;
+
+    if(request->type == REQUEST_HELLO)
+    {
+        bytes[0] = REQUEST_HELLO_MAGIC;
+        bytes[1] = HELLO_NAME_0;
+        bytes[2] = HELLO_REPLY_NAME_1;
+        bytes[3] = (unsigned char)request->version;
+
+        return REQUEST_HELLO_SIZE;
+    }
+
+    if(mode != FRAME_BINARY)
+    {
+        return request_format_response(buffer, request->words);
+    }
+
+    write_be(&bytes[0], REQUEST_BINARY_RESPONSE_SIZE - BINARY_RESPONSE_HEADER_SIZE, 4);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    write_be(&bytes[4], request->id, 4);                            // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    write_be(&bytes[8], REQUEST_STATUS_OK, 2);                      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    write_be(&bytes[10], 0, 2);                                     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    write_be(&bytes[12], request->words, 8);                        // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return REQUEST_BINARY_RESPONSE_SIZE;
+}
+
+bool request_parse_frame_mode(const char *name, enum frame_mode *mode)
+{
+    if(strcmp(name, "none") == 0)
+    {
+        *mode = FRAME_NONE;
+    }
+    else if(strcmp(name, "line") == 0)
+    {
+        *mode = FRAME_LINE;
+    }
+    else if(strcmp(name, "length") == 0)
+    {
+        *mode = FRAME_LENGTH;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * a hello with the wrong name, or asking for version 0, gets version 0 back and changes nothing
+ * */
+static bool feed_hello(struct request_parser *parser, const char *data, size_t len, size_t *consumed, struct request *request)
+{
+    size_t used;
+
+    used = 0;
+
+    while(parser->prefix_len < REQUEST_HELLO_SIZE && used < len)
+    {
+        parser->prefix[parser->prefix_len] = (unsigned char)data[used];
+        parser->prefix_len++;
+        used++;
+    }
+
+    *consumed = used;
+
+    if(parser->prefix_len < REQUEST_HELLO_SIZE)
+    {
+        return false;
+    }
+
+    request->type = REQUEST_HELLO;
+    request->id = 0;
+    request->words = 0;
+    request->version = 0;
+
+    if(parser->prefix[1] == HELLO_NAME_0 && parser->prefix[2] == HELLO_NAME_1)
+    {
+        request->version = parser->prefix[3] < REQUEST_PROTOCOL_VERSION ? parser->prefix[3] : REQUEST_PROTOCOL_VERSION;
+    }
+
+    if(request->version >= 1)
+    {
+        parser->mode = FRAME_BINARY;
+    }
+
+    parser->prefix_len = 0;
+    parser->negotiable = false;
+
+    return true;
+}
+
+/**
+ * the newline is whitespace, so it can go through the counter along with the rest of the line
+ * */
+static bool feed_line(struct request_parser *parser, const char *data, size_t len, size_t *consumed, uint64_t *words)
+{
+    const char *newline;
+    size_t chunk;
+
+    newline = memchr(data, '\n', len);
+    chunk = newline == NULL ? len : (size_t)(newline - data) + 1;
+    word_counter_feed(&parser->counter, data, chunk);
+    *consumed = chunk;
+
+    if(newline == NULL)
+    {
+        return false;
+    }
+
+    *words = word_counter_take(&parser->counter);
+    parser->counter.in_word = false;
+
+    return true;
+}
+
+/**
+ * the binary protocol is the length prefix followed by the request id, so both share the header handling
+ * a payload that is to be offloaded comes back a piece per call, each one a completed REQUEST_PAYLOAD
+ * */
+static bool feed_length(struct request_parser *parser, const char *data, size_t len, size_t *consumed, struct request *request)
+{
+    size_t header_size;
+    size_t used;
+    size_t chunk;
+
+    header_size = parser->mode == FRAME_BINARY ? REQUEST_BINARY_HEADER_SIZE : REQUEST_LENGTH_PREFIX_SIZE;
+    used = 0;
+
+    if(parser->prefix_len < header_size)
+    {
+        while(parser->prefix_len < header_size && used < len)
+        {
+            parser->prefix[parser->prefix_len] = (unsigned char)data[used];
+            parser->prefix_len++;
+            used++;
+        }
+
+        if(parser->prefix_len < header_size)
+        {
+            *consumed = used;
+
+            return false;
+        }
+
+        parser->remaining = read_be32(parser->prefix);
+        parser->id = header_size == REQUEST_BINARY_HEADER_SIZE ? read_be32(&parser->prefix[REQUEST_LENGTH_PREFIX_SIZE]) : 0;
+        parser->offloading = parser->offload_threshold != 0 && parser->remaining >= parser->offload_threshold;
+    }
+
+    chunk = len - used;
+
+    if(chunk > parser->remaining)
+    {
+        chunk = (size_t)parser->remaining;
+    }
+
+    parser->remaining -= chunk;
+    *consumed = used + chunk;
+    request->id = parser->id;
+
+    if(parser->offloading)
+    {
+        if(chunk == 0)
+        {
+            return false;
+        }
+
+        request->type = REQUEST_PAYLOAD;
+        request->data = &data[used];
+        request->len = chunk;
+        request->remaining = parser->remaining;
+
+        if(parser->remaining == 0)
+        {
+            parser->offloading = false;
+            parser->prefix_len = 0;
+        }
+
+        return true;
+    }
+
+    word_counter_feed(&parser->counter, &data[used], chunk);
+
+    if(parser->remaining > 0)
+    {
+        return false;
+    }
+
+    request->words = word_counter_take(&parser->counter);
+    parser->counter.in_word = false;
+    parser->prefix_len = 0;
+
+    return true;
+}
+
+static uint32_t read_be32(const unsigned char *bytes)
+{
+    return ((uint32_t)bytes[0] << 24U) | ((uint32_t)bytes[1] << 16U) | ((uint32_t)bytes[2] << 8U) | (uint32_t)bytes[3];   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
+
+static void write_be(unsigned char *bytes, uint64_t value, size_t size)
+{
+    for(size_t i = size; i > 0; i--)
+    {
+        bytes[i - 1] = (unsigned char)(value & 0xFFU);      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        value >>= 8U;                                       // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+}
@@ -0,0 +1,80 @@
+#include "spsc_queue.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include "trace.h"
+
+
+void spsc_queue_init(const struct dc_env *env, struct dc_error *err, struct spsc_queue *queue, size_t capacity, size_t element_size)
+{
+    size_t size;
+
+    DC_TRACE(env);
+    size = 1;
+
+    while(size < capacity)
+    {
+        size <<= 1U;
+    }
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->mask = size - 1;
+    queue->element_size = element_size;
+    queue->slots = dc_calloc(env, err, size, element_size);
+}
+
+void spsc_queue_destroy(const struct dc_env *env, struct spsc_queue *queue)
+{
+    DC_TRACE(env);
+
+    if(queue->slots != NULL)
+    {
+        dc_free(env, queue->slots);
+        queue->slots = NULL;
+    }
+}
+
+bool spsc_queue_push(struct spsc_queue *queue, const void *element)
+{
+    size_t tail;
+    size_t head;
+
+    tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if(tail - head > queue->mask)
+    {
+        return false;
+    }
+
+    memcpy(&queue->slots[(tail & queue->mask) * queue->element_size], element, queue->element_size);
+    // publishes the slot contents to the consumer
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+bool spsc_queue_pop(struct spsc_queue *queue, void *element)
+{
+    size_t head;
+    size_t tail;
+
+    head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if(head == tail)
+    {
+        return false;
+    }
+
+    memcpy(element, &queue->slots[(head & queue->mask) * queue->element_size], queue->element_size);
+    // hands the slot back to the producer
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+size_t spsc_queue_size(struct spsc_queue *queue)
+{
+    return atomic_load_explicit(&queue->tail, memory_order_acquire) - atomic_load_explicit(&queue->head, memory_order_acquire);
+}
@@ -0,0 +1,145 @@
+#include "timeouts.h"
+#include <stdlib.h>
+
+
+#define NANOSECONDS_PER_MILLISECOND 1000000ULL
+
+
+static void earliest(enum timeout_kind *kind, uint64_t *deadline_ns, enum timeout_kind candidate, uint64_t candidate_ns);
+
+
+bool timeouts_parse(const char *text, uint64_t *ns)
+{
+    char *end;
+    unsigned long long value;
+
+    if(*text < '0' || *text > '9')
+    {
+        return false;
+    }
+
+    value = strtoull(text, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    if(*end != '\0' || value > UINT64_MAX / NANOSECONDS_PER_MILLISECOND)
+    {
+        return false;
+    }
+
+    *ns = value * NANOSECONDS_PER_MILLISECOND;
+
+    return true;
+}
+
+bool timeouts_enabled(const struct timeouts *timeouts)
+{
+    return timeouts->idle_ns != 0 || timeouts->read_ns != 0 || timeouts->write_ns != 0;
+}
+
+/**
+ * queued_since_ns is zero while nothing is queued, it starts when replies first back up and restarts whenever the client takes some
+ * */
+void timeouts_touch(struct connection *connection, uint64_t now_ns, bool read, bool wrote)
+{
+    if(read)
+    {
+        connection->last_read_ns = now_ns;
+    }
+
+    if(out_buffer_pending(&connection->out) == 0)
+    {
+        connection->queued_since_ns = 0;
+    }
+    else if(wrote || connection->queued_since_ns == 0)
+    {
+        connection->queued_since_ns = now_ns;
+    }
+}
+
+enum timeout_kind timeouts_deadline(const struct timeouts *timeouts, const struct connection *connection, uint64_t *deadline_ns)
+{
+    enum timeout_kind kind;
+
+    kind = TIMEOUT_NONE;
+    *deadline_ns = UINT64_MAX;
+
+    if(connection->queued_since_ns != 0)
+    {
+        if(timeouts->write_ns != 0)
+        {
+            earliest(&kind, deadline_ns, TIMEOUT_WRITE, connection->queued_since_ns + timeouts->write_ns);
+        }
+    }
+    else if(timeouts->idle_ns != 0)
+    {
+        earliest(&kind, deadline_ns, TIMEOUT_IDLE, connection->last_read_ns + timeouts->idle_ns);
+    }
+
+    if(connection->parser.in_request && timeouts->read_ns != 0)
+    {
+        earliest(&kind, deadline_ns, TIMEOUT_READ, connection->last_read_ns + timeouts->read_ns);
+    }
+
+    return kind;
+}
+
+bool timeouts_arm(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, const struct timeouts *timeouts, const struct connection *connection, size_t id)
+{
+    uint64_t deadline_ns;
+    uint64_t scheduled_ns;
+
+    if(timeouts_deadline(timeouts, connection, &deadline_ns) == TIMEOUT_NONE)
+    {
+        timer_wheel_cancel(wheel, id);
+        return true;
+    }
+
+    if(timer_wheel_expiry(wheel, id, &scheduled_ns) && scheduled_ns <= deadline_ns)
+    {
+        return true;
+    }
+
+    return timer_wheel_schedule(env, err, wheel, id, deadline_ns);
+}
+
+enum timeout_kind timeouts_expired(const struct timeouts *timeouts, const struct connection *connection, uint64_t now_ns)
+{
+    enum timeout_kind kind;
+    uint64_t deadline_ns;
+
+    kind = timeouts_deadline(timeouts, connection, &deadline_ns);
+
+    return deadline_ns <= now_ns ? kind : TIMEOUT_NONE;
+}
+
+const char *timeouts_kind_name(enum timeout_kind kind)
+{
+    switch(kind)
+    {
+        case TIMEOUT_IDLE:
+        {
+            return "idle";
+        }
+        case TIMEOUT_READ:
+        {
+            return "read";
+        }
+        case TIMEOUT_WRITE:
+        {
+            return "write";
+        }
+        case TIMEOUT_NONE:
+        default:
+        {
+            return "no";
+        }
+    }
+}
+
+static void earliest(enum timeout_kind *kind, uint64_t *deadline_ns, enum timeout_kind candidate, uint64_t candidate_ns)
+{
+    if(candidate_ns < *deadline_ns)
+    {
+        *kind = candidate;
+        *deadline_ns = candidate_ns;
+    }
+}
@@ -0,0 +1,346 @@
+#include "timer_wheel.h"
+#include <dc_c/dc_stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include "trace.h"
+
+
+#define NO_NODE SIZE_MAX
+#define MIN_CAPACITY 64
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define NANOSECONDS_PER_MILLISECOND 1000000ULL
+
+
+static bool grow(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, size_t id);
+static void place(struct timer_wheel *wheel, size_t id);
+static void unlink_node(struct timer_wheel *wheel, size_t id);
+static void cascade(struct timer_wheel *wheel, unsigned int level);
+static uint64_t next_tick(const struct timer_wheel *wheel);
+static uint64_t expiry_tick(const struct timer_wheel *wheel, uint64_t expires_ns);
+
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t tick_ns, uint64_t now_ns)
+{
+    memset(wheel, 0, sizeof(*wheel));
+
+    for(unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for(unsigned int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            wheel->heads[level][slot] = NO_NODE;
+        }
+    }
+
+    wheel->tick_ns = tick_ns == 0 ? 1 : tick_ns;
+    wheel->origin_ns = now_ns;
+}
+
+void timer_wheel_destroy(const struct dc_env *env, struct timer_wheel *wheel)
+{
+    DC_TRACE(env);
+
+    if(wheel->nodes != NULL)
+    {
+        dc_free(env, wheel->nodes);
+    }
+
+    wheel->nodes = NULL;
+    wheel->capacity = 0;
+    wheel->count = 0;
+}
+
+bool timer_wheel_schedule(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, size_t id, uint64_t expires_ns)
+{
+    if(id >= wheel->capacity && !(grow(env, err, wheel, id)))
+    {
+        return false;
+    }
+
+    if(wheel->nodes[id].scheduled)
+    {
+        unlink_node(wheel, id);
+    }
+
+    wheel->nodes[id].expires = expires_ns;
+    wheel->nodes[id].scheduled = true;
+    wheel->count++;
+    place(wheel, id);
+
+    return true;
+}
+
+void timer_wheel_cancel(struct timer_wheel *wheel, size_t id)
+{
+    if(id < wheel->capacity && wheel->nodes[id].scheduled)
+    {
+        unlink_node(wheel, id);
+        wheel->nodes[id].scheduled = false;
+        wheel->count--;
+    }
+}
+
+bool timer_wheel_expiry(const struct timer_wheel *wheel, size_t id, uint64_t *expires_ns)
+{
+    if(id >= wheel->capacity || !(wheel->nodes[id].scheduled))
+    {
+        return false;
+    }
+
+    *expires_ns = wheel->nodes[id].expires;
+
+    return true;
+}
+
+/**
+ * each tick first lets every level that just turned over drop its timers a level down, then fires the level 0 slot
+ * a wheel with nothing scheduled jumps straight to now
+ * */
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ns, timer_wheel_handler handler, void *arg)
+{
+    uint64_t target;
+
+    if(now_ns < wheel->origin_ns)
+    {
+        return;
+    }
+
+    target = (now_ns - wheel->origin_ns) / wheel->tick_ns;
+
+    while(wheel->current < target)
+    {
+        unsigned int slot;
+
+        if(wheel->count == 0)
+        {
+            wheel->current = target;
+            break;
+        }
+
+        wheel->current++;
+
+        for(unsigned int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if((wheel->current & ((UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) != 0)
+            {
+                break;
+            }
+
+            cascade(wheel, level);
+        }
+
+        slot = (unsigned int)(wheel->current & SLOT_MASK);
+
+        // the handler may schedule or cancel other timers, so the head is read again every time
+        while(wheel->heads[0][slot] != NO_NODE)
+        {
+            size_t id;
+
+            id = wheel->heads[0][slot];
+            unlink_node(wheel, id);
+            wheel->nodes[id].scheduled = false;
+            wheel->count--;
+            handler(arg, id);
+        }
+    }
+}
+
+int timer_wheel_timeout_ms(const struct timer_wheel *wheel, uint64_t now_ns)
+{
+    uint64_t tick;
+    uint64_t due_ns;
+    uint64_t wait_ms;
+
+    if(wheel->count == 0)
+    {
+        return -1;
+    }
+
+    tick = next_tick(wheel);
+    due_ns = wheel->origin_ns + tick * wheel->tick_ns;
+
+    if(due_ns <= now_ns)
+    {
+        return 0;
+    }
+
+    wait_ms = (due_ns - now_ns + NANOSECONDS_PER_MILLISECOND - 1) / NANOSECONDS_PER_MILLISECOND;
+
+    return wait_ms > INT_MAX ? INT_MAX : (int)wait_ms;
+}
+
+/**
+ * the nodes array doubles until it covers id, new nodes start out unscheduled
+ * */
+static bool grow(const struct dc_env *env, struct dc_error *err, struct timer_wheel *wheel, size_t id)
+{
+    struct timer_wheel_node *nodes;
+    size_t capacity;
+
+    DC_TRACE(env);
+    capacity = wheel->capacity == 0 ? MIN_CAPACITY : wheel->capacity;
+
+    while(capacity <= id)
+    {
+        capacity *= 2;
+    }
+
+    nodes = dc_realloc(env, err, wheel->nodes, capacity * sizeof(struct timer_wheel_node));
+
+    if(dc_error_has_error(err))
+    {
+        return false;
+    }
+
+    memset(&nodes[wheel->capacity], 0, (capacity - wheel->capacity) * sizeof(struct timer_wheel_node));
+    wheel->nodes = nodes;
+    wheel->capacity = capacity;
+
+    return true;
+}
+
+/**
+ * a timer that is already due goes in the next level 0 slot, the current one has been fired already
+ * one too far out for the top level goes in the top level's furthest slot and is placed again when that slot comes round
+ * */
+static void place(struct timer_wheel *wheel, size_t id)
+{
+    struct timer_wheel_node *node;
+    uint64_t tick;
+    uint64_t delta;
+    unsigned int level;
+    unsigned int slot;
+
+    node = &wheel->nodes[id];
+    tick = expiry_tick(wheel, node->expires);
+
+    if(tick <= wheel->current)
+    {
+        tick = wheel->current + 1;
+    }
+
+    delta = tick - wheel->current;
+    level = 0;
+
+    while(level < TIMER_WHEEL_LEVELS - 1 && delta >= (UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * (level + 1))))
+    {
+        level++;
+    }
+
+    if(delta >= (UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)))
+    {
+        tick = wheel->current + (UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+
+    slot = (unsigned int)((tick >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+    node->level = level;
+    node->slot = slot;
+    node->prev = NO_NODE;
+    node->next = wheel->heads[level][slot];
+
+    if(node->next != NO_NODE)
+    {
+        wheel->nodes[node->next].prev = id;
+    }
+
+    wheel->heads[level][slot] = id;
+    wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+static void unlink_node(struct timer_wheel *wheel, size_t id)
+{
+    struct timer_wheel_node *node;
+
+    node = &wheel->nodes[id];
+
+    if(node->prev == NO_NODE)
+    {
+        wheel->heads[node->level][node->slot] = node->next;
+    }
+    else
+    {
+        wheel->nodes[node->prev].next = node->next;
+    }
+
+    if(node->next != NO_NODE)
+    {
+        wheel->nodes[node->next].prev = node->prev;
+    }
+
+    if(wheel->heads[node->level][node->slot] == NO_NODE)
+    {
+        wheel->occupied[node->level] &= ~(UINT64_C(1) << node->slot);
+    }
+}
+
+/**
+ * empties the level's current slot and places each timer again, which puts it in a lower level now that it is closer
+ * */
+static void cascade(struct timer_wheel *wheel, unsigned int level)
+{
+    unsigned int slot;
+    size_t id;
+
+    slot = (unsigned int)((wheel->current >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+    id = wheel->heads[level][slot];
+    wheel->heads[level][slot] = NO_NODE;
+    wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+
+    while(id != NO_NODE)
+    {
+        size_t next;
+
+        next = wheel->nodes[id].next;
+        place(wheel, id);
+        id = next;
+    }
+}
+
+/**
+ * the earliest tick at which some slot is due, for level 0 that is when its timers fire and for the levels above
+ * it is when the slot cascades, which is never later than the timers in it expire
+ * the current slot of every level is already behind us, so the search starts one slot after it and wraps around
+ * */
+static uint64_t next_tick(const struct timer_wheel *wheel)
+{
+    uint64_t best;
+
+    best = UINT64_MAX;
+
+    for(unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        unsigned int shift;
+        unsigned int start;
+        uint64_t rotated;
+        uint64_t tick;
+
+        if(wheel->occupied[level] == 0)
+        {
+            continue;
+        }
+
+        shift = TIMER_WHEEL_SLOT_BITS * level;
+        start = (unsigned int)(((wheel->current >> shift) + 1) & SLOT_MASK);
+        rotated = start == 0 ? wheel->occupied[level] : (wheel->occupied[level] >> start) | (wheel->occupied[level] << (TIMER_WHEEL_SLOTS - start));
+        tick = ((wheel->current >> shift) + 1 + (uint64_t)__builtin_ctzll(rotated)) << shift;
+
+        if(tick < best)
+        {
+            best = tick;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * rounded up, a timer never fires before its expiry
+ * */
+static uint64_t expiry_tick(const struct timer_wheel *wheel, uint64_t expires_ns)
+{
+    if(expires_ns <= wheel->origin_ns)
+    {
+        return 0;
+    }
+
+    return (expires_ns - wheel->origin_ns + wheel->tick_ns - 1) / wheel->tick_ns;
+}
@@ -0,0 +1,267 @@
+#include "word_count.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WORD_COUNT_X86 1
+#else
+#define WORD_COUNT_X86 0
+#endif
+
+
+typedef uint64_t (*word_count_fn)(const char *buffer, size_t len, bool *in_word);
+
+
+static uint64_t count_scalar(const char *buffer, size_t len, bool *in_word);
+#if WORD_COUNT_X86
+static uint64_t count_sse2(const char *buffer, size_t len, bool *in_word);
+static uint64_t count_avx2(const char *buffer, size_t len, bool *in_word);
+static uint64_t count_avx512(const char *buffer, size_t len, bool *in_word);
+#endif
+
+
+static const char *const kernel_names[WORD_COUNT_KERNEL_COUNT] =
+{
+    "scalar",
+    "sse2",
+    "avx2",
+    "avx512",
+};
+
+static const word_count_fn kernels[WORD_COUNT_KERNEL_COUNT] =
+{
+    count_scalar,
+#if WORD_COUNT_X86
+    count_sse2,
+    count_avx2,
+    count_avx512,
+#else
+    NULL,
+    NULL,
+    NULL,
+#endif
+};
+
+// written once by word_count_init() before any thread starts, scalar until then so counting is always safe
+static enum word_count_kernel active_kernel = WORD_COUNT_SCALAR;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+
+void word_count_init(void)
+{
+    for(int kernel = WORD_COUNT_KERNEL_COUNT - 1; kernel >= 0; kernel--)
+    {
+        if(word_count_kernel_supported((enum word_count_kernel)kernel))
+        {
+            active_kernel = (enum word_count_kernel)kernel;
+            break;
+        }
+    }
+}
+
+bool word_count_kernel_supported(enum word_count_kernel kernel)
+{
+    switch(kernel)
+    {
+        case WORD_COUNT_SCALAR:
+        {
+            return true;
+        }
+#if WORD_COUNT_X86
+        case WORD_COUNT_SSE2:
+        {
+            __builtin_cpu_init();
+
+            return __builtin_cpu_supports("sse2");
+        }
+        case WORD_COUNT_AVX2:
+        {
+            __builtin_cpu_init();
+
+            return __builtin_cpu_supports("avx2");
+        }
+        case WORD_COUNT_AVX512:
+        {
+            __builtin_cpu_init();
+
+            return __builtin_cpu_supports("avx512bw");
+        }
+#else
+        case WORD_COUNT_SSE2:
+        case WORD_COUNT_AVX2:
+        case WORD_COUNT_AVX512:
+#endif
+        case WORD_COUNT_KERNEL_COUNT:
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+const char *word_count_kernel_name(enum word_count_kernel kernel)
+{
+    return kernel < WORD_COUNT_KERNEL_COUNT ? kernel_names[kernel] : "unknown";
+}
+
+enum word_count_kernel word_count_kernel_active(void)
+{
+    return active_kernel;
+}
+
+uint64_t word_count_run(enum word_count_kernel kernel, const char *buffer, size_t len, bool *in_word)
+{
+    return kernels[kernel](buffer, len, in_word);
+}
+
+void word_counter_init(struct word_counter *counter)
+{
+    counter->in_word = false;
+    counter->words = 0;
+}
+
+void word_counter_feed(struct word_counter *counter, const char *buffer, size_t len)
+{
+    counter->words += kernels[active_kernel](buffer, len, &counter->in_word);
+}
+
+uint64_t word_counter_take(struct word_counter *counter)
+{
+    uint64_t words;
+
+    words = counter->words;
+    counter->words = 0;
+
+    return words;
+}
+
+bool word_count_is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static uint64_t count_scalar(const char *buffer, size_t len, bool *in_word)
+{
+    bool word;
+    uint64_t words;
+
+    word = *in_word;
+    words = 0;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        bool space;
+
+        space = word_count_is_space(buffer[i]);
+        words += (uint64_t)(!space && !word);
+        word = !space;
+    }
+
+    *in_word = word;
+
+    return words;
+}
+
+#if WORD_COUNT_X86
+/**
+ * the vector kernels build a bitmask with one bit per byte that is set for whitespace
+ * a word starts wherever a clear bit follows a set one, the byte before bit 0 comes from the previous block
+ * so shifting the mask left by one, carrying in the last bit of the previous block, lines every byte up with its predecessor
+ * */
+__attribute__((target("sse2")))
+static uint64_t count_sse2(const char *buffer, size_t len, bool *in_word)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i below_tab = _mm_set1_epi8('\t' - 1);
+    const __m128i above_cr = _mm_set1_epi8('\r' + 1);
+    uint64_t words;
+    uint32_t prev_space;
+    size_t i;
+
+    words = 0;
+    prev_space = *in_word ? 0 : 1;
+
+    for(i = 0; i + sizeof(__m128i) <= len; i += sizeof(__m128i))
+    {
+        __m128i chunk;
+        __m128i is_space;
+        uint32_t space_mask;
+        uint32_t starts;
+
+        chunk = _mm_loadu_si128((const __m128i *)(const void *)&buffer[i]);
+        is_space = _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_and_si128(_mm_cmpgt_epi8(chunk, below_tab), _mm_cmplt_epi8(chunk, above_cr)));
+        space_mask = (uint32_t)_mm_movemask_epi8(is_space);
+        starts = ~space_mask & ((space_mask << 1U) | prev_space) & 0xFFFFU;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        words += (uint64_t)__builtin_popcount(starts);
+        prev_space = space_mask >> 15U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    *in_word = prev_space == 0;
+
+    return words + count_scalar(&buffer[i], len - i, in_word);
+}
+
+__attribute__((target("avx2")))
+static uint64_t count_avx2(const char *buffer, size_t len, bool *in_word)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i below_tab = _mm256_set1_epi8('\t' - 1);
+    const __m256i above_cr = _mm256_set1_epi8('\r' + 1);
+    uint64_t words;
+    uint64_t prev_space;
+    size_t i;
+
+    words = 0;
+    prev_space = *in_word ? 0 : 1;
+
+    for(i = 0; i + sizeof(__m256i) <= len; i += sizeof(__m256i))
+    {
+        __m256i chunk;
+        __m256i is_space;
+        uint64_t space_mask;
+        uint64_t starts;
+
+        chunk = _mm256_loadu_si256((const __m256i *)(const void *)&buffer[i]);
+        is_space = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_and_si256(_mm256_cmpgt_epi8(chunk, below_tab), _mm256_cmpgt_epi8(above_cr, chunk)));
+        space_mask = (uint32_t)_mm256_movemask_epi8(is_space);
+        starts = ~space_mask & ((space_mask << 1U) | prev_space) & 0xFFFFFFFFU;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        words += (uint64_t)__builtin_popcountll(starts);
+        prev_space = space_mask >> 31U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    *in_word = prev_space == 0;
+
+    return words + count_scalar(&buffer[i], len - i, in_word);
+}
+
+/**
+ * AVX-512BW compares straight into a 64 bit mask register, and the tab..cr range is a single unsigned compare after subtracting tab
+ * */
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static uint64_t count_avx512(const char *buffer, size_t len, bool *in_word)
+{
+    const __m512i space = _mm512_set1_epi8(' ');
+    const __m512i tab = _mm512_set1_epi8('\t');
+    const __m512i range = _mm512_set1_epi8('\r' - '\t' + 1);
+    uint64_t words;
+    uint64_t prev_space;
+    size_t i;
+
+    words = 0;
+    prev_space = *in_word ? 0 : 1;
+
+    for(i = 0; i + sizeof(__m512i) <= len; i += sizeof(__m512i))
+    {
+        __m512i chunk;
+        uint64_t space_mask;
+        uint64_t starts;
+
+        chunk = _mm512_loadu_si512((const void *)&buffer[i]);
+        space_mask = _mm512_cmpeq_epi8_mask(chunk, space) | _mm512_cmplt_epu8_mask(_mm512_sub_epi8(chunk, tab), range);
+        starts = ~space_mask & ((space_mask << 1U) | prev_space);
+        words += (uint64_t)_mm_popcnt_u64(starts);
+        prev_space = space_mask >> 63U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    *in_word = prev_space == 0;
+
+    return words + count_scalar(&buffer[i], len - i, in_word);
+}
+#endif
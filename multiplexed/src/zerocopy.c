@@ -0,0 +1,247 @@
+#include "zerocopy.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define CONTROL_SIZE 128
+
+
+static void mark_done(struct zerocopy *zerocopy, uint32_t low, uint32_t high);
+
+
+bool zerocopy_enable(struct zerocopy *zerocopy, int fd)
+{
+    int one;
+
+    one = 1;
+    zerocopy->enabled = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+
+    return zerocopy->enabled;
+}
+
+bool zerocopy_ready(const struct zerocopy *zerocopy, size_t len)
+{
+    return zerocopy->enabled && len >= ZEROCOPY_MIN_SIZE && zerocopy->count < ZEROCOPY_MAX_PINNED;
+}
+
+ssize_t zerocopy_send(struct zerocopy *zerocopy, int fd, const struct iovec *iov, size_t iovcnt, char *data, size_t size)
+{
+    struct msghdr msg;
+    ssize_t written;
+    struct zerocopy_pin *pin;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+    msg.msg_iovlen = iovcnt;
+
+    do
+    {
+        written = sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    while(written == -1 && errno == EINTR);
+
+    if(written == -1)
+    {
+        return -1;
+    }
+
+    // every send that returns counts, even one that only took part of the iovecs
+    pin = &zerocopy->pins[(zerocopy->head + zerocopy->count) % ZEROCOPY_MAX_PINNED];
+    pin->data = data;
+    pin->size = size;
+    pin->seq = zerocopy->next_seq;
+    pin->done = false;
+    zerocopy->count++;
+    zerocopy->next_seq++;
+
+    return written;
+}
+
+/**
+ * each notification covers an inclusive range of sends, the ranges usually arrive in order but are not guaranteed to,
+ * so finished pins are marked and only given back once every older one is finished too
+ * */
+size_t zerocopy_reap(struct zerocopy *zerocopy, struct buffer_cache *cache, int fd, uint64_t *copied)
+{
+    size_t released;
+
+    for(;;)
+    {
+        struct msghdr msg;
+        char control[CONTROL_SIZE];
+        ssize_t received;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        do
+        {
+            received = recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        }
+        while(received == -1 && errno == EINTR);
+
+        if(received == -1)
+        {
+            break;
+        }
+
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            struct sock_extended_err error;
+
+            if(!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+
+            if(error.ee_origin != SO_EE_ORIGIN_ZEROCOPY || error.ee_errno != 0)
+            {
+                continue;
+            }
+
+            if(copied != NULL && (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0)
+            {
+                *copied += (uint64_t)(error.ee_data - error.ee_info) + 1;
+            }
+
+            mark_done(zerocopy, error.ee_info, error.ee_data);
+        }
+    }
+
+    released = 0;
+
+    while(zerocopy->count > 0 && zerocopy->pins[zerocopy->head].done)
+    {
+        buffer_free(cache, zerocopy->pins[zerocopy->head].data, zerocopy->pins[zerocopy->head].size);
+        zerocopy->head = (zerocopy->head + 1) % ZEROCOPY_MAX_PINNED;
+        zerocopy->count--;
+        released++;
+    }
+
+    return released;
+}
+
+/**
+ * the kernel's references to the pages only keep the memory from being freed, not from being written,
+ * a buffer handed out again while the closed socket still has it queued would send the new owner's bytes to this peer
+ * */
+void zerocopy_release(struct zerocopy *zerocopy, struct zerocopy_lingering *lingering, struct buffer_cache *cache, int fd)
+{
+    int lingering_fd;
+
+    if(zerocopy->count == 0)
+    {
+        return;
+    }
+
+    zerocopy_reap(zerocopy, cache, fd, NULL);
+
+    if(zerocopy->count == 0)
+    {
+        return;
+    }
+
+    if(lingering->count == ZEROCOPY_MAX_LINGERING)
+    {
+        zerocopy_lingering_reap(lingering, cache);
+    }
+
+    lingering_fd = lingering->count < ZEROCOPY_MAX_LINGERING ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : -1;    // NOLINT(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+
+    if(lingering_fd == -1)
+    {
+        lingering->abandoned += zerocopy->count;
+        zerocopy->count = 0;
+        return;
+    }
+
+    // the dup keeps the socket from closing with the caller's fd, the shutdown sends the end after what is queued
+    shutdown(lingering_fd, SHUT_RDWR);
+    lingering->fds[lingering->count] = lingering_fd;
+    lingering->zerocopies[lingering->count] = *zerocopy;
+    lingering->count++;
+    zerocopy->count = 0;
+}
+
+void zerocopy_discard(struct zerocopy *zerocopy, struct buffer_cache *cache)
+{
+    while(zerocopy->count > 0)
+    {
+        buffer_free(cache, zerocopy->pins[zerocopy->head].data, zerocopy->pins[zerocopy->head].size);
+        zerocopy->head = (zerocopy->head + 1) % ZEROCOPY_MAX_PINNED;
+        zerocopy->count--;
+    }
+}
+
+void zerocopy_lingering_init(struct zerocopy_lingering *lingering)
+{
+    lingering->count = 0;
+    lingering->abandoned = 0;
+}
+
+/**
+ * a finished socket takes the place of the last one so the array stays packed
+ * */
+size_t zerocopy_lingering_reap(struct zerocopy_lingering *lingering, struct buffer_cache *cache)
+{
+    size_t released;
+    size_t i;
+
+    released = 0;
+    i = 0;
+
+    while(i < lingering->count)
+    {
+        released += zerocopy_reap(&lingering->zerocopies[i], cache, lingering->fds[i], NULL);
+
+        if(lingering->zerocopies[i].count > 0)
+        {
+            i++;
+            continue;
+        }
+
+        close(lingering->fds[i]);
+        lingering->count--;
+        lingering->fds[i] = lingering->fds[lingering->count];
+        lingering->zerocopies[i] = lingering->zerocopies[lingering->count];
+    }
+
+    return released;
+}
+
+void zerocopy_lingering_destroy(struct zerocopy_lingering *lingering, struct buffer_cache *cache)
+{
+    for(size_t i = 0; i < lingering->count; i++)
+    {
+        zerocopy_discard(&lingering->zerocopies[i], cache);
+        close(lingering->fds[i]);
+    }
+
+    lingering->count = 0;
+}
+
+/**
+ * the range may wrap around the 32 bit counter, unsigned differences handle that
+ * */
+static void mark_done(struct zerocopy *zerocopy, uint32_t low, uint32_t high)
+{
+    for(size_t i = 0; i < zerocopy->count; i++)
+    {
+        struct zerocopy_pin *pin;
+
+        pin = &zerocopy->pins[(zerocopy->head + i) % ZEROCOPY_MAX_PINNED];
+
+        if(pin->seq - low <= high - low)
+        {
+            pin->done = true;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#include "tests.h"
+
+
+int main(int argc, char *argv[])
+{
+    TestSuite *suite;
+    int ret_val;
+
+    suite = create_test_suite();
+    add_suite(suite, buffer_pool_tests());
+    add_suite(suite, conn_table_tests());
+    add_suite(suite, count_deque_tests());
+    add_suite(suite, endpoint_tests());
+    add_suite(suite, histogram_tests());
+    add_suite(suite, logger_tests());
+    add_suite(suite, out_buffer_tests());
+    add_suite(suite, request_tests());
+    add_suite(suite, spsc_queue_tests());
+    add_suite(suite, timer_wheel_tests());
+    add_suite(suite, word_count_tests());
+
+    if(argc > 1)
+    {
+        ret_val = run_single_test(suite, argv[1], create_text_reporter());
+    }
+    else
+    {
+        ret_val = run_test_suite(suite, create_text_reporter());
+    }
+
+    destroy_test_suite(suite);
+
+    return ret_val;
+}
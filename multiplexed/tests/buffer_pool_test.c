@@ -0,0 +1,150 @@
+#include "tests.h"
+#include "buffer_pool.h"
+
+
+static const struct dc_env *env;
+static struct dc_error *err;
+static struct buffer_pool pool;
+static struct buffer_cache cache;
+
+
+Describe(buffer_pool);
+
+BeforeEach(buffer_pool)
+{
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+    buffer_pool_init(env, &pool);
+    buffer_cache_init(env, &cache, &pool);
+}
+
+AfterEach(buffer_pool)
+{
+    buffer_cache_destroy(&cache);
+    buffer_pool_destroy(env, &pool);
+}
+
+Ensure(buffer_pool, rounds_a_size_up_to_its_class)
+{
+    static const size_t sizes[] = { 1, 4096, 4097, 65536, 100000, BUFFER_POOL_MAX_SIZE, BUFFER_POOL_MAX_SIZE + 1 };
+    static const size_t capacities[] = { 4096, 4096, 8192, 65536, 131072, BUFFER_POOL_MAX_SIZE, BUFFER_POOL_MAX_SIZE + 1 };
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        char *data;
+        size_t capacity;
+
+        data = buffer_alloc(err, &cache, sizes[i], &capacity);
+        assert_that(data, is_non_null);
+        assert_that(capacity, is_equal_to(capacities[i]));
+        data[capacity - 1] = 'x';
+        buffer_free(&cache, data, sizes[i]);
+    }
+}
+
+Ensure(buffer_pool, hands_a_freed_buffer_straight_back)
+{
+    char *first;
+    char *second;
+    size_t capacity;
+    struct buffer_pool_stats stats;
+
+    first = buffer_alloc(err, &cache, 5000, &capacity);
+    buffer_free(&cache, first, capacity);
+    second = buffer_alloc(err, &cache, 6000, &capacity);
+    assert_that(second, is_equal_to(first));
+    buffer_pool_stats(&pool, &stats);
+    assert_that(stats.hits, is_equal_to(1));
+    assert_that(stats.misses, is_equal_to(1));
+    assert_that(stats.in_use_buffers, is_equal_to(1));
+    assert_that(stats.in_use_bytes, is_equal_to(8192));
+    buffer_free(&cache, second, 6000);
+    buffer_pool_stats(&pool, &stats);
+    assert_that(stats.in_use_buffers, is_equal_to(0));
+    assert_that(stats.in_use_bytes, is_equal_to(0));
+    assert_that(stats.free_bytes, is_equal_to(8192));
+}
+
+/**
+ * a full cache spills half to the pool, where another thread's cache can pick the buffers up
+ * */
+Ensure(buffer_pool, moves_buffers_between_caches_through_the_pool)
+{
+    struct buffer_cache other;
+    char *buffers[2 * BUFFER_CACHE_DEPTH];
+    size_t capacity;
+    size_t reused;
+
+    for(size_t i = 0; i < 2 * BUFFER_CACHE_DEPTH; i++)
+    {
+        buffers[i] = buffer_alloc(err, &cache, 4096, &capacity);
+    }
+
+    for(size_t i = 0; i < 2 * BUFFER_CACHE_DEPTH; i++)
+    {
+        buffer_free(&cache, buffers[i], capacity);
+    }
+
+    buffer_cache_init(env, &other, &pool);
+    reused = 0;
+
+    for(size_t i = 0; i < BUFFER_CACHE_DEPTH / 2; i++)
+    {
+        char *data;
+
+        data = buffer_alloc(err, &other, 4096, &capacity);
+
+        for(size_t j = 0; j < 2 * BUFFER_CACHE_DEPTH; j++)
+        {
+            reused += data == buffers[j] ? 1 : 0;
+        }
+
+        buffers[i] = data;
+    }
+
+    assert_that(reused, is_equal_to(BUFFER_CACHE_DEPTH / 2));
+
+    for(size_t i = 0; i < BUFFER_CACHE_DEPTH / 2; i++)
+    {
+        buffer_free(&other, buffers[i], capacity);
+    }
+
+    buffer_cache_destroy(&other);
+}
+
+Ensure(buffer_pool, gives_memory_back_beyond_the_free_limit)
+{
+    static char *buffers[2 * BUFFER_POOL_MAX_FREE_BYTES / BUFFER_POOL_MAX_SIZE + BUFFER_CACHE_DEPTH];
+    size_t count;
+    size_t capacity;
+    struct buffer_pool_stats stats;
+
+    count = sizeof(buffers) / sizeof(buffers[0]);
+
+    for(size_t i = 0; i < count; i++)
+    {
+        buffers[i] = buffer_alloc(err, &cache, BUFFER_POOL_MAX_SIZE, &capacity);
+    }
+
+    for(size_t i = 0; i < count; i++)
+    {
+        buffer_free(&cache, buffers[i], capacity);
+    }
+
+    buffer_pool_stats(&pool, &stats);
+    assert_that(stats.in_use_bytes, is_equal_to(0));
+    assert_that(stats.free_bytes <= BUFFER_POOL_MAX_FREE_BYTES + BUFFER_CACHE_DEPTH * BUFFER_POOL_MAX_SIZE, is_true);
+}
+
+TestSuite *buffer_pool_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, buffer_pool, rounds_a_size_up_to_its_class);
+    add_test_with_context(suite, buffer_pool, hands_a_freed_buffer_straight_back);
+    add_test_with_context(suite, buffer_pool, moves_buffers_between_caches_through_the_pool);
+    add_test_with_context(suite, buffer_pool, gives_memory_back_beyond_the_free_limit);
+
+    return suite;
+}
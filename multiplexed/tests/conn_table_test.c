@@ -0,0 +1,118 @@
+#include "tests.h"
+#include "conn_table.h"
+
+
+#define MANY_CONNECTIONS (3 * CONN_TABLE_SLAB_SIZE + 7)
+
+
+static const struct dc_env *env;
+static struct dc_error *err;
+static struct buffer_pool pool;
+static struct buffer_cache cache;
+static struct conn_table table;
+static struct connection *connections[MANY_CONNECTIONS];
+
+
+Describe(conn_table);
+
+BeforeEach(conn_table)
+{
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+    buffer_pool_init(env, &pool);
+    buffer_cache_init(env, &cache, &pool);
+    conn_table_init(env, err, &table, 1, &cache);
+}
+
+AfterEach(conn_table)
+{
+    conn_table_destroy(env, &table);
+    buffer_cache_destroy(&cache);
+    buffer_pool_destroy(env, &pool);
+}
+
+Ensure(conn_table, finds_a_connection_by_its_socket)
+{
+    struct connection *connection;
+
+    connection = conn_table_insert(env, err, &table, 9);
+    assert_that(connection, is_non_null);
+    assert_that(connection->fd, is_equal_to(9));
+    assert_that(conn_table_lookup(&table, 9), is_equal_to(connection));
+    assert_that(conn_table_lookup(&table, 8), is_null);
+    assert_that(conn_table_lookup(&table, -1), is_null);
+    assert_that(conn_table_at(&table, conn_table_slot(&table, connection)), is_equal_to(connection));
+    conn_table_remove(env, &table, connection);
+    assert_that(conn_table_lookup(&table, 9), is_null);
+    assert_that(table.count, is_equal_to(0));
+}
+
+Ensure(conn_table, keeps_connections_in_place_as_it_grows)
+{
+    for(size_t i = 0; i < MANY_CONNECTIONS; i++)
+    {
+        connections[i] = conn_table_insert(env, err, &table, (int)(i + 3));
+        assert_that(connections[i], is_non_null);
+        connections[i]->last_read_ns = i;
+    }
+
+    assert_that(table.num_slabs, is_equal_to(4));
+
+    for(size_t i = 0; i < MANY_CONNECTIONS; i++)
+    {
+        assert_that(conn_table_lookup(&table, (int)(i + 3)), is_equal_to(connections[i]));
+        assert_that(connections[i]->last_read_ns, is_equal_to(i));
+        assert_that(connections[i]->slot, is_equal_to(i));
+    }
+}
+
+Ensure(conn_table, reuses_the_slot_of_a_removed_connection)
+{
+    struct connection *kept;
+    struct connection *removed;
+    struct connection *reused;
+    size_t slabs;
+
+    kept = conn_table_insert(env, err, &table, 3);
+    removed = conn_table_insert(env, err, &table, 4);
+    slabs = table.num_slabs;
+    conn_table_remove(env, &table, removed);
+    reused = conn_table_insert(env, err, &table, 5000);
+    assert_that(reused, is_equal_to(removed));
+    assert_that(reused->fd, is_equal_to(5000));
+    assert_that(reused->in_use, is_true);
+    assert_that(table.num_slabs, is_equal_to(slabs));
+    assert_that(conn_table_lookup(&table, 4), is_null);
+    assert_that(conn_table_lookup(&table, 3), is_equal_to(kept));
+    assert_that(conn_table_lookup(&table, 5000), is_equal_to(reused));
+}
+
+Ensure(conn_table, gives_queued_output_back_to_the_cache_on_remove)
+{
+    struct connection *connection;
+    struct buffer_pool_stats stats;
+    size_t capacity;
+
+    connection = conn_table_insert(env, err, &table, 3);
+    connection->stash = buffer_alloc(err, &cache, 100, &capacity);
+    connection->stash_len = capacity;
+    buffer_pool_stats(&pool, &stats);
+    assert_that(stats.in_use_buffers, is_equal_to(1));
+    conn_table_remove(env, &table, connection);
+    buffer_pool_stats(&pool, &stats);
+    assert_that(stats.in_use_buffers, is_equal_to(0));
+    assert_that(connection->stash, is_null);
+}
+
+TestSuite *conn_table_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, conn_table, finds_a_connection_by_its_socket);
+    add_test_with_context(suite, conn_table, keeps_connections_in_place_as_it_grows);
+    add_test_with_context(suite, conn_table, reuses_the_slot_of_a_removed_connection);
+    add_test_with_context(suite, conn_table, gives_queued_output_back_to_the_cache_on_remove);
+
+    return suite;
+}
@@ -0,0 +1,210 @@
+#include "tests.h"
+#include "count_pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+
+#define THIEVES 3
+#define STRESS_CHUNKS 100000
+#define STRESS_BATCH 64
+
+
+static void *steal_chunks(void *arg);
+static void claim(const struct count_chunk *chunk);
+
+
+static struct count_deque deque;
+static struct count_chunk chunks[STRESS_CHUNKS];
+static atomic_int claims[STRESS_CHUNKS];
+static atomic_bool owner_done;
+
+
+Describe(count_deque);
+
+BeforeEach(count_deque)
+{
+    // the pool hands every worker a zeroed deque, so that is all a test needs too
+    memset(&deque, 0, sizeof(deque));
+    memset(chunks, 0, sizeof(chunks));
+
+    for(size_t i = 0; i < STRESS_CHUNKS; i++)
+    {
+        atomic_init(&claims[i], 0);
+    }
+
+    atomic_init(&owner_done, false);
+}
+
+AfterEach(count_deque)
+{
+}
+
+Ensure(count_deque, gives_the_owner_the_newest_chunk_first)
+{
+    for(size_t i = 0; i < 3; i++)
+    {
+        assert_that(count_deque_push(&deque, &chunks[i]), is_true);
+    }
+
+    assert_that(count_deque_size(&deque), is_equal_to(3));
+    assert_that(count_deque_take(&deque), is_equal_to(&chunks[2]));
+    assert_that(count_deque_take(&deque), is_equal_to(&chunks[1]));
+    assert_that(count_deque_take(&deque), is_equal_to(&chunks[0]));
+    assert_that(count_deque_take(&deque), is_null);
+    assert_that(count_deque_size(&deque), is_equal_to(0));
+}
+
+Ensure(count_deque, gives_thieves_the_oldest_chunk_first)
+{
+    for(size_t i = 0; i < 3; i++)
+    {
+        assert_that(count_deque_push(&deque, &chunks[i]), is_true);
+    }
+
+    assert_that(count_deque_steal(&deque), is_equal_to(&chunks[0]));
+    assert_that(count_deque_steal(&deque), is_equal_to(&chunks[1]));
+    assert_that(count_deque_take(&deque), is_equal_to(&chunks[2]));
+    assert_that(count_deque_steal(&deque), is_null);
+    assert_that(count_deque_take(&deque), is_null);
+}
+
+Ensure(count_deque, refuses_a_push_when_full)
+{
+    for(size_t i = 0; i < COUNT_DEQUE_SIZE; i++)
+    {
+        assert_that(count_deque_push(&deque, &chunks[i]), is_true);
+    }
+
+    assert_that(count_deque_push(&deque, &chunks[COUNT_DEQUE_SIZE]), is_false);
+    assert_that(count_deque_steal(&deque), is_equal_to(&chunks[0]));
+    assert_that(count_deque_push(&deque, &chunks[COUNT_DEQUE_SIZE]), is_true);
+    assert_that(count_deque_size(&deque), is_equal_to(COUNT_DEQUE_SIZE));
+}
+
+Ensure(count_deque, keeps_its_order_across_wraparound)
+{
+    size_t next_push;
+    size_t next_steal;
+
+    next_push = 0;
+    next_steal = 0;
+
+    while(next_push < 3 * COUNT_DEQUE_SIZE)
+    {
+        while(next_push < 3 * COUNT_DEQUE_SIZE && count_deque_push(&deque, &chunks[next_push]))
+        {
+            next_push++;
+        }
+
+        for(size_t i = 0; i < COUNT_DEQUE_SIZE / 3; i++)
+        {
+            assert_that(count_deque_steal(&deque), is_equal_to(&chunks[next_steal]));
+            next_steal++;
+        }
+    }
+
+    assert_that(count_deque_take(&deque), is_equal_to(&chunks[next_push - 1]));
+}
+
+/**
+ * the owner pushes in batches and takes from its own end while the thieves steal from the other,
+ * every chunk has to be claimed exactly once no matter who won the race for it
+ * */
+Ensure(count_deque, hands_each_chunk_to_exactly_one_thread)
+{
+    pthread_t thieves[THIEVES];
+    size_t pushed;
+    size_t twice;
+
+    for(size_t i = 0; i < THIEVES; i++)
+    {
+        pthread_create(&thieves[i], NULL, steal_chunks, NULL);
+    }
+
+    pushed = 0;
+
+    while(pushed < STRESS_CHUNKS)
+    {
+        struct count_chunk *chunk;
+
+        for(size_t i = 0; i < STRESS_BATCH && pushed < STRESS_CHUNKS && count_deque_push(&deque, &chunks[pushed]); i++)
+        {
+            pushed++;
+        }
+
+        for(size_t i = 0; i < STRESS_BATCH / 2 && (chunk = count_deque_take(&deque)) != NULL; i++)
+        {
+            claim(chunk);
+        }
+
+        sched_yield();
+    }
+
+    for(struct count_chunk *chunk = count_deque_take(&deque); chunk != NULL; chunk = count_deque_take(&deque))
+    {
+        claim(chunk);
+    }
+
+    atomic_store(&owner_done, true);
+
+    for(size_t i = 0; i < THIEVES; i++)
+    {
+        pthread_join(thieves[i], NULL);
+    }
+
+    twice = 0;
+
+    for(size_t i = 0; i < STRESS_CHUNKS; i++)
+    {
+        if(atomic_load(&claims[i]) != 1)
+        {
+            twice++;
+        }
+    }
+
+    assert_that(twice, is_equal_to(0));
+    assert_that(count_deque_size(&deque), is_equal_to(0));
+}
+
+TestSuite *count_deque_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, count_deque, gives_the_owner_the_newest_chunk_first);
+    add_test_with_context(suite, count_deque, gives_thieves_the_oldest_chunk_first);
+    add_test_with_context(suite, count_deque, refuses_a_push_when_full);
+    add_test_with_context(suite, count_deque, keeps_its_order_across_wraparound);
+    add_test_with_context(suite, count_deque, hands_each_chunk_to_exactly_one_thread);
+
+    return suite;
+}
+
+static void *steal_chunks(void *arg)
+{
+    (void)arg;
+
+    while(!(atomic_load(&owner_done)) || count_deque_size(&deque) > 0)
+    {
+        struct count_chunk *chunk;
+
+        chunk = count_deque_steal(&deque);
+
+        if(chunk == NULL)
+        {
+            sched_yield();
+        }
+        else
+        {
+            claim(chunk);
+        }
+    }
+
+    return NULL;
+}
+
+static void claim(const struct count_chunk *chunk)
+{
+    atomic_fetch_add(&claims[chunk - chunks], 1);
+}
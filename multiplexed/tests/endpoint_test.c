@@ -0,0 +1,211 @@
+#include "tests.h"
+#include "endpoint.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+#define DEFAULT_PORT 4981
+
+
+static uint16_t port_of(const struct endpoint *parsed);
+static const char *address_of(const struct endpoint *parsed, char *buffer);
+
+
+static struct endpoint endpoint;
+
+
+Describe(endpoint);
+
+BeforeEach(endpoint)
+{
+}
+
+AfterEach(endpoint)
+{
+}
+
+Ensure(endpoint, takes_a_bare_address_with_the_default_port)
+{
+    char address[INET_ADDRSTRLEN];
+
+    assert_that(endpoint_parse("127.0.0.1", DEFAULT_PORT, &endpoint), is_true);
+    assert_that(endpoint_is_unix(&endpoint), is_false);
+    assert_that(address_of(&endpoint, address), is_equal_to_string("127.0.0.1"));
+    assert_that(port_of(&endpoint), is_equal_to(DEFAULT_PORT));
+    assert_that(endpoint.name, is_equal_to_string("127.0.0.1"));
+}
+
+Ensure(endpoint, takes_an_address_and_a_port)
+{
+    char address[INET_ADDRSTRLEN];
+
+    assert_that(endpoint_parse("10.1.2.3:8080", DEFAULT_PORT, &endpoint), is_true);
+    assert_that(address_of(&endpoint, address), is_equal_to_string("10.1.2.3"));
+    assert_that(port_of(&endpoint), is_equal_to(8080));
+    assert_that(endpoint_parse("tcp:10.1.2.3:8080", DEFAULT_PORT, &endpoint), is_true);
+    assert_that(address_of(&endpoint, address), is_equal_to_string("10.1.2.3"));
+    assert_that(port_of(&endpoint), is_equal_to(8080));
+}
+
+Ensure(endpoint, reads_a_lone_tcp_token_as_the_port)
+{
+    char address[INET_ADDRSTRLEN];
+
+    assert_that(endpoint_parse("tcp:9000", DEFAULT_PORT, &endpoint), is_true);
+    assert_that(address_of(&endpoint, address), is_equal_to_string("0.0.0.0"));
+    assert_that(port_of(&endpoint), is_equal_to(9000));
+    assert_that(endpoint_parse(":9000", DEFAULT_PORT, &endpoint), is_true);
+    assert_that(address_of(&endpoint, address), is_equal_to_string("0.0.0.0"));
+    assert_that(port_of(&endpoint), is_equal_to(9000));
+}
+
+Ensure(endpoint, rejects_bad_addresses_and_ports)
+{
+    const char *bad[] = { "localhost", "1.2.3.4:0", "1.2.3.4:65536", "1.2.3.4:-1", "1.2.3.4:80x", "1.2.3.4:", "tcp:", "unix:", "unix:@" };
+
+    for(size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        errno = 0;
+        assert_that(endpoint_parse(bad[i], DEFAULT_PORT, &endpoint), is_false);
+        assert_that(errno, is_equal_to(EINVAL));
+    }
+}
+
+Ensure(endpoint, keeps_a_unix_path_with_its_terminator)
+{
+    const struct sockaddr_un *addr;
+
+    assert_that(endpoint_parse("unix:/tmp/multiplex.sock", DEFAULT_PORT, &endpoint), is_true);
+    addr = (const struct sockaddr_un *)&endpoint.addr;
+    assert_that(endpoint_is_unix(&endpoint), is_true);
+    assert_that(endpoint_path(&endpoint), is_equal_to_string("/tmp/multiplex.sock"));
+    assert_that(addr->sun_path, is_equal_to_string("/tmp/multiplex.sock"));
+    assert_that(endpoint.addr_len, is_equal_to(sizeof(struct sockaddr_un)));
+}
+
+Ensure(endpoint, sizes_an_abstract_name_to_its_length)
+{
+    const struct sockaddr_un *addr;
+
+    assert_that(endpoint_parse("unix:@multiplex", DEFAULT_PORT, &endpoint), is_true);
+    addr = (const struct sockaddr_un *)&endpoint.addr;
+    assert_that(endpoint_is_unix(&endpoint), is_true);
+    assert_that(endpoint_path(&endpoint), is_null);
+    assert_that(addr->sun_path[0], is_equal_to('\0'));
+    assert_that(memcmp(addr->sun_path + 1, "multiplex", 9), is_equal_to(0));
+    assert_that(endpoint.addr_len, is_equal_to(offsetof(struct sockaddr_un, sun_path) + 1 + 9));
+}
+
+Ensure(endpoint, refuses_to_cut_a_long_unix_path_short)
+{
+    char text[ENDPOINT_NAME_SIZE];
+    char too_long[ENDPOINT_NAME_SIZE + 1];
+    size_t prefix;
+
+    prefix = strlen("unix:@");
+
+    // the longest path and the longest abstract name both fit, one byte more does not
+    memset(text, 'p', sizeof(text));
+    memcpy(text, "unix:", prefix - 1);
+    text[prefix - 1 + ENDPOINT_PATH_MAX] = '\0';
+    assert_that(endpoint_parse(text, DEFAULT_PORT, &endpoint), is_true);
+    text[prefix - 1 + ENDPOINT_PATH_MAX] = 'p';
+    text[prefix + ENDPOINT_PATH_MAX] = '\0';
+    errno = 0;
+    assert_that(endpoint_parse(text, DEFAULT_PORT, &endpoint), is_false);
+    assert_that(errno, is_equal_to(ENAMETOOLONG));
+
+    memcpy(text, "unix:@", prefix);
+    text[prefix + ENDPOINT_PATH_MAX] = '\0';
+    assert_that(endpoint_parse(text, DEFAULT_PORT, &endpoint), is_true);
+    text[prefix + ENDPOINT_PATH_MAX] = 'p';
+    text[prefix + ENDPOINT_PATH_MAX + 1] = '\0';
+    errno = 0;
+    assert_that(endpoint_parse(text, DEFAULT_PORT, &endpoint), is_false);
+    assert_that(errno, is_equal_to(ENAMETOOLONG));
+
+    // text that would not fit the name kept for logs is refused before it is looked at
+    memset(too_long, 'p', sizeof(too_long));
+    too_long[sizeof(too_long) - 1] = '\0';
+    errno = 0;
+    assert_that(endpoint_parse(too_long, DEFAULT_PORT, &endpoint), is_false);
+    assert_that(errno, is_equal_to(ENAMETOOLONG));
+}
+
+Ensure(endpoint, connects_to_an_abstract_name_and_names_the_peer)
+{
+    char name[ENDPOINT_NAME_SIZE];
+    char text[ENDPOINT_NAME_SIZE];
+    struct endpoint client;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int listener;
+    int connected;
+    int accepted;
+
+    snprintf(text, sizeof(text), "unix:@multiplex-test-%d", (int)getpid());     // NOLINT(cert-err33-c)
+    assert_that(endpoint_parse(text, DEFAULT_PORT, &endpoint), is_true);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);     // NOLINT(hicpp-signed-bitwise)
+    assert_that(listener, is_not_equal_to(-1));
+    assert_that(bind(listener, (const struct sockaddr *)&endpoint.addr, endpoint.addr_len), is_equal_to(0));
+    assert_that(listen(listener, 1), is_equal_to(0));
+
+    // the client binds a name of its own so the server has something to report
+    snprintf(text, sizeof(text), "unix:@multiplex-client-%d", (int)getpid());     // NOLINT(cert-err33-c)
+    assert_that(endpoint_parse(text, DEFAULT_PORT, &client), is_true);
+    connected = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);    // NOLINT(hicpp-signed-bitwise)
+    assert_that(bind(connected, (const struct sockaddr *)&client.addr, client.addr_len), is_equal_to(0));
+    assert_that(connect(connected, (const struct sockaddr *)&endpoint.addr, endpoint.addr_len), is_equal_to(0));
+
+    addr_len = sizeof(addr);
+    accepted = accept(listener, (struct sockaddr *)&addr, &addr_len);
+    assert_that(accepted, is_not_equal_to(-1));
+    endpoint_peer_name(&addr, addr_len, name, sizeof(name));
+    assert_that(name, is_equal_to_string(text));
+    close(accepted);
+    close(connected);
+
+    // a client that never bound has no name
+    connected = endpoint_connect(&endpoint);
+    assert_that(connected, is_not_equal_to(-1));
+    addr_len = sizeof(addr);
+    accepted = accept(listener, (struct sockaddr *)&addr, &addr_len);
+    assert_that(accepted, is_not_equal_to(-1));
+    endpoint_peer_name(&addr, addr_len, name, sizeof(name));
+    assert_that(name, is_equal_to_string("unix"));
+    close(accepted);
+    close(connected);
+    close(listener);
+}
+
+TestSuite *endpoint_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, endpoint, takes_a_bare_address_with_the_default_port);
+    add_test_with_context(suite, endpoint, takes_an_address_and_a_port);
+    add_test_with_context(suite, endpoint, reads_a_lone_tcp_token_as_the_port);
+    add_test_with_context(suite, endpoint, rejects_bad_addresses_and_ports);
+    add_test_with_context(suite, endpoint, keeps_a_unix_path_with_its_terminator);
+    add_test_with_context(suite, endpoint, sizes_an_abstract_name_to_its_length);
+    add_test_with_context(suite, endpoint, refuses_to_cut_a_long_unix_path_short);
+    add_test_with_context(suite, endpoint, connects_to_an_abstract_name_and_names_the_peer);
+
+    return suite;
+}
+
+static uint16_t port_of(const struct endpoint *parsed)
+{
+    return ntohs(((const struct sockaddr_in *)&parsed->addr)->sin_port);
+}
+
+static const char *address_of(const struct endpoint *parsed, char *buffer)
+{
+    return inet_ntop(AF_INET, &((const struct sockaddr_in *)&parsed->addr)->sin_addr, buffer, INET_ADDRSTRLEN);
+}
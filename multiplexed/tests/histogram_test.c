@@ -0,0 +1,206 @@
+#include "tests.h"
+#include "histogram.h"
+#include <stdlib.h>
+
+
+#define HIGHEST_TRACKABLE UINT64_C(3600000000000)
+#define SIGNIFICANT_FIGURES 3
+#define PRECISION 1000
+#define EXACT_LIMIT 2000
+#define RANDOM_VALUES 100000
+#define PRECISION_SAMPLES 5000
+#define RANDOM_SEED UINT64_C(0x9E3779B97F4A7C15)
+
+
+static uint64_t next_random(uint64_t *random);
+static int compare_values(const void *a, const void *b);
+
+
+static struct histogram histogram;
+static uint64_t values[RANDOM_VALUES];
+
+
+Describe(histogram);
+
+BeforeEach(histogram)
+{
+    histogram_init(&histogram, HIGHEST_TRACKABLE, SIGNIFICANT_FIGURES);
+}
+
+AfterEach(histogram)
+{
+    histogram_destroy(&histogram);
+}
+
+Ensure(histogram, refuses_precision_it_cannot_keep)
+{
+    struct histogram other;
+
+    assert_that(histogram_init(&other, HIGHEST_TRACKABLE, 0), is_false);
+    assert_that(histogram_init(&other, HIGHEST_TRACKABLE, 6), is_false);
+    assert_that(histogram_init(&other, 1, SIGNIFICANT_FIGURES), is_false);
+}
+
+Ensure(histogram, reports_nothing_when_empty)
+{
+    assert_that(histogram_value_at_percentile(&histogram, 50), is_equal_to(0));
+    assert_that(histogram_value_at_percentile(&histogram, 100), is_equal_to(0));
+    assert_that((uint64_t)histogram_mean(&histogram), is_equal_to(0));
+}
+
+Ensure(histogram, keeps_small_values_exactly)
+{
+    for(uint64_t value = 1; value <= EXACT_LIMIT; value++)
+    {
+        histogram_record(&histogram, value);
+    }
+
+    assert_that(histogram.total_count, is_equal_to(EXACT_LIMIT));
+    assert_that(histogram.min, is_equal_to(1));
+    assert_that(histogram.max, is_equal_to(EXACT_LIMIT));
+    assert_that(histogram_value_at_percentile(&histogram, 0), is_equal_to(1));
+    assert_that(histogram_value_at_percentile(&histogram, 50), is_equal_to(EXACT_LIMIT / 2));
+    assert_that(histogram_value_at_percentile(&histogram, 99), is_equal_to(EXACT_LIMIT * 99 / 100));
+    assert_that(histogram_value_at_percentile(&histogram, 100), is_equal_to(EXACT_LIMIT));
+    assert_that((uint64_t)(histogram_mean(&histogram) * 2), is_equal_to(EXACT_LIMIT + 1));
+}
+
+Ensure(histogram, stays_within_its_precision_across_the_range)
+{
+    uint64_t random;
+    size_t outside;
+
+    random = RANDOM_SEED;
+    outside = 0;
+
+    for(int i = 0; i < PRECISION_SAMPLES; i++)
+    {
+        uint64_t value;
+        uint64_t reported;
+
+        // a value, then the largest one so the median is the bucket the value landed in rather than the max
+        value = 1 + next_random(&random) % (HIGHEST_TRACKABLE >> (next_random(&random) % 40));
+        histogram_reset(&histogram);
+        histogram_record(&histogram, value);
+        histogram_record(&histogram, HIGHEST_TRACKABLE);
+        reported = histogram_value_at_percentile(&histogram, 50);
+
+        if(reported < value || reported - value > value / PRECISION)
+        {
+            outside++;
+        }
+    }
+
+    assert_that(outside, is_equal_to(0));
+}
+
+Ensure(histogram, matches_exact_percentiles_of_a_sorted_sample)
+{
+    // in hundredths of a percent
+    const uint64_t percentiles[] = { 100, 2500, 5000, 9000, 9900, 9990, 9999, 10000 };
+    uint64_t random;
+
+    random = RANDOM_SEED;
+
+    for(int i = 0; i < RANDOM_VALUES; i++)
+    {
+        // a long tail, most values in microseconds and a few out to seconds
+        values[i] = 1 + next_random(&random) % (UINT64_C(1) << (10 + next_random(&random) % 22));
+        histogram_record(&histogram, values[i]);
+    }
+
+    qsort(values, RANDOM_VALUES, sizeof(values[0]), compare_values);
+
+    for(size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    {
+        uint64_t exact;
+        uint64_t reported;
+        size_t rank;
+
+        rank = (size_t)((percentiles[i] * RANDOM_VALUES + 5000) / 10000);   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        exact = values[rank == 0 ? 0 : rank - 1];
+        reported = histogram_value_at_percentile(&histogram, (double)percentiles[i] / 100);
+        assert_that(reported >= exact, is_true);
+        assert_that(reported - exact <= exact / PRECISION, is_true);
+    }
+
+    assert_that(histogram.min, is_equal_to(values[0]));
+    assert_that(histogram.max, is_equal_to(values[RANDOM_VALUES - 1]));
+}
+
+Ensure(histogram, records_a_stall_past_the_top_as_the_top)
+{
+    histogram_record(&histogram, HIGHEST_TRACKABLE * 2);
+    assert_that(histogram.total_count, is_equal_to(1));
+    assert_that(histogram.max, is_equal_to(HIGHEST_TRACKABLE));
+    assert_that(histogram_value_at_percentile(&histogram, 100), is_equal_to(HIGHEST_TRACKABLE));
+}
+
+Ensure(histogram, adds_up_to_the_same_as_recording_into_one)
+{
+    struct histogram even;
+    struct histogram odd;
+    uint64_t random;
+
+    histogram_init(&even, HIGHEST_TRACKABLE, SIGNIFICANT_FIGURES);
+    histogram_init(&odd, HIGHEST_TRACKABLE, SIGNIFICANT_FIGURES);
+    random = RANDOM_SEED;
+
+    for(int i = 0; i < RANDOM_VALUES; i++)
+    {
+        uint64_t value;
+
+        value = 1 + next_random(&random) % HIGHEST_TRACKABLE;
+        histogram_record(&histogram, value);
+        histogram_record(i % 2 == 0 ? &even : &odd, value);
+    }
+
+    histogram_add(&even, &odd);
+    assert_that(even.total_count, is_equal_to(histogram.total_count));
+    assert_that(even.min, is_equal_to(histogram.min));
+    assert_that(even.max, is_equal_to(histogram.max));
+
+    for(size_t i = 0; i < histogram.counts_len; i++)
+    {
+        assert_that(even.counts[i], is_equal_to(histogram.counts[i]));
+    }
+
+    histogram_destroy(&odd);
+    histogram_destroy(&even);
+}
+
+TestSuite *histogram_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, histogram, refuses_precision_it_cannot_keep);
+    add_test_with_context(suite, histogram, reports_nothing_when_empty);
+    add_test_with_context(suite, histogram, keeps_small_values_exactly);
+    add_test_with_context(suite, histogram, stays_within_its_precision_across_the_range);
+    add_test_with_context(suite, histogram, matches_exact_percentiles_of_a_sorted_sample);
+    add_test_with_context(suite, histogram, records_a_stall_past_the_top_as_the_top);
+    add_test_with_context(suite, histogram, adds_up_to_the_same_as_recording_into_one);
+
+    return suite;
+}
+
+static uint64_t next_random(uint64_t *random)
+{
+    *random ^= *random << 13U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random >> 7U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random << 17U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return *random;
+}
+
+static int compare_values(const void *a, const void *b)
+{
+    uint64_t left;
+    uint64_t right;
+
+    left = *(const uint64_t *)a;
+    right = *(const uint64_t *)b;
+
+    return (left > right) - (left < right);
+}
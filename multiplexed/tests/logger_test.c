@@ -0,0 +1,140 @@
+#include "tests.h"
+#include "logger.h"
+#include <dc_c/dc_stdlib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define LOGGING_THREADS 4
+#define RECORDS_PER_THREAD 1000
+
+
+static void *log_records(void *arg);
+static size_t count_lines(const char *path, const char *needle);
+
+
+static const struct dc_env *env;
+static struct dc_error *err;
+static char path[] = "/tmp/multiplex-logger-test-XXXXXX";
+
+
+Describe(logger);
+
+BeforeEach(logger)
+{
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+}
+
+AfterEach(logger)
+{
+}
+
+Ensure(logger, discards_records_before_it_is_started)
+{
+    assert_that(logger_enabled(LOG_LEVEL_ERROR), is_false);
+    logger_write(LOG_LEVEL_ERROR, "nobody is listening");
+}
+
+/**
+ * every thread gets its own ring the first time it logs, so this is the path the sanitizer has to see
+ * */
+Ensure(logger, writes_every_record_from_every_thread)
+{
+    pthread_t threads[LOGGING_THREADS];
+    size_t ids[LOGGING_THREADS];
+    int fd;
+
+    fd = mkstemp(path);
+    assert_that(fd, is_not_equal_to(-1));
+    close(fd);
+    logger_init(env, err, path, LOG_LEVEL_INFO);
+    assert_that(dc_error_has_no_error(err), is_true);
+    assert_that(logger_enabled(LOG_LEVEL_INFO), is_true);
+    assert_that(logger_enabled(LOG_LEVEL_DEBUG), is_false);
+
+    for(size_t i = 0; i < LOGGING_THREADS; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, log_records, &ids[i]);
+    }
+
+    for(size_t i = 0; i < LOGGING_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    logger_shutdown();
+    assert_that(count_lines(path, ",info,"), is_equal_to(LOGGING_THREADS * RECORDS_PER_THREAD));
+    assert_that(count_lines(path, ",debug,"), is_equal_to(0));
+    assert_that(count_lines(path, "dropped"), is_equal_to(0));
+    unlink(path);
+}
+
+Ensure(logger, parses_the_level_names)
+{
+    enum log_level level;
+
+    assert_that(logger_parse_level("error", &level), is_true);
+    assert_that(level, is_equal_to(LOG_LEVEL_ERROR));
+    assert_that(logger_parse_level("trace", &level), is_true);
+    assert_that(level, is_equal_to(LOG_LEVEL_TRACE));
+    assert_that(logger_parse_level("verbose", &level), is_false);
+}
+
+TestSuite *logger_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, logger, discards_records_before_it_is_started);
+    add_test_with_context(suite, logger, writes_every_record_from_every_thread);
+    add_test_with_context(suite, logger, parses_the_level_names);
+
+    return suite;
+}
+
+static void *log_records(void *arg)
+{
+    const size_t *id;
+
+    id = arg;
+
+    for(int i = 0; i < RECORDS_PER_THREAD; i++)
+    {
+        logger_write(LOG_LEVEL_INFO, "record %d from thread %zu", i, *id);
+        logger_write(LOG_LEVEL_DEBUG, "filtered %d", i);
+    }
+
+    return NULL;
+}
+
+static size_t count_lines(const char *file_path, const char *needle)
+{
+    FILE *file;
+    char line[1024];     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    size_t count;
+
+    file = fopen(file_path, "r");
+    count = 0;
+
+    if(file == NULL)
+    {
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        if(strstr(line, needle) != NULL)
+        {
+            count++;
+        }
+    }
+
+    fclose(file);
+
+    return count;
+}
@@ -0,0 +1,206 @@
+#include "tests.h"
+#include "out_buffer.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define STREAM_SIZE (4UL * 1024UL * 1024UL)
+#define MAX_WRITE 9000
+#define MAX_READ 20000
+
+
+static void read_some(size_t limit);
+static uint64_t next_random(uint64_t *random);
+
+
+static const struct dc_env *env;
+static struct dc_error *err;
+static struct buffer_pool pool;
+static struct buffer_cache cache;
+static struct out_buffer out;
+static int fds[2];
+static unsigned char stream[STREAM_SIZE];
+static unsigned char received[STREAM_SIZE];
+static size_t received_len;
+
+
+Describe(out_buffer);
+
+BeforeEach(out_buffer)
+{
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+    buffer_pool_init(env, &pool);
+    buffer_cache_init(env, &cache, &pool);
+    memset(&out, 0, sizeof(out));
+    out.cache = &cache;
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    received_len = 0;
+}
+
+AfterEach(out_buffer)
+{
+    out_buffer_destroy(env, &out);
+    buffer_cache_destroy(&cache);
+    buffer_pool_destroy(env, &pool);
+    close(fds[0]);
+
+    if(fds[1] != -1)
+    {
+        close(fds[1]);
+    }
+}
+
+Ensure(out_buffer, sends_straight_through_when_nothing_is_queued)
+{
+    struct iovec iov[2];
+    char reply[16];
+
+    iov[0].iov_base = (void *)(uintptr_t)"12";
+    iov[0].iov_len = 2;
+    iov[1].iov_base = (void *)(uintptr_t)"\n";
+    iov[1].iov_len = 1;
+    assert_that(out_buffer_send(env, err, &out, fds[0], iov, 2), is_true);
+    assert_that(out_buffer_pending(&out), is_equal_to(0));
+    assert_that(read(fds[1], reply, sizeof(reply)), is_equal_to(3));
+    assert_that(memcmp(reply, "12\n", 3), is_equal_to(0));
+}
+
+/**
+ * the reader falls behind and catches up at random, so the ring grows, wraps and drains many times over
+ * */
+Ensure(out_buffer, delivers_everything_in_order_to_a_slow_reader)
+{
+    uint64_t random;
+    size_t sent;
+
+    random = 0x853C49E6748FEA9BULL;
+
+    for(size_t i = 0; i < STREAM_SIZE; i++)
+    {
+        stream[i] = (unsigned char)next_random(&random);
+    }
+
+    sent = 0;
+
+    while(sent < STREAM_SIZE)
+    {
+        struct iovec iov[2];
+        size_t first;
+        size_t second;
+
+        first = (size_t)(next_random(&random) % MAX_WRITE);
+        second = (size_t)(next_random(&random) % MAX_WRITE);
+        first = first > STREAM_SIZE - sent ? STREAM_SIZE - sent : first;
+        second = second > STREAM_SIZE - sent - first ? STREAM_SIZE - sent - first : second;
+        iov[0].iov_base = &stream[sent];
+        iov[0].iov_len = first;
+        iov[1].iov_base = &stream[sent + first];
+        iov[1].iov_len = second;
+        assert_that(out_buffer_send(env, err, &out, fds[0], iov, 2), is_true);
+        sent += first + second;
+
+        if(next_random(&random) % 4 == 0)
+        {
+            read_some((size_t)(next_random(&random) % MAX_READ));
+        }
+    }
+
+    while(out_buffer_pending(&out) > 0)
+    {
+        read_some(MAX_READ);
+        assert_that(out_buffer_flush(&out, fds[0]), is_true);
+    }
+
+    read_some(STREAM_SIZE);
+    assert_that(received_len, is_equal_to(STREAM_SIZE));
+    assert_that(memcmp(received, stream, STREAM_SIZE), is_equal_to(0));
+}
+
+Ensure(out_buffer, gathers_a_batch_into_one_send)
+{
+    struct out_batch batch;
+    char reply[16];
+
+    out_batch_init(&batch, &out, fds[0]);
+    assert_that(out_batch_add(env, err, &batch, "1\n", 2), is_true);
+    assert_that(out_batch_add(env, err, &batch, "22\n", 3), is_true);
+    assert_that(read(fds[1], reply, sizeof(reply)), is_equal_to(-1));
+    assert_that(out_batch_flush(env, err, &batch), is_true);
+    assert_that(read(fds[1], reply, sizeof(reply)), is_equal_to(5));
+    assert_that(memcmp(reply, "1\n22\n", 5), is_equal_to(0));
+}
+
+Ensure(out_buffer, reports_a_peer_that_went_away)
+{
+    struct iovec iov;
+
+    close(fds[1]);
+    fds[1] = -1;
+    iov.iov_base = (void *)(uintptr_t)"lost\n";
+    iov.iov_len = 5;
+    assert_that(out_buffer_send(env, err, &out, fds[0], &iov, 1), is_false);
+    assert_that(dc_error_has_no_error(err), is_true);
+}
+
+Ensure(out_buffer, rejects_a_high_water_mark_that_is_not_a_positive_count)
+{
+    size_t bytes;
+
+    bytes = 0;
+    assert_that(out_buffer_parse_high_water("65536", &bytes), is_true);
+    assert_that(bytes, is_equal_to(65536));
+    assert_that(out_buffer_parse_high_water("-1", &bytes), is_false);
+    assert_that(out_buffer_parse_high_water(" -1", &bytes), is_false);
+    assert_that(out_buffer_parse_high_water("+1", &bytes), is_false);
+    assert_that(out_buffer_parse_high_water("0", &bytes), is_false);
+    assert_that(out_buffer_parse_high_water("1k", &bytes), is_false);
+    assert_that(out_buffer_parse_high_water("", &bytes), is_false);
+    assert_that(out_buffer_parse_high_water("99999999999999999999999", &bytes), is_false);
+    assert_that(bytes, is_equal_to(65536));
+}
+
+TestSuite *out_buffer_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, out_buffer, sends_straight_through_when_nothing_is_queued);
+    add_test_with_context(suite, out_buffer, delivers_everything_in_order_to_a_slow_reader);
+    add_test_with_context(suite, out_buffer, gathers_a_batch_into_one_send);
+    add_test_with_context(suite, out_buffer, reports_a_peer_that_went_away);
+    add_test_with_context(suite, out_buffer, rejects_a_high_water_mark_that_is_not_a_positive_count);
+
+    return suite;
+}
+
+static void read_some(size_t limit)
+{
+    while(limit > 0 && received_len < STREAM_SIZE)
+    {
+        ssize_t got;
+        size_t want;
+
+        want = limit < STREAM_SIZE - received_len ? limit : STREAM_SIZE - received_len;
+        got = read(fds[1], &received[received_len], want);
+
+        if(got <= 0)
+        {
+            return;
+        }
+
+        received_len += (size_t)got;
+        limit -= (size_t)got;
+    }
+}
+
+static uint64_t next_random(uint64_t *random)
+{
+    *random ^= *random << 13U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random >> 7U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random << 17U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return *random;
+}
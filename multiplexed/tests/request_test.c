@@ -0,0 +1,341 @@
+#include "tests.h"
+#include "request.h"
+#include <string.h>
+
+
+#define MAX_REQUESTS 16
+
+
+/**
+ * everything a feed completed, in order
+ * */
+struct collected
+{
+    struct request requests[MAX_REQUESTS];
+    size_t count;
+};
+
+
+static bool collect(void *arg, const struct request *request);
+static void feed_in_pieces(struct request_parser *parser, const char *data, size_t len, size_t piece, struct collected *collected);
+static size_t length_frame(char *buffer, const char *payload);
+static size_t binary_frame(char *buffer, uint32_t id, const char *payload);
+
+
+static struct request_parser parser;
+static struct collected collected;
+
+
+Describe(request);
+
+BeforeEach(request)
+{
+    memset(&collected, 0, sizeof(collected));
+}
+
+AfterEach(request)
+{
+}
+
+Ensure(request, counts_every_read_as_a_request_when_unframed)
+{
+    request_parser_init(&parser, FRAME_NONE);
+    request_parser_feed_all(&parser, "one two  three\n", 15, collect, &collected);
+    request_parser_feed_all(&parser, "four", 4, collect, &collected);
+    assert_that(collected.count, is_equal_to(2));
+    assert_that(collected.requests[0].type, is_equal_to(REQUEST_COUNT));
+    assert_that(collected.requests[0].words, is_equal_to(3));
+    assert_that(collected.requests[1].words, is_equal_to(1));
+}
+
+Ensure(request, does_not_negotiate_when_unframed)
+{
+    request_parser_init(&parser, FRAME_NONE);
+    request_parser_feed_all(&parser, "\xFFWC\x01", 4, collect, &collected);
+    assert_that(collected.count, is_equal_to(1));
+    assert_that(collected.requests[0].type, is_equal_to(REQUEST_COUNT));
+    assert_that(parser.mode, is_equal_to(FRAME_NONE));
+}
+
+Ensure(request, ends_a_line_request_at_each_newline)
+{
+    request_parser_init(&parser, FRAME_LINE);
+    request_parser_feed_all(&parser, "a b c\n\nd e\n", 11, collect, &collected);
+    assert_that(collected.count, is_equal_to(3));
+    assert_that(collected.requests[0].words, is_equal_to(3));
+    assert_that(collected.requests[1].words, is_equal_to(0));
+    assert_that(collected.requests[2].words, is_equal_to(2));
+}
+
+Ensure(request, keeps_a_partial_line_for_the_next_read)
+{
+    request_parser_init(&parser, FRAME_LINE);
+    request_parser_feed_all(&parser, "hello wo", 8, collect, &collected);
+    assert_that(collected.count, is_equal_to(0));
+    assert_that(parser.in_request, is_true);
+    request_parser_feed_all(&parser, "rld\n", 4, collect, &collected);
+    assert_that(collected.count, is_equal_to(1));
+    assert_that(collected.requests[0].words, is_equal_to(2));
+    assert_that(parser.in_request, is_false);
+}
+
+Ensure(request, counts_lines_the_same_whatever_the_read_size)
+{
+    const char *text = "the quick  brown\tfox\njumps over\n the lazy dog \n";
+
+    for(size_t piece = 1; piece <= strlen(text); piece++)
+    {
+        memset(&collected, 0, sizeof(collected));
+        request_parser_init(&parser, FRAME_LINE);
+        feed_in_pieces(&parser, text, strlen(text), piece, &collected);
+        assert_that(collected.count, is_equal_to(3));
+        assert_that(collected.requests[0].words, is_equal_to(4));
+        assert_that(collected.requests[1].words, is_equal_to(2));
+        assert_that(collected.requests[2].words, is_equal_to(3));
+    }
+}
+
+Ensure(request, reads_length_prefixed_requests_split_anywhere)
+{
+    char stream[64];
+    size_t len;
+
+    len = length_frame(stream, "alpha beta");
+    len += length_frame(&stream[len], "");
+    len += length_frame(&stream[len], " gamma\ndelta epsilon ");
+
+    for(size_t piece = 1; piece <= len; piece++)
+    {
+        memset(&collected, 0, sizeof(collected));
+        request_parser_init(&parser, FRAME_LENGTH);
+        feed_in_pieces(&parser, stream, len, piece, &collected);
+        assert_that(collected.count, is_equal_to(3));
+        assert_that(collected.requests[0].words, is_equal_to(2));
+        assert_that(collected.requests[1].words, is_equal_to(0));
+        assert_that(collected.requests[2].words, is_equal_to(3));
+        assert_that(collected.requests[2].id, is_equal_to(0));
+    }
+}
+
+Ensure(request, does_not_carry_a_word_across_length_prefixed_requests)
+{
+    char stream[32];
+    size_t len;
+
+    request_parser_init(&parser, FRAME_LENGTH);
+    len = length_frame(stream, "ab");
+    len += length_frame(&stream[len], "cd");
+    request_parser_feed_all(&parser, stream, len, collect, &collected);
+    assert_that(collected.count, is_equal_to(2));
+    assert_that(collected.requests[1].words, is_equal_to(1));
+}
+
+Ensure(request, hands_over_large_length_prefixed_payloads_in_pieces)
+{
+    char stream[32];
+    char payload[32];
+    size_t len;
+    size_t payload_len;
+
+    request_parser_init(&parser, FRAME_LENGTH);
+    parser.offload_threshold = 8;
+    len = length_frame(stream, "one two three");
+    feed_in_pieces(&parser, stream, len, 5, &collected);
+    assert_that(collected.count, is_equal_to(4));
+    assert_that(collected.requests[0].remaining, is_equal_to(12));
+    assert_that(collected.requests[3].remaining, is_equal_to(0));
+    payload_len = 0;
+
+    for(size_t i = 0; i < collected.count; i++)
+    {
+        assert_that(collected.requests[i].type, is_equal_to(REQUEST_PAYLOAD));
+        memcpy(&payload[payload_len], collected.requests[i].data, collected.requests[i].len);
+        payload_len += collected.requests[i].len;
+    }
+
+    payload[payload_len] = '\0';
+    assert_that(payload, is_equal_to_string("one two three"));
+    assert_that(parser.in_request, is_false);
+}
+
+Ensure(request, formats_a_count_as_a_decimal_line)
+{
+    char buffer[REQUEST_RESPONSE_SIZE];
+
+    assert_that(request_format_response(buffer, 0), is_equal_to(2));
+    assert_that(buffer, is_equal_to_string("0\n"));
+    assert_that(request_format_response(buffer, UINT64_MAX), is_equal_to(21));
+    assert_that(buffer, is_equal_to_string("18446744073709551615\n"));
+}
+
+Ensure(request, parses_the_frame_mode_names)
+{
+    enum frame_mode mode;
+
+    assert_that(request_parse_frame_mode("line", &mode), is_true);
+    assert_that(mode, is_equal_to(FRAME_LINE));
+    assert_that(request_parse_frame_mode("length", &mode), is_true);
+    assert_that(mode, is_equal_to(FRAME_LENGTH));
+    assert_that(request_parse_frame_mode("none", &mode), is_true);
+    assert_that(mode, is_equal_to(FRAME_NONE));
+    assert_that(request_parse_frame_mode("binary", &mode), is_false);
+}
+
+Ensure(request, switches_to_the_binary_protocol_on_a_hello)
+{
+    char reply[REQUEST_RESPONSE_SIZE];
+
+    request_parser_init(&parser, FRAME_LINE);
+    request_parser_feed_all(&parser, "\xFFWC\x07", 4, collect, &collected);
+    assert_that(collected.count, is_equal_to(1));
+    assert_that(collected.requests[0].type, is_equal_to(REQUEST_HELLO));
+    assert_that(collected.requests[0].version, is_equal_to(REQUEST_PROTOCOL_VERSION));
+    assert_that(parser.mode, is_equal_to(FRAME_BINARY));
+    assert_that(request_format_reply(reply, parser.mode, &collected.requests[0]), is_equal_to(REQUEST_HELLO_SIZE));
+    assert_that(memcmp(reply, "\xFFWS\x01", REQUEST_HELLO_SIZE), is_equal_to(0));
+}
+
+Ensure(request, reads_a_hello_split_over_reads)
+{
+    request_parser_init(&parser, FRAME_LENGTH);
+    feed_in_pieces(&parser, "\xFFWC\x01", 4, 1, &collected);
+    assert_that(collected.count, is_equal_to(1));
+    assert_that(collected.requests[0].type, is_equal_to(REQUEST_HELLO));
+    assert_that(parser.mode, is_equal_to(FRAME_BINARY));
+}
+
+Ensure(request, keeps_the_mode_for_a_hello_with_the_wrong_name)
+{
+    request_parser_init(&parser, FRAME_LINE);
+    request_parser_feed_all(&parser, "\xFFWS\x01", 4, collect, &collected);
+    assert_that(collected.count, is_equal_to(1));
+    assert_that(collected.requests[0].type, is_equal_to(REQUEST_HELLO));
+    assert_that(collected.requests[0].version, is_equal_to(0));
+    assert_that(parser.mode, is_equal_to(FRAME_LINE));
+}
+
+Ensure(request, only_negotiates_before_the_first_request)
+{
+    request_parser_init(&parser, FRAME_LINE);
+    request_parser_feed_all(&parser, "a\n\xFFWC\x01\n", 7, collect, &collected);
+    assert_that(collected.count, is_equal_to(2));
+    assert_that(collected.requests[1].type, is_equal_to(REQUEST_COUNT));
+    assert_that(collected.requests[1].words, is_equal_to(1));
+    assert_that(parser.mode, is_equal_to(FRAME_LINE));
+}
+
+Ensure(request, reads_binary_requests_split_anywhere)
+{
+    char stream[64];
+    size_t len;
+
+    memcpy(stream, "\xFFWC\x01", REQUEST_HELLO_SIZE);
+    len = REQUEST_HELLO_SIZE;
+    len += binary_frame(&stream[len], 7, "a b c");
+    len += binary_frame(&stream[len], 0xDEADBEEFU, "");
+    len += binary_frame(&stream[len], 1, "split words ");
+
+    for(size_t piece = 1; piece <= len; piece++)
+    {
+        memset(&collected, 0, sizeof(collected));
+        request_parser_init(&parser, FRAME_LENGTH);
+        feed_in_pieces(&parser, stream, len, piece, &collected);
+        assert_that(collected.count, is_equal_to(4));
+        assert_that(collected.requests[1].id, is_equal_to(7));
+        assert_that(collected.requests[1].words, is_equal_to(3));
+        assert_that(collected.requests[2].id, is_equal_to(0xDEADBEEFU));
+        assert_that(collected.requests[2].words, is_equal_to(0));
+        assert_that(collected.requests[3].id, is_equal_to(1));
+        assert_that(collected.requests[3].words, is_equal_to(2));
+    }
+}
+
+Ensure(request, formats_a_binary_reply_with_the_request_id)
+{
+    const unsigned char expected[REQUEST_BINARY_RESPONSE_SIZE] = { 0, 0, 0, 8, 0x12, 0x34, 0x56, 0x78, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 2 };
+    char reply[REQUEST_RESPONSE_SIZE];
+    struct request request;
+
+    request.type = REQUEST_COUNT;
+    request.id = 0x12345678U;
+    request.words = 0x100000002ULL;
+    assert_that(request_format_reply(reply, FRAME_BINARY, &request), is_equal_to(REQUEST_BINARY_RESPONSE_SIZE));
+    assert_that(memcmp(reply, expected, sizeof(expected)), is_equal_to(0));
+}
+
+TestSuite *request_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, request, counts_every_read_as_a_request_when_unframed);
+    add_test_with_context(suite, request, does_not_negotiate_when_unframed);
+    add_test_with_context(suite, request, ends_a_line_request_at_each_newline);
+    add_test_with_context(suite, request, keeps_a_partial_line_for_the_next_read);
+    add_test_with_context(suite, request, counts_lines_the_same_whatever_the_read_size);
+    add_test_with_context(suite, request, reads_length_prefixed_requests_split_anywhere);
+    add_test_with_context(suite, request, does_not_carry_a_word_across_length_prefixed_requests);
+    add_test_with_context(suite, request, hands_over_large_length_prefixed_payloads_in_pieces);
+    add_test_with_context(suite, request, formats_a_count_as_a_decimal_line);
+    add_test_with_context(suite, request, parses_the_frame_mode_names);
+    add_test_with_context(suite, request, switches_to_the_binary_protocol_on_a_hello);
+    add_test_with_context(suite, request, reads_a_hello_split_over_reads);
+    add_test_with_context(suite, request, keeps_the_mode_for_a_hello_with_the_wrong_name);
+    add_test_with_context(suite, request, only_negotiates_before_the_first_request);
+    add_test_with_context(suite, request, reads_binary_requests_split_anywhere);
+    add_test_with_context(suite, request, formats_a_binary_reply_with_the_request_id);
+
+    return suite;
+}
+
+static bool collect(void *arg, const struct request *request)
+{
+    struct collected *requests;
+
+    requests = arg;
+
+    if(requests->count < MAX_REQUESTS)
+    {
+        requests->requests[requests->count] = *request;
+    }
+
+    requests->count++;
+
+    return true;
+}
+
+static void feed_in_pieces(struct request_parser *request_parser, const char *data, size_t len, size_t piece, struct collected *requests)
+{
+    for(size_t offset = 0; offset < len; offset += piece)
+    {
+        request_parser_feed_all(request_parser, &data[offset], len - offset < piece ? len - offset : piece, collect, requests);
+    }
+}
+
+static size_t length_frame(char *buffer, const char *payload)
+{
+    size_t len;
+
+    len = strlen(payload);
+    buffer[0] = (char)((len >> 24U) & 0xFFU);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    buffer[1] = (char)((len >> 16U) & 0xFFU);     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    buffer[2] = (char)((len >> 8U) & 0xFFU);      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    buffer[3] = (char)(len & 0xFFU);              // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    memcpy(&buffer[REQUEST_LENGTH_PREFIX_SIZE], payload, len);
+
+    return REQUEST_LENGTH_PREFIX_SIZE + len;
+}
+
+static size_t binary_frame(char *buffer, uint32_t id, const char *payload)
+{
+    size_t len;
+
+    len = length_frame(buffer, payload);
+    memmove(&buffer[REQUEST_BINARY_HEADER_SIZE], &buffer[REQUEST_LENGTH_PREFIX_SIZE], len - REQUEST_LENGTH_PREFIX_SIZE);
+    buffer[4] = (char)((id >> 24U) & 0xFFU);      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    buffer[5] = (char)((id >> 16U) & 0xFFU);      // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    buffer[6] = (char)((id >> 8U) & 0xFFU);       // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    buffer[7] = (char)(id & 0xFFU);               // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return len + REQUEST_BINARY_HEADER_SIZE - REQUEST_LENGTH_PREFIX_SIZE;
+}
@@ -0,0 +1,158 @@
+#include "tests.h"
+#include "spsc_queue.h"
+#include <dc_c/dc_stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+
+#define STRESS_COUNT 200000
+#define STRESS_CAPACITY 64
+
+
+static void *produce(void *arg);
+
+
+static const struct dc_env *env;
+static struct dc_error *err;
+static struct spsc_queue queue;
+
+
+Describe(spsc_queue);
+
+BeforeEach(spsc_queue)
+{
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+}
+
+AfterEach(spsc_queue)
+{
+    spsc_queue_destroy(env, &queue);
+}
+
+Ensure(spsc_queue, rounds_the_capacity_up_to_a_power_of_two)
+{
+    int value;
+    int pushed;
+
+    spsc_queue_init(env, err, &queue, 5, sizeof(int));     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    assert_that(dc_error_has_no_error(err), is_true);
+    pushed = 0;
+    value = 0;
+
+    while(spsc_queue_push(&queue, &value))
+    {
+        pushed++;
+        value++;
+    }
+
+    assert_that(pushed, is_equal_to(8));
+    assert_that(spsc_queue_size(&queue), is_equal_to(8));
+}
+
+Ensure(spsc_queue, pops_in_the_order_pushed_across_wraparound)
+{
+    uint64_t next_push;
+    uint64_t next_pop;
+
+    spsc_queue_init(env, err, &queue, 4, sizeof(uint64_t));     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    next_push = 0;
+    next_pop = 0;
+
+    for(int round = 0; round < 100; round++)     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    {
+        uint64_t value;
+
+        while(spsc_queue_push(&queue, &next_push))
+        {
+            next_push++;
+        }
+
+        for(int i = 0; i < round % 4 + 1 && spsc_queue_pop(&queue, &value); i++)     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        {
+            assert_that(value, is_equal_to(next_pop));
+            next_pop++;
+        }
+    }
+
+    assert_that(spsc_queue_size(&queue), is_equal_to(next_push - next_pop));
+}
+
+Ensure(spsc_queue, fails_to_pop_when_empty)
+{
+    int value;
+
+    spsc_queue_init(env, err, &queue, 2, sizeof(int));
+    value = 42;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    assert_that(spsc_queue_pop(&queue, &value), is_false);
+    assert_that(spsc_queue_push(&queue, &value), is_true);
+    value = 0;
+    assert_that(spsc_queue_pop(&queue, &value), is_true);
+    assert_that(value, is_equal_to(42));
+    assert_that(spsc_queue_pop(&queue, &value), is_false);
+}
+
+Ensure(spsc_queue, hands_every_element_over_between_threads_in_order)
+{
+    pthread_t producer;
+    uint64_t expected;
+
+    spsc_queue_init(env, err, &queue, STRESS_CAPACITY, sizeof(uint64_t));
+    assert_that(pthread_create(&producer, NULL, produce, &queue), is_equal_to(0));
+    expected = 0;
+
+    while(expected < STRESS_COUNT)
+    {
+        uint64_t value;
+
+        if(spsc_queue_pop(&queue, &value))
+        {
+            if(value != expected)
+            {
+                break;
+            }
+
+            expected++;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+
+    pthread_join(producer, NULL);
+    assert_that(expected, is_equal_to(STRESS_COUNT));
+    assert_that(spsc_queue_size(&queue), is_equal_to(0));
+}
+
+TestSuite *spsc_queue_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, spsc_queue, rounds_the_capacity_up_to_a_power_of_two);
+    add_test_with_context(suite, spsc_queue, pops_in_the_order_pushed_across_wraparound);
+    add_test_with_context(suite, spsc_queue, fails_to_pop_when_empty);
+    add_test_with_context(suite, spsc_queue, hands_every_element_over_between_threads_in_order);
+
+    return suite;
+}
+
+static void *produce(void *arg)
+{
+    struct spsc_queue *ring;
+
+    ring = arg;
+
+    for(uint64_t value = 0; value < STRESS_COUNT; value++)
+    {
+        // yielding keeps the test quick on a single cpu where a spinning producer would hold off the consumer for a whole slice
+        while(!(spsc_queue_push(ring, &value)))
+        {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef MULTIPLEX_TESTS_H
+#define MULTIPLEX_TESTS_H
+
+#include <cgreen/cgreen.h>
+
+
+/**
+ * one suite per module, all_tests.c runs them together so ctest has a single binary to run under the sanitizer
+ * */
+TestSuite *buffer_pool_tests(void);
+TestSuite *conn_table_tests(void);
+TestSuite *count_deque_tests(void);
+TestSuite *endpoint_tests(void);
+TestSuite *histogram_tests(void);
+TestSuite *logger_tests(void);
+TestSuite *out_buffer_tests(void);
+TestSuite *request_tests(void);
+TestSuite *spsc_queue_tests(void);
+TestSuite *timer_wheel_tests(void);
+TestSuite *word_count_tests(void);
+
+#endif // MULTIPLEX_TESTS_H
@@ -0,0 +1,224 @@
+#include "tests.h"
+#include "timer_wheel.h"
+#include <string.h>
+
+
+#define TICK_NS 1000
+#define RANDOM_TIMERS 2000
+#define RANDOM_SPAN_TICKS 300000
+#define MAX_STEP_TICKS 5000
+
+
+/**
+ * what the handler saw, now_ns is the time the test advanced to and previous_ns where the advance before it stopped
+ * */
+struct fired
+{
+    struct timer_wheel *wheel;
+    uint64_t now_ns;
+    uint64_t previous_ns;
+    uint64_t expires[RANDOM_TIMERS];
+    size_t count[RANDOM_TIMERS];
+    size_t early;
+    size_t late;
+    size_t reschedule;
+};
+
+
+static void record(void *arg, size_t id);
+static void advance_to(struct fired *fired_timers, uint64_t now_ns);
+static uint64_t next_random(uint64_t *random);
+
+
+static const struct dc_env *env;
+static struct dc_error *err;
+static struct timer_wheel wheel;
+static struct fired fired;
+
+
+Describe(timer_wheel);
+
+BeforeEach(timer_wheel)
+{
+    err = dc_error_create(true);
+    env = dc_env_create(err, true, NULL);
+    timer_wheel_init(&wheel, TICK_NS, 0);
+    memset(&fired, 0, sizeof(fired));
+    fired.wheel = &wheel;
+}
+
+AfterEach(timer_wheel)
+{
+    timer_wheel_destroy(env, &wheel);
+}
+
+Ensure(timer_wheel, fires_on_the_first_tick_at_or_after_the_expiry)
+{
+    fired.expires[3] = 5 * TICK_NS + 1;
+    timer_wheel_schedule(env, err, &wheel, 3, fired.expires[3]);
+    advance_to(&fired, 5 * TICK_NS);
+    assert_that(fired.count[3], is_equal_to(0));
+    advance_to(&fired, 6 * TICK_NS);
+    assert_that(fired.count[3], is_equal_to(1));
+    assert_that(timer_wheel_timeout_ms(&wheel, 6 * TICK_NS), is_equal_to(-1));
+}
+
+Ensure(timer_wheel, forgets_a_cancelled_timer)
+{
+    uint64_t expires;
+
+    timer_wheel_schedule(env, err, &wheel, 7, 10 * TICK_NS);
+    assert_that(timer_wheel_expiry(&wheel, 7, &expires), is_true);
+    assert_that(expires, is_equal_to(10 * TICK_NS));
+    timer_wheel_cancel(&wheel, 7);
+    assert_that(timer_wheel_expiry(&wheel, 7, &expires), is_false);
+    advance_to(&fired, 100 * TICK_NS);
+    assert_that(fired.count[7], is_equal_to(0));
+}
+
+Ensure(timer_wheel, moves_a_timer_that_is_scheduled_again)
+{
+    fired.expires[1] = 2000 * TICK_NS;
+    timer_wheel_schedule(env, err, &wheel, 1, 10 * TICK_NS);
+    timer_wheel_schedule(env, err, &wheel, 1, fired.expires[1]);
+    advance_to(&fired, 1999 * TICK_NS);
+    assert_that(fired.count[1], is_equal_to(0));
+    advance_to(&fired, 2000 * TICK_NS);
+    assert_that(fired.count[1], is_equal_to(1));
+}
+
+Ensure(timer_wheel, lets_a_handler_schedule_its_timer_again)
+{
+    fired.expires[2] = 3 * TICK_NS;
+    fired.reschedule = 3;
+    timer_wheel_schedule(env, err, &wheel, 2, fired.expires[2]);
+
+    for(uint64_t tick = 1; tick <= 10; tick++)
+    {
+        advance_to(&fired, tick * TICK_NS);
+    }
+
+    assert_that(fired.count[2], is_equal_to(4));
+    assert_that(timer_wheel_expiry(&wheel, 2, &fired.expires[0]), is_false);
+    assert_that(fired.early + fired.late, is_equal_to(0));
+}
+
+Ensure(timer_wheel, reports_the_wait_until_the_next_timer_in_milliseconds)
+{
+    timer_wheel_init(&wheel, 10000000, 0);
+    assert_that(timer_wheel_timeout_ms(&wheel, 0), is_equal_to(-1));
+    timer_wheel_schedule(env, err, &wheel, 0, 25000000);
+    assert_that(timer_wheel_timeout_ms(&wheel, 0), is_equal_to(30));
+    assert_that(timer_wheel_timeout_ms(&wheel, 29500000), is_equal_to(1));
+    assert_that(timer_wheel_timeout_ms(&wheel, 40000000), is_equal_to(0));
+}
+
+Ensure(timer_wheel, fires_random_timers_exactly_once_and_on_time)
+{
+    uint64_t random;
+    uint64_t now_ns;
+    size_t total;
+
+    random = 0x2545F4914F6CDD1DULL;
+
+    for(size_t id = 0; id < RANDOM_TIMERS; id++)
+    {
+        fired.expires[id] = next_random(&random) % (RANDOM_SPAN_TICKS * TICK_NS) + 1;
+        assert_that(timer_wheel_schedule(env, err, &wheel, id, fired.expires[id]), is_true);
+    }
+
+    now_ns = 0;
+
+    while(now_ns <= RANDOM_SPAN_TICKS * TICK_NS)
+    {
+        now_ns += (next_random(&random) % MAX_STEP_TICKS + 1) * TICK_NS;
+        advance_to(&fired, now_ns);
+    }
+
+    total = 0;
+
+    for(size_t id = 0; id < RANDOM_TIMERS; id++)
+    {
+        assert_that(fired.count[id], is_equal_to(1));
+        total += fired.count[id];
+    }
+
+    assert_that(total, is_equal_to(RANDOM_TIMERS));
+    assert_that(fired.early, is_equal_to(0));
+    assert_that(fired.late, is_equal_to(0));
+    assert_that(timer_wheel_timeout_ms(&wheel, now_ns), is_equal_to(-1));
+}
+
+Ensure(timer_wheel, holds_a_timer_beyond_its_range_until_it_is_due)
+{
+    uint64_t beyond;
+
+    beyond = (UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) + 12345;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    timer_wheel_init(&wheel, 1, 0);
+    fired.expires[0] = beyond;
+    timer_wheel_schedule(env, err, &wheel, 0, beyond);
+    advance_to(&fired, beyond - 1);
+    assert_that(fired.count[0], is_equal_to(0));
+    advance_to(&fired, beyond);
+    assert_that(fired.count[0], is_equal_to(1));
+}
+
+TestSuite *timer_wheel_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, timer_wheel, fires_on_the_first_tick_at_or_after_the_expiry);
+    add_test_with_context(suite, timer_wheel, forgets_a_cancelled_timer);
+    add_test_with_context(suite, timer_wheel, moves_a_timer_that_is_scheduled_again);
+    add_test_with_context(suite, timer_wheel, lets_a_handler_schedule_its_timer_again);
+    add_test_with_context(suite, timer_wheel, reports_the_wait_until_the_next_timer_in_milliseconds);
+    add_test_with_context(suite, timer_wheel, fires_random_timers_exactly_once_and_on_time);
+    add_test_with_context(suite, timer_wheel, holds_a_timer_beyond_its_range_until_it_is_due);
+
+    return suite;
+}
+
+/**
+ * the test only advances to tick boundaries, so a timer is late exactly when it was already due at the previous advance
+ * */
+static void record(void *arg, size_t id)
+{
+    struct fired *fired_timers;
+
+    fired_timers = arg;
+    fired_timers->count[id]++;
+
+    if(fired_timers->expires[id] > fired_timers->now_ns)
+    {
+        fired_timers->early++;
+    }
+
+    if(fired_timers->expires[id] <= fired_timers->previous_ns)
+    {
+        fired_timers->late++;
+    }
+
+    if(fired_timers->reschedule > 0)
+    {
+        fired_timers->reschedule--;
+        fired_timers->expires[id] = fired_timers->now_ns + TICK_NS;
+        timer_wheel_schedule(env, err, fired_timers->wheel, id, fired_timers->expires[id]);
+    }
+}
+
+static void advance_to(struct fired *fired_timers, uint64_t now_ns)
+{
+    fired_timers->now_ns = now_ns;
+    timer_wheel_advance(fired_timers->wheel, now_ns, record, fired_timers);
+    fired_timers->previous_ns = now_ns;
+}
+
+static uint64_t next_random(uint64_t *random)
+{
+    *random ^= *random << 13U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random >> 7U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random << 17U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return *random;
+}
@@ -0,0 +1,186 @@
+#include "tests.h"
+#include "word_count.h"
+#include <string.h>
+
+
+#define BUFFER_SIZE 1024
+#define ALIGNMENT_SLACK 64
+#define RANDOM_ROUNDS 200
+
+
+static uint64_t next_random(uint64_t *state);
+static void fill_random(char *buffer, size_t len, uint64_t *state);
+static uint64_t count_reference(const char *buffer, size_t len, bool *in_word);
+
+
+/**
+ * spaces and non-ascii bytes are over-represented so every vector holds a mix of word starts, runs and high-bit bytes
+ * */
+static const char alphabet[] = " \t\n\r\v\f  abcxyz09\x80\xFF\x1F!";
+
+static char buffer[BUFFER_SIZE + ALIGNMENT_SLACK];
+static uint64_t state;
+
+
+Describe(word_count);
+
+BeforeEach(word_count)
+{
+    state = 0x9E3779B97F4A7C15ULL;
+}
+
+AfterEach(word_count)
+{
+}
+
+Ensure(word_count, counts_a_word_when_text_follows_whitespace)
+{
+    bool in_word;
+
+    for(int kernel = 0; kernel < WORD_COUNT_KERNEL_COUNT; kernel++)
+    {
+        if(!(word_count_kernel_supported((enum word_count_kernel)kernel)))
+        {
+            continue;
+        }
+
+        in_word = false;
+        assert_that(word_count_run((enum word_count_kernel)kernel, "", 0, &in_word), is_equal_to(0));
+        assert_that(word_count_run((enum word_count_kernel)kernel, "  one\ttwo\n\nthree  ", 18, &in_word), is_equal_to(3));
+        assert_that(in_word, is_false);
+        assert_that(word_count_run((enum word_count_kernel)kernel, "four", 4, &in_word), is_equal_to(1));
+        assert_that(in_word, is_true);
+        assert_that(word_count_run((enum word_count_kernel)kernel, "ty five", 7, &in_word), is_equal_to(1));
+    }
+}
+
+Ensure(word_count, agrees_with_the_reference_on_random_input)
+{
+    for(int round = 0; round < RANDOM_ROUNDS; round++)
+    {
+        size_t len;
+        size_t offset;
+        bool start;
+        bool expected_in_word;
+        uint64_t expected;
+
+        len = (size_t)(next_random(&state) % BUFFER_SIZE);
+        offset = (size_t)(next_random(&state) % ALIGNMENT_SLACK);
+        start = (next_random(&state) & 1U) != 0;
+        fill_random(&buffer[offset], len, &state);
+        expected_in_word = start;
+        expected = count_reference(&buffer[offset], len, &expected_in_word);
+
+        for(int kernel = 0; kernel < WORD_COUNT_KERNEL_COUNT; kernel++)
+        {
+            bool in_word;
+
+            if(!(word_count_kernel_supported((enum word_count_kernel)kernel)))
+            {
+                continue;
+            }
+
+            in_word = start;
+            assert_that(word_count_run((enum word_count_kernel)kernel, &buffer[offset], len, &in_word), is_equal_to(expected));
+            assert_that(in_word, is_equal_to(expected_in_word));
+        }
+    }
+}
+
+Ensure(word_count, counts_the_same_wherever_a_buffer_is_split)
+{
+    size_t len;
+    uint64_t expected;
+    bool in_word;
+
+    len = 3 * ALIGNMENT_SLACK + 5;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    fill_random(buffer, len, &state);
+    in_word = false;
+    expected = count_reference(buffer, len, &in_word);
+
+    for(int kernel = 0; kernel < WORD_COUNT_KERNEL_COUNT; kernel++)
+    {
+        if(!(word_count_kernel_supported((enum word_count_kernel)kernel)))
+        {
+            continue;
+        }
+
+        for(size_t split = 0; split <= len; split++)
+        {
+            uint64_t words;
+
+            in_word = false;
+            words = word_count_run((enum word_count_kernel)kernel, buffer, split, &in_word);
+            words += word_count_run((enum word_count_kernel)kernel, &buffer[split], len - split, &in_word);
+            assert_that(words, is_equal_to(expected));
+        }
+    }
+}
+
+Ensure(word_count, keeps_a_word_split_over_feeds_to_one)
+{
+    struct word_counter counter;
+
+    word_counter_init(&counter);
+    word_counter_feed(&counter, "hello wor", 9);
+    word_counter_feed(&counter, "ld  again", 9);
+    assert_that(word_counter_take(&counter), is_equal_to(3));
+    word_counter_feed(&counter, "st it", 5);
+    assert_that(word_counter_take(&counter), is_equal_to(1));
+}
+
+TestSuite *word_count_tests(void)
+{
+    TestSuite *suite;
+
+    suite = create_test_suite();
+    add_test_with_context(suite, word_count, counts_a_word_when_text_follows_whitespace);
+    add_test_with_context(suite, word_count, agrees_with_the_reference_on_random_input);
+    add_test_with_context(suite, word_count, counts_the_same_wherever_a_buffer_is_split);
+    add_test_with_context(suite, word_count, keeps_a_word_split_over_feeds_to_one);
+
+    return suite;
+}
+
+static uint64_t next_random(uint64_t *random)
+{
+    *random ^= *random << 13U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random >> 7U;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *random ^= *random << 17U;   // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return *random;
+}
+
+static void fill_random(char *text, size_t len, uint64_t *random)
+{
+    for(size_t i = 0; i < len; i++)
+    {
+        text[i] = alphabet[next_random(random) % (sizeof(alphabet) - 1)];
+    }
+}
+
+/**
+ * byte at a time and independent of the kernels, so the scalar kernel is checked as well as the vector ones
+ * */
+static uint64_t count_reference(const char *text, size_t len, bool *in_word)
+{
+    uint64_t words;
+
+    words = 0;
+
+    for(size_t i = 0; i < len; i++)
+    {
+        bool space;
+
+        space = text[i] == ' ' || (text[i] >= '\t' && text[i] <= '\r');
+
+        if(!(space) && !(*in_word))
+        {
+            words++;
+        }
+
+        *in_word = !(space);
+    }
+
+    return words;
+}